@@ -0,0 +1,431 @@
+/*
+**  FILENAME            SerialAwait.cpp
+**
+**  PURPOSE             C++20 coroutine interface of CSerialPort.
+**                      CSerialStream takes the framer slot of a port and buffers what is
+**                      received; its Read and Write awaitables resume the coroutine on the
+**                      comm thread or reactor shard, or hand it to an executor. No window
+**                      and no message loop are needed, and nothing is allocated per operation.
+**                      Compiles to nothing below C++20.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialAwait.h"
+#include <assert.h>
+#include <exception>
+
+#ifdef SERIAL_AWAIT_ENABLED
+
+bool CSerialReadAwaiter::await_ready()
+{
+    // buffered data is taken under the stream lock in await_suspend()
+    return false;
+}
+
+bool CSerialReadAwaiter::await_suspend( std::coroutine_handle<> Handle )
+{
+    return m_pStream->BeginRead( this, Handle ) != FALSE;
+}
+
+SERIAL_AWAIT_READ CSerialReadAwaiter::await_resume()
+{
+    return m_Result;
+}
+
+bool CSerialWriteAwaiter::await_ready()
+{
+    return false;
+}
+
+bool CSerialWriteAwaiter::await_suspend( std::coroutine_handle<> Handle )
+{
+    SERIAL_WRITE_RESULT Result;
+
+    // the completion may resume the coroutine before WriteAsync() returns, this must not be touched after it
+    m_Handle = Handle;
+    Result = m_pStream->m_pPort->WriteAsync( m_pData, m_nSize, m_Priority, m_dwTimeout, OnWritten, this );
+
+    if ( Result != SERIAL_WRITE_OK )
+    {
+        m_Result = Result;
+        return false;
+    }
+
+    return true;
+}
+
+SERIAL_WRITE_RESULT CSerialWriteAwaiter::await_resume()
+{
+    return m_Result;
+}
+
+void CALLBACK CSerialWriteAwaiter::OnWritten( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent )
+{
+    CSerialWriteAwaiter *pWrite = ( CSerialWriteAwaiter * )pContext;
+
+    pWrite->m_Result = bSent ? SERIAL_WRITE_OK : SERIAL_WRITE_CLOSED;
+    pWrite->m_pStream->Resume( pWrite->m_Handle );
+}
+
+CSerialTask CSerialTask::promise_type::get_return_object()
+{
+    return CSerialTask();
+}
+
+std::suspend_never CSerialTask::promise_type::initial_suspend()
+{
+    return std::suspend_never();
+}
+
+std::suspend_never CSerialTask::promise_type::final_suspend() noexcept
+{
+    return std::suspend_never();
+}
+
+void CSerialTask::promise_type::return_void()
+{
+}
+
+void CSerialTask::promise_type::unhandled_exception()
+{
+    std::terminate();
+}
+
+CSerialStream::CSerialStream( DWORD nBufferSize )
+    : CSerialFramer( nBufferSize )
+{
+    m_pPort = NULL;
+    m_pfnResume = NULL;
+    m_pResumeContext = NULL;
+    m_nHead = 0;
+    m_pRead = NULL;
+    m_llReadDeadline = MAXLONGLONG;
+    InitializeCriticalSection( &m_csStream );
+}
+
+CSerialStream::~CSerialStream()
+{
+    DeleteCriticalSection( &m_csStream );
+}
+
+BOOL CSerialStream::Attach( CSerialPort *pPort )            // before Open(), the port needs SERIAL_RX_CHUNK
+{
+    assert( pPort != NULL );
+    m_pPort = pPort;
+    return pPort->SetFramer( this );
+}
+
+void CSerialStream::SetExecutor( SERIAL_RESUME_CALLBACK pfnResume, LPVOID pContext )    // NULL: resume on the comm thread
+{
+    m_pfnResume = pfnResume;
+    m_pResumeContext = pContext;
+}
+
+CSerialReadAwaiter CSerialStream::ReadSome( void *pBuffer, DWORD nSize, DWORD dwTimeout )     // whatever is there, at least one byte
+{
+    return MakeRead( pBuffer, nSize, 1, FALSE, 0, dwTimeout );
+}
+
+CSerialReadAwaiter CSerialStream::ReadExactly( void *pBuffer, DWORD nSize, DWORD dwTimeout )
+{
+    return MakeRead( pBuffer, nSize, nSize, FALSE, 0, dwTimeout );
+}
+
+CSerialReadAwaiter CSerialStream::ReadUntil( void *pBuffer, DWORD nSize, BYTE Delimiter, DWORD dwTimeout )    // the delimiter is kept
+{
+    return MakeRead( pBuffer, nSize, nSize, TRUE, Delimiter, dwTimeout );
+}
+
+CSerialWriteAwaiter CSerialStream::Write( const void *pData, DWORD nSize, SERIAL_PRIORITY Priority, DWORD dwTimeout )
+{
+    CSerialWriteAwaiter Awaiter;
+    assert( m_pPort != NULL );
+
+    // the bytes are copied into the transmit queue, pData may go once the write is awaited
+    Awaiter.m_pStream = this;
+    Awaiter.m_pData = pData;
+    Awaiter.m_nSize = nSize;
+    Awaiter.m_Priority = Priority;
+    Awaiter.m_dwTimeout = dwTimeout;
+    Awaiter.m_Result = SERIAL_WRITE_OK;
+    return Awaiter;
+}
+
+DWORD CSerialStream::GetBuffered()
+{
+    DWORD nBuffered;
+    EnterCriticalSection( &m_csStream );
+    nBuffered = m_nAssembly;
+    LeaveCriticalSection( &m_csStream );
+    return nBuffered;
+}
+
+void CSerialStream::Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    std::coroutine_handle<> Handle;
+    SERIAL_AWAIT_STATUS Status;
+    DWORD nTaken;
+    EnterCriticalSection( &m_csStream );
+
+    // a waiting read gets the chunk straight into its buffer, the rest is kept for the next one
+    if ( m_pRead != NULL )
+    {
+        nTaken = Take( pData, nSize );
+        pData += nTaken;
+        nSize -= nTaken;
+
+        if ( IsReadDone( &Status ) )
+        {
+            Handle = EndRead( Status );
+        }
+    }
+
+    Store( pData, nSize );
+    LeaveCriticalSection( &m_csStream );
+
+    if ( Handle )
+    {
+        Resume( Handle );
+    }
+}
+
+void CSerialStream::Reset()
+{
+    std::coroutine_handle<> Handle;
+    EnterCriticalSection( &m_csStream );
+    CSerialFramer::Reset();
+    m_nHead = 0;
+
+    // the port opens or closes, a read still waiting will not get its bytes
+    if ( m_pRead != NULL )
+    {
+        Handle = EndRead( SERIAL_AWAIT_CLOSED );
+    }
+
+    LeaveCriticalSection( &m_csStream );
+
+    if ( Handle )
+    {
+        Resume( Handle );
+    }
+}
+
+LONGLONG CSerialStream::GetDeadline()
+{
+    LONGLONG llDeadline;
+    EnterCriticalSection( &m_csStream );
+    llDeadline = m_llReadDeadline;
+    LeaveCriticalSection( &m_csStream );
+    return llDeadline;
+}
+
+void CSerialStream::OnDeadline( LONGLONG llNow )
+{
+    std::coroutine_handle<> Handle;
+    EnterCriticalSection( &m_csStream );
+
+    if ( ( m_pRead != NULL ) && ( m_llReadDeadline <= llNow ) )
+    {
+        Handle = EndRead( SERIAL_AWAIT_TIMEOUT );
+    }
+
+    LeaveCriticalSection( &m_csStream );
+
+    if ( Handle )
+    {
+        Resume( Handle );
+    }
+}
+
+CSerialReadAwaiter CSerialStream::MakeRead( void *pBuffer, DWORD nSize, DWORD nMin, BOOL bUntil, BYTE Delimiter, DWORD dwTimeout )
+{
+    CSerialReadAwaiter Awaiter;
+    assert( ( pBuffer != NULL ) && ( nSize > 0 ) );
+
+    Awaiter.m_pStream = this;
+    Awaiter.m_pBuffer = ( BYTE * )pBuffer;
+    Awaiter.m_nSize = nSize;
+    Awaiter.m_nMin = nMin;
+    Awaiter.m_bUntil = bUntil;
+    Awaiter.m_Delimiter = Delimiter;
+    Awaiter.m_bFound = FALSE;
+    Awaiter.m_dwTimeout = dwTimeout;
+    Awaiter.m_Result.Status = SERIAL_AWAIT_OK;
+    Awaiter.m_Result.nSize = 0;
+    return Awaiter;
+}
+
+BOOL CSerialStream::BeginRead( CSerialReadAwaiter *pRead, std::coroutine_handle<> Handle )
+{
+    SERIAL_AWAIT_STATUS Status;
+    BOOL bDone;
+    BOOL bWake;
+    EnterCriticalSection( &m_csStream );
+    pRead->m_Result.nSize = 0;
+    pRead->m_bFound = FALSE;
+
+    if ( m_pRead != NULL )
+    {
+        LeaveCriticalSection( &m_csStream );
+        pRead->m_Result.Status = SERIAL_AWAIT_BUSY;
+        return FALSE;
+    }
+
+    m_pRead = pRead;
+    TakeBuffered();
+
+    // completes without suspending when the buffer already had enough, the port is closed or the caller does not wait
+    bDone = IsReadDone( &Status );
+
+    if ( !bDone && ( ( m_pPort == NULL ) || !m_pPort->IsOpen() ) )
+    {
+        Status = SERIAL_AWAIT_CLOSED;
+        bDone = TRUE;
+    }
+    else if ( !bDone && ( pRead->m_dwTimeout == 0 ) )
+    {
+        Status = SERIAL_AWAIT_TIMEOUT;
+        bDone = TRUE;
+    }
+
+    if ( bDone )
+    {
+        EndRead( Status );
+        LeaveCriticalSection( &m_csStream );
+        return FALSE;
+    }
+
+    m_hRead = Handle;
+    bWake = ( pRead->m_dwTimeout != INFINITE );
+
+    if ( bWake )
+    {
+        m_llReadDeadline = CSerialPort::GetTimestamp() + ( LONGLONG )pRead->m_dwTimeout * 1000;
+    }
+
+    LeaveCriticalSection( &m_csStream );
+
+    // the comm thread may sleep without a timeout, it has to pick up the new deadline
+    if ( bWake )
+    {
+        m_pPort->WakeUp();
+    }
+
+    return TRUE;
+}
+
+std::coroutine_handle<> CSerialStream::EndRead( SERIAL_AWAIT_STATUS Status )
+{
+    std::coroutine_handle<> Handle = m_hRead;
+
+    m_pRead->m_Result.Status = Status;
+    m_pRead = NULL;
+    m_hRead = std::coroutine_handle<>();
+    m_llReadDeadline = MAXLONGLONG;
+    return Handle;
+}
+
+BOOL CSerialStream::IsReadDone( SERIAL_AWAIT_STATUS *pStatus )
+{
+    CSerialReadAwaiter *pRead = m_pRead;
+
+    if ( pRead->m_bUntil )
+    {
+        if ( pRead->m_bFound )
+        {
+            *pStatus = SERIAL_AWAIT_OK;
+            return TRUE;
+        }
+
+        *pStatus = SERIAL_AWAIT_TRUNCATED;
+        return pRead->m_Result.nSize == pRead->m_nSize;
+    }
+
+    *pStatus = SERIAL_AWAIT_OK;
+    return pRead->m_Result.nSize >= pRead->m_nMin;
+}
+
+DWORD CSerialStream::Take( const BYTE *pData, DWORD nSize )
+{
+    CSerialReadAwaiter *pRead = m_pRead;
+    DWORD nCopy = min( nSize, pRead->m_nSize - pRead->m_Result.nSize );
+    const BYTE *pFound;
+
+    if ( pRead->m_bUntil && ( ( pFound = FindByte( pData, nCopy, pRead->m_Delimiter ) ) != NULL ) )
+    {
+        nCopy = ( DWORD )( pFound - pData ) + 1;
+        pRead->m_bFound = TRUE;
+    }
+
+    memcpy( pRead->m_pBuffer + pRead->m_Result.nSize, pData, nCopy );
+    pRead->m_Result.nSize += nCopy;
+    return nCopy;
+}
+
+void CSerialStream::TakeBuffered()
+{
+    SERIAL_AWAIT_STATUS Status;
+    DWORD nSegment;
+    DWORD nTaken;
+
+    // at most two pieces, up to the end of the buffer and from its start
+    while ( ( m_nAssembly > 0 ) && !IsReadDone( &Status ) )
+    {
+        nSegment = min( m_nAssembly, m_nMaxFrame - m_nHead );
+        nTaken = Take( m_pAssembly + m_nHead, nSegment );
+        m_nHead = ( m_nHead + nTaken ) % m_nMaxFrame;
+        m_nAssembly -= nTaken;
+
+        if ( nTaken < nSegment )
+        {
+            break;
+        }
+    }
+
+    if ( m_nAssembly == 0 )
+    {
+        m_nHead = 0;
+    }
+}
+
+void CSerialStream::Store( const BYTE *pData, DWORD nSize )
+{
+    DWORD nTail;
+    DWORD nCopy;
+
+    // nobody reads: what does not fit is dropped and counted, the port keeps receiving
+    if ( nSize > m_nMaxFrame - m_nAssembly )
+    {
+        m_nErrors++;
+        nSize = m_nMaxFrame - m_nAssembly;
+    }
+
+    while ( nSize > 0 )
+    {
+        nTail = ( m_nHead + m_nAssembly ) % m_nMaxFrame;
+        nCopy = min( nSize, m_nMaxFrame - nTail );
+        memcpy( m_pAssembly + nTail, pData, nCopy );
+        m_nAssembly += nCopy;
+        pData += nCopy;
+        nSize -= nCopy;
+    }
+}
+
+void CSerialStream::Resume( std::coroutine_handle<> Handle )
+{
+    if ( m_pfnResume != NULL )
+    {
+        m_pfnResume( m_pResumeContext, Handle );
+    }
+    else
+    {
+        Handle.resume();
+    }
+}
+
+#endif SERIAL_AWAIT_ENABLED
@@ -0,0 +1,154 @@
+/*
+**  FILENAME            SerialAwait.h
+**
+**  PURPOSE             C++20 coroutine interface of CSerialPort.
+**                      CSerialStream takes the framer slot of a port and buffers what is
+**                      received; its Read and Write awaitables resume the coroutine on the
+**                      comm thread or reactor shard, or hand it to an executor. No window
+**                      and no message loop are needed, and nothing is allocated per operation.
+**                      Compiles to nothing below C++20.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_AWAIT_H
+#define SERIAL_AWAIT_H
+
+#include "SerialPort.h"
+
+#if ( __cplusplus >= 202002L ) || ( defined( _MSVC_LANG ) && ( _MSVC_LANG >= 202002L ) )
+#define SERIAL_AWAIT_ENABLED
+#endif
+
+#ifdef SERIAL_AWAIT_ENABLED
+
+#include <coroutine>
+
+typedef enum
+{
+    SERIAL_AWAIT_OK = 0,
+    SERIAL_AWAIT_TIMEOUT,                                   /* nSize holds what arrived in time */
+    SERIAL_AWAIT_TRUNCATED,                                 /* ReadUntil(): the buffer filled before the delimiter came */
+    SERIAL_AWAIT_BUSY,                                      /* another read of the stream is waiting */
+    SERIAL_AWAIT_CLOSED                                     /* the port is not open or closed while waiting */
+} SERIAL_AWAIT_STATUS;
+
+typedef struct
+{
+    SERIAL_AWAIT_STATUS Status;
+    DWORD               nSize;                              /* bytes placed in the buffer */
+} SERIAL_AWAIT_READ;
+
+/* runs Handle.resume() on a thread of the caller's choice */
+typedef void ( CALLBACK *SERIAL_RESUME_CALLBACK )( LPVOID pContext, std::coroutine_handle<> Handle );
+
+class CSerialStream;
+
+/* returned by the Read calls of CSerialStream, lives in the coroutine frame while suspended */
+class CSerialReadAwaiter
+{
+    public:
+        bool                await_ready();
+        bool                await_suspend( std::coroutine_handle<> Handle );
+        SERIAL_AWAIT_READ   await_resume();
+
+    protected:
+        friend class CSerialStream;
+
+        CSerialStream       *m_pStream;
+        BYTE                *m_pBuffer;
+        DWORD               m_nSize;
+        DWORD               m_nMin;                         /* bytes that complete the read */
+        BOOL                m_bUntil;
+        BYTE                m_Delimiter;
+        BOOL                m_bFound;
+        DWORD               m_dwTimeout;
+        SERIAL_AWAIT_READ   m_Result;
+};
+
+/* returned by CSerialStream::Write(), completes when the bytes left the driver */
+class CSerialWriteAwaiter
+{
+    public:
+        bool                await_ready();
+        bool                await_suspend( std::coroutine_handle<> Handle );
+        SERIAL_WRITE_RESULT await_resume();
+
+    protected:
+        friend class CSerialStream;
+
+        CSerialStream       *m_pStream;
+        const void          *m_pData;
+        DWORD               m_nSize;
+        SERIAL_PRIORITY     m_Priority;
+        DWORD               m_dwTimeout;
+        SERIAL_WRITE_RESULT m_Result;
+        std::coroutine_handle<> m_Handle;
+
+        static void CALLBACK OnWritten( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent );
+};
+
+/* fire and forget coroutine for code that has no task type of its own */
+class CSerialTask
+{
+    public:
+        class promise_type
+        {
+            public:
+                CSerialTask         get_return_object();
+                std::suspend_never  initial_suspend();
+                std::suspend_never  final_suspend() noexcept;
+                void                return_void();
+                void                unhandled_exception();
+        };
+};
+
+class CSerialStream : public CSerialFramer
+{
+    public:
+        CSerialStream( DWORD nBufferSize = SERIAL_RX_RING_SIZE );
+        virtual             ~CSerialStream();
+
+        BOOL                Attach( CSerialPort *pPort );
+        void                SetExecutor( SERIAL_RESUME_CALLBACK pfnResume, LPVOID pContext = NULL );
+
+        CSerialReadAwaiter  ReadSome( void *pBuffer, DWORD nSize, DWORD dwTimeout = INFINITE );
+        CSerialReadAwaiter  ReadExactly( void *pBuffer, DWORD nSize, DWORD dwTimeout = INFINITE );
+        CSerialReadAwaiter  ReadUntil( void *pBuffer, DWORD nSize, BYTE Delimiter, DWORD dwTimeout = INFINITE );
+        CSerialWriteAwaiter Write( const void *pData, DWORD nSize, SERIAL_PRIORITY Priority = SERIAL_PRIORITY_NORMAL, DWORD dwTimeout = 0 );
+        DWORD               GetBuffered();
+
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        virtual void        Reset();
+        virtual LONGLONG    GetDeadline();
+        virtual void        OnDeadline( LONGLONG llNow );
+
+    protected:
+        friend class CSerialReadAwaiter;
+        friend class CSerialWriteAwaiter;
+
+        CSerialPort         *m_pPort;
+        SERIAL_RESUME_CALLBACK m_pfnResume;
+        LPVOID              m_pResumeContext;
+        CRITICAL_SECTION    m_csStream;
+        DWORD               m_nHead;                        /* oldest buffered byte in m_pAssembly, m_nAssembly bytes wrap from there */
+        CSerialReadAwaiter  *m_pRead;
+        std::coroutine_handle<> m_hRead;
+        LONGLONG            m_llReadDeadline;
+
+        CSerialReadAwaiter  MakeRead( void *pBuffer, DWORD nSize, DWORD nMin, BOOL bUntil, BYTE Delimiter, DWORD dwTimeout );
+        BOOL                BeginRead( CSerialReadAwaiter *pRead, std::coroutine_handle<> Handle );
+        std::coroutine_handle<> EndRead( SERIAL_AWAIT_STATUS Status );
+        BOOL                IsReadDone( SERIAL_AWAIT_STATUS *pStatus );
+        DWORD               Take( const BYTE *pData, DWORD nSize );
+        void                TakeBuffered();
+        void                Store( const BYTE *pData, DWORD nSize );
+        void                Resume( std::coroutine_handle<> Handle );
+};
+
+#endif SERIAL_AWAIT_ENABLED
+
+#endif SERIAL_AWAIT_H
@@ -0,0 +1,383 @@
+/*
+**  FILENAME            SerialCapture.cpp
+**
+**  PURPOSE             Capture of the traffic of one serial port into memory-mapped segment
+**                      files, and replay of such a capture through the receive pipeline of a
+**                      port without hardware. Records hold the direction, a microsecond
+**                      timestamp, the line events and the bytes.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+#pragma warning(disable:4996)
+
+CSerialCapture::CSerialCapture()
+{
+    m_szPath[0] = '\0';
+    m_nSegmentSize = SERIAL_CAPTURE_SEGMENT;
+    m_nSegments = 0;
+    m_nSequence = 0;
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+    m_pView = NULL;
+    m_nUsed = 0;
+    m_nDropped = 0;
+}
+
+CSerialCapture::~CSerialCapture()
+{
+    Close();
+}
+
+BOOL CSerialCapture::Create( const char *pszPath,          // segments are written to <path>.000, <path>.001, ...
+                             DWORD nSegmentSize,            // bytes mapped per segment file
+                             UINT  nSegments )              // keep only the last n files, 0 keeps all
+{
+    assert( pszPath != NULL );
+    Close();
+
+    if ( ( strlen( pszPath ) + 5 > MAX_PATH ) || ( nSegmentSize < SERIAL_CAPTURE_SEGMENT_MIN ) || ( nSegments > SERIAL_CAPTURE_SEGMENTS_MAX ) )
+    {
+        return FALSE;
+    }
+
+    strcpy( m_szPath, pszPath );
+    m_nSegmentSize = nSegmentSize & ~( SERIAL_CAPTURE_ALIGN - 1 );
+    m_nSegments = nSegments;
+    m_nSequence = 0;
+    m_nDropped = 0;
+    return OpenSegment();
+}
+
+void CSerialCapture::Close()
+{
+    CloseSegment();
+}
+
+BOOL CSerialCapture::IsOpen()
+{
+    return m_pView != NULL;
+}
+
+void CSerialCapture::Append( SERIAL_CAPTURE_DIRECTION Direction, WORD wEvents, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    SERIAL_CAPTURE_RECORD *pRecord;
+    DWORD nRoom = m_nSegmentSize - sizeof( SERIAL_CAPTURE_HEADER ) - sizeof( SERIAL_CAPTURE_RECORD );
+    DWORD nFree;
+    DWORD nPiece;
+
+    for ( ;; )
+    {
+        if ( m_pView == NULL )
+        {
+            m_nDropped++;
+            return;
+        }
+
+        // only a write larger than a whole segment is split, into records with the same timestamp
+        // that fill up the current segment first
+        nFree = ( m_nUsed + sizeof( SERIAL_CAPTURE_RECORD ) < m_nSegmentSize ) ? m_nSegmentSize - m_nUsed - sizeof( SERIAL_CAPTURE_RECORD ) : 0;
+        nPiece = ( nSize > nRoom ) ? min( nSize, nFree ) : nSize;
+
+        if ( ( ( nPiece == 0 ) && ( nSize > 0 ) ) || ( m_nUsed + GetRecordLength( nPiece ) > m_nSegmentSize ) )
+        {
+            // a few system calls once per segment, every other record is a copy into mapped memory
+            CloseSegment();
+            m_nSequence++;
+
+            if ( !OpenSegment() )
+            {
+                m_nDropped++;
+                return;
+            }
+
+            continue;
+        }
+
+        pRecord = ( SERIAL_CAPTURE_RECORD * )( m_pView + m_nUsed );
+        pRecord->nSize = nPiece;
+        pRecord->wEvents = wEvents;
+        pRecord->llTimestamp = llTimestamp;
+        memcpy( pRecord + 1, pData, nPiece );
+        // the direction last, a reader of a segment left behind by a crash stops at the first zero
+        pRecord->Direction = ( WORD )Direction;
+        m_nUsed += GetRecordLength( nPiece );
+        pData += nPiece;
+        nSize -= nPiece;
+
+        if ( nSize == 0 )
+        {
+            return;
+        }
+    }
+}
+
+DWORD CSerialCapture::GetDroppedCount()
+{
+    return m_nDropped;
+}
+
+DWORD CSerialCapture::GetRecordLength( DWORD nSize )
+{
+    return ( sizeof( SERIAL_CAPTURE_RECORD ) + nSize + SERIAL_CAPTURE_ALIGN - 1 ) & ~( SERIAL_CAPTURE_ALIGN - 1 );
+}
+
+BOOL CSerialCapture::OpenSegment()
+{
+    char szFile[MAX_PATH];
+    SERIAL_CAPTURE_HEADER *pHeader;
+    UINT nFile = ( m_nSegments > 0 ) ? ( m_nSequence % m_nSegments ) : m_nSequence;
+
+    if ( nFile >= SERIAL_CAPTURE_SEGMENTS_MAX )
+    {
+        return FALSE;
+    }
+
+    sprintf( szFile, "%s.%03u", m_szPath, nFile );
+    // an old segment of a rotating capture is overwritten, the mapping extends the file to full size
+    m_hFile = CreateFile( szFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+
+    if ( m_hFile == INVALID_HANDLE_VALUE )
+    {
+        return FALSE;
+    }
+
+    m_hMapping = CreateFileMapping( m_hFile, NULL, PAGE_READWRITE, 0, m_nSegmentSize, NULL );
+    m_pView = ( m_hMapping != NULL ) ? ( BYTE * )MapViewOfFile( m_hMapping, FILE_MAP_WRITE, 0, 0, m_nSegmentSize ) : NULL;
+
+    if ( m_pView == NULL )
+    {
+        CloseSegment();
+        return FALSE;
+    }
+
+    pHeader = ( SERIAL_CAPTURE_HEADER * )m_pView;
+    pHeader->dwMagic = SERIAL_CAPTURE_MAGIC;
+    pHeader->dwVersion = SERIAL_CAPTURE_VERSION;
+    pHeader->nSequence = m_nSequence;
+    pHeader->nHeaderSize = sizeof( SERIAL_CAPTURE_HEADER );
+    pHeader->llCreated = CSerialPort::GetTimestamp();
+    pHeader->llReserved = 0;
+    m_nUsed = sizeof( SERIAL_CAPTURE_HEADER );
+    return TRUE;
+}
+
+void CSerialCapture::CloseSegment()
+{
+    if ( m_pView != NULL )
+    {
+        UnmapViewOfFile( m_pView );
+        m_pView = NULL;
+    }
+
+    if ( m_hMapping != NULL )
+    {
+        CloseHandle( m_hMapping );
+        m_hMapping = NULL;
+    }
+
+    if ( m_hFile != INVALID_HANDLE_VALUE )
+    {
+        // the unused tail of the mapping is cut off
+        SetFilePointer( m_hFile, ( LONG )m_nUsed, NULL, FILE_BEGIN );
+        SetEndOfFile( m_hFile );
+        CloseHandle( m_hFile );
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_nUsed = 0;
+}
+
+CSerialReplay::CSerialReplay()
+{
+    m_szPath[0] = '\0';
+    m_nSegments = 0;
+    m_nCurrent = 0;
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+    m_pView = NULL;
+    m_nViewSize = 0;
+    m_nPos = 0;
+    m_bFinished = FALSE;
+}
+
+CSerialReplay::~CSerialReplay()
+{
+    Close();
+}
+
+BOOL CSerialReplay::Open( const char *pszPath )            // the path given to CSerialCapture::Create()
+{
+    char szFile[MAX_PATH];
+    SERIAL_CAPTURE_HEADER Header;
+    DWORD nSequence[SERIAL_CAPTURE_SEGMENTS_MAX];
+    DWORD nRead;
+    HANDLE hFile;
+    UINT i;
+    UINT j;
+    assert( pszPath != NULL );
+    Close();
+
+    if ( strlen( pszPath ) + 5 > MAX_PATH )
+    {
+        return FALSE;
+    }
+
+    strcpy( m_szPath, pszPath );
+
+    // a rotating capture wraps around, the sequence numbers in the headers give the order
+    for ( i = 0; i < SERIAL_CAPTURE_SEGMENTS_MAX; i++ )
+    {
+        sprintf( szFile, "%s.%03u", m_szPath, i );
+        hFile = CreateFile( szFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+        if ( hFile == INVALID_HANDLE_VALUE )
+        {
+            break;
+        }
+
+        if ( ReadFile( hFile, &Header, sizeof( Header ), &nRead, NULL ) && ( nRead == sizeof( Header ) ) &&
+             ( Header.dwMagic == SERIAL_CAPTURE_MAGIC ) && ( Header.dwVersion == SERIAL_CAPTURE_VERSION ) )
+        {
+            for ( j = m_nSegments; ( j > 0 ) && ( nSequence[j - 1] > Header.nSequence ); j-- )
+            {
+                nSequence[j] = nSequence[j - 1];
+                m_nOrder[j] = m_nOrder[j - 1];
+            }
+
+            nSequence[j] = Header.nSequence;
+            m_nOrder[j] = i;
+            m_nSegments++;
+        }
+
+        CloseHandle( hFile );
+    }
+
+    if ( m_nSegments == 0 )
+    {
+        return FALSE;
+    }
+
+    Rewind();
+    return TRUE;
+}
+
+void CSerialReplay::Close()
+{
+    UnmapSegment();
+    m_nSegments = 0;
+    m_nCurrent = 0;
+}
+
+BOOL CSerialReplay::IsOpen()
+{
+    return m_nSegments > 0;
+}
+
+const SERIAL_CAPTURE_RECORD *CSerialReplay::Next( const BYTE **ppData )    // NULL after the last record
+{
+    const SERIAL_CAPTURE_RECORD *pRecord;
+
+    for ( ;; )
+    {
+        if ( ( m_pView != NULL ) && ( m_nPos + sizeof( SERIAL_CAPTURE_RECORD ) <= m_nViewSize ) )
+        {
+            pRecord = ( const SERIAL_CAPTURE_RECORD * )( m_pView + m_nPos );
+
+            if ( ( pRecord->Direction != SERIAL_CAPTURE_END ) && ( pRecord->nSize <= m_nViewSize - m_nPos - sizeof( SERIAL_CAPTURE_RECORD ) ) )
+            {
+                *ppData = ( const BYTE * )( pRecord + 1 );
+                m_nPos += CSerialCapture::GetRecordLength( pRecord->nSize );
+                return pRecord;
+            }
+        }
+
+        // the bytes of the previous record stay mapped until here
+        if ( ( m_nCurrent + 1 >= m_nSegments ) || !MapSegment( m_nCurrent + 1 ) )
+        {
+            return NULL;
+        }
+    }
+}
+
+void CSerialReplay::Rewind()
+{
+    m_bFinished = FALSE;
+
+    if ( !MapSegment( 0 ) )
+    {
+        // Next() moves on to the following segment
+        m_nCurrent = 0;
+    }
+}
+
+BOOL CSerialReplay::IsFinished()
+{
+    return m_bFinished;
+}
+
+BOOL CSerialReplay::MapSegment( UINT nSegment )
+{
+    char szFile[MAX_PATH];
+
+    UnmapSegment();
+    m_nCurrent = nSegment;
+    sprintf( szFile, "%s.%03u", m_szPath, m_nOrder[nSegment] );
+    m_hFile = CreateFile( szFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+
+    if ( m_hFile == INVALID_HANDLE_VALUE )
+    {
+        return FALSE;
+    }
+
+    m_nViewSize = GetFileSize( m_hFile, NULL );
+
+    if ( ( m_nViewSize == INVALID_FILE_SIZE ) || ( m_nViewSize < sizeof( SERIAL_CAPTURE_HEADER ) ) )
+    {
+        UnmapSegment();
+        return FALSE;
+    }
+
+    m_hMapping = CreateFileMapping( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    m_pView = ( m_hMapping != NULL ) ? ( const BYTE * )MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+
+    if ( m_pView == NULL )
+    {
+        UnmapSegment();
+        return FALSE;
+    }
+
+    m_nPos = ( ( const SERIAL_CAPTURE_HEADER * )m_pView )->nHeaderSize;
+    return TRUE;
+}
+
+void CSerialReplay::UnmapSegment()
+{
+    if ( m_pView != NULL )
+    {
+        UnmapViewOfFile( m_pView );
+        m_pView = NULL;
+    }
+
+    if ( m_hMapping != NULL )
+    {
+        CloseHandle( m_hMapping );
+        m_hMapping = NULL;
+    }
+
+    if ( m_hFile != INVALID_HANDLE_VALUE )
+    {
+        CloseHandle( m_hFile );
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_nViewSize = 0;
+    m_nPos = 0;
+}
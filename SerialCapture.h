@@ -0,0 +1,115 @@
+/*
+**  FILENAME            SerialCapture.h
+**
+**  PURPOSE             Capture of the traffic of one serial port into memory-mapped segment
+**                      files, and replay of such a capture through the receive pipeline of a
+**                      port without hardware. Records hold the direction, a microsecond
+**                      timestamp, the line events and the bytes.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_CAPTURE_H
+#define SERIAL_CAPTURE_H
+
+#define SERIAL_CAPTURE_MAGIC        0x50414353UL            /* "SCAP" */
+#define SERIAL_CAPTURE_VERSION      1UL
+#define SERIAL_CAPTURE_SEGMENT      ( 16UL * 1024 * 1024 )  /* default bytes per segment file */
+#define SERIAL_CAPTURE_SEGMENT_MIN  65536UL
+#define SERIAL_CAPTURE_SEGMENTS_MAX 1000UL                  /* segment files are named <path>.000 to <path>.999 */
+#define SERIAL_CAPTURE_ALIGN        8UL                     /* records start on this boundary */
+#define SERIAL_REPLAY_SPIN          2000UL                  /* us, a replay closer than this to the next record polls instead of sleeping */
+#define SERIAL_REPLAY_POLL          256UL                   /* records delivered back to back between looks at close and writes */
+
+typedef enum
+{
+    SERIAL_CAPTURE_END = 0,                                 /* the rest of the segment is unused */
+    SERIAL_CAPTURE_RX,                                      /* bytes of one read */
+    SERIAL_CAPTURE_TX,                                      /* bytes of one write */
+    SERIAL_CAPTURE_EVENT                                    /* line events in wEvents, no bytes */
+} SERIAL_CAPTURE_DIRECTION;
+
+typedef struct
+{
+    DWORD               dwMagic;
+    DWORD               dwVersion;
+    DWORD               nSequence;                          /* segments written before this one */
+    DWORD               nHeaderSize;                        /* the first record starts here */
+    LONGLONG            llCreated;                          /* CSerialPort::GetTimestamp() */
+    LONGLONG            llReserved;
+} SERIAL_CAPTURE_HEADER;
+
+typedef struct
+{
+    DWORD               nSize;                              /* bytes following the record */
+    WORD                Direction;                          /* SERIAL_CAPTURE_DIRECTION */
+    WORD                wEvents;                            /* EV_CTS, EV_BREAK, ... */
+    LONGLONG            llTimestamp;                        /* microseconds, monotonic */
+} SERIAL_CAPTURE_RECORD;
+
+/* writer, used by the comm thread of one port */
+class CSerialCapture
+{
+    public:
+        CSerialCapture();
+        virtual             ~CSerialCapture();
+
+        BOOL                Create( const char *pszPath, DWORD nSegmentSize = SERIAL_CAPTURE_SEGMENT, UINT nSegments = 0 );
+        void                Close();
+        BOOL                IsOpen();
+        void                Append( SERIAL_CAPTURE_DIRECTION Direction, WORD wEvents, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        DWORD               GetDroppedCount();
+
+        static DWORD        GetRecordLength( DWORD nSize );
+
+    protected:
+        char                m_szPath[MAX_PATH];
+        DWORD               m_nSegmentSize;
+        UINT                m_nSegments;                    /* files kept, 0 keeps every one */
+        DWORD               m_nSequence;
+        HANDLE              m_hFile;
+        HANDLE              m_hMapping;
+        BYTE                *m_pView;
+        DWORD               m_nUsed;
+        DWORD               m_nDropped;
+
+        BOOL                OpenSegment();
+        void                CloseSegment();
+};
+
+/* reader, walks the segments of a capture in the order they were written */
+class CSerialReplay
+{
+    public:
+        CSerialReplay();
+        virtual             ~CSerialReplay();
+
+        BOOL                Open( const char *pszPath );
+        void                Close();
+        BOOL                IsOpen();
+        const SERIAL_CAPTURE_RECORD *Next( const BYTE **ppData );
+        void                Rewind();
+        BOOL                IsFinished();
+
+    protected:
+        friend class CSerialPort;
+
+        char                m_szPath[MAX_PATH];
+        UINT                m_nOrder[SERIAL_CAPTURE_SEGMENTS_MAX];  /* file numbers, oldest first */
+        UINT                m_nSegments;
+        UINT                m_nCurrent;
+        HANDLE              m_hFile;
+        HANDLE              m_hMapping;
+        const BYTE          *m_pView;
+        DWORD               m_nViewSize;
+        DWORD               m_nPos;
+        volatile BOOL       m_bFinished;                    /* set by the port once the last record was delivered */
+
+        BOOL                MapSegment( UINT nSegment );
+        void                UnmapSegment();
+};
+
+#endif SERIAL_CAPTURE_H
@@ -0,0 +1,508 @@
+/*
+**  FILENAME            SerialChecksum.cpp
+**
+**  PURPOSE             Checksums of the protocols run over serial ports: Modbus CRC-16, CRC-CCITT,
+**                      CRC-32, CRC-32C, XOR and LRC. Eight bytes per step through tables built
+**                      by the compiler, CRC-32C with SSE4.2 and CRC-32 with PCLMULQDQ where the
+**                      processor has them. Framers check them, the port appends them to writes.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialChecksum.h"
+#include <assert.h>
+#include <intrin.h>
+
+#if defined( _M_X64 ) || ( defined( _M_IX86_FP ) && ( _M_IX86_FP >= 2 ) )
+#define SERIAL_CRC_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined( _M_X64 ) || defined( _M_IX86 )
+#define SERIAL_CRC_X86                                  /* the instructions are used after a cpuid check only */
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+typedef struct
+{
+    UINT                nWidth;                         /* bits of the register */
+    DWORD               dwPoly;                         /* bit reversed for reflected ones */
+    DWORD               dwInit;
+    DWORD               dwXorOut;
+    BOOL                bReflected;                     /* least significant bit first on the wire */
+    BOOL                bBigEndian;                     /* order of the trailer bytes */
+} SERIAL_CRC_PARAMS;
+
+typedef struct
+{
+    DWORD               Table[8][256];                  /* [k][b]: byte b followed by k zero bytes */
+} SERIAL_CRC_TABLES;
+
+static const SERIAL_CRC_PARAMS s_Params[SERIAL_CHECKSUM_TYPES] =
+{
+    { 0,  0,          0,          0,          FALSE, FALSE },
+    { 16, 0xA001,     0xFFFF,     0,          TRUE,  FALSE },
+    { 16, 0x1021,     0xFFFF,     0,          FALSE, TRUE  },
+    { 32, 0xEDB88320, 0xFFFFFFFF, 0xFFFFFFFF, TRUE,  FALSE },
+    { 32, 0x82F63B78, 0xFFFFFFFF, 0xFFFFFFFF, TRUE,  FALSE },
+    { 8,  0,          0,          0,          FALSE, FALSE },
+    { 8,  0,          0,          0,          FALSE, FALSE }
+};
+
+static constexpr SERIAL_CRC_TABLES MakeTables( DWORD dwPoly, UINT nWidth, bool bReflected )
+{
+    SERIAL_CRC_TABLES Tables = {};
+    DWORD dwMask = ( nWidth == 32 ) ? 0xFFFFFFFF : ( ( 1UL << nWidth ) - 1 );
+    DWORD dwTop = 1UL << ( nWidth - 1 );
+    DWORD dwCrc = 0;
+    UINT  b = 0;
+    UINT  k = 0;
+
+    for ( b = 0; b < 256; b++ )
+    {
+        dwCrc = bReflected ? b : ( ( DWORD )b << ( nWidth - 8 ) );
+
+        for ( k = 0; k < 8; k++ )
+        {
+            if ( bReflected )
+            {
+                dwCrc = ( dwCrc & 1 ) ? ( dwCrc >> 1 ) ^ dwPoly : ( dwCrc >> 1 );
+            }
+            else
+            {
+                dwCrc = ( ( dwCrc & dwTop ) ? ( dwCrc << 1 ) ^ dwPoly : ( dwCrc << 1 ) ) & dwMask;
+            }
+        }
+
+        Tables.Table[0][b] = dwCrc;
+    }
+
+    // every further table moves the byte one position further away from the end
+    for ( k = 1; k < 8; k++ )
+    {
+        for ( b = 0; b < 256; b++ )
+        {
+            dwCrc = Tables.Table[k - 1][b];
+            Tables.Table[k][b] = bReflected ? ( dwCrc >> 8 ) ^ Tables.Table[0][dwCrc & 0xFF]
+                                            : ( ( dwCrc << 8 ) & dwMask ) ^ Tables.Table[0][dwCrc >> ( nWidth - 8 )];
+        }
+    }
+
+    return Tables;
+}
+
+static constexpr SERIAL_CRC_TABLES s_Crc16Modbus = MakeTables( 0xA001, 16, true );
+static constexpr SERIAL_CRC_TABLES s_Crc16Ccitt = MakeTables( 0x1021, 16, false );
+static constexpr SERIAL_CRC_TABLES s_Crc32 = MakeTables( 0xEDB88320, 32, true );
+static constexpr SERIAL_CRC_TABLES s_Crc32c = MakeTables( 0x82F63B78, 32, true );
+
+static const SERIAL_CRC_TABLES *s_pTables[SERIAL_CHECKSUM_TYPES] =
+{
+    NULL, &s_Crc16Modbus, &s_Crc16Ccitt, &s_Crc32, &s_Crc32c, NULL, NULL
+};
+
+static volatile LONG s_nHardware = -1;
+
+CSerialChecksum::CSerialChecksum( SERIAL_CHECKSUM_TYPE Type )
+{
+    assert( ( UINT )Type < SERIAL_CHECKSUM_TYPES );
+    m_Type = Type;
+    m_dwState = GetInitial( Type );
+}
+
+void CSerialChecksum::Reset()
+{
+    m_dwState = GetInitial( m_Type );
+}
+
+void CSerialChecksum::Update( const BYTE *pData, DWORD nSize )  // the next bytes, a frame may span any number of calls
+{
+    m_dwState = UpdateState( m_Type, m_dwState, pData, nSize, SERIAL_CHECKSUM_FASTEST );
+}
+
+DWORD CSerialChecksum::GetValue()                               // of the bytes so far, Update() may go on afterwards
+{
+    return GetFinal( m_Type, m_dwState );
+}
+
+DWORD CSerialChecksum::GetTrailer( BYTE *pTrailer )             // room for GetTrailerSize(), written in the order Append() sends
+{
+    DWORD nTrailer = GetTrailerSize( m_Type );
+    DWORD dwValue = GetValue();
+    DWORD i;
+
+    for ( i = 0; i < nTrailer; i++ )
+    {
+        pTrailer[i] = s_Params[m_Type].bBigEndian ? ( BYTE )( dwValue >> ( 8 * ( nTrailer - 1 - i ) ) ) : ( BYTE )( dwValue >> ( 8 * i ) );
+    }
+
+    return nTrailer;
+}
+
+SERIAL_CHECKSUM_TYPE CSerialChecksum::GetType()
+{
+    return m_Type;
+}
+
+DWORD CSerialChecksum::Compute( SERIAL_CHECKSUM_TYPE Type,      // algorithm
+                                const BYTE *pData,              // bytes covered
+                                DWORD nSize,
+                                SERIAL_CHECKSUM_METHOD Method ) // all methods give the same value
+{
+    assert( ( UINT )Type < SERIAL_CHECKSUM_TYPES );
+    return GetFinal( Type, UpdateState( Type, GetInitial( Type ), pData, nSize, Method ) );
+}
+
+BOOL CSerialChecksum::Verify( SERIAL_CHECKSUM_TYPE Type,        // algorithm
+                              const BYTE *pFrame,               // frame followed by its checksum
+                              DWORD nSize )                     // with the checksum
+{
+    DWORD nTrailer = GetTrailerSize( Type );
+    DWORD dwValue;
+    DWORD dwSent = 0;
+    DWORD i;
+
+    if ( nSize < nTrailer )
+    {
+        return FALSE;
+    }
+
+    dwValue = Compute( Type, pFrame, nSize - nTrailer );
+
+    for ( i = 0; i < nTrailer; i++ )
+    {
+        if ( s_Params[Type].bBigEndian )
+        {
+            dwSent = ( dwSent << 8 ) | pFrame[nSize - nTrailer + i];
+        }
+        else
+        {
+            dwSent |= ( DWORD )pFrame[nSize - nTrailer + i] << ( 8 * i );
+        }
+    }
+
+    return ( dwSent == dwValue );
+}
+
+DWORD CSerialChecksum::Append( SERIAL_CHECKSUM_TYPE Type,       // algorithm
+                               BYTE *pFrame,                    // room for GetTrailerSize() more bytes
+                               DWORD nSize )                    // without the checksum
+{
+    DWORD nTrailer = GetTrailerSize( Type );
+    DWORD dwValue = Compute( Type, pFrame, nSize );
+    DWORD i;
+
+    for ( i = 0; i < nTrailer; i++ )
+    {
+        pFrame[nSize + i] = s_Params[Type].bBigEndian ? ( BYTE )( dwValue >> ( 8 * ( nTrailer - 1 - i ) ) ) : ( BYTE )( dwValue >> ( 8 * i ) );
+    }
+
+    return nSize + nTrailer;
+}
+
+DWORD CSerialChecksum::GetTrailerSize( SERIAL_CHECKSUM_TYPE Type )   // bytes the checksum takes on the wire
+{
+    assert( ( UINT )Type < SERIAL_CHECKSUM_TYPES );
+    return s_Params[Type].nWidth / 8;
+}
+
+DWORD CSerialChecksum::GetHardware()                            // SERIAL_CHECKSUM_HW_* of this processor
+{
+#if defined( SERIAL_CRC_X86 )
+    int Info[4];
+
+    if ( s_nHardware < 0 )
+    {
+        __cpuid( Info, 1 );
+        s_nHardware = ( ( Info[2] & ( 1 << 20 ) ) ? SERIAL_CHECKSUM_HW_SSE42 : 0 ) |
+                      ( ( Info[2] & ( 1 << 1 ) ) ? SERIAL_CHECKSUM_HW_PCLMUL : 0 );
+    }
+
+    return ( DWORD )s_nHardware;
+#else
+    return 0;
+#endif
+}
+
+DWORD CSerialChecksum::GetInitial( SERIAL_CHECKSUM_TYPE Type )
+{
+    return s_Params[Type].dwInit;
+}
+
+DWORD CSerialChecksum::GetFinal( SERIAL_CHECKSUM_TYPE Type, DWORD dwState )
+{
+    if ( Type == SERIAL_CHECKSUM_LRC )
+    {
+        return ( 0x100 - dwState ) & 0xFF;
+    }
+
+    return dwState ^ s_Params[Type].dwXorOut;
+}
+
+DWORD CSerialChecksum::UpdateState( SERIAL_CHECKSUM_TYPE Type, DWORD dwState, const BYTE *pData, DWORD nSize, SERIAL_CHECKSUM_METHOD Method )
+{
+    DWORD nFold;
+    DWORD dwHardware = ( Method == SERIAL_CHECKSUM_FASTEST ) ? GetHardware() : 0;
+
+    if ( Method == SERIAL_CHECKSUM_BITWISE )
+    {
+        return UpdateBitwise( Type, dwState, pData, nSize );
+    }
+
+    if ( ( Type == SERIAL_CHECKSUM_CRC32C ) && ( dwHardware & SERIAL_CHECKSUM_HW_SSE42 ) )
+    {
+        return UpdateCrc32c( dwState, pData, nSize );
+    }
+
+    // folding pays off from 64 bytes on and takes whole 16 byte blocks, the tables do the rest
+    if ( ( Type == SERIAL_CHECKSUM_CRC32 ) && ( ( dwHardware & ( SERIAL_CHECKSUM_HW_SSE42 | SERIAL_CHECKSUM_HW_PCLMUL ) ) ==
+                                                ( SERIAL_CHECKSUM_HW_SSE42 | SERIAL_CHECKSUM_HW_PCLMUL ) ) && ( nSize >= 64 ) )
+    {
+        nFold = nSize & ~15UL;
+        dwState = FoldCrc32( dwState, pData, nFold );
+        pData += nFold;
+        nSize -= nFold;
+    }
+
+    return UpdateTables( Type, dwState, pData, nSize );
+}
+
+DWORD CSerialChecksum::UpdateTables( SERIAL_CHECKSUM_TYPE Type, DWORD dwState, const BYTE *pData, DWORD nSize )
+{
+    const SERIAL_CRC_TABLES *pTables = s_pTables[Type];
+    const DWORD ( *T )[256];
+    ULONGLONG qwWord;
+    DWORD dwLow;
+    DWORD dwHigh;
+
+    if ( pTables == NULL )
+    {
+        if ( Type == SERIAL_CHECKSUM_XOR )
+        {
+            // eight lanes at once, folded into one byte at the end
+            for ( qwWord = 0; nSize >= 8; pData += 8, nSize -= 8 )
+            {
+                memcpy( &dwLow, pData, 4 );
+                memcpy( &dwHigh, pData + 4, 4 );
+                qwWord ^= ( ( ULONGLONG )dwHigh << 32 ) | dwLow;
+            }
+
+            qwWord ^= qwWord >> 32;
+            qwWord ^= qwWord >> 16;
+            qwWord ^= qwWord >> 8;
+            dwState ^= ( DWORD )( qwWord & 0xFF );
+        }
+        else if ( Type == SERIAL_CHECKSUM_LRC )
+        {
+#if defined( SERIAL_CRC_SSE2 )
+            // sum of absolute differences against zero adds eight bytes per lane
+            __m128i Sum = _mm_setzero_si128();
+
+            for ( ; nSize >= 16; pData += 16, nSize -= 16 )
+            {
+                Sum = _mm_add_epi64( Sum, _mm_sad_epu8( _mm_loadu_si128( ( const __m128i * )pData ), _mm_setzero_si128() ) );
+            }
+
+            dwState += ( DWORD )_mm_cvtsi128_si32( Sum ) + ( DWORD )_mm_cvtsi128_si32( _mm_srli_si128( Sum, 8 ) );
+#endif
+        }
+
+        return UpdateBitwise( Type, dwState, pData, nSize ) & 0xFF;
+    }
+
+    T = pTables->Table;
+
+    if ( s_Params[Type].bReflected )
+    {
+        // the register lines up with the first bytes, the eight lookups are independent
+        for ( ; nSize >= 8; pData += 8, nSize -= 8 )
+        {
+            memcpy( &dwLow, pData, 4 );
+            memcpy( &dwHigh, pData + 4, 4 );
+            dwLow ^= dwState;
+            dwState = T[7][dwLow & 0xFF] ^ T[6][( dwLow >> 8 ) & 0xFF] ^ T[5][( dwLow >> 16 ) & 0xFF] ^ T[4][dwLow >> 24] ^
+                      T[3][dwHigh & 0xFF] ^ T[2][( dwHigh >> 8 ) & 0xFF] ^ T[1][( dwHigh >> 16 ) & 0xFF] ^ T[0][dwHigh >> 24];
+        }
+
+        for ( ; nSize > 0; pData++, nSize-- )
+        {
+            dwState = ( dwState >> 8 ) ^ T[0][( dwState ^ *pData ) & 0xFF];
+        }
+
+        return dwState;
+    }
+
+    // most significant bit first, only CRC-CCITT: the register covers the first two bytes
+    assert( s_Params[Type].nWidth == 16 );
+
+    for ( ; nSize >= 8; pData += 8, nSize -= 8 )
+    {
+        dwState = T[7][pData[0] ^ ( dwState >> 8 )] ^ T[6][pData[1] ^ ( dwState & 0xFF )] ^ T[5][pData[2]] ^ T[4][pData[3]] ^
+                  T[3][pData[4]] ^ T[2][pData[5]] ^ T[1][pData[6]] ^ T[0][pData[7]];
+    }
+
+    for ( ; nSize > 0; pData++, nSize-- )
+    {
+        dwState = ( ( dwState << 8 ) & 0xFFFF ) ^ T[0][( ( dwState >> 8 ) ^ *pData ) & 0xFF];
+    }
+
+    return dwState;
+}
+
+DWORD CSerialChecksum::UpdateBitwise( SERIAL_CHECKSUM_TYPE Type, DWORD dwState, const BYTE *pData, DWORD nSize )
+{
+    const SERIAL_CRC_PARAMS *pParams = &s_Params[Type];
+    DWORD i;
+    UINT  k;
+
+    for ( i = 0; i < nSize; i++ )
+    {
+        if ( Type == SERIAL_CHECKSUM_XOR )
+        {
+            dwState ^= pData[i];
+        }
+        else if ( Type == SERIAL_CHECKSUM_LRC )
+        {
+            dwState = ( dwState + pData[i] ) & 0xFF;
+        }
+        else if ( pParams->bReflected )
+        {
+            dwState ^= pData[i];
+
+            for ( k = 0; k < 8; k++ )
+            {
+                dwState = ( dwState & 1 ) ? ( dwState >> 1 ) ^ pParams->dwPoly : ( dwState >> 1 );
+            }
+        }
+        else
+        {
+            dwState ^= ( DWORD )pData[i] << 8;
+
+            for ( k = 0; k < 8; k++ )
+            {
+                dwState = ( ( dwState & 0x8000 ) ? ( dwState << 1 ) ^ pParams->dwPoly : ( dwState << 1 ) ) & 0xFFFF;
+            }
+        }
+    }
+
+    return dwState;
+}
+
+DWORD CSerialChecksum::UpdateCrc32c( DWORD dwState, const BYTE *pData, DWORD nSize )
+{
+#if defined( SERIAL_CRC_X86 )
+#if defined( _M_X64 )
+    ULONGLONG qwState = dwState;
+    ULONGLONG qwWord;
+
+    for ( ; nSize >= 8; pData += 8, nSize -= 8 )
+    {
+        memcpy( &qwWord, pData, 8 );
+        qwState = _mm_crc32_u64( qwState, qwWord );
+    }
+
+    dwState = ( DWORD )qwState;
+#else
+    DWORD dwWord;
+
+    for ( ; nSize >= 4; pData += 4, nSize -= 4 )
+    {
+        memcpy( &dwWord, pData, 4 );
+        dwState = _mm_crc32_u32( dwState, dwWord );
+    }
+#endif
+
+    for ( ; nSize > 0; pData++, nSize-- )
+    {
+        dwState = _mm_crc32_u8( dwState, *pData );
+    }
+
+    return dwState;
+#else
+    return UpdateTables( SERIAL_CHECKSUM_CRC32C, dwState, pData, nSize );
+#endif
+}
+
+DWORD CSerialChecksum::FoldCrc32( DWORD dwState,                // register, not inverted
+                                  const BYTE *pData,
+                                  DWORD nSize )                 // at least 64, a multiple of 16
+{
+#if defined( SERIAL_CRC_X86 )
+    // Gopal et al., "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction",
+    // constants for the bit reflected IEEE polynomial
+    static const ULONGLONG k1k2[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const ULONGLONG k3k4[2] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const ULONGLONG k5k0[2] = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const ULONGLONG Poly[2] = { 0x01db710641ULL, 0x01f7011641ULL };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    assert( ( nSize >= 64 ) && ( nSize % 16 == 0 ) );
+
+    x1 = _mm_loadu_si128( ( const __m128i * )( pData + 0x00 ) );
+    x2 = _mm_loadu_si128( ( const __m128i * )( pData + 0x10 ) );
+    x3 = _mm_loadu_si128( ( const __m128i * )( pData + 0x20 ) );
+    x4 = _mm_loadu_si128( ( const __m128i * )( pData + 0x30 ) );
+    x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( ( int )dwState ) );
+    x0 = _mm_loadu_si128( ( const __m128i * )k1k2 );
+    pData += 64;
+    nSize -= 64;
+
+    // four lanes of 128 bits folded 64 bytes ahead at a time
+    for ( ; nSize >= 64; pData += 64, nSize -= 64 )
+    {
+        x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+        x6 = _mm_clmulepi64_si128( x2, x0, 0x00 );
+        x7 = _mm_clmulepi64_si128( x3, x0, 0x00 );
+        x8 = _mm_clmulepi64_si128( x4, x0, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+        x2 = _mm_clmulepi64_si128( x2, x0, 0x11 );
+        x3 = _mm_clmulepi64_si128( x3, x0, 0x11 );
+        x4 = _mm_clmulepi64_si128( x4, x0, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( ( const __m128i * )( pData + 0x00 ) ) );
+        x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ), _mm_loadu_si128( ( const __m128i * )( pData + 0x10 ) ) );
+        x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ), _mm_loadu_si128( ( const __m128i * )( pData + 0x20 ) ) );
+        x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ), _mm_loadu_si128( ( const __m128i * )( pData + 0x30 ) ) );
+    }
+
+    // the four lanes into one
+    x0 = _mm_loadu_si128( ( const __m128i * )k3k4 );
+    x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x2 ), x5 );
+    x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x3 ), x5 );
+    x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x4 ), x5 );
+
+    for ( ; nSize >= 16; pData += 16, nSize -= 16 )
+    {
+        x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128( x1, _mm_loadu_si128( ( const __m128i * )pData ) ), x5 );
+    }
+
+    // 128 bits to 64, then Barrett reduction to 32
+    x2 = _mm_clmulepi64_si128( x1, x0, 0x10 );
+    x3 = _mm_setr_epi32( ~0, 0, ~0, 0 );
+    x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+    x0 = _mm_loadl_epi64( ( const __m128i * )k5k0 );
+    x2 = _mm_srli_si128( x1, 4 );
+    x1 = _mm_and_si128( x1, x3 );
+    x1 = _mm_xor_si128( _mm_clmulepi64_si128( x1, x0, 0x00 ), x2 );
+    x0 = _mm_loadu_si128( ( const __m128i * )Poly );
+    x2 = _mm_and_si128( x1, x3 );
+    x2 = _mm_clmulepi64_si128( x2, x0, 0x10 );
+    x2 = _mm_and_si128( x2, x3 );
+    x2 = _mm_clmulepi64_si128( x2, x0, 0x00 );
+    x1 = _mm_xor_si128( x1, x2 );
+    return ( DWORD )_mm_extract_epi32( x1, 1 );
+#else
+    return UpdateTables( SERIAL_CHECKSUM_CRC32, dwState, pData, nSize );
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+**  FILENAME            SerialChecksum.h
+**
+**  PURPOSE             Checksums of the protocols run over serial ports: Modbus CRC-16, CRC-CCITT,
+**                      CRC-32, CRC-32C, XOR and LRC. Eight bytes per step through tables built
+**                      by the compiler, CRC-32C with SSE4.2 and CRC-32 with PCLMULQDQ where the
+**                      processor has them. Framers check them, the port appends them to writes.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_CHECKSUM_H
+#define SERIAL_CHECKSUM_H
+
+#define SERIAL_CHECKSUM_HW_SSE42    0x00000001UL            /* crc32 instruction, CRC-32C */
+#define SERIAL_CHECKSUM_HW_PCLMUL   0x00000002UL            /* carry-less multiply, CRC-32 folding */
+#define SERIAL_CHECKSUM_MAX         4UL                     /* bytes of the widest trailer, CRC-32 */
+
+typedef enum
+{
+    SERIAL_CHECKSUM_NONE = 0,
+    SERIAL_CHECKSUM_CRC16_MODBUS,                           /* 0xA001 reflected, init 0xFFFF, low byte first */
+    SERIAL_CHECKSUM_CRC16_CCITT,                            /* 0x1021, init 0xFFFF, high byte first */
+    SERIAL_CHECKSUM_CRC32,                                  /* IEEE 802.3 as in zip and Ethernet, low byte first */
+    SERIAL_CHECKSUM_CRC32C,                                 /* Castagnoli, low byte first */
+    SERIAL_CHECKSUM_XOR,                                    /* one byte, all bytes xored */
+    SERIAL_CHECKSUM_LRC,                                    /* one byte, two's complement of the sum as in Modbus ASCII */
+    SERIAL_CHECKSUM_TYPES
+} SERIAL_CHECKSUM_TYPE;
+
+typedef enum
+{
+    SERIAL_CHECKSUM_FASTEST = 0,                            /* instructions of the processor, else tables */
+    SERIAL_CHECKSUM_TABLES,                                 /* slicing by eight */
+    SERIAL_CHECKSUM_BITWISE                                 /* one bit at a time, the reference */
+} SERIAL_CHECKSUM_METHOD;
+
+/* one running checksum, fed chunk by chunk in the order the bytes arrive */
+class CSerialChecksum
+{
+    public:
+        CSerialChecksum( SERIAL_CHECKSUM_TYPE Type = SERIAL_CHECKSUM_CRC32 );
+
+        void                Reset();
+        void                Update( const BYTE *pData, DWORD nSize );
+        DWORD               GetValue();
+        DWORD               GetTrailer( BYTE *pTrailer );
+        SERIAL_CHECKSUM_TYPE GetType();
+
+        static DWORD        Compute( SERIAL_CHECKSUM_TYPE Type, const BYTE *pData, DWORD nSize, SERIAL_CHECKSUM_METHOD Method = SERIAL_CHECKSUM_FASTEST );
+        static BOOL         Verify( SERIAL_CHECKSUM_TYPE Type, const BYTE *pFrame, DWORD nSize );
+        static DWORD        Append( SERIAL_CHECKSUM_TYPE Type, BYTE *pFrame, DWORD nSize );
+        static DWORD        GetTrailerSize( SERIAL_CHECKSUM_TYPE Type );
+        static DWORD        GetHardware();
+
+    protected:
+        SERIAL_CHECKSUM_TYPE m_Type;
+        DWORD               m_dwState;
+
+        static DWORD        GetInitial( SERIAL_CHECKSUM_TYPE Type );
+        static DWORD        GetFinal( SERIAL_CHECKSUM_TYPE Type, DWORD dwState );
+        static DWORD        UpdateState( SERIAL_CHECKSUM_TYPE Type, DWORD dwState, const BYTE *pData, DWORD nSize, SERIAL_CHECKSUM_METHOD Method );
+        static DWORD        UpdateTables( SERIAL_CHECKSUM_TYPE Type, DWORD dwState, const BYTE *pData, DWORD nSize );
+        static DWORD        UpdateBitwise( SERIAL_CHECKSUM_TYPE Type, DWORD dwState, const BYTE *pData, DWORD nSize );
+        static DWORD        UpdateCrc32c( DWORD dwState, const BYTE *pData, DWORD nSize );
+        static DWORD        FoldCrc32( DWORD dwState, const BYTE *pData, DWORD nSize );
+};
+
+#endif SERIAL_CHECKSUM_H
@@ -0,0 +1,446 @@
+/*
+**  FILENAME            SerialDevices.cpp
+**
+**  PURPOSE             Cached index of the serial ports of the machine.
+**                      A thread watches the SERIALCOMM key the serial drivers keep up to date
+**                      and reports ports that come and go, with the USB vendor, product and
+**                      serial number looked up once per arrival.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+#pragma warning(disable:4996)
+
+CSerialDeviceIndex::CSerialDeviceIndex()
+{
+    InitializeCriticalSection( &m_csDevices );
+    m_nDevices = 0;
+    m_pfnCallback = NULL;
+    m_pContext = NULL;
+    m_pScan = NULL;
+    m_pArrived = NULL;
+    m_pRemoved = NULL;
+    m_hKey = NULL;
+    m_hChangeEvent = NULL;
+    m_hStopEvent = NULL;
+    m_hThread = NULL;
+}
+
+CSerialDeviceIndex::~CSerialDeviceIndex()
+{
+    Stop();
+    DeleteCriticalSection( &m_csDevices );
+}
+
+// the ports present now are reported as arrivals before Start() returns, later changes on the watch thread
+BOOL CSerialDeviceIndex::Start( SERIAL_DEVICE_CALLBACK pfnCallback,    // NULL keeps only the cache
+                                LPVOID pContext )
+{
+    BOOL ret = TRUE;
+    Stop();
+    m_pfnCallback = pfnCallback;
+    m_pContext = pContext;
+    m_pScan = ( SERIAL_DEVICE_INFO * )LocalAlloc( LMEM_ZEROINIT, 3 * SERIAL_PORT_MAX * sizeof( SERIAL_DEVICE_INFO ) );
+
+    if ( m_pScan == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    m_pArrived = m_pScan + SERIAL_PORT_MAX;
+    m_pRemoved = m_pArrived + SERIAL_PORT_MAX;
+
+    // SERIALCOMM is volatile and goes away with the last port, so its parent is watched
+    if ( RegOpenKeyEx( HKEY_LOCAL_MACHINE, SERIAL_DEVICEMAP_KEY, 0, KEY_NOTIFY, &m_hKey ) != ERROR_SUCCESS )
+    {
+        m_hKey = NULL;
+        ret = FALSE;
+        goto done;
+    }
+
+    m_hChangeEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    m_hStopEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+    // armed before the first read, a port that arrives in between is not missed
+    if ( ( m_hChangeEvent == NULL ) || ( m_hStopEvent == NULL ) ||
+         ( RegNotifyChangeKeyValue( m_hKey, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, m_hChangeEvent, TRUE ) != ERROR_SUCCESS ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    Refresh();
+    m_hThread = ::CreateThread( NULL, 0, WatchThread, this, 0, NULL );
+    ret = ( m_hThread != NULL );
+
+done:
+
+    if ( !ret )
+    {
+        Stop();
+    }
+
+    return ret;
+}
+
+void CSerialDeviceIndex::Stop()
+{
+    if ( m_hThread != NULL )
+    {
+        SetEvent( m_hStopEvent );
+        WaitForSingleObject( m_hThread, INFINITE );
+        CloseHandle( m_hThread );
+        m_hThread = NULL;
+    }
+
+    if ( m_hKey != NULL )
+    {
+        RegCloseKey( m_hKey );
+        m_hKey = NULL;
+    }
+
+    if ( m_hChangeEvent != NULL )
+    {
+        CloseHandle( m_hChangeEvent );
+        m_hChangeEvent = NULL;
+    }
+
+    if ( m_hStopEvent != NULL )
+    {
+        CloseHandle( m_hStopEvent );
+        m_hStopEvent = NULL;
+    }
+
+    if ( m_pScan != NULL )
+    {
+        LocalFree( m_pScan );
+        m_pScan = NULL;
+        m_pArrived = NULL;
+        m_pRemoved = NULL;
+    }
+
+    EnterCriticalSection( &m_csDevices );
+    m_nDevices = 0;
+    LeaveCriticalSection( &m_csDevices );
+}
+
+UINT CSerialDeviceIndex::GetDevices( SERIAL_DEVICE_INFO *pDevices,    // copy of the cache, sorted by port number
+                                     UINT nMax )
+{
+    UINT nCount;
+    EnterCriticalSection( &m_csDevices );
+    nCount = min( m_nDevices, nMax );
+    memcpy( pDevices, m_Devices, nCount * sizeof( SERIAL_DEVICE_INFO ) );
+    LeaveCriticalSection( &m_csDevices );
+    return nCount;
+}
+
+BOOL CSerialDeviceIndex::Find( UINT nPort, SERIAL_DEVICE_INFO *pDevice )
+{
+    BOOL ret = FALSE;
+    UINT i;
+    EnterCriticalSection( &m_csDevices );
+
+    for ( i = 0; i < m_nDevices; i++ )
+    {
+        if ( m_Devices[i].nPort == nPort )
+        {
+            *pDevice = m_Devices[i];
+            ret = TRUE;
+            break;
+        }
+    }
+
+    LeaveCriticalSection( &m_csDevices );
+    return ret;
+}
+
+UINT CSerialDeviceIndex::Scan( SERIAL_DEVICE_INFO *pDevices,           // one-shot listing without a watch thread
+                               UINT nMax,
+                               BOOL bUsb )                             // FALSE skips the walk of the USB devices for the ids
+{
+    UINT nCount = ReadKey( pDevices, nMax );
+
+    if ( bUsb )
+    {
+        LookupUsb( pDevices, nCount );
+    }
+
+    return nCount;
+}
+
+void CSerialDeviceIndex::Refresh()
+{
+    UINT nScan = ReadKey( m_pScan, SERIAL_PORT_MAX );
+    UINT nArrived = 0;
+    UINT nRemoved = 0;
+    UINT i = 0;
+    UINT j = 0;
+    UINT k;
+
+    // both lists are sorted, ports that stayed keep what was looked up for them
+    while ( ( i < m_nDevices ) || ( j < nScan ) )
+    {
+        if ( ( j == nScan ) || ( ( i < m_nDevices ) && ( m_Devices[i].nPort < m_pScan[j].nPort ) ) )
+        {
+            m_pRemoved[nRemoved++] = m_Devices[i++];
+        }
+        else if ( ( i == m_nDevices ) || ( m_pScan[j].nPort < m_Devices[i].nPort ) )
+        {
+            m_pArrived[nArrived++] = m_pScan[j++];
+        }
+        else if ( lstrcmpi( m_Devices[i].szDevice, m_pScan[j].szDevice ) != 0 )
+        {
+            // the number went to another adapter
+            m_pRemoved[nRemoved++] = m_Devices[i++];
+            m_pArrived[nArrived++] = m_pScan[j++];
+        }
+        else
+        {
+            m_pScan[j++] = m_Devices[i++];
+        }
+    }
+
+    if ( ( nArrived == 0 ) && ( nRemoved == 0 ) )
+    {
+        return;
+    }
+
+    LookupUsb( m_pArrived, nArrived );
+
+    for ( i = 0, j = 0; i < nArrived; i++ )
+    {
+        while ( m_pScan[j].nPort != m_pArrived[i].nPort )
+        {
+            j++;
+        }
+
+        m_pScan[j] = m_pArrived[i];
+    }
+
+    EnterCriticalSection( &m_csDevices );
+    memcpy( m_Devices, m_pScan, nScan * sizeof( SERIAL_DEVICE_INFO ) );
+    m_nDevices = nScan;
+    LeaveCriticalSection( &m_csDevices );
+
+    // outside the lock, so callbacks may look at the index
+    if ( m_pfnCallback != NULL )
+    {
+        for ( k = 0; k < nRemoved; k++ )
+        {
+            m_pfnCallback( m_pContext, &m_pRemoved[k], FALSE );
+        }
+
+        for ( k = 0; k < nArrived; k++ )
+        {
+            m_pfnCallback( m_pContext, &m_pArrived[k], TRUE );
+        }
+    }
+}
+
+UINT CSerialDeviceIndex::ReadKey( SERIAL_DEVICE_INFO *pDevices, UINT nMax )
+{
+    HKEY  hKey;
+    TCHAR szName[MAX_PATH];
+    TCHAR szData[16];
+    DWORD cchName;
+    DWORD cbData;
+    DWORD dwType;
+    LONG  lResult;
+    UINT  nCount = 0;
+    UINT  nPort;
+    UINT  nPrefix = ( UINT )_tcslen( SERIAL_DEVICE_PREFIX );
+    DWORD i;
+    UINT  j;
+
+    if ( RegOpenKeyEx( HKEY_LOCAL_MACHINE, SERIAL_COMM_KEY, 0, KEY_QUERY_VALUE, &hKey ) != ERROR_SUCCESS )
+    {
+        // no serial port at all
+        return 0;
+    }
+
+    // \Device\Serial0 = COM1, one value per port
+    for ( i = 0; nCount < nMax; i++ )
+    {
+        cchName = MAX_PATH;
+        cbData = sizeof( szData ) - sizeof( TCHAR );
+        memset( szData, 0, sizeof( szData ) );
+        lResult = RegEnumValue( hKey, i, szName, &cchName, NULL, &dwType, ( LPBYTE )szData, &cbData );
+
+        if ( lResult == ERROR_NO_MORE_ITEMS )
+        {
+            break;
+        }
+
+        if ( ( lResult != ERROR_SUCCESS ) || ( dwType != REG_SZ ) || ( _tcsnicmp( szData, SERIAL_DEVICE_PREFIX, nPrefix ) != 0 ) )
+        {
+            continue;
+        }
+
+        nPort = ( UINT )_ttoi( szData + nPrefix );
+
+        if ( ( nPort == 0 ) || ( nPort > SERIAL_PORT_MAX ) )
+        {
+            continue;
+        }
+
+        for ( j = nCount; ( j > 0 ) && ( pDevices[j - 1].nPort > nPort ); j-- )
+        {
+            pDevices[j] = pDevices[j - 1];
+        }
+
+        memset( &pDevices[j], 0, sizeof( SERIAL_DEVICE_INFO ) );
+        pDevices[j].nPort = nPort;
+        sprintf( pDevices[j].szPath, _T( "\\\\.\\%s%u" ), SERIAL_DEVICE_PREFIX, nPort );
+        lstrcpyn( pDevices[j].szDevice, szName, MAX_PATH );
+        nCount++;
+    }
+
+    RegCloseKey( hKey );
+    return nCount;
+}
+
+void CSerialDeviceIndex::LookupUsb( SERIAL_DEVICE_INFO *pDevices, UINT nCount )
+{
+    if ( nCount == 0 )
+    {
+        return;
+    }
+
+    // FTDI adapters hang below their own bus, the others below USB
+    LookupBus( SERIAL_USB_ENUM_KEY, pDevices, nCount );
+    LookupBus( SERIAL_FTDI_ENUM_KEY, pDevices, nCount );
+}
+
+void CSerialDeviceIndex::LookupBus( LPCTSTR pszBus, SERIAL_DEVICE_INFO *pDevices, UINT nCount )
+{
+    HKEY   hBus;
+    HKEY   hDevice;
+    HKEY   hParameters;
+    TCHAR  szDevice[MAX_PATH];
+    TCHAR  szInstance[MAX_PATH];
+    TCHAR  szPath[MAX_PATH + 32];
+    TCHAR  szPortName[32];
+    TCHAR  *pVendor;
+    TCHAR  *pProduct;
+    TCHAR  *pSerial;
+    DWORD  cchName;
+    DWORD  cbData;
+    DWORD  i;
+    DWORD  j;
+    UINT   k;
+    BOOL   bFtdi = ( lstrcmpi( pszBus, SERIAL_FTDI_ENUM_KEY ) == 0 );
+
+    if ( RegOpenKeyEx( HKEY_LOCAL_MACHINE, pszBus, 0, KEY_READ, &hBus ) != ERROR_SUCCESS )
+    {
+        return;
+    }
+
+    // USB\VID_xxxx&PID_yyyy\<serial> or FTDIBUS\VID_xxxx+PID_yyyy+<serial>\0000, PortName tells the COM number
+    for ( i = 0; ; i++ )
+    {
+        cchName = MAX_PATH;
+
+        if ( RegEnumKeyEx( hBus, i, szDevice, &cchName, NULL, NULL, NULL, NULL ) != ERROR_SUCCESS )
+        {
+            break;
+        }
+
+        pVendor = _tcsstr( szDevice, _T( "VID_" ) );
+        pProduct = _tcsstr( szDevice, _T( "PID_" ) );
+
+        if ( ( pVendor == NULL ) || ( pProduct == NULL ) || ( RegOpenKeyEx( hBus, szDevice, 0, KEY_READ, &hDevice ) != ERROR_SUCCESS ) )
+        {
+            continue;
+        }
+
+        for ( j = 0; ; j++ )
+        {
+            cchName = MAX_PATH;
+
+            if ( RegEnumKeyEx( hDevice, j, szInstance, &cchName, NULL, NULL, NULL, NULL ) != ERROR_SUCCESS )
+            {
+                break;
+            }
+
+            sprintf( szPath, _T( "%s\\Device Parameters" ), szInstance );
+
+            if ( RegOpenKeyEx( hDevice, szPath, 0, KEY_QUERY_VALUE, &hParameters ) != ERROR_SUCCESS )
+            {
+                continue;
+            }
+
+            cbData = sizeof( szPortName ) - sizeof( TCHAR );
+            memset( szPortName, 0, sizeof( szPortName ) );
+
+            if ( RegQueryValueEx( hParameters, _T( "PortName" ), NULL, NULL, ( LPBYTE )szPortName, &cbData ) == ERROR_SUCCESS )
+            {
+                for ( k = 0; k < nCount; k++ )
+                {
+                    sprintf( szPath, _T( "%s%u" ), SERIAL_DEVICE_PREFIX, pDevices[k].nPort );
+
+                    if ( lstrcmpi( szPortName, szPath ) != 0 )
+                    {
+                        continue;
+                    }
+
+                    pDevices[k].wVendorId = ( WORD )_tcstoul( pVendor + 4, NULL, 16 );
+                    pDevices[k].wProductId = ( WORD )_tcstoul( pProduct + 4, NULL, 16 );
+
+                    if ( bFtdi )
+                    {
+                        // the third part of the name, the driver appends the channel letter
+                        pSerial = _tcschr( pProduct, '+' );
+
+                        if ( pSerial != NULL )
+                        {
+                            lstrcpyn( pDevices[k].szSerial, pSerial + 1, sizeof( pDevices[k].szSerial ) / sizeof( TCHAR ) );
+                        }
+                    }
+                    else if ( _tcschr( szInstance, '&' ) == NULL )
+                    {
+                        // Windows makes up an instance with '&' in it when the adapter has no serial number
+                        lstrcpyn( pDevices[k].szSerial, szInstance, sizeof( pDevices[k].szSerial ) / sizeof( TCHAR ) );
+                    }
+                }
+            }
+
+            RegCloseKey( hParameters );
+        }
+
+        RegCloseKey( hDevice );
+    }
+
+    RegCloseKey( hBus );
+}
+
+DWORD WINAPI CSerialDeviceIndex::WatchThread( LPVOID pParam )
+{
+    CSerialDeviceIndex *pIndex = ( CSerialDeviceIndex * )pParam;
+    HANDLE hEvents[2];
+    hEvents[0] = pIndex->m_hStopEvent;
+    hEvents[1] = pIndex->m_hChangeEvent;
+
+    while ( WaitForMultipleObjects( 2, hEvents, FALSE, INFINITE ) == WAIT_OBJECT_0 + 1 )
+    {
+        // a notification fires once, it is armed again before the key is read
+        RegNotifyChangeKeyValue( pIndex->m_hKey, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, pIndex->m_hChangeEvent, TRUE );
+
+        if ( WaitForSingleObject( pIndex->m_hStopEvent, SERIAL_DEVICE_SETTLE ) == WAIT_OBJECT_0 )
+        {
+            break;
+        }
+
+        pIndex->Refresh();
+    }
+
+    return 0;
+}
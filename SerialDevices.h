@@ -0,0 +1,70 @@
+/*
+**  FILENAME            SerialDevices.h
+**
+**  PURPOSE             Cached index of the serial ports of the machine.
+**                      A thread watches the SERIALCOMM key the serial drivers keep up to date
+**                      and reports ports that come and go, with the USB vendor, product and
+**                      serial number looked up once per arrival.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_DEVICES_H
+#define SERIAL_DEVICES_H
+
+#define SERIAL_DEVICEMAP_KEY        _T("HARDWARE\\DEVICEMAP")   /* watched, SERIALCOMM below it only exists while a port does */
+#define SERIAL_COMM_KEY             _T("HARDWARE\\DEVICEMAP\\SERIALCOMM")
+#define SERIAL_USB_ENUM_KEY         _T("SYSTEM\\CurrentControlSet\\Enum\\USB")
+#define SERIAL_DEVICE_SETTLE        100UL                   /* ms a change is left to settle, one USB adapter touches the key several times */
+
+typedef struct
+{
+    UINT                nPort;                              /* 7 for COM7 */
+    TCHAR               szPath[16];                         /* \\.\COM7, for CreateFile() */
+    TCHAR               szDevice[MAX_PATH];                 /* kernel device, e.g. \Device\VCP0 */
+    WORD                wVendorId;                          /* USB ids, 0 for other ports */
+    WORD                wProductId;
+    TCHAR               szSerial[64];                       /* USB serial number, empty if the adapter has none */
+} SERIAL_DEVICE_INFO;
+
+/* called on the watch thread, bArrived is FALSE when the port went away */
+typedef void ( CALLBACK *SERIAL_DEVICE_CALLBACK )( LPVOID pContext, const SERIAL_DEVICE_INFO *pDevice, BOOL bArrived );
+
+class CSerialDeviceIndex
+{
+    public:
+        CSerialDeviceIndex();
+        virtual             ~CSerialDeviceIndex();
+
+        BOOL                Start( SERIAL_DEVICE_CALLBACK pfnCallback = NULL, LPVOID pContext = NULL );
+        void                Stop();
+        UINT                GetDevices( SERIAL_DEVICE_INFO *pDevices, UINT nMax );
+        BOOL                Find( UINT nPort, SERIAL_DEVICE_INFO *pDevice );
+
+        static UINT         Scan( SERIAL_DEVICE_INFO *pDevices, UINT nMax, BOOL bUsb = TRUE );
+
+    protected:
+        CRITICAL_SECTION    m_csDevices;
+        SERIAL_DEVICE_INFO  m_Devices[SERIAL_PORT_MAX];     /* sorted by port number */
+        UINT                m_nDevices;
+        SERIAL_DEVICE_CALLBACK m_pfnCallback;
+        LPVOID              m_pContext;
+        SERIAL_DEVICE_INFO  *m_pScan;                       /* work lists of the watch thread, SERIAL_PORT_MAX each */
+        SERIAL_DEVICE_INFO  *m_pArrived;
+        SERIAL_DEVICE_INFO  *m_pRemoved;
+        HKEY                m_hKey;
+        HANDLE              m_hChangeEvent;
+        HANDLE              m_hStopEvent;
+        HANDLE              m_hThread;
+
+        void                Refresh();
+        static UINT         ReadKey( SERIAL_DEVICE_INFO *pDevices, UINT nMax );
+        static void         LookupUsb( SERIAL_DEVICE_INFO *pDevices, UINT nCount );
+        static void         LookupBus( LPCTSTR pszBus, SERIAL_DEVICE_INFO *pDevices, UINT nCount );
+        static DWORD WINAPI WatchThread( LPVOID pParam );
+};
+
+#endif SERIAL_DEVICES_H
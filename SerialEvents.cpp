@@ -0,0 +1,125 @@
+/*
+**  FILENAME            SerialEvents.cpp
+**
+**  PURPOSE             Errors and line events of serial ports as fixed records in a preallocated
+**                      lock-free ring. The comm threads never wait for the application to look
+**                      at them, a full ring drops the event and counts it.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+static LPCTSTR s_pszSteps[SERIAL_STEPS] =
+{
+    _T( "CreateFile()" ),
+    _T( "SetCommTimeouts()" ),
+    _T( "SetCommMask()" ),
+    _T( "GetCommState()" ),
+    _T( "SetCommState()" ),
+    _T( "SetupComm()" ),
+    _T( "PurgeComm()" ),
+    _T( "CreateThread()" ),
+    _T( "CreateIoCompletionPort()" ),
+    _T( "CreateEvent()" ),
+    _T( "WaitCommEvent()" ),
+    _T( "ClearCommError()" ),
+    _T( "ReadFile()" ),
+    _T( "WriteFile()" ),
+    _T( "EscapeCommFunction()" ),
+    _T( "SetThreadAffinityMask()" ),
+    _T( "SetThreadPriority()" ),
+    _T( "TransmitCommChar()" ),
+    _T( "Write()" )
+};
+
+CSerialEventRing::CSerialEventRing()
+{
+    m_hReady = NULL;
+    m_nDropped = 0;
+}
+
+CSerialEventRing::~CSerialEventRing()
+{
+    Destroy();
+}
+
+BOOL CSerialEventRing::Create( UINT nEvents )
+{
+    DWORD nRecord = ( sizeof( SERIAL_RECORD ) + sizeof( SERIAL_EVENT ) + SERIAL_RECORD_ALIGN - 1 ) & ~( SERIAL_RECORD_ALIGN - 1 );
+    Destroy();
+    m_hReady = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+    // everything is allocated here, publishing an event never allocates
+    if ( ( m_hReady == NULL ) || !m_Queue.Create( nEvents * nRecord ) )
+    {
+        Destroy();
+        return FALSE;
+    }
+
+    m_nDropped = 0;
+    return TRUE;
+}
+
+void CSerialEventRing::Destroy()
+{
+    m_Queue.Destroy();
+
+    if ( m_hReady != NULL )
+    {
+        CloseHandle( m_hReady );
+        m_hReady = NULL;
+    }
+}
+
+BOOL CSerialEventRing::Publish( const SERIAL_EVENT *pEvent )   // FALSE when the ring is full, the event is counted as dropped
+{
+    SERIAL_RECORD *pRecord;
+
+    if ( m_Queue.Reserve( sizeof( SERIAL_EVENT ), 0, &pRecord ) != SERIAL_WRITE_OK )
+    {
+        InterlockedIncrement( &m_nDropped );
+        return FALSE;
+    }
+
+    memcpy( CSerialQueue::GetPayload( pRecord ), pEvent, sizeof( SERIAL_EVENT ) );
+    pRecord->llTimestamp = pEvent->llTimestamp;
+    m_Queue.Commit( pRecord );
+    SetEvent( m_hReady );
+    return TRUE;
+}
+
+BOOL CSerialEventRing::Get( SERIAL_EVENT *pEvent )             // oldest event, FALSE if there is none
+{
+    SERIAL_RECORD *pRecord;
+    DWORD nPos = m_Queue.GetTail();
+
+    if ( ( pRecord = m_Queue.Peek( &nPos ) ) == NULL )
+    {
+        return FALSE;
+    }
+
+    memcpy( pEvent, CSerialQueue::GetPayload( pRecord ), sizeof( SERIAL_EVENT ) );
+    m_Queue.Release( nPos + pRecord->nLength );
+    return TRUE;
+}
+
+HANDLE CSerialEventRing::GetReadyEvent()                        // signaled once events arrived, then drain with Get()
+{
+    return m_hReady;
+}
+
+DWORD CSerialEventRing::GetDroppedCount()
+{
+    return ( DWORD )m_nDropped;
+}
+
+LPCTSTR CSerialEventRing::GetStepName( SERIAL_STEP Step )
+{
+    return ( ( UINT )Step < SERIAL_STEPS ) ? s_pszSteps[Step] : _T( "?" );
+}
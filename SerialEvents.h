@@ -0,0 +1,96 @@
+/*
+**  FILENAME            SerialEvents.h
+**
+**  PURPOSE             Errors and line events of serial ports as fixed records in a preallocated
+**                      lock-free ring. The comm threads never wait for the application to look
+**                      at them, a full ring drops the event and counts it.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_EVENTS_H
+#define SERIAL_EVENTS_H
+
+#define SERIAL_EVENT_RING_SIZE      256UL                   /* default events the ring holds */
+#define SERIAL_EVENT_RATE           10UL                    /* default events per second and code of one port, the rest is counted */
+
+typedef enum
+{
+    SERIAL_EVENT_ERROR = 0,                                 /* a call failed, dwError and the SERIAL_STEP in dwDetail */
+    SERIAL_EVENT_LINE,                                      /* ClearCommError() reported CE_* bits in dwDetail */
+    SERIAL_EVENT_COMM,                                      /* EV_CTS, EV_BREAK, ... in dwDetail */
+    SERIAL_EVENT_DISCONNECTED,                              /* the comm thread stopped on an error */
+    SERIAL_EVENT_RECONNECTING,                              /* attempt number in dwDetail */
+    SERIAL_EVENT_RECONNECTED,                               /* attempts it took in dwDetail */
+    SERIAL_EVENT_CODES
+} SERIAL_EVENT_CODE;
+
+typedef enum
+{
+    SERIAL_STEP_CREATEFILE = 0,
+    SERIAL_STEP_SETCOMMTIMEOUTS,
+    SERIAL_STEP_SETCOMMMASK,
+    SERIAL_STEP_GETCOMMSTATE,
+    SERIAL_STEP_SETCOMMSTATE,
+    SERIAL_STEP_SETUPCOMM,
+    SERIAL_STEP_PURGECOMM,
+    SERIAL_STEP_CREATETHREAD,
+    SERIAL_STEP_ATTACH,                                     /* CreateIoCompletionPort() of a reactor */
+    SERIAL_STEP_CREATEEVENT,
+    SERIAL_STEP_WAITCOMMEVENT,
+    SERIAL_STEP_CLEARCOMMERROR,
+    SERIAL_STEP_READFILE,
+    SERIAL_STEP_WRITEFILE,
+    SERIAL_STEP_ESCAPECOMMFUNCTION,                         /* SERIAL_COMMAND_ESCAPE */
+    SERIAL_STEP_SETTHREADAFFINITYMASK,                      /* SERIAL_BUSY_POLL nCore, the port runs on */
+    SERIAL_STEP_SETTHREADPRIORITY,                          /* SERIAL_BUSY_POLL nPriority, the port runs on */
+    SERIAL_STEP_TRANSMITCOMMCHAR,                           /* XON or XOFF of SERIAL_FLOW_CONTROL */
+    SERIAL_STEP_ENQUEUE,                                    /* Write() refused by the transmit queue */
+    SERIAL_STEPS
+} SERIAL_STEP;
+
+typedef struct
+{
+    SERIAL_EVENT_CODE   Code;
+    UINT                nPort;
+    DWORD               dwError;                            /* GetLastError(), ERROR_SUCCESS if none */
+    DWORD               dwDetail;                           /* depends on Code */
+    DWORD               cbInQue;                            /* COMSTAT of SERIAL_EVENT_LINE */
+    DWORD               cbOutQue;
+    DWORD               nSuppressed;                        /* events of this code and port left out by the rate limit before this one */
+    LONGLONG            llTimestamp;                        /* CSerialPort::GetTimestamp() */
+} SERIAL_EVENT;
+
+typedef struct
+{
+    DWORD               dwInitialDelay;                     /* ms before the first attempt, 0 never reconnects */
+    DWORD               dwMaxDelay;                         /* the delay doubles up to this */
+    UINT                nMaxAttempts;                       /* 0 keeps trying until Close() */
+} SERIAL_RECONNECT;
+
+/* written by the comm threads of any number of ports, read by one application thread */
+class CSerialEventRing
+{
+    public:
+        CSerialEventRing();
+        virtual             ~CSerialEventRing();
+
+        BOOL                Create( UINT nEvents = SERIAL_EVENT_RING_SIZE );
+        void                Destroy();
+        BOOL                Publish( const SERIAL_EVENT *pEvent );
+        BOOL                Get( SERIAL_EVENT *pEvent );
+        HANDLE              GetReadyEvent();
+        DWORD               GetDroppedCount();
+
+        static LPCTSTR      GetStepName( SERIAL_STEP Step );
+
+    protected:
+        CSerialQueue        m_Queue;
+        HANDLE              m_hReady;                       /* auto-reset, set with every event */
+        volatile LONG       m_nDropped;
+};
+
+#endif SERIAL_EVENTS_H
@@ -0,0 +1,562 @@
+/*
+**  FILENAME            SerialFramer.cpp
+**
+**  PURPOSE             Frame assembly stage of the receive pipeline.
+**                      A framer cuts the received chunks into frames and hands them to a
+**                      callback, pointing straight into the receive buffer when a frame lies
+**                      within one chunk. Derive from CSerialFramer for other encodings.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialChecksum.h"
+#include "SerialFramer.h"
+#include <assert.h>
+#include <intrin.h>
+
+#if defined( _M_X64 ) || ( defined( _M_IX86_FP ) && ( _M_IX86_FP >= 2 ) )
+#define SERIAL_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined( __AVX2__ )                                 /* /arch:AVX2 */
+#define SERIAL_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+CSerialFramer::CSerialFramer( DWORD nMaxFrame )
+{
+    m_pfnCallback = NULL;
+    m_pContext = NULL;
+    m_nMaxFrame = nMaxFrame;
+    m_pAssembly = new BYTE[nMaxFrame];
+    m_nAssembly = 0;
+    m_dwFrameFlags = 0;
+    m_llFrameTime = 0;
+    m_nErrors = 0;
+    m_ChecksumType = SERIAL_CHECKSUM_NONE;
+    m_bStripChecksum = TRUE;
+    m_ScanMethod = SERIAL_SCAN_FASTEST;
+}
+
+CSerialFramer::~CSerialFramer()
+{
+    if ( m_pAssembly != NULL )
+    {
+        delete [] m_pAssembly;
+        m_pAssembly = NULL;
+    }
+}
+
+void CSerialFramer::SetCallback( SERIAL_FRAME_CALLBACK pfnCallback, LPVOID pContext )
+{
+    m_pfnCallback = pfnCallback;
+    m_pContext = pContext;
+}
+
+DWORD CSerialFramer::GetErrorCount()
+{
+    return m_nErrors;
+}
+
+void CSerialFramer::SetChecksum( SERIAL_CHECKSUM_TYPE Type,     // checked over every frame before the callback
+                                 BOOL bStrip )                  // leave the checksum bytes out of the frame
+{
+    m_ChecksumType = Type;
+    m_bStripChecksum = bStrip;
+}
+
+void CSerialFramer::SetScanMethod( SERIAL_SCAN_METHOD Method )
+{
+    m_ScanMethod = Method;
+}
+
+void CSerialFramer::Reset()
+{
+    m_nAssembly = 0;
+    m_dwFrameFlags = 0;
+}
+
+LONGLONG CSerialFramer::GetDeadline()
+{
+    return MAXLONGLONG;
+}
+
+void CSerialFramer::OnDeadline( LONGLONG llNow )
+{
+}
+
+const BYTE *CSerialFramer::FindByte( const BYTE *pData, DWORD nSize, BYTE Value, SERIAL_SCAN_METHOD Method )
+{
+    DWORD nIndex;
+#if defined( SERIAL_SIMD_AVX2 )
+    const __m256i Needle32 = _mm256_set1_epi8( ( char )Value );
+
+    while ( ( Method == SERIAL_SCAN_FASTEST ) && ( nSize >= 32 ) )
+    {
+        DWORD dwMask = ( DWORD )_mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_loadu_si256( ( const __m256i * )pData ), Needle32 ) );
+
+        if ( _BitScanForward( &nIndex, dwMask ) )
+        {
+            return pData + nIndex;
+        }
+
+        pData += 32;
+        nSize -= 32;
+    }
+
+#endif
+#if defined( SERIAL_SIMD_SSE2 )
+    const __m128i Needle16 = _mm_set1_epi8( ( char )Value );
+
+    while ( ( Method != SERIAL_SCAN_SCALAR ) && ( nSize >= 16 ) )
+    {
+        DWORD dwMask = ( DWORD )_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( ( const __m128i * )pData ), Needle16 ) );
+
+        if ( _BitScanForward( &nIndex, dwMask ) )
+        {
+            return pData + nIndex;
+        }
+
+        pData += 16;
+        nSize -= 16;
+    }
+
+#endif
+
+    for ( nIndex = 0; nIndex < nSize; nIndex++ )
+    {
+        if ( pData[nIndex] == Value )
+        {
+            return pData + nIndex;
+        }
+    }
+
+    return NULL;
+}
+
+const BYTE *CSerialFramer::FindEither( const BYTE *pData, DWORD nSize, BYTE Value1, BYTE Value2, SERIAL_SCAN_METHOD Method )
+{
+    DWORD nIndex;
+#if defined( SERIAL_SIMD_AVX2 )
+    const __m256i First32 = _mm256_set1_epi8( ( char )Value1 );
+    const __m256i Second32 = _mm256_set1_epi8( ( char )Value2 );
+
+    while ( ( Method == SERIAL_SCAN_FASTEST ) && ( nSize >= 32 ) )
+    {
+        __m256i Block = _mm256_loadu_si256( ( const __m256i * )pData );
+        DWORD dwMask = ( DWORD )_mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpeq_epi8( Block, First32 ), _mm256_cmpeq_epi8( Block, Second32 ) ) );
+
+        if ( _BitScanForward( &nIndex, dwMask ) )
+        {
+            return pData + nIndex;
+        }
+
+        pData += 32;
+        nSize -= 32;
+    }
+
+#endif
+#if defined( SERIAL_SIMD_SSE2 )
+    const __m128i First16 = _mm_set1_epi8( ( char )Value1 );
+    const __m128i Second16 = _mm_set1_epi8( ( char )Value2 );
+
+    while ( ( Method != SERIAL_SCAN_SCALAR ) && ( nSize >= 16 ) )
+    {
+        __m128i Block = _mm_loadu_si128( ( const __m128i * )pData );
+        DWORD dwMask = ( DWORD )_mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( Block, First16 ), _mm_cmpeq_epi8( Block, Second16 ) ) );
+
+        if ( _BitScanForward( &nIndex, dwMask ) )
+        {
+            return pData + nIndex;
+        }
+
+        pData += 16;
+        nSize -= 16;
+    }
+
+#endif
+
+    for ( nIndex = 0; nIndex < nSize; nIndex++ )
+    {
+        if ( ( pData[nIndex] == Value1 ) || ( pData[nIndex] == Value2 ) )
+        {
+            return pData + nIndex;
+        }
+    }
+
+    return NULL;
+}
+
+void CSerialFramer::Append( const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    DWORD nCopy = min( nSize, m_nMaxFrame - m_nAssembly );
+
+    if ( m_nAssembly == 0 )
+    {
+        m_llFrameTime = llTimestamp;
+    }
+
+    if ( nCopy < nSize )
+    {
+        m_dwFrameFlags |= SERIAL_FRAME_TRUNCATED;
+    }
+
+    memcpy( m_pAssembly + m_nAssembly, pData, nCopy );
+    m_nAssembly += nCopy;
+}
+
+void CSerialFramer::Emit( const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp )
+{
+    // the frame is contiguous here, in the receive buffer or in the assembly buffer
+    if ( m_ChecksumType != SERIAL_CHECKSUM_NONE )
+    {
+        if ( !CSerialChecksum::Verify( m_ChecksumType, pFrame, nSize ) )
+        {
+            m_dwFrameFlags |= SERIAL_FRAME_CHECKSUM;
+        }
+
+        if ( m_bStripChecksum )
+        {
+            nSize -= min( nSize, CSerialChecksum::GetTrailerSize( m_ChecksumType ) );
+        }
+    }
+
+    if ( m_dwFrameFlags != 0 )
+    {
+        m_nErrors++;
+    }
+
+    if ( m_pfnCallback != NULL )
+    {
+        m_pfnCallback( m_pContext, pFrame, nSize, llTimestamp, m_dwFrameFlags );
+    }
+
+    m_dwFrameFlags = 0;
+}
+
+void CSerialFramer::EmitAssembly()
+{
+    Emit( m_pAssembly, m_nAssembly, m_llFrameTime );
+    m_nAssembly = 0;
+}
+
+CSerialDelimiterFramer::CSerialDelimiterFramer( BYTE Delimiter, BOOL bKeepDelimiter, DWORD nMaxFrame )
+    : CSerialFramer( nMaxFrame )
+{
+    m_Delimiter = Delimiter;
+    m_bKeepDelimiter = bKeepDelimiter;
+}
+
+void CSerialDelimiterFramer::Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    const BYTE *pEnd = pData + nSize;
+    const BYTE *pStart = pData;
+    const BYTE *pHit;
+    DWORD nFrame;
+
+    while ( ( pHit = FindByte( pStart, ( DWORD )( pEnd - pStart ), m_Delimiter, m_ScanMethod ) ) != NULL )
+    {
+        nFrame = ( DWORD )( pHit - pStart ) + ( m_bKeepDelimiter ? 1 : 0 );
+
+        if ( m_nAssembly > 0 )
+        {
+            Append( pStart, nFrame, llTimestamp );
+            EmitAssembly();
+        }
+        else if ( nFrame > 0 )
+        {
+            Emit( pStart, nFrame, llTimestamp );
+        }
+
+        pStart = pHit + 1;
+    }
+
+    if ( pStart < pEnd )
+    {
+        Append( pStart, ( DWORD )( pEnd - pStart ), llTimestamp );
+    }
+}
+
+CSerialLengthFramer::CSerialLengthFramer( DWORD nLengthOffset,  // bytes in front of the length field
+                                          DWORD nLengthSize,    // 1, 2 or 4
+                                          BOOL  bBigEndian,
+                                          LONG  nAdjust,        // trailer such as a CRC, negative if the length counts the header
+                                          DWORD nMaxFrame )
+    : CSerialFramer( nMaxFrame )
+{
+    assert( ( nLengthSize == 1 ) || ( nLengthSize == 2 ) || ( nLengthSize == 4 ) );
+    assert( nLengthOffset + nLengthSize <= nMaxFrame );
+    m_nLengthOffset = nLengthOffset;
+    m_nLengthSize = nLengthSize;
+    m_bBigEndian = bBigEndian;
+    m_nAdjust = nAdjust;
+    m_nFrameSize = 0;
+}
+
+void CSerialLengthFramer::Reset()
+{
+    CSerialFramer::Reset();
+    m_nFrameSize = 0;
+}
+
+DWORD CSerialLengthFramer::GetFrameSize( const BYTE *pHeader )
+{
+    DWORD i;
+    DWORD nHeader = m_nLengthOffset + m_nLengthSize;
+    LONGLONG llSize = 0;
+
+    for ( i = 0; i < m_nLengthSize; i++ )
+    {
+        llSize |= ( LONGLONG )pHeader[m_nLengthOffset + ( m_bBigEndian ? i : ( m_nLengthSize - 1 - i ) )] << ( 8 * ( m_nLengthSize - 1 - i ) );
+    }
+
+    llSize += nHeader + m_nAdjust;
+
+    // 0 means the header cannot be right, the caller resynchronizes
+    return ( ( llSize < nHeader ) || ( llSize > m_nMaxFrame ) ) ? 0 : ( DWORD )llSize;
+}
+
+void CSerialLengthFramer::Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    DWORD nHeader = m_nLengthOffset + m_nLengthSize;
+    DWORD nCopy;
+
+    while ( nSize > 0 )
+    {
+        if ( ( m_nAssembly == 0 ) && ( nSize >= nHeader ) )
+        {
+            m_nFrameSize = GetFrameSize( pData );
+
+            if ( m_nFrameSize == 0 )
+            {
+                m_nErrors++;
+                pData++;
+                nSize--;
+                continue;
+            }
+
+            if ( nSize >= m_nFrameSize )
+            {
+                Emit( pData, m_nFrameSize, llTimestamp );
+                pData += m_nFrameSize;
+                nSize -= m_nFrameSize;
+                m_nFrameSize = 0;
+                continue;
+            }
+        }
+
+        // frame continues in the next chunk: header first, then the rest
+        nCopy = ( m_nFrameSize == 0 ) ? ( nHeader - m_nAssembly ) : ( m_nFrameSize - m_nAssembly );
+        nCopy = min( nCopy, nSize );
+        Append( pData, nCopy, llTimestamp );
+        pData += nCopy;
+        nSize -= nCopy;
+
+        if ( m_nFrameSize == 0 )
+        {
+            if ( m_nAssembly < nHeader )
+            {
+                continue;
+            }
+
+            m_nFrameSize = GetFrameSize( m_pAssembly );
+
+            if ( m_nFrameSize == 0 )
+            {
+                m_nErrors++;
+                memmove( m_pAssembly, m_pAssembly + 1, --m_nAssembly );
+                continue;
+            }
+        }
+
+        if ( m_nAssembly >= m_nFrameSize )
+        {
+            EmitAssembly();
+            m_nFrameSize = 0;
+        }
+    }
+}
+
+CSerialSlipFramer::CSerialSlipFramer( DWORD nMaxFrame )
+    : CSerialFramer( nMaxFrame )
+{
+    m_bEscape = FALSE;
+}
+
+void CSerialSlipFramer::Reset()
+{
+    CSerialFramer::Reset();
+    m_bEscape = FALSE;
+}
+
+BYTE CSerialSlipFramer::Unescape( BYTE Value )
+{
+    if ( Value == SLIP_ESC_END )
+    {
+        return SLIP_END;
+    }
+
+    if ( Value == SLIP_ESC_ESC )
+    {
+        return SLIP_ESC;
+    }
+
+    m_dwFrameFlags |= SERIAL_FRAME_ERROR;
+    return Value;
+}
+
+void CSerialSlipFramer::Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BYTE *pRead = pData;
+    BYTE *pEnd = pData + nSize;
+    BYTE *pWrite;
+    BYTE *pFrame;
+    BYTE Value;
+    const BYTE *pHit;
+    DWORD nRun;
+
+    if ( m_bEscape && ( pRead < pEnd ) )
+    {
+        // escape character was the last byte of the previous chunk
+        Value = Unescape( *pRead++ );
+        Append( &Value, 1, llTimestamp );
+        m_bEscape = FALSE;
+    }
+
+    // decode in place, the frame stays contiguous in the receive buffer
+    pFrame = pWrite = pRead;
+
+    while ( pRead < pEnd )
+    {
+        pHit = FindEither( pRead, ( DWORD )( pEnd - pRead ), SLIP_END, SLIP_ESC, m_ScanMethod );
+        nRun = ( DWORD )( ( ( pHit != NULL ) ? pHit : pEnd ) - pRead );
+
+        if ( pWrite != pRead )
+        {
+            memmove( pWrite, pRead, nRun );
+        }
+
+        pWrite += nRun;
+        pRead += nRun;
+
+        if ( pHit == NULL )
+        {
+            break;
+        }
+
+        if ( *pRead == SLIP_ESC )
+        {
+            if ( pRead + 1 == pEnd )
+            {
+                m_bEscape = TRUE;
+                pRead = pEnd;
+                break;
+            }
+
+            *pWrite++ = Unescape( pRead[1] );
+            pRead += 2;
+        }
+        else
+        {
+            if ( m_nAssembly > 0 )
+            {
+                Append( pFrame, ( DWORD )( pWrite - pFrame ), llTimestamp );
+                EmitAssembly();
+            }
+            else if ( pWrite > pFrame )
+            {
+                Emit( pFrame, ( DWORD )( pWrite - pFrame ), llTimestamp );
+            }
+
+            pRead++;
+            pFrame = pWrite = pRead;
+        }
+    }
+
+    if ( pWrite > pFrame )
+    {
+        Append( pFrame, ( DWORD )( pWrite - pFrame ), llTimestamp );
+    }
+}
+
+CSerialCobsFramer::CSerialCobsFramer( DWORD nMaxFrame )
+    : CSerialFramer( nMaxFrame )
+{
+}
+
+DWORD CSerialCobsFramer::Decode( BYTE *pData, DWORD nSize, BOOL *pbError )
+{
+    DWORD nRead = 0;
+    DWORD nWrite = 0;
+    DWORD nCode;
+    *pbError = FALSE;
+
+    // output never overtakes input, so decoding in place is safe
+    while ( nRead < nSize )
+    {
+        nCode = pData[nRead++];
+
+        if ( ( nCode == 0 ) || ( nRead + nCode - 1 > nSize ) )
+        {
+            *pbError = TRUE;
+            break;
+        }
+
+        memmove( pData + nWrite, pData + nRead, nCode - 1 );
+        nWrite += nCode - 1;
+        nRead += nCode - 1;
+
+        if ( ( nCode != 0xFF ) && ( nRead < nSize ) )
+        {
+            pData[nWrite++] = 0;
+        }
+    }
+
+    return nWrite;
+}
+
+void CSerialCobsFramer::EmitDecoded( BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp )
+{
+    BOOL bError;
+    nSize = Decode( pFrame, nSize, &bError );
+
+    if ( bError )
+    {
+        m_dwFrameFlags |= SERIAL_FRAME_ERROR;
+    }
+
+    Emit( pFrame, nSize, llTimestamp );
+}
+
+void CSerialCobsFramer::Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BYTE *pEnd = pData + nSize;
+    BYTE *pStart = pData;
+    const BYTE *pHit;
+
+    while ( ( pHit = FindByte( pStart, ( DWORD )( pEnd - pStart ), 0, m_ScanMethod ) ) != NULL )
+    {
+        if ( m_nAssembly > 0 )
+        {
+            Append( pStart, ( DWORD )( pHit - pStart ), llTimestamp );
+            EmitDecoded( m_pAssembly, m_nAssembly, m_llFrameTime );
+            m_nAssembly = 0;
+        }
+        else if ( pHit > pStart )
+        {
+            EmitDecoded( pStart, ( DWORD )( pHit - pStart ), llTimestamp );
+        }
+
+        pStart = ( BYTE * )pHit + 1;
+    }
+
+    if ( pStart < pEnd )
+    {
+        Append( pStart, ( DWORD )( pEnd - pStart ), llTimestamp );
+    }
+}
@@ -0,0 +1,141 @@
+/*
+**  FILENAME            SerialFramer.h
+**
+**  PURPOSE             Frame assembly stage of the receive pipeline.
+**                      A framer cuts the received chunks into frames and hands them to a
+**                      callback, pointing straight into the receive buffer when a frame lies
+**                      within one chunk. Derive from CSerialFramer for other encodings.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_FRAMER_H
+#define SERIAL_FRAMER_H
+
+#define SERIAL_FRAME_MAX            4096UL                  /* default largest frame that is assembled across chunks */
+#define SERIAL_FRAME_TRUNCATED      0x0001UL                /* frame was longer than the assembly buffer */
+#define SERIAL_FRAME_ERROR          0x0002UL                /* encoding error inside the frame */
+#define SERIAL_FRAME_CHECKSUM       0x0004UL                /* checksum at the end of the frame does not match */
+
+#define SLIP_END                    0xC0
+#define SLIP_ESC                    0xDB
+#define SLIP_ESC_END                0xDC
+#define SLIP_ESC_ESC                0xDD
+
+/* how FindByte() and FindEither() search, only the bench picks a slower one */
+typedef enum
+{
+    SERIAL_SCAN_FASTEST = 0,                                /* AVX2 where the build has it, else SSE2 */
+    SERIAL_SCAN_SSE2,                                       /* 16 bytes at a time */
+    SERIAL_SCAN_SCALAR                                      /* one byte at a time, the reference */
+} SERIAL_SCAN_METHOD;
+
+/* pFrame is only valid during the call, llTimestamp is the arrival time of the chunk the frame started in */
+typedef void ( CALLBACK *SERIAL_FRAME_CALLBACK )( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags );
+
+class CSerialFramer
+{
+    public:
+        CSerialFramer( DWORD nMaxFrame = SERIAL_FRAME_MAX );
+        virtual             ~CSerialFramer();
+
+        void                SetCallback( SERIAL_FRAME_CALLBACK pfnCallback, LPVOID pContext );
+        DWORD               GetErrorCount();
+        void                SetChecksum( SERIAL_CHECKSUM_TYPE Type, BOOL bStrip = TRUE );
+        void                SetScanMethod( SERIAL_SCAN_METHOD Method );
+
+        /* pData may be modified in place, it is the port's receive buffer */
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp ) = 0;
+        virtual void        Reset();
+
+        /* timers of framers that need one, called on the thread that feeds them */
+        virtual LONGLONG    GetDeadline();
+        virtual void        OnDeadline( LONGLONG llNow );
+
+        static const BYTE   *FindByte( const BYTE *pData, DWORD nSize, BYTE Value, SERIAL_SCAN_METHOD Method = SERIAL_SCAN_FASTEST );
+        static const BYTE   *FindEither( const BYTE *pData, DWORD nSize, BYTE Value1, BYTE Value2, SERIAL_SCAN_METHOD Method = SERIAL_SCAN_FASTEST );
+
+    protected:
+        SERIAL_FRAME_CALLBACK m_pfnCallback;
+        LPVOID              m_pContext;
+        BYTE                *m_pAssembly;
+        DWORD               m_nAssembly;
+        DWORD               m_nMaxFrame;
+        DWORD               m_dwFrameFlags;
+        LONGLONG            m_llFrameTime;
+        DWORD               m_nErrors;
+        SERIAL_CHECKSUM_TYPE m_ChecksumType;
+        BOOL                m_bStripChecksum;
+        SERIAL_SCAN_METHOD  m_ScanMethod;
+
+        void                Append( const BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        void                Emit( const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp );
+        void                EmitAssembly();
+};
+
+class CSerialDelimiterFramer : public CSerialFramer
+{
+    public:
+        CSerialDelimiterFramer( BYTE Delimiter = '\n', BOOL bKeepDelimiter = FALSE, DWORD nMaxFrame = SERIAL_FRAME_MAX );
+
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+
+    protected:
+        BYTE                m_Delimiter;
+        BOOL                m_bKeepDelimiter;
+};
+
+class CSerialLengthFramer : public CSerialFramer
+{
+    public:
+        /* frame size = nLengthOffset + nLengthSize + length field + nAdjust */
+        CSerialLengthFramer( DWORD nLengthOffset = 0,
+                             DWORD nLengthSize = 2,
+                             BOOL  bBigEndian = TRUE,
+                             LONG  nAdjust = 0,
+                             DWORD nMaxFrame = SERIAL_FRAME_MAX );
+
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        virtual void        Reset();
+
+    protected:
+        DWORD               m_nLengthOffset;
+        DWORD               m_nLengthSize;
+        BOOL                m_bBigEndian;
+        LONG                m_nAdjust;
+        DWORD               m_nFrameSize;
+
+        DWORD               GetFrameSize( const BYTE *pHeader );
+};
+
+class CSerialSlipFramer : public CSerialFramer
+{
+    public:
+        CSerialSlipFramer( DWORD nMaxFrame = SERIAL_FRAME_MAX );
+
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        virtual void        Reset();
+
+    protected:
+        BOOL                m_bEscape;
+
+        BYTE                Unescape( BYTE Value );
+};
+
+class CSerialCobsFramer : public CSerialFramer
+{
+    public:
+        CSerialCobsFramer( DWORD nMaxFrame = SERIAL_FRAME_MAX );
+
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+
+        static DWORD        Decode( BYTE *pData, DWORD nSize, BOOL *pbError );
+
+    protected:
+        void                EmitDecoded( BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp );
+};
+
+#endif SERIAL_FRAMER_H
@@ -0,0 +1,245 @@
+/*
+**  FILENAME            SerialPool.cpp
+**
+**  PURPOSE             Fixed pool of receive blocks handed out as reference counted chunks.
+**                      A chunk can be kept, sliced and passed to other threads without copying,
+**                      its block goes back to the pool when the last reference is dropped.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialQueue.h"
+#include "SerialPool.h"
+#include <assert.h>
+
+#define SERIAL_POOL_HEADER  ( ( sizeof( SERIAL_POOL_ARENA ) + SERIAL_CACHE_LINE - 1 ) & ~( SERIAL_CACHE_LINE - 1 ) )
+
+CSerialPool::CSerialPool()
+{
+    m_pArena = NULL;
+}
+
+CSerialPool::~CSerialPool()
+{
+    Destroy();
+}
+
+BOOL CSerialPool::Create( DWORD nBlocks, DWORD nBlockSize )
+{
+    DWORD i;
+    DWORD nStride = ( sizeof( SERIAL_BLOCK ) + nBlockSize + SERIAL_CACHE_LINE - 1 ) & ~( SERIAL_CACHE_LINE - 1 );
+    BYTE *pBlocks;
+    SERIAL_BLOCK *pBlock;
+    Destroy();
+
+    if ( ( nBlocks == 0 ) || ( nBlockSize == 0 ) )
+    {
+        return FALSE;
+    }
+
+    // one allocation up front, nothing is allocated while receiving
+    m_pArena = ( SERIAL_POOL_ARENA * )VirtualAlloc( NULL, SERIAL_POOL_HEADER + ( SIZE_T )nStride * nBlocks, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+
+    if ( m_pArena == NULL )
+    {
+        return FALSE;
+    }
+
+    InitializeSListHead( &m_pArena->FreeList );
+    m_pArena->nRefs = 1;
+    m_pArena->nExhausted = 0;
+    m_pArena->nBlocks = nBlocks;
+    m_pArena->nBlockSize = nBlockSize;
+    m_pArena->nStride = nStride;
+    pBlocks = ( BYTE * )m_pArena + SERIAL_POOL_HEADER;
+
+    for ( i = 0; i < nBlocks; i++ )
+    {
+        pBlock = ( SERIAL_BLOCK * )( pBlocks + ( SIZE_T )nStride * i );
+        pBlock->pArena = m_pArena;
+        pBlock->nRefs = 0;
+        InterlockedPushEntrySList( &m_pArena->FreeList, &pBlock->Entry );
+    }
+
+    return TRUE;
+}
+
+void CSerialPool::Destroy()
+{
+    if ( m_pArena == NULL )
+    {
+        return;
+    }
+
+    // chunks still held by consumers keep the arena alive, the last one frees it
+    ReleaseArena( m_pArena );
+    m_pArena = NULL;
+}
+
+SERIAL_BLOCK *CSerialPool::Alloc()
+{
+    SERIAL_BLOCK *pBlock;
+
+    if ( m_pArena == NULL )
+    {
+        return NULL;
+    }
+
+    pBlock = ( SERIAL_BLOCK * )InterlockedPopEntrySList( &m_pArena->FreeList );
+
+    if ( pBlock == NULL )
+    {
+        InterlockedIncrement( &m_pArena->nExhausted );
+        return NULL;
+    }
+
+    InterlockedIncrement( &m_pArena->nRefs );
+    pBlock->nRefs = 1;
+    pBlock->nSize = 0;
+    pBlock->llTimestamp = 0;
+    return pBlock;
+}
+
+DWORD CSerialPool::GetBlockSize()
+{
+    return ( m_pArena != NULL ) ? m_pArena->nBlockSize : 0;
+}
+
+DWORD CSerialPool::GetFreeCount()
+{
+    return ( m_pArena != NULL ) ? QueryDepthSList( &m_pArena->FreeList ) : 0;
+}
+
+DWORD CSerialPool::GetExhaustedCount()
+{
+    return ( m_pArena != NULL ) ? ( DWORD )m_pArena->nExhausted : 0;
+}
+
+void CSerialPool::AddRef( SERIAL_BLOCK *pBlock )
+{
+    assert( pBlock->nRefs > 0 );
+    InterlockedIncrement( &pBlock->nRefs );
+}
+
+void CSerialPool::Release( SERIAL_BLOCK *pBlock )
+{
+    SERIAL_POOL_ARENA *pArena = pBlock->pArena;
+
+    if ( InterlockedDecrement( &pBlock->nRefs ) == 0 )
+    {
+        InterlockedPushEntrySList( &pArena->FreeList, &pBlock->Entry );
+        ReleaseArena( pArena );
+    }
+}
+
+BYTE *CSerialPool::GetData( SERIAL_BLOCK *pBlock )
+{
+    return ( BYTE * )( pBlock + 1 );
+}
+
+void CSerialPool::ReleaseArena( SERIAL_POOL_ARENA *pArena )
+{
+    if ( InterlockedDecrement( &pArena->nRefs ) == 0 )
+    {
+        VirtualFree( pArena, 0, MEM_RELEASE );
+    }
+}
+
+CSerialChunk::CSerialChunk()
+{
+    m_pBlock = NULL;
+    m_nOffset = 0;
+    m_nSize = 0;
+}
+
+CSerialChunk::CSerialChunk( SERIAL_BLOCK *pBlock, DWORD nOffset, DWORD nSize )
+{
+    assert( ( pBlock != NULL ) && ( nOffset + nSize <= pBlock->nSize ) );
+    CSerialPool::AddRef( pBlock );
+    m_pBlock = pBlock;
+    m_nOffset = nOffset;
+    m_nSize = nSize;
+}
+
+CSerialChunk::CSerialChunk( const CSerialChunk &Chunk )
+{
+    if ( Chunk.m_pBlock != NULL )
+    {
+        CSerialPool::AddRef( Chunk.m_pBlock );
+    }
+
+    m_pBlock = Chunk.m_pBlock;
+    m_nOffset = Chunk.m_nOffset;
+    m_nSize = Chunk.m_nSize;
+}
+
+CSerialChunk::~CSerialChunk()
+{
+    Reset();
+}
+
+CSerialChunk &CSerialChunk::operator=( const CSerialChunk &Chunk )
+{
+    // reference first, the chunk may share the block or be this one
+    if ( Chunk.m_pBlock != NULL )
+    {
+        CSerialPool::AddRef( Chunk.m_pBlock );
+    }
+
+    Reset();
+    m_pBlock = Chunk.m_pBlock;
+    m_nOffset = Chunk.m_nOffset;
+    m_nSize = Chunk.m_nSize;
+    return *this;
+}
+
+const BYTE *CSerialChunk::GetData() const
+{
+    return ( m_pBlock != NULL ) ? CSerialPool::GetData( m_pBlock ) + m_nOffset : NULL;
+}
+
+SERIAL_BLOCK *CSerialChunk::GetBlock() const                   // for a reference of your own, CSerialPool::AddRef()
+{
+    return m_pBlock;
+}
+
+DWORD CSerialChunk::GetSize() const
+{
+    return m_nSize;
+}
+
+LONGLONG CSerialChunk::GetTimestamp() const
+{
+    return ( m_pBlock != NULL ) ? m_pBlock->llTimestamp : 0;
+}
+
+BOOL CSerialChunk::IsEmpty() const
+{
+    return m_nSize == 0;
+}
+
+CSerialChunk CSerialChunk::Slice( DWORD nOffset, DWORD nSize ) const
+{
+    if ( ( m_pBlock == NULL ) || ( nOffset >= m_nSize ) )
+    {
+        return CSerialChunk();
+    }
+
+    return CSerialChunk( m_pBlock, m_nOffset + nOffset, min( nSize, m_nSize - nOffset ) );
+}
+
+void CSerialChunk::Reset()
+{
+    if ( m_pBlock != NULL )
+    {
+        CSerialPool::Release( m_pBlock );
+        m_pBlock = NULL;
+    }
+
+    m_nOffset = 0;
+    m_nSize = 0;
+}
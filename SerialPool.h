@@ -0,0 +1,88 @@
+/*
+**  FILENAME            SerialPool.h
+**
+**  PURPOSE             Fixed pool of receive blocks handed out as reference counted chunks.
+**                      A chunk can be kept, sliced, passed to other threads and written out
+**                      again without copying, its block goes back to the pool when the last
+**                      reference is dropped.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_POOL_H
+#define SERIAL_POOL_H
+
+typedef struct
+{
+    SLIST_HEADER        FreeList;                           /* blocks not referenced by anyone */
+    volatile LONG       nRefs;                              /* owner plus one per block in use */
+    volatile LONG       nExhausted;                         /* Alloc() calls that found no free block */
+    DWORD               nBlocks;
+    DWORD               nBlockSize;                         /* payload bytes per block */
+    DWORD               nStride;                            /* header and payload, multiple of a cache line */
+} SERIAL_POOL_ARENA;
+
+typedef struct
+{
+    SLIST_ENTRY         Entry;                              /* free list link, must stay first */
+    SERIAL_POOL_ARENA   *pArena;
+    volatile LONG       nRefs;
+    DWORD               nSize;                              /* bytes received into the block */
+    LONGLONG            llTimestamp;                        /* arrival of the first byte, microseconds */
+} SERIAL_BLOCK;
+
+class CSerialPool
+{
+    public:
+        CSerialPool();
+        virtual             ~CSerialPool();
+
+        BOOL                Create( DWORD nBlocks, DWORD nBlockSize );
+        void                Destroy();
+
+        SERIAL_BLOCK        *Alloc();
+        DWORD               GetBlockSize();
+        DWORD               GetFreeCount();
+        DWORD               GetExhaustedCount();
+
+        static void         AddRef( SERIAL_BLOCK *pBlock );
+        static void         Release( SERIAL_BLOCK *pBlock );
+        static BYTE         *GetData( SERIAL_BLOCK *pBlock );
+
+    protected:
+        SERIAL_POOL_ARENA   *m_pArena;
+
+        static void         ReleaseArena( SERIAL_POOL_ARENA *pArena );
+};
+
+class CSerialChunk
+{
+    public:
+        CSerialChunk();
+        CSerialChunk( SERIAL_BLOCK *pBlock, DWORD nOffset, DWORD nSize );
+        CSerialChunk( const CSerialChunk &Chunk );
+        ~CSerialChunk();
+
+        CSerialChunk        &operator=( const CSerialChunk &Chunk );
+
+        const BYTE          *GetData() const;
+        SERIAL_BLOCK        *GetBlock() const;
+        DWORD               GetSize() const;
+        LONGLONG            GetTimestamp() const;
+        BOOL                IsEmpty() const;
+        CSerialChunk        Slice( DWORD nOffset, DWORD nSize ) const;
+        void                Reset();
+
+    protected:
+        SERIAL_BLOCK        *m_pBlock;
+        DWORD               m_nOffset;
+        DWORD               m_nSize;
+};
+
+/* copy the chunk to keep the data after the call, the copy only takes a reference */
+typedef void ( CALLBACK *SERIAL_CHUNK_CALLBACK )( LPVOID pContext, const CSerialChunk &Chunk );
+
+#endif SERIAL_POOL_H
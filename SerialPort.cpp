@@ -7,7 +7,7 @@
 **                      program is not blocked.
 **
 **  CREATION DATE       15-09-1997
-**  LAST MODIFICATION   18-03-2018
+**  LAST MODIFICATION   16-10-2026
 **
 **  AUTHOR              Remon Spekreijse
 */
@@ -23,16 +23,104 @@ CSerialPort::CSerialPort()
     m_hComm = INVALID_HANDLE_VALUE;
     m_szWriteBuffer = NULL;
     m_bThreadAlive = FALSE;
-    m_bUserRequestClose = FALSE;
-    m_nWriteSize = 0;
     m_Thread = NULL;
+    m_dwThreadId = 0;
+    m_pOwner = NULL;
+    m_RxMode = SERIAL_RX_BYTE;
+    m_nRxChunkSize = SERIAL_RX_CHUNK_SIZE;
+    m_dwRxCoalesceTime = 0;
+    m_pfnRxCallback = NULL;
+    m_pRxContext = NULL;
+    m_pFramer = NULL;
+    m_nRxPoolBlocks = 0;
+    m_bEventChar = FALSE;
+    m_EventChar = '\n';
+    m_pfnChunkCallback = NULL;
+    m_pRxBlock = NULL;
+    m_bRxStarved = FALSE;
+    m_llRxStarveTime = 0;
+    m_pRxChunk = NULL;
+    m_nRxChunkFill = 0;
+    m_llRxChunkTime = 0;
+    m_pRxRing = NULL;
+    m_nRxRingSize = SERIAL_RX_RING_SIZE;
+    m_nRxHead = 0;
+    m_nRxTail = 0;
+    m_pCapture = NULL;
+    m_pReplay = NULL;
+    m_dReplaySpeed = 1.0;
+    m_bReplaying = FALSE;
+    m_pBroadcast = NULL;
+    m_pEventRing = NULL;
+    m_nEventRate = SERIAL_EVENT_RATE;
+    m_bReconnecting = FALSE;
+    memset( &m_Reconnect, 0, sizeof( m_Reconnect ) );
+    m_TxChecksum = SERIAL_CHECKSUM_NONE;
+    m_BusyPoll.dwSpinTime = 0;
+    m_BusyPoll.nCore = -1;
+    m_BusyPoll.nPriority = THREAD_PRIORITY_NORMAL;
+    memset( &m_FlowControl, 0, sizeof( m_FlowControl ) );
+    m_nRxHighWater = 0;
+    m_nRxLowWater = 0;
+    m_bRxFlowOff = FALSE;
+    m_bRxHeld = FALSE;
+    m_bTxHeld = FALSE;
+    m_nRxDriverQueue = 0;
+    memset( ( void * )m_llEventWindow, 0, sizeof( m_llEventWindow ) );
+    memset( ( void * )m_nEventCount, 0, sizeof( m_nEventCount ) );
+    memset( ( void * )m_nEventSuppressed, 0, sizeof( m_nEventSuppressed ) );
+    m_nTxSignaled = FALSE;
+    m_dwEventMask = 0;
+    m_llWakeTime = 0;
+    m_pReactor = NULL;
+    m_nReactorShard = 0;
+    m_nReactorSlot = SERIAL_PORT_MAX;
+    m_llReactorDeadline = MAXLONGLONG;
+    m_hReactorPort = NULL;
+    m_bEventPending = FALSE;
+    m_bTxPending = FALSE;
+    m_bClosing = FALSE;
+    m_bWritePending = FALSE;
+    m_nWriteEnd = 0;
+    m_nWriteClass = 0;
+    m_nWritePartial = 0;
+    m_nTxPending = 0;
+    m_bTxBlocked = FALSE;
+    m_nTxRound = 0;
+    m_bTxDraining = FALSE;
+    m_llTxReady = 0;
+    m_llTxDeadline = MAXLONGLONG;
+    m_llTxTokens = 0;
+    m_llTxRefill = 0;
+    memset( &m_TxSchedule, 0, sizeof( m_TxSchedule ) );
+    memset( m_nTxOffset, 0, sizeof( m_nTxOffset ) );
+    memset( m_llTxDeficit, 0, sizeof( m_llTxDeficit ) );
+    memset( &m_ovSignal, 0, sizeof( m_ovSignal ) );
+    memset( &m_WakeLatency, 0, sizeof( m_WakeLatency ) );
+    memset( &m_Stats, 0, sizeof( m_Stats ) );
+    memset( &m_StatsBase, 0, sizeof( m_StatsBase ) );
+    memset( &m_ovEvent, 0, sizeof( m_ovEvent ) );
+    memset( &m_ovRead, 0, sizeof( m_ovRead ) );
+    memset( &m_ovWrite, 0, sizeof( m_ovWrite ) );
+    m_hCloseEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+    m_hTxEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    m_ovEvent.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+    m_ovRead.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+    m_ovWrite.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
     InitializeCriticalSection( &m_csCommunicationSync );
+    InitializeCriticalSection( &m_csStats );
 }
 
 CSerialPort::~CSerialPort()
 {
     Close();
+    CloseHandle( m_hCloseEvent );
+    CloseHandle( m_hTxEvent );
+    CloseHandle( m_ovEvent.hEvent );
+    CloseHandle( m_ovRead.hEvent );
+    CloseHandle( m_ovWrite.hEvent );
     DeleteCriticalSection( &m_csCommunicationSync );
+    DeleteCriticalSection( &m_csStats );
 }
 
 BOOL CSerialPort::Open( HWND    pPortOwner,      // the owner (CWnd) of the port (receives message)
@@ -51,15 +139,27 @@ BOOL CSerialPort::Open( HWND    pPortOwner,      // the owner (CWnd) of the port
 
 {
     BOOL ret = TRUE;
-    char szPort[MAX_PATH];
+    DWORD dwError;
+    DWORD nRecord;
+    UINT i;
     Close();
     EnterCriticalSection( &m_csCommunicationSync );
     assert( port <= SERIAL_PORT_MAX );
-    assert( pPortOwner != NULL );
+    assert( ( pPortOwner != NULL ) || ( m_pfnRxCallback != NULL ) || ( m_pFramer != NULL ) || ( m_pfnChunkCallback != NULL ) );
     // save the owner
     m_pOwner = pPortOwner;
     // Allocate memory
     m_szWriteBuffer = new char[nBufferSize];
+    m_pRxChunk = NULL;
+    m_nRxChunkFill = 0;
+    m_bRxStarved = FALSE;
+    m_bRxHeld = FALSE;
+    m_nRxDriverQueue = 0;
+
+    if ( m_pFramer != NULL )
+    {
+        m_pFramer->Reset();
+    }
 
     if ( m_szWriteBuffer == NULL )
     {
@@ -67,24 +167,66 @@ BOOL CSerialPort::Open( HWND    pPortOwner,      // the owner (CWnd) of the port
         goto done;
     }
 
+    // twice the largest record, so a legacy Write() of nBufferSize bytes with its header,
+    // completion and checksum trailer always fits
+    nRecord = ( sizeof( SERIAL_RECORD ) + sizeof( SERIAL_TX_COMPLETION ) + SERIAL_CHECKSUM_MAX + nBufferSize + SERIAL_RECORD_ALIGN - 1 ) &
+              ~( SERIAL_RECORD_ALIGN - 1 );
+
+    for ( i = 0; i < SERIAL_TX_PRIORITIES; i++ )
+    {
+        if ( !m_TxQueue[i].Create( nRecord * 2 ) )
+        {
+            ret = FALSE;
+            goto done;
+        }
+    }
+
+    // with a pool every chunk is read straight into a block of its own
+    if ( m_nRxPoolBlocks > 0 )
+    {
+        ret = m_RxPool.Create( m_nRxPoolBlocks, m_nRxChunkSize );
+    }
+    else
+    {
+        m_pRxChunk = new BYTE[m_nRxChunkSize];
+        ret = ( m_pRxChunk != NULL );
+    }
+
+    if ( !ret )
+    {
+        goto done;
+    }
+
+    // the ring only backs Read(), a callback or framer gets the chunks directly
+    if ( ( m_RxMode == SERIAL_RX_CHUNK ) && ( m_pfnRxCallback == NULL ) && ( m_pFramer == NULL ) && ( m_pfnChunkCallback == NULL ) )
+    {
+        m_pRxRing = new BYTE[m_nRxRingSize];
+        m_nRxHead = 0;
+        m_nRxTail = 0;
+
+        if ( m_pRxRing == NULL )
+        {
+            ret = FALSE;
+            goto done;
+        }
+    }
+
     m_nPortNr = port;
     m_nWriteBufferSize = nBufferSize;
     m_dwCommEvents = dwCommEvents | (EV_RXCHAR | EV_TXEMPTY);
-    // prepare port strings
-    sprintf( szPort, _T( "\\\\.\\%s%d" ), SERIAL_DEVICE_PREFIX, (signed int)port );
-    // get a handle to the port
-    m_hComm = CreateFile( szPort,                       // communication port string (COMX)
-                          GENERIC_READ | GENERIC_WRITE, // read/write types
-                          0,                            // comm devices must be opened with exclusive access
-                          NULL,                         // no security attributes
-                          OPEN_EXISTING,                // comm devices must use OPEN_EXISTING
-                          FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH,
-                          0 );                          // template must be 0 for comm devices
 
-    if ( m_hComm == INVALID_HANDLE_VALUE )
+    if ( m_pReplay != NULL )
     {
-        ret = FALSE;
-        goto done;
+        // the capture stands in for the device, nothing is opened or configured
+        if ( !m_pReplay->IsOpen() )
+        {
+            ret = FALSE;
+            goto done;
+        }
+
+        m_pReplay->Rewind();
+        m_bReplaying = TRUE;
+        goto ready;
     }
 
     // set the timeout values
@@ -93,13 +235,133 @@ BOOL CSerialPort::Open( HWND    pPortOwner,      // the owner (CWnd) of the port
     m_CommTimeouts.ReadTotalTimeoutConstant = ReadTotalTimeoutConstant;
     m_CommTimeouts.WriteTotalTimeoutMultiplier = WriteTotalTimeoutMultiplier;
     m_CommTimeouts.WriteTotalTimeoutConstant   = WriteTotalTimeoutConstant;
+    SetRxWatermarks();
+
+    if ( !OpenDevice( baud, parity, databits, stopbits ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+ready:
+    m_bThreadAlive = TRUE;
+    m_bClosing = FALSE;
+    m_bEventPending = FALSE;
+    m_bTxPending = FALSE;
+    m_bWritePending = FALSE;
+    m_nTxPending = 0;
+    m_bTxBlocked = FALSE;
+    m_nWritePartial = 0;
+    m_nTxRound = 0;
+    m_bTxDraining = FALSE;
+    m_llTxReady = 0;
+    m_llTxDeadline = MAXLONGLONG;
+    m_llTxRefill = GetTimestamp();
+    m_llTxTokens = ( LONGLONG )m_TxSchedule.nBurst * 1000000;
+    memset( m_nTxOffset, 0, sizeof( m_nTxOffset ) );
+    memset( m_llTxDeficit, 0, sizeof( m_llTxDeficit ) );
+    m_nTxSignaled = FALSE;
+    ResetEvent( m_hCloseEvent );
+    memset( &m_WakeLatency, 0, sizeof( m_WakeLatency ) );
+    memset( &m_Stats, 0, sizeof( m_Stats ) );
+    memset( &m_StatsBase, 0, sizeof( m_StatsBase ) );
+
+    if ( ( m_pReactor != NULL ) && !m_bReplaying )
+    {
+        // reads complete in place, comm events, writes and signals go to the shard
+        m_ovRead.hEvent = ( HANDLE )( ( DWORD_PTR )m_ovRead.hEvent | 1 );
+
+        if ( !m_pReactor->Attach( this ) )
+        {
+            ReportError( SERIAL_STEP_ATTACH );
+            ret = FALSE;
+            m_bThreadAlive = FALSE;
+        }
+
+        goto done;
+    }
+
+    assert( m_Thread == NULL );
+    m_Thread = ::CreateThread(NULL, 0, m_bReplaying ? ReplayThread : CommThread, this, CREATE_SUSPENDED, &m_dwThreadId);
+
+    if (m_Thread == NULL)
+    {
+        ReportError( SERIAL_STEP_CREATETHREAD );
+        ret = FALSE;
+        m_bThreadAlive = FALSE;
+        goto done;
+    }
+
+    // a core or priority the system refuses is reported, the port still runs without it
+    if ( ( m_BusyPoll.nCore >= 0 ) && ( SetThreadAffinityMask( m_Thread, ( DWORD_PTR )1 << m_BusyPoll.nCore ) == 0 ) )
+    {
+        ReportError( SERIAL_STEP_SETTHREADAFFINITYMASK );
+    }
+
+    if ( ( m_BusyPoll.nPriority != THREAD_PRIORITY_NORMAL ) && !SetThreadPriority( m_Thread, m_BusyPoll.nPriority ) )
+    {
+        ReportError( SERIAL_STEP_SETTHREADPRIORITY );
+    }
+
+    ResumeThread( m_Thread );
+
+done:
+    LeaveCriticalSection( &m_csCommunicationSync );
+
+    if ( !ret )
+    {
+        // the caller, OpenMany() in particular, gets the error of the step that failed
+        dwError = GetLastError();
+        Close();
+        SetLastError( dwError );
+    }
+
+    return ret;
+}
+
+BOOL CSerialPort::OpenDevice( UINT baud,        // baudrate, 0 applies m_dcb as it is
+                              BYTE parity,      // parity
+                              BYTE databits,    // databits
+                              BYTE stopbits )   // stopbits
+{
+    char szPort[MAX_PATH];
+    SERIAL_STEP Step;
+    DWORD dwError;
+    // prepare port strings
+    sprintf( szPort, _T( "\\\\.\\%s%d" ), SERIAL_DEVICE_PREFIX, (signed int)m_nPortNr );
+    // get a handle to the port, a virtual pair that claimed the number comes first
+    if ( ( m_hComm = CSerialVirtual::CreateFile( m_nPortNr ) ) == NULL )
+    {
+        m_hComm = CreateFile( szPort,                       // communication port string (COMX)
+                              GENERIC_READ | GENERIC_WRITE, // read/write types
+                              0,                            // comm devices must be opened with exclusive access
+                              NULL,                         // no security attributes
+                              OPEN_EXISTING,                // comm devices must use OPEN_EXISTING
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_OVERLAPPED,
+                              0 );                          // template must be 0 for comm devices
+    }
+
+    if ( m_hComm == INVALID_HANDLE_VALUE )
+    {
+        Step = SERIAL_STEP_CREATEFILE;
+        goto failed;
+    }
 
     // configure
-    if ( SetCommTimeouts( m_hComm, &m_CommTimeouts ) )
+    if ( ApplyTimeouts() )
     {
-        if ( SetCommMask( m_hComm, dwCommEvents ) )
+        if ( CSerialVirtual::SetCommMask( m_hComm, GetCommMask() ) )
         {
-            if ( GetCommState( m_hComm, &m_dcb ) )
+            if ( baud == 0 )
+            {
+                // a reconnect brings back the settings the port had, SetDCB() included
+                if ( CSerialVirtual::SetCommState( m_hComm, &m_dcb ) == 0 )
+                {
+                    Step = SERIAL_STEP_SETCOMMSTATE;
+                    goto failed;
+                }
+            }
+            else if ( CSerialVirtual::GetCommState( m_hComm, &m_dcb ) )
             {
                 m_dcb.BaudRate = baud;
                 m_dcb.Parity   = parity;
@@ -117,206 +379,2451 @@ BOOL CSerialPort::Open( HWND    pPortOwner,      // the owner (CWnd) of the port
                 m_dcb.fErrorChar = FALSE;
                 m_dcb.fNull = FALSE;
                 m_dcb.fAbortOnError = FALSE;
+                m_dcb.EvtChar = m_bEventChar ? m_EventChar : '\0';
+                SetFlowDcb( &m_dcb );
+
+                if ( CSerialVirtual::SetCommState( m_hComm, &m_dcb ) == 0 )
+                {
+                    Step = SERIAL_STEP_SETCOMMSTATE;
+                    goto failed;
+                }
+            }
+            else
+            {
+                Step = SERIAL_STEP_GETCOMMSTATE;
+                goto failed;
+            }
+        }
+        else
+        {
+            Step = SERIAL_STEP_SETCOMMMASK;
+            goto failed;
+        }
+    }
+    else
+    {
+        Step = SERIAL_STEP_SETCOMMTIMEOUTS;
+        goto failed;
+    }
+
+    // set the SetupComm parameter into device control.
+    if ( !CSerialVirtual::SetupComm( m_hComm, m_nWriteBufferSize, m_nWriteBufferSize ) )
+    {
+        Step = SERIAL_STEP_SETUPCOMM;
+        goto failed;
+    }
+
+    // flush the port
+    if ( !CSerialVirtual::PurgeComm( m_hComm, PURGE_RXCLEAR | PURGE_TXCLEAR | PURGE_RXABORT | PURGE_TXABORT ) )
+    {
+        Step = SERIAL_STEP_PURGECOMM;
+        goto failed;
+    }
+
+    // SetCommState() raised RTS and DTR, a reconnect starts with the peer let go
+    m_bRxFlowOff = FALSE;
+    m_bTxHeld = FALSE;
+    return TRUE;
+
+failed:
+    ReportError( Step );
+    dwError = GetLastError();
+
+    if ( m_hComm != INVALID_HANDLE_VALUE )
+    {
+        CSerialVirtual::CloseHandle( m_hComm );
+        m_hComm = INVALID_HANDLE_VALUE;
+    }
+
+    SetLastError( dwError );
+    return FALSE;
+}
+
+DWORD WINAPI CSerialPort::CommThread( LPVOID pParam )
+{
+    CSerialPort *pPort = ( CSerialPort * )pParam;
+    HANDLE      hEvents[4];
+    DWORD       dwWait;
+    DWORD       dwDummy;
+    hEvents[0] = pPort->m_hCloseEvent;
+    hEvents[1] = pPort->m_hTxEvent;
+    hEvents[2] = pPort->m_ovEvent.hEvent;
+    hEvents[3] = pPort->m_ovWrite.hEvent;
+
+    // sleep until the driver reports a line event, a write is queued or completes, or Close() is called;
+    // a write stays in flight while the thread keeps servicing the receive side
+    for ( ;; )
+    {
+        if ( pPort->WaitEvent() )
+        {
+            while ( pPort->m_bThreadAlive )
+            {
+                pPort->Spin();
+                dwWait = WaitForMultipleObjects( pPort->m_bWritePending ? 4 : 3, hEvents, FALSE, pPort->GetWaitTimeout() );
+                pPort->m_llWakeTime = GetTimestamp();
+                CSerialStats::Add( &pPort->m_Stats.llWakeups );
+
+                if ( dwWait == WAIT_OBJECT_0 + 1 )
+                {
+                    if ( !pPort->OnTransmit() )
+                    {
+                        break;
+                    }
+                }
+                else if ( dwWait == WAIT_OBJECT_0 + 2 )
+                {
+                    if ( !pPort->OnEvent() || !pPort->WaitEvent() )
+                    {
+                        break;
+                    }
+                }
+                else if ( dwWait == WAIT_TIMEOUT )
+                {
+                    // coalescing window of a partly filled chunk ran out, the pool may have a block again
+                    // or a paced write may go now
+                    if ( !pPort->OnDeadline() )
+                    {
+                        break;
+                    }
+                }
+                else if ( dwWait != WAIT_OBJECT_0 + 3 )
+                {
+                    break;
+                }
+
+                // a busy receive side keeps the lower handles signaled, so look at the write on every pass
+                if ( pPort->m_bWritePending && HasOverlappedIoCompleted( &pPort->m_ovWrite ) && !pPort->OnWriteComplete() )
+                {
+                    break;
+                }
+            }
+
+            CSerialVirtual::CancelIo( pPort->m_hComm );
+            CSerialVirtual::GetOverlappedResult( pPort->m_hComm, &pPort->m_ovEvent, &dwDummy, TRUE );
+
+            if ( pPort->m_bWritePending )
+            {
+                // the batch counts as failed, a reconnect goes on with the records behind it
+                CSerialVirtual::GetOverlappedResult( pPort->m_hComm, &pPort->m_ovWrite, &dwDummy, TRUE );
+                pPort->m_bWritePending = FALSE;
+                pPort->RetireBatch( 0, TRUE );
+                pPort->CompleteTx( FALSE );
+            }
+        }
+
+        // the loop ended on an error unless Close() asked for it
+        if ( WaitForSingleObject( pPort->m_hCloseEvent, 0 ) == WAIT_OBJECT_0 )
+        {
+            break;
+        }
+
+        if ( !pPort->Reconnect() )
+        {
+            // nothing sends any more, the writers waiting for their records learn it now instead of at Close()
+            pPort->m_bThreadAlive = FALSE;
+            pPort->FailTx();
+            break;
+        }
+    }
+
+    pPort->m_bThreadAlive = FALSE;
+    ::ExitThread(0);
+    //return 0;
+}
+
+BOOL CSerialPort::Reconnect()   // comm thread, after the loop stopped on an error; FALSE ends the thread
+{
+    DWORD dwDelay = m_Reconnect.dwInitialDelay;
+    UINT  nAttempt;
+    BOOL  bOpened;
+    PostEvent( SERIAL_EVENT_DISCONNECTED, ERROR_SUCCESS, 0 );
+
+    if ( dwDelay == 0 )
+    {
+        return FALSE;
+    }
+
+    // IsOpen() stays TRUE and writes keep queueing while the device is gone, until Close()
+    EnterCriticalSection( &m_csCommunicationSync );
+    m_bReconnecting = TRUE;
+    CSerialVirtual::CloseHandle( m_hComm );
+    m_hComm = INVALID_HANDLE_VALUE;
+    LeaveCriticalSection( &m_csCommunicationSync );
+
+    // a partial frame does not continue on the new handle
+    if ( m_pFramer != NULL )
+    {
+        m_pFramer->Reset();
+    }
+
+    for ( nAttempt = 1; ( m_Reconnect.nMaxAttempts == 0 ) || ( nAttempt <= m_Reconnect.nMaxAttempts ); nAttempt++ )
+    {
+        PostEvent( SERIAL_EVENT_RECONNECTING, ERROR_SUCCESS, nAttempt );
+
+        if ( WaitForSingleObject( m_hCloseEvent, dwDelay ) == WAIT_OBJECT_0 )
+        {
+            return FALSE;
+        }
+
+        EnterCriticalSection( &m_csCommunicationSync );
+        bOpened = OpenDevice( 0, 0, 0, 0 );
+        LeaveCriticalSection( &m_csCommunicationSync );
+
+        if ( bOpened )
+        {
+            m_bReconnecting = FALSE;
+            m_bThreadAlive = TRUE;
+            PostEvent( SERIAL_EVENT_RECONNECTED, ERROR_SUCCESS, nAttempt );
+            // writes queued in the meantime go out now
+            SignalTx();
+            return TRUE;
+        }
+
+        dwDelay = ( dwDelay > m_Reconnect.dwMaxDelay / 2 ) ? m_Reconnect.dwMaxDelay : dwDelay * 2;
+    }
+
+    return FALSE;
+}
+
+DWORD WINAPI CSerialPort::ReplayThread( LPVOID pParam )
+{
+    CSerialPort *pPort = ( CSerialPort * )pParam;
+    CSerialReplay *pReplay = pPort->m_pReplay;
+    const SERIAL_CAPTURE_RECORD *pRecord;
+    const BYTE  *pData = NULL;
+    HANDLE      hEvents[2];
+    LONGLONG    llStart = GetTimestamp();
+    LONGLONG    llBase = 0;
+    LONGLONG    llDue = MAXLONGLONG;
+    LONGLONG    llNext;
+    LONGLONG    llNow;
+    DWORD       dwTimeout;
+    DWORD       dwWait;
+    UINT        nBurst = 0;
+    hEvents[0] = pPort->m_hCloseEvent;
+    hEvents[1] = pPort->m_hTxEvent;
+
+    // the recorded gaps are scaled by the speed and measured from the first record
+    if ( ( pRecord = pReplay->Next( &pData ) ) != NULL )
+    {
+        llBase = pRecord->llTimestamp;
+    }
+
+    while ( pPort->m_bThreadAlive )
+    {
+        llNow = GetTimestamp();
+
+        if ( pRecord != NULL )
+        {
+            llDue = ( pPort->m_dReplaySpeed > 0 ) ? llStart + ( LONGLONG )( ( pRecord->llTimestamp - llBase ) / pPort->m_dReplaySpeed ) : llNow;
+        }
+
+        llNext = min( llDue, pPort->GetDeadline() );
+
+        // sleep in milliseconds while the next record is far off, poll the last stretch;
+        // records that are already due only look at close and writes every so often
+        if ( llNext == MAXLONGLONG )
+        {
+            dwTimeout = INFINITE;
+        }
+        else
+        {
+            dwTimeout = ( llNext - llNow > ( LONGLONG )SERIAL_REPLAY_SPIN ) ? ( DWORD )( ( llNext - llNow - ( LONGLONG )SERIAL_REPLAY_SPIN / 2 ) / 1000 ) : 0;
+        }
+
+        if ( ( llNext > llNow ) || ( ++nBurst % SERIAL_REPLAY_POLL == 0 ) )
+        {
+            dwWait = WaitForMultipleObjects( 2, hEvents, FALSE, dwTimeout );
+
+            if ( dwWait == WAIT_OBJECT_0 + 1 )
+            {
+                // nothing goes out during a replay, the writes complete as if sent
+                InterlockedExchange( &pPort->m_nTxSignaled, FALSE );
+                pPort->DiscardTx();
+            }
+            else if ( dwWait != WAIT_TIMEOUT )
+            {
+                break;
+            }
+
+            llNow = GetTimestamp();
+        }
+
+        if ( ( pPort->GetDeadline() <= llNow ) && !pPort->OnDeadline() )
+        {
+            break;
+        }
+
+        if ( ( pRecord == NULL ) || ( llDue > llNow ) )
+        {
+            continue;
+        }
+
+        if ( pRecord->Direction == SERIAL_CAPTURE_RX )
+        {
+            if ( !pPort->ReplayRx( pData, pRecord->nSize ) )
+            {
+                break;
+            }
+        }
+        else if ( pRecord->Direction == SERIAL_CAPTURE_EVENT )
+        {
+            if ( pPort->m_pCapture != NULL )
+            {
+                pPort->m_pCapture->Append( SERIAL_CAPTURE_EVENT, pRecord->wEvents, NULL, 0, llNow );
+            }
+
+            pPort->NotifyEvents( pRecord->wEvents & pPort->m_dwCommEvents & ~( EV_RXCHAR | EV_TXEMPTY ) );
+        }
+
+        if ( ( pRecord = pReplay->Next( &pData ) ) == NULL )
+        {
+            // a coalescing chunk goes out now, the port stays open for writes until Close()
+            llDue = MAXLONGLONG;
+            pPort->DeliverRx();
+            pReplay->m_bFinished = TRUE;
+            pPort->Notify( ( WPARAM )SERIAL_EV_REPLAYDONE, 0 );
+        }
+    }
+
+    pPort->m_bThreadAlive = FALSE;
+    ::ExitThread(0);
+    //return 0;
+}
+
+BOOL CSerialPort::ReplayRx( const BYTE *pData, DWORD nSize )
+{
+    DWORD nCopy;
+    LONGLONG llNow = GetTimestamp();
+    m_llWakeTime = llNow;
+
+    // one recorded read goes through the chunk the way ReceiveChar() fills it,
+    // the consumers see replay time rather than the recorded timestamps
+    while ( nSize > 0 )
+    {
+        if ( ( m_pRxChunk == NULL ) && !AllocRxBlock() )
+        {
+            // no driver queue to hold the bytes back, so the replay waits for a block
+            if ( WaitForSingleObject( m_hCloseEvent, SERIAL_RX_STARVED_RETRY ) == WAIT_OBJECT_0 )
+            {
+                return FALSE;
+            }
+
+            llNow = GetTimestamp();
+            continue;
+        }
+
+        nCopy = min( m_nRxChunkSize - m_nRxChunkFill, nSize );
+        memcpy( m_pRxChunk + m_nRxChunkFill, pData, nCopy );
+        CSerialStats::Add( &m_Stats.llReadCalls );
+        CSerialStats::Add( &m_Stats.llRxBytes, nCopy );
+
+        if ( m_pCapture != NULL )
+        {
+            m_pCapture->Append( SERIAL_CAPTURE_RX, 0, pData, nCopy, llNow );
+        }
+
+        if ( m_nRxChunkFill == 0 )
+        {
+            m_llRxChunkTime = llNow;
+        }
+
+        m_nRxChunkFill += nCopy;
+        pData += nCopy;
+        nSize -= nCopy;
+
+        if ( IsRxDue( llNow ) )
+        {
+            DeliverRx();
+        }
+    }
+
+    return TRUE;
+}
+
+void CSerialPort::DiscardTx()
+{
+    SERIAL_TX_COMPLETION Completion;
+    SERIAL_RECORD *pRecord;
+    CSerialQueue *pQueue;
+    const BYTE *pData;
+    BOOL  bBorrowed;
+    DWORD nPrefix;
+    DWORD nOffset;
+    DWORD nSize;
+    DWORD nPos;
+    LONGLONG llNow = GetTimestamp();
+    UINT i;
+
+    for ( i = 0; i < SERIAL_TX_PRIORITIES; i++ )
+    {
+        pQueue = &m_TxQueue[i];
+        nPos = pQueue->GetTail();
+
+        while ( ( pRecord = pQueue->Peek( &nPos ) ) != NULL )
+        {
+            nPrefix = ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+
+            // without a device a command has nothing to change and completes like a write
+            if ( pRecord->dwType == SERIAL_RECORD_DATA )
+            {
+                CSerialStats::Record( &m_Stats.TxLatency, llNow - pRecord->llTimestamp );
+                CSerialStats::Add( &m_Stats.llTxBytes, GetTxSize( pRecord ) );
+            }
+
+            if ( ( m_pCapture != NULL ) && ( pRecord->dwType == SERIAL_RECORD_DATA ) )
+            {
+                for ( nOffset = 0; nOffset < GetTxSize( pRecord ); nOffset += nSize )
+                {
+                    pData = GetTxData( pRecord, nOffset, &nSize, &bBorrowed );
+                    m_pCapture->Append( SERIAL_CAPTURE_TX, 0, pData, nSize, llNow );
+                }
+            }
+
+            if ( nPrefix > 0 )
+            {
+                memcpy( &Completion, CSerialQueue::GetPayload( pRecord ), sizeof( Completion ) );
+            }
+
+            ReleaseTxRecord( pRecord );
+
+            // released first, a completion may queue the next write into the same class
+            nPos += pRecord->nLength;
+            pQueue->Release( nPos );
+
+            if ( nPrefix > 0 )
+            {
+                Completion.pfnCallback( Completion.pContext, llNow, TRUE );
+            }
+        }
+    }
+}
+
+BOOL CSerialPort::WaitEvent()
+{
+    m_dwEventMask = 0;
+
+    // a synchronous completion signals the event as well, both cases are handled in OnEvent()
+    if ( !CSerialVirtual::WaitCommEvent( m_hComm, &m_dwEventMask, &m_ovEvent ) && ( GetLastError() != ERROR_IO_PENDING ) )
+    {
+        ReportError( SERIAL_STEP_WAITCOMMEVENT );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialPort::OnEvent()
+{
+    DWORD dwDummy;
+    DWORD dwEvents;
+
+    if ( !CSerialVirtual::GetOverlappedResult( m_hComm, &m_ovEvent, &dwDummy, FALSE ) )
+    {
+        ReportError( SERIAL_STEP_WAITCOMMEVENT );
+        return FALSE;
+    }
+
+    // always drain the input queue, bytes may have arrived after the last EV_RXCHAR
+    if ( !ReceiveChar( this ) )
+    {
+        return FALSE;
+    }
+
+    if ( m_dwEventMask & EV_TXEMPTY )
+    {
+        CheckTxDrained();
+    }
+
+    dwEvents = m_dwEventMask & m_dwCommEvents & ~( EV_RXCHAR | EV_TXEMPTY );
+
+    if ( ( m_pCapture != NULL ) && ( dwEvents != 0 ) )
+    {
+        m_pCapture->Append( SERIAL_CAPTURE_EVENT, ( WORD )dwEvents, NULL, 0, GetTimestamp() );
+    }
+
+    if ( ( m_pEventRing != NULL ) && ( dwEvents != 0 ) )
+    {
+        PostEvent( SERIAL_EVENT_COMM, ERROR_SUCCESS, dwEvents );
+    }
+
+    NotifyEvents( dwEvents );
+    return TRUE;
+}
+
+void CSerialPort::NotifyEvents( DWORD dwEvents )
+{
+    for ( DWORD dwBit = 1; dwEvents != 0; dwBit <<= 1 )
+    {
+        if ( dwEvents & dwBit )
+        {
+            Notify( ( WPARAM )dwBit, 0 );
+            dwEvents &= ~dwBit;
+        }
+    }
+}
+
+BOOL CSerialPort::OnTransmit()
+{
+    InterlockedExchange( &m_nTxSignaled, FALSE );
+
+    // Read() wakes the thread when it made room while the receive side is held back
+    if ( ( m_bRxFlowOff || m_bRxHeld ) && !OnRxFlow() )
+    {
+        m_bThreadAlive = FALSE;
+        return FALSE;
+    }
+
+    // with a write in flight the completion picks up the rest of the queue
+    if ( !m_bWritePending && !WriteChar( this ) )
+    {
+        m_bThreadAlive = FALSE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialPort::OnWriteComplete()
+{
+    BOOL  bResult;
+    DWORD Sent = 0;
+    bResult = CSerialVirtual::GetOverlappedResult( m_hComm, &m_ovWrite, &Sent, FALSE );
+    m_bWritePending = FALSE;
+
+    if ( !bResult )
+    {
+        RetireBatch( Sent, TRUE );
+        CompleteTx( FALSE );
+        ReportError( SERIAL_STEP_WRITEFILE );
+        m_bThreadAlive = FALSE;
+        return FALSE;
+    }
+
+    RetireBatch( Sent );
+    // most drivers hold nothing back once the write completed, EV_TXEMPTY covers the others
+    m_bTxDraining = ( m_TxSchedule.dwFrameGap > 0 );
+    CheckTxDrained();
+    Notify( ( WPARAM )EV_TXEMPTY, ( LPARAM )Sent );
+    return OnTransmit();
+}
+
+void CSerialPort::RetireBatch( DWORD nSent,            // bytes the driver took
+                               BOOL bFailed )           // the whole batch is done with, its completions fail
+{
+    CSerialQueue *pQueue = &m_TxQueue[m_nWriteClass];
+    DWORD nPos = pQueue->GetTail();
+    DWORD nDone = nPos;
+    DWORD nOffset = m_nTxOffset[m_nWriteClass];
+    DWORD nLeft = nSent;
+    DWORD nSize;
+    LONGLONG llNow = GetTimestamp();
+    SERIAL_RECORD *pRecord;
+    SERIAL_TX_COMPLETION *pCompletion;
+
+    // the records of the batch are still in the queue, each one carries its enqueue time
+    // and maybe a completion that has to wait until the driver is empty
+    while ( ( nPos != m_nWriteEnd ) && ( ( pRecord = pQueue->Peek( &nPos ) ) != NULL ) )
+    {
+        nSize = GetTxSize( pRecord ) - nOffset;
+
+        if ( !bFailed && ( nSize > nLeft ) )
+        {
+            // a write timeout or a held line cut the batch short, the rest stays at the head of its class
+            break;
+        }
+
+        nLeft -= min( nSize, nLeft );
+        nOffset = 0;
+        CSerialStats::Record( &m_Stats.TxLatency, llNow - pRecord->llTimestamp );
+
+        if ( m_nWriteClass == SERIAL_PRIORITY_URGENT )
+        {
+            CSerialStats::Record( &m_Stats.TxUrgentLatency, llNow - pRecord->llTimestamp );
+        }
+
+        if ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY )
+        {
+            pCompletion = ( SERIAL_TX_COMPLETION * )CSerialQueue::GetPayload( pRecord );
+
+            if ( bFailed )
+            {
+                pCompletion->pfnCallback( pCompletion->pContext, llNow, FALSE );
+            }
+            else
+            {
+                if ( m_nTxPending == SERIAL_TX_PENDING_MAX )
+                {
+                    // WriteChar() keeps a batch within the free slots, should they still run out
+                    // the records waiting for the driver to drain are reported now instead of being lost
+                    CompleteTx( TRUE );
+                }
+
+                memcpy( &m_TxPending[m_nTxPending++], pCompletion, sizeof( SERIAL_TX_COMPLETION ) );
+            }
+        }
+
+        ReleaseTxRecord( pRecord );
+        nPos += pRecord->nLength;
+        nDone = nPos;
+    }
+
+    CSerialStats::Add( &m_Stats.llTxBytes, nSent );
+    pQueue->Release( nDone );
+
+    if ( nDone != m_nWriteEnd )
+    {
+        // the first record not sent in full goes on behind its last byte that went out
+        m_nTxOffset[m_nWriteClass] = nOffset + nLeft;
+    }
+    else if ( m_nWritePartial > 0 )
+    {
+        // a slice keeps its record at the head, the next write of the class continues behind it
+        m_nTxOffset[m_nWriteClass] = nOffset + ( bFailed ? m_nWritePartial : min( nLeft, m_nWritePartial ) );
+    }
+    else
+    {
+        m_nTxOffset[m_nWriteClass] = 0;
+    }
+
+    m_nWritePartial = 0;
+}
+
+DWORD CSerialPort::GetTxSize( SERIAL_RECORD *pRecord )          // bytes the record puts on the wire
+{
+    DWORD nPrefix = ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+    SERIAL_TX_CHUNK *pChunk;
+
+    if ( pRecord->dwFlags & SERIAL_RECORD_CHUNK )
+    {
+        pChunk = ( SERIAL_TX_CHUNK * )( CSerialQueue::GetPayload( pRecord ) + nPrefix );
+        return pChunk->nSize + pRecord->nSize - nPrefix - sizeof( SERIAL_TX_CHUNK );
+    }
+
+    return pRecord->nSize - nPrefix;
+}
+
+const BYTE *CSerialPort::GetTxData( SERIAL_RECORD *pRecord,     // data record
+                                    DWORD nOffset,              // bytes of it already written
+                                    DWORD *pnSize,              // contiguous bytes from there on
+                                    BOOL *pbBorrowed )          // TRUE in the block of a WriteChunk(), never copied
+{
+    DWORD nPrefix = ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+    SERIAL_TX_CHUNK *pChunk;
+
+    *pbBorrowed = FALSE;
+
+    // a chunk goes out of its block first, then the checksum trailer the record carries itself
+    if ( pRecord->dwFlags & SERIAL_RECORD_CHUNK )
+    {
+        pChunk = ( SERIAL_TX_CHUNK * )( CSerialQueue::GetPayload( pRecord ) + nPrefix );
+        nPrefix += sizeof( SERIAL_TX_CHUNK );
+
+        if ( nOffset < pChunk->nSize )
+        {
+            *pnSize = pChunk->nSize - nOffset;
+            *pbBorrowed = TRUE;
+            return pChunk->pData + nOffset;
+        }
+
+        nOffset -= pChunk->nSize;
+    }
+
+    *pnSize = pRecord->nSize - nPrefix - nOffset;
+    return CSerialQueue::GetPayload( pRecord ) + nPrefix + nOffset;
+}
+
+void CSerialPort::ReleaseTxRecord( SERIAL_RECORD *pRecord )     // done with, before the queue releases it
+{
+    DWORD nPrefix = ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+
+    if ( pRecord->dwFlags & SERIAL_RECORD_CHUNK )
+    {
+        CSerialPool::Release( ( ( SERIAL_TX_CHUNK * )( CSerialQueue::GetPayload( pRecord ) + nPrefix ) )->pBlock );
+    }
+}
+
+void CSerialPort::CheckTxDrained()
+{
+    DWORD   dwErrors;
+    COMSTAT Stat;
+
+    if ( ( ( m_nTxPending > 0 ) || m_bTxDraining ) && !m_bWritePending &&
+         CSerialVirtual::ClearCommError( m_hComm, &dwErrors, &Stat ) )
+    {
+        // the call clears the error bits, so they are counted here as well
+        if ( dwErrors != 0 )
+        {
+            CSerialStats::AddErrors( &m_Stats, dwErrors );
+            PostEvent( SERIAL_EVENT_LINE, ERROR_SUCCESS, dwErrors, &Stat );
+        }
+
+        UpdateTxHold( &Stat );
+
+        if ( Stat.cbOutQue > 0 )
+        {
+            return;
+        }
+
+        if ( m_bTxDraining )
+        {
+            // the line went idle, the next write waits out the frame gap from here
+            m_bTxDraining = FALSE;
+            m_llTxReady = GetTimestamp() + m_TxSchedule.dwFrameGap;
+            m_llTxDeadline = m_llTxReady;
+        }
+
+        CompleteTx( TRUE );
+    }
+}
+
+void CSerialPort::CompleteTx( BOOL bSent )
+{
+    LONGLONG llNow = GetTimestamp();
+    UINT i;
+
+    for ( i = 0; i < m_nTxPending; i++ )
+    {
+        m_TxPending[i].pfnCallback( m_TxPending[i].pContext, llNow, bSent );
+    }
+
+    m_nTxPending = 0;
+
+    // WriteChar() held back records because no completion slot was free
+    if ( m_bTxBlocked )
+    {
+        m_bTxBlocked = FALSE;
+        SignalTx();
+    }
+}
+
+// the port will not send again before Close(): no record is taken any more, the in-flight
+// completions and every record still queued complete with bSent FALSE, oldest first within a class
+void CSerialPort::FailTx()
+{
+    SERIAL_TX_COMPLETION Completion;
+    SERIAL_RECORD *pRecord;
+    DWORD nPrefix;
+    DWORD nPos;
+    UINT  i;
+
+    for ( i = 0; i < SERIAL_TX_PRIORITIES; i++ )
+    {
+        m_TxQueue[i].Close();
+    }
+
+    m_bTxBlocked = FALSE;
+    m_bTxDraining = FALSE;
+    m_llTxDeadline = MAXLONGLONG;
+    CompleteTx( FALSE );
+
+    for ( i = 0; i < SERIAL_TX_PRIORITIES; i++ )
+    {
+        nPos = m_TxQueue[i].GetTail();
+        m_nTxOffset[i] = 0;
+
+        while ( ( pRecord = m_TxQueue[i].Peek( &nPos ) ) != NULL )
+        {
+            nPrefix = ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+
+            if ( nPrefix > 0 )
+            {
+                memcpy( &Completion, CSerialQueue::GetPayload( pRecord ), sizeof( Completion ) );
+            }
+
+            ReleaseTxRecord( pRecord );
+            nPos += pRecord->nLength;
+            m_TxQueue[i].Release( nPos );
+
+            if ( nPrefix > 0 )
+            {
+                Completion.pfnCallback( Completion.pContext, GetTimestamp(), FALSE );
+            }
+        }
+    }
+}
+
+void CALLBACK CSerialPort::SignalWriteDone( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent )
+{
+    SetEvent( ( HANDLE )pContext );
+}
+
+void CALLBACK CSerialPort::SignalCommandDone( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent )
+{
+    SERIAL_COMMAND_DONE *pDone = ( SERIAL_COMMAND_DONE * )pContext;
+    pDone->bApplied = bSent;
+    SetEvent( pDone->hDone );
+}
+
+BOOL CSerialPort::ApplyCommand( CSerialQueue *pQueue,       // class the command is queued in
+                                DWORD nPos,                 // position of the command
+                                SERIAL_RECORD *pRecord )    // head of the class
+{
+    SERIAL_TX_COMPLETION Completion;
+    SERIAL_COMMAND Command;
+    SERIAL_STEP Step = SERIAL_STEP_SETCOMMSTATE;
+    BOOL    bState = TRUE;
+    COMSTAT Stat;
+    DWORD   dwErrors;
+    DWORD   dwFlow = m_FlowControl.dwFlow;
+    COMMTIMEOUTS Timeouts;
+    DCB     dcb;
+    BOOL    bResult = TRUE;
+    DWORD   nPrefix = ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+    LONGLONG llNow = GetTimestamp();
+
+    if ( llNow < m_llTxReady )
+    {
+        m_llTxDeadline = m_llTxReady;
+        return FALSE;
+    }
+
+    // the bytes before the command go out with the old settings; draining lets
+    // CheckTxDrained() set a deadline once the driver is empty, which comes back here
+    if ( CSerialVirtual::ClearCommError( m_hComm, &dwErrors, &Stat ) )
+    {
+        if ( dwErrors != 0 )
+        {
+            CSerialStats::AddErrors( &m_Stats, dwErrors );
+            PostEvent( SERIAL_EVENT_LINE, ERROR_SUCCESS, dwErrors, &Stat );
+        }
+
+        if ( Stat.cbOutQue > 0 )
+        {
+            m_bTxDraining = TRUE;
+            return FALSE;
+        }
+    }
+
+    // completions of the writes before it are due first
+    CompleteTx( TRUE );
+    memcpy( &Command, CSerialQueue::GetPayload( pRecord ) + nPrefix, sizeof( Command ) );
+    EnterCriticalSection( &m_csCommunicationSync );
+    dcb = m_dcb;
+
+    switch ( Command.Code )
+    {
+        case SERIAL_COMMAND_BAUD:
+            dcb.BaudRate = Command.dwValue;
+            break;
+
+        case SERIAL_COMMAND_FORMAT:
+            dcb.Parity = Command.Parity;
+            dcb.ByteSize = Command.DataBits;
+            dcb.StopBits = Command.StopBits;
+            break;
+
+        case SERIAL_COMMAND_FLOW:
+            // the engine keeps the lines, as after Open() with SetFlowControl(); a peer the old kind stopped goes on first
+            if ( m_bRxFlowOff )
+            {
+                SetPeerFlow( TRUE );
+                m_bRxFlowOff = FALSE;
+            }
+
+            m_FlowControl.dwFlow = Command.dwValue;
+            SetFlowDcb( &dcb );
+            break;
+
+        case SERIAL_COMMAND_DCB:
+            dcb = Command.dcb;
+            break;
+
+        case SERIAL_COMMAND_TIMEOUTS:
+            Step = SERIAL_STEP_SETCOMMTIMEOUTS;
+            bState = FALSE;
+
+            Timeouts = m_CommTimeouts;
+            m_CommTimeouts = Command.Timeouts;
+
+            if ( !( bResult = ApplyTimeouts() ) )
+            {
+                m_CommTimeouts = Timeouts;
+            }
+
+            break;
+
+        case SERIAL_COMMAND_ESCAPE:
+            Step = SERIAL_STEP_ESCAPECOMMFUNCTION;
+            bState = FALSE;
+            bResult = CSerialVirtual::EscapeCommFunction( m_hComm, Command.dwValue );
+            break;
+
+        case SERIAL_COMMAND_WAIT:
+            bState = FALSE;
+            m_llTxReady = llNow + Command.dwValue;
+            m_llTxDeadline = m_llTxReady;
+            break;
+    }
+
+    if ( bState )
+    {
+        // a reconnect brings back whatever was applied last
+        if ( ( bResult = CSerialVirtual::SetCommState( m_hComm, &dcb ) ) )
+        {
+            m_dcb = dcb;
+        }
+    }
+
+    if ( m_FlowControl.dwFlow != dwFlow )
+    {
+        if ( !bResult )
+        {
+            m_FlowControl.dwFlow = dwFlow;
+        }
+        else
+        {
+            // watermarks, write timeouts and the line events follow the new kind
+            SetRxWatermarks();
+            Step = SERIAL_STEP_SETCOMMTIMEOUTS;
+
+            if ( ( bResult = ApplyTimeouts() ) )
+            {
+                Step = SERIAL_STEP_SETCOMMMASK;
+                bResult = CSerialVirtual::SetCommMask( m_hComm, GetCommMask() );
+            }
+        }
+    }
+
+    LeaveCriticalSection( &m_csCommunicationSync );
+
+    if ( bResult )
+    {
+        UpdateRxFlow();
+    }
+
+    if ( !bResult )
+    {
+        ReportError( Step );
+    }
+
+    if ( nPrefix > 0 )
+    {
+        memcpy( &Completion, CSerialQueue::GetPayload( pRecord ), sizeof( Completion ) );
+    }
+
+    pQueue->Release( nPos + pRecord->nLength );
+
+    if ( nPrefix > 0 )
+    {
+        Completion.pfnCallback( Completion.pContext, GetTimestamp(), bResult );
+    }
+
+    return TRUE;
+}
+
+LONGLONG CSerialPort::OnCompletion( LPOVERLAPPED pOverlapped, DWORD nBytes, LONGLONG llNow )
+{
+    BOOL bAlive = m_bThreadAlive;
+    m_llWakeTime = llNow;
+    CSerialStats::Add( &m_Stats.llWakeups );
+
+    if ( pOverlapped == &m_ovEvent )
+    {
+        m_bEventPending = FALSE;
+
+        if ( !m_bClosing && m_bThreadAlive )
+        {
+            m_bThreadAlive = OnEvent() && WaitEvent();
+            m_bEventPending = m_bThreadAlive;
+        }
+    }
+    else if ( nBytes == SERIAL_SIGNAL_START )
+    {
+        m_bThreadAlive = WaitEvent();
+        m_bEventPending = m_bThreadAlive;
+    }
+    else if ( pOverlapped == &m_ovWrite )
+    {
+        if ( m_bClosing )
+        {
+            m_bWritePending = FALSE;
+            RetireBatch( 0, TRUE );
+        }
+        else if ( m_bThreadAlive )
+        {
+            OnWriteComplete();
+        }
+        else
+        {
+            // the last write of a port that went down, the records behind it fail with it
+            m_bWritePending = FALSE;
+            RetireBatch( 0, TRUE );
+            FailTx();
+        }
+    }
+    else if ( nBytes == SERIAL_SIGNAL_TX )
+    {
+        if ( m_bClosing )
+        {
+            m_bTxPending = FALSE;
+        }
+        else if ( m_bThreadAlive )
+        {
+            OnTransmit();
+        }
+    }
+    else if ( nBytes == SERIAL_SIGNAL_CLOSE )
+    {
+        m_bClosing = TRUE;
+        m_bThreadAlive = FALSE;
+        // the flag stays set from now on, so no producer posts another signal;
+        // if it already was set one signal is still on its way
+        m_bTxPending = ( InterlockedExchange( &m_nTxSignaled, TRUE ) == TRUE );
+
+        if ( m_bEventPending )
+        {
+            CSerialVirtual::CancelIoEx( m_hComm, &m_ovEvent );
+        }
+
+        if ( m_bWritePending )
+        {
+            CSerialVirtual::CancelIoEx( m_hComm, &m_ovWrite );
+        }
+    }
+
+    if ( m_bClosing )
+    {
+        if ( !m_bEventPending && !m_bTxPending && !m_bWritePending )
+        {
+            // nothing of this port is queued any more, Close() may free it
+            m_pReactor->Remove( this );
+            SetEvent( m_hCloseEvent );
+        }
+
+        return MAXLONGLONG;
+    }
+
+    if ( bAlive && !m_bThreadAlive )
+    {
+        // a shard serves many ports and does not wait out a reconnect, the port stays down until Close()
+        PostEvent( SERIAL_EVENT_DISCONNECTED, ERROR_SUCCESS, 0 );
+
+        if ( !m_bWritePending )
+        {
+            FailTx();
+        }
+    }
+
+    return GetDeadline();
+}
+
+void CSerialPort::SignalTx()
+{
+    // one wakeup per batch, the comm thread clears the flag before it drains
+    if ( InterlockedExchange( &m_nTxSignaled, TRUE ) == FALSE )
+    {
+        // attached ports only, a replay keeps its own thread
+        if ( m_hReactorPort != NULL )
+        {
+            PostQueuedCompletionStatus( m_hReactorPort, SERIAL_SIGNAL_TX, ( ULONG_PTR )this, &m_ovSignal );
+        }
+        else
+        {
+            SetEvent( m_hTxEvent );
+        }
+    }
+}
+
+void CSerialPort::Spin()
+{
+    LONGLONG llNow;
+    LONGLONG llEnd;
+
+    if ( m_BusyPoll.dwSpinTime == 0 )
+    {
+        return;
+    }
+
+    llNow = GetTimestamp();
+    llEnd = min( llNow + ( LONGLONG )m_BusyPoll.dwSpinTime, GetDeadline() );
+
+    // plain reads of what the driver and SignalTx() write, no call into the kernel; once one of them
+    // is set the event follows and the wait after this returns without giving up the processor
+    while ( !m_nTxSignaled && !HasOverlappedIoCompleted( &m_ovEvent ) && !( m_bWritePending && HasOverlappedIoCompleted( &m_ovWrite ) ) )
+    {
+        if ( llNow >= llEnd )
+        {
+            return;
+        }
+
+        YieldProcessor();
+        llNow = GetTimestamp();
+    }
+
+    CSerialStats::Add( &m_Stats.llSpinWakeups );
+}
+
+void CSerialPort::WakeUp()
+{
+    // a framer deadline set from another thread, the comm thread may be sleeping without a timeout
+    SignalTx();
+}
+
+DWORD CSerialPort::GetWaitTimeout()
+{
+    LONGLONG llLeft = GetDeadline();
+
+    if ( llLeft == MAXLONGLONG )
+    {
+        return INFINITE;
+    }
+
+    llLeft -= GetTimestamp();
+    return ( llLeft <= 0 ) ? 0 : ( DWORD )( ( llLeft + 999 ) / 1000 );
+}
+
+LONGLONG CSerialPort::GetRxDeadline()
+{
+    LONGLONG llDeadline;
+
+    if ( m_bRxStarved || m_bRxHeld )
+    {
+        return m_llRxStarveTime + ( LONGLONG )SERIAL_RX_STARVED_RETRY * 1000;
+    }
+
+    llDeadline = ( m_nRxChunkFill == 0 ) ? MAXLONGLONG : m_llRxChunkTime + ( LONGLONG )m_dwRxCoalesceTime * 1000;
+
+    // consumers of pool blocks do not wake the thread, the level is looked at again after a while
+    if ( m_bRxFlowOff )
+    {
+        llDeadline = min( llDeadline, m_llRxStarveTime + ( LONGLONG )SERIAL_RX_STARVED_RETRY * 1000 );
+    }
+
+    return llDeadline;
+}
+
+LONGLONG CSerialPort::GetDeadline()
+{
+    LONGLONG llDeadline = min( GetRxDeadline(), m_llTxDeadline );
+
+    if ( m_pFramer != NULL )
+    {
+        llDeadline = min( llDeadline, m_pFramer->GetDeadline() );
+    }
+
+    return llDeadline;
+}
+
+void CSerialPort::GetStats( SERIAL_STATS *pStats, BOOL bReset )
+{
+    assert( pStats != NULL );
+    // readers serialize on the base, the counters themselves never take a lock
+    EnterCriticalSection( &m_csStats );
+    CSerialStats::Snapshot( &m_Stats, &m_StatsBase, pStats, bReset );
+    LeaveCriticalSection( &m_csStats );
+}
+
+void CSerialPort::GetWakeLatency( SERIAL_LATENCY *pLatency, BOOL bReset )
+{
+    assert( pLatency != NULL );
+    // updated by the comm thread without a lock, a snapshot taken while it runs is approximate
+    *pLatency = m_WakeLatency;
+
+    if ( bReset )
+    {
+        memset( &m_WakeLatency, 0, sizeof( m_WakeLatency ) );
+    }
+}
+
+void CSerialPort::ReportError( SERIAL_STEP Step )  // GetLastError() is kept for the caller
+{
+    DWORD dwError = GetLastError();
+    PostEvent( SERIAL_EVENT_ERROR, dwError, ( DWORD )Step );
+    SetLastError( dwError );
+}
+
+void CSerialPort::PostEvent( SERIAL_EVENT_CODE Code,    // what happened
+                             DWORD dwError,             // GetLastError() or ERROR_SUCCESS
+                             DWORD dwDetail,            // see SERIAL_EVENT_CODE
+                             const COMSTAT *pStat )     // queue sizes of a line event
+{
+    SERIAL_EVENT Event;
+    char szText[128];
+    LONGLONG llNow = GetTimestamp();
+    LONGLONG llWindow = m_llEventWindow[Code];
+
+    // called from the comm thread and the reactor shards as well, so nothing here blocks, locks or allocates;
+    // a flapping line or a dead device gets a budget per code and second, state changes always get through
+    if ( ( llNow - llWindow >= 1000000 ) && ( InterlockedCompareExchange64( &m_llEventWindow[Code], llNow, llWindow ) == llWindow ) )
+    {
+        // one caller opens the new second, the others count in it
+        InterlockedExchange( &m_nEventCount[Code], 0 );
+    }
+
+    if ( ( m_nEventRate > 0 ) && ( InterlockedIncrement( &m_nEventCount[Code] ) > ( LONG )m_nEventRate ) &&
+         ( Code != SERIAL_EVENT_DISCONNECTED ) && ( Code != SERIAL_EVENT_RECONNECTED ) )
+    {
+        InterlockedIncrement( &m_nEventSuppressed[Code] );
+        return;
+    }
+
+    Event.nSuppressed = ( DWORD )InterlockedExchange( &m_nEventSuppressed[Code], 0 );
+
+    Event.Code = Code;
+    Event.nPort = m_nPortNr;
+    Event.dwError = dwError;
+    Event.dwDetail = dwDetail;
+    Event.cbInQue = ( pStat != NULL ) ? pStat->cbInQue : 0;
+    Event.cbOutQue = ( pStat != NULL ) ? pStat->cbOutQue : 0;
+    Event.llTimestamp = llNow;
+
+    if ( m_pEventRing != NULL )
+    {
+        m_pEventRing->Publish( &Event );
+    }
+    else if ( Code == SERIAL_EVENT_ERROR )
+    {
+        // no ring to read from, a debugger shows what failed and the owner gets the error code
+        sprintf( szText, _T( "%s%d: %s failed with error %lu (%lu suppressed)\n" ), SERIAL_DEVICE_PREFIX, (signed int)m_nPortNr,
+                 CSerialEventRing::GetStepName( ( SERIAL_STEP )dwDetail ), dwError, Event.nSuppressed );
+        OutputDebugString( szText );
+        Notify( ( WPARAM )SERIAL_EV_ERROR, ( LPARAM )dwError );
+    }
+}
+
+BOOL CSerialPort::WriteChar( CSerialPort *pPort )
+{
+    BOOL  bResult;
+    BOOL  bBorrowed;
+    DWORD nBatch;
+    DWORD nStart;
+    DWORD nPos;
+    DWORD nEnd;
+    DWORD nOffset;
+    DWORD nLeft;
+    DWORD nSegment;
+    DWORD nNeed;
+    DWORD nAllowed;
+    DWORD nCopy;
+    UINT  nClass;
+    UINT  nNotify;
+    const BYTE *pData;
+    const BYTE *pSegment;
+    CSerialQueue *pQueue;
+    SERIAL_RECORD *pRecord;
+
+    pPort->m_llTxDeadline = MAXLONGLONG;
+
+    for ( ;; )
+    {
+        // the frame gap starts once the driver is empty, CheckTxDrained() picks it up
+        if ( pPort->m_bTxDraining )
+        {
+            return TRUE;
+        }
+
+        nClass = pPort->PickTxClass();
+
+        if ( nClass == SERIAL_TX_PRIORITIES )
+        {
+            // nothing committed yet, the producer signals again
+            return TRUE;
+        }
+
+        pQueue = &pPort->m_TxQueue[nClass];
+        nPos = pQueue->GetTail();
+        pRecord = pQueue->Peek( &nPos );
+
+        if ( pRecord->dwType == SERIAL_RECORD_COMMAND )
+        {
+            if ( !pPort->ApplyCommand( pQueue, nPos, pRecord ) )
+            {
+                // the driver still sends what came before, EV_TXEMPTY or the deadline brings us back
+                return TRUE;
+            }
+
+            continue;
+        }
+
+        nStart = nPos;
+        nOffset = pPort->m_nTxOffset[nClass];
+        nNeed = min( GetTxSize( pRecord ) - nOffset, pPort->GetTxSlice() );
+
+        if ( !pPort->PaceTx( nNeed, &nAllowed ) )
+        {
+            return TRUE;
+        }
+
+        nBatch = 0;
+        nEnd = nStart;
+        nNotify = pPort->m_nTxPending;
+        nCopy = min( nAllowed, pPort->m_nWriteBufferSize );
+        pData = ( const BYTE * )pPort->m_szWriteBuffer;
+        pPort->m_nWritePartial = 0;
+
+        // gather committed records of this class that fit into one WriteFile, up to the next command
+        while ( ( pRecord != NULL ) && ( pRecord->dwType != SERIAL_RECORD_COMMAND ) )
+        {
+            if ( pRecord->dwFlags & SERIAL_RECORD_NOTIFY )
+            {
+                if ( nNotify == SERIAL_TX_PENDING_MAX )
+                {
+                    // CompleteTx() signals again once the completions went out
+                    pPort->m_bTxBlocked = TRUE;
+                    break;
+                }
+
+                nNotify++;
+            }
+
+            nLeft = GetTxSize( pRecord ) - nOffset;
+            pSegment = GetTxData( pRecord, nOffset, &nSegment, &bBorrowed );
+
+            if ( bBorrowed || ( nBatch + nLeft > nCopy ) )
+            {
+                if ( nBatch == 0 )
+                {
+                    // larger than the batch buffer or the slice, or the block of a chunk, write it straight
+                    // from where it is; a slice or a trailer behind the block leaves the record at the head
+                    pData = pSegment;
+                    nBatch = min( nSegment, nAllowed );
+
+                    if ( nBatch < nLeft )
+                    {
+                        pPort->m_nWritePartial = nBatch;
+                    }
+                    else
+                    {
+                        nEnd = nPos + pRecord->nLength;
+                    }
+                }
+
+                break;
+            }
+
+            memcpy( pPort->m_szWriteBuffer + nBatch, pSegment, nLeft );
+            CSerialStats::Add( &pPort->m_Stats.llTxCopied, nLeft );
+            nBatch += nLeft;
+            nPos += pRecord->nLength;
+            nEnd = nPos;
+            nOffset = 0;
+
+            if ( ( nBatch > 0 ) && ( pPort->m_TxSchedule.dwFrameGap > 0 ) )
+            {
+                // one record per write, so the gap lands between records
+                break;
+            }
+
+            pRecord = pQueue->Peek( &nPos );
+        }
+
+        pPort->m_nWriteClass = nClass;
+        pPort->m_nWriteEnd = nEnd;
+
+        if ( nBatch == 0 )
+        {
+            if ( nEnd == nStart )
+            {
+                // held back by the completion limit
+                return TRUE;
+            }
+
+            // empty records with a completion are a drain barrier and finish right here,
+            // then the next class gets its turn
+            pPort->RetireBatch( 0 );
+            pPort->CheckTxDrained();
+            continue;
+        }
+
+        // completes through m_ovWrite, the records are released in OnWriteComplete()
+        bResult = CSerialVirtual::WriteFile( pPort->m_hComm,
+                                             pData,
+                                             nBatch,
+                                             NULL,
+                                             &pPort->m_ovWrite);
+
+        if ( !bResult && ( GetLastError() != ERROR_IO_PENDING ) )
+        {
+            pPort->RetireBatch( 0, TRUE );
+            pPort->CompleteTx( FALSE );
+            pPort->ReportError( SERIAL_STEP_WRITEFILE );
+            return FALSE;
+        }
+
+        CSerialStats::Add( &pPort->m_Stats.llWriteCalls );
+        pPort->m_bWritePending = TRUE;
+
+        if ( pPort->m_pCapture != NULL )
+        {
+            pPort->m_pCapture->Append( SERIAL_CAPTURE_TX, 0, pData, nBatch, GetTimestamp() );
+        }
+
+        if ( pPort->m_TxSchedule.nRate > 0 )
+        {
+            pPort->m_llTxTokens -= ( LONGLONG )nBatch * 1000000;
+        }
+
+        if ( pPort->m_TxSchedule.bWeighted && ( ( pPort->m_llTxDeficit[nClass] -= nBatch ) <= 0 ) )
+        {
+            pPort->m_nTxRound = ( nClass + 1 ) % SERIAL_TX_PRIORITIES;
+        }
+
+        return TRUE;
+    }
+}
+
+UINT CSerialPort::PickTxClass()
+{
+    UINT  nClass;
+    UINT  nIdle = 0;
+    DWORD nPos;
+    DWORD nQuantum;
+
+    if ( !m_TxSchedule.bWeighted )
+    {
+        // strict priority, a lower class only goes when every higher one is empty
+        for ( nClass = 0; nClass < SERIAL_TX_PRIORITIES; nClass++ )
+        {
+            nPos = m_TxQueue[nClass].GetTail();
+
+            if ( m_TxQueue[nClass].Peek( &nPos ) != NULL )
+            {
+                return nClass;
+            }
+        }
+
+        return SERIAL_TX_PRIORITIES;
+    }
+
+    // deficit round robin: every visit credits a class its weight in slices, a write
+    // uses up what it sent, a class that overdrew waits until its credit is positive again
+    while ( nIdle < SERIAL_TX_PRIORITIES )
+    {
+        nClass = m_nTxRound;
+        nPos = m_TxQueue[nClass].GetTail();
+
+        if ( m_TxQueue[nClass].Peek( &nPos ) == NULL )
+        {
+            // an idle class does not save up credit
+            m_llTxDeficit[nClass] = 0;
+            m_nTxRound = ( nClass + 1 ) % SERIAL_TX_PRIORITIES;
+            nIdle++;
+            continue;
+        }
+
+        nIdle = 0;
+
+        if ( m_llTxDeficit[nClass] <= 0 )
+        {
+            nQuantum = ( m_TxSchedule.nSliceSize > 0 ) ? m_TxSchedule.nSliceSize : m_nWriteBufferSize;
+            m_llTxDeficit[nClass] += ( LONGLONG )max( m_TxSchedule.nWeight[nClass], 1 ) * nQuantum;
+        }
+
+        if ( m_llTxDeficit[nClass] > 0 )
+        {
+            return nClass;
+        }
+
+        m_nTxRound = ( nClass + 1 ) % SERIAL_TX_PRIORITIES;
+    }
+
+    return SERIAL_TX_PRIORITIES;
+}
+
+DWORD CSerialPort::GetTxSlice()
+{
+    DWORD nSlice = ( m_TxSchedule.nSliceSize > 0 ) ? m_TxSchedule.nSliceSize : MAXDWORD;
+
+    // one write never needs more tokens than the bucket holds
+    if ( m_TxSchedule.nRate > 0 )
+    {
+        nSlice = min( nSlice, m_TxSchedule.nBurst );
+    }
+
+    return nSlice;
+}
+
+BOOL CSerialPort::PaceTx( DWORD nNeed,                  // bytes the next write takes at least
+                          DWORD *pnAllowed )            // bytes it may take at most
+{
+    LONGLONG llNow = GetTimestamp();
+    LONGLONG llRate = m_TxSchedule.nRate;
+    LONGLONG llBurst = ( LONGLONG )m_TxSchedule.nBurst * 1000000;
+
+    if ( llNow < m_llTxReady )
+    {
+        m_llTxDeadline = m_llTxReady;
+        return FALSE;
+    }
+
+    *pnAllowed = GetTxSlice();
+
+    if ( llRate == 0 )
+    {
+        return TRUE;
+    }
+
+    // tokens are counted in millionths of a byte, so they refill every microsecond
+    m_llTxTokens = min( m_llTxTokens + min( llNow - m_llTxRefill, llBurst / llRate + 1 ) * llRate, llBurst );
+    m_llTxRefill = llNow;
+
+    if ( m_llTxTokens < ( LONGLONG )nNeed * 1000000 )
+    {
+        m_llTxDeadline = llNow + ( ( LONGLONG )nNeed * 1000000 - m_llTxTokens + llRate - 1 ) / llRate;
+        return FALSE;
+    }
+
+    *pnAllowed = ( DWORD )min( ( LONGLONG )*pnAllowed, m_llTxTokens / 1000000 );
+    return TRUE;
+}
+
+BOOL CSerialPort::ReceiveChar( CSerialPort *pPort )
+{
+    BOOL    bResult = TRUE;
+    DWORD   BytesRead = 0;
+    DWORD   dwErrors = 0;
+    DWORD   nRequest;
+    BOOL    bFirst = TRUE;
+    COMSTAT Stat;
+    SERIAL_STEP Step;
+
+    for ( ;; )
+    {
+        // read exactly what the driver has queued, so the call completes at once
+        // whatever read timeouts were given to Open()
+        bResult = CSerialVirtual::ClearCommError( pPort->m_hComm, &dwErrors, &Stat );
+        Step = SERIAL_STEP_CLEARCOMMERROR;
+
+        if ( bResult )
+        {
+            CSerialStats::AddErrors( &pPort->m_Stats, dwErrors );
+
+            if ( dwErrors != 0 )
+            {
+                pPort->PostEvent( SERIAL_EVENT_LINE, ERROR_SUCCESS, dwErrors, &Stat );
+            }
+            CSerialStats::Max( &pPort->m_Stats.llRxQueueHigh, Stat.cbInQue );
+            pPort->m_nRxDriverQueue = Stat.cbInQue;
+            pPort->UpdateTxHold( &Stat );
+            pPort->UpdateRxFlow();
+
+            if ( bFirst && ( Stat.cbInQue == 0 ) )
+            {
+                CSerialStats::Add( &pPort->m_Stats.llEmptyPolls );
+            }
+
+            bFirst = FALSE;
+        }
+
+        if ( bResult && ( Stat.cbInQue > 0 ) && ( pPort->m_pRxChunk == NULL ) && !pPort->AllocRxBlock() )
+        {
+            // pool exhausted: the bytes stay in the driver and flow control holds off the sender
+            break;
+        }
+
+        if ( bResult && ( Stat.cbInQue > 0 ) )
+        {
+            nRequest = min( pPort->m_nRxChunkSize - pPort->m_nRxChunkFill, Stat.cbInQue );
+
+            if ( ( pPort->m_FlowControl.dwFlow != 0 ) && ( pPort->m_pRxRing != NULL ) )
+            {
+                // with flow control nothing is dropped: what Read() has no room for stays in the driver
+                nRequest = min( nRequest, pPort->m_nRxRingSize - pPort->GetRxCount() - pPort->m_nRxChunkFill );
+                pPort->m_bRxHeld = ( nRequest == 0 );
+
+                if ( pPort->m_bRxHeld )
+                {
+                    pPort->m_llRxStarveTime = GetTimestamp();
+                    break;
+                }
+            }
+
+            Step = SERIAL_STEP_READFILE;
+            bResult = CSerialVirtual::ReadFile( pPort->m_hComm,                                   // Handle to COMM port
+                                                pPort->m_pRxChunk + pPort->m_nRxChunkFill,        // RX Buffer Pointer
+                                                nRequest,                                         // Read what is available
+                                                &BytesRead,                                       // Stores number of bytes read
+                                                &pPort->m_ovRead);
+
+            if ( !bResult && ( GetLastError() == ERROR_IO_PENDING ) )
+            {
+                bResult = CSerialVirtual::GetOverlappedResult( pPort->m_hComm, &pPort->m_ovRead, &BytesRead, TRUE );
+            }
+
+            CSerialStats::Add( &pPort->m_Stats.llReadCalls );
+            CSerialStats::Add( &pPort->m_Stats.llRxBytes, BytesRead );
+        }
+        else
+        {
+            BytesRead = 0;
+        }
+
+        if ( !bResult )
+        {
+            pPort->ReportError( Step );
+            return FALSE;
+        }
+
+        if ( BytesRead == 0 )
+        {
+            break;
+        }
+
+        if ( pPort->m_nRxChunkFill == 0 )
+        {
+            pPort->m_llRxChunkTime = GetTimestamp();
+        }
+
+        if ( pPort->m_pCapture != NULL )
+        {
+            pPort->m_pCapture->Append( SERIAL_CAPTURE_RX, 0, pPort->m_pRxChunk + pPort->m_nRxChunkFill, BytesRead, GetTimestamp() );
+        }
+
+        pPort->m_nRxChunkFill += BytesRead;
+
+        if ( pPort->IsRxDue( GetTimestamp() ) )
+        {
+            pPort->DeliverRx();
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialPort::IsRxDue( LONGLONG llNow )
+{
+    return ( m_RxMode == SERIAL_RX_BYTE ) ||
+           ( m_nRxChunkFill >= m_nRxChunkSize ) ||
+           ( ( llNow - m_llRxChunkTime ) >= ( LONGLONG )m_dwRxCoalesceTime * 1000 );
+}
+
+void CSerialPort::DeliverRx()
+{
+    DWORD i;
+    LONGLONG llLatency;
+
+    if ( m_nRxChunkFill == 0 )
+    {
+        return;
+    }
+
+    // wake of the comm thread to handing the data out
+    llLatency = GetTimestamp() - m_llWakeTime;
+
+    if ( ( m_WakeLatency.llCount == 0 ) || ( llLatency < m_WakeLatency.llMin ) )
+    {
+        m_WakeLatency.llMin = llLatency;
+    }
+
+    if ( llLatency > m_WakeLatency.llMax )
+    {
+        m_WakeLatency.llMax = llLatency;
+    }
+
+    m_WakeLatency.llTotal += llLatency;
+    m_WakeLatency.llCount++;
+    CSerialStats::Record( &m_Stats.RxLatency, GetTimestamp() - m_llRxChunkTime );
+
+    // before the framer, which may decode the chunk in place
+    if ( m_pBroadcast != NULL )
+    {
+        m_pBroadcast->Publish( m_pRxChunk, m_nRxChunkFill, m_llRxChunkTime );
+    }
+
+    if ( m_RxMode == SERIAL_RX_BYTE )
+    {
+        for ( i = 0; i < m_nRxChunkFill; i++ )
+        {
+            Notify( ( WPARAM )EV_RXCHAR, ( LPARAM )m_pRxChunk[i] );
+        }
+    }
+    else if ( m_pfnChunkCallback != NULL )
+    {
+        m_pRxBlock->nSize = m_nRxChunkFill;
+        m_pRxBlock->llTimestamp = m_llRxChunkTime;
+        CSerialChunk Chunk( m_pRxBlock, 0, m_nRxChunkFill );
+        m_pfnChunkCallback( m_pRxContext, Chunk );
+    }
+    else if ( m_pFramer != NULL )
+    {
+        // frames may be decoded in place, the chunk is rewritten before the next read
+        m_pFramer->Feed( m_pRxChunk, m_nRxChunkFill, m_llRxChunkTime );
+    }
+    else if ( m_pfnRxCallback != NULL )
+    {
+        m_pfnRxCallback( m_pRxContext, m_pRxChunk, m_nRxChunkFill, m_llRxChunkTime );
+    }
+    else
+    {
+        DWORD nMask = m_nRxRingSize - 1;
+        DWORD nHead = ( DWORD )m_nRxHead;
+        DWORD nSize = min( m_nRxChunkFill, m_nRxRingSize - ( nHead - ( DWORD )m_nRxTail ) );
+        DWORD nFirst = min( nSize, m_nRxRingSize - ( nHead & nMask ) );
+        // bytes that do not fit are dropped and counted, only without flow control: Read() is running behind
+        memcpy( m_pRxRing + ( nHead & nMask ), m_pRxChunk, nFirst );
+        memcpy( m_pRxRing, m_pRxChunk + nFirst, nSize - nFirst );
+        InterlockedExchangeAdd( &m_nRxHead, ( LONG )nSize );
+        CSerialStats::Add( &m_Stats.llRxDropped, m_nRxChunkFill - nSize );
+        Notify( ( WPARAM )SERIAL_EV_RXCHUNK, ( LPARAM )GetRxCount() );
+    }
+
+    m_nRxChunkFill = 0;
+
+    if ( m_pRxBlock != NULL )
+    {
+        // consumers took their own references, the port lets go of the block
+        CSerialPool::Release( m_pRxBlock );
+        m_pRxBlock = NULL;
+        m_pRxChunk = NULL;
+    }
+}
+
+BOOL CSerialPort::AllocRxBlock()
+{
+    m_pRxBlock = m_RxPool.Alloc();
+
+    if ( m_pRxBlock == NULL )
+    {
+        // one message per dry spell, the counter keeps the total
+        if ( !m_bRxStarved )
+        {
+            m_bRxStarved = TRUE;
+            Notify( ( WPARAM )SERIAL_EV_RXSTARVED, ( LPARAM )m_RxPool.GetExhaustedCount() );
+        }
+
+        m_llRxStarveTime = GetTimestamp();
+        return FALSE;
+    }
+
+    m_bRxStarved = FALSE;
+    m_pRxChunk = CSerialPool::GetData( m_pRxBlock );
+    return TRUE;
+}
+
+BOOL CSerialPort::OnRxDeadline()
+{
+    if ( m_bRxStarved )
+    {
+        return ReceiveChar( this );
+    }
+
+    if ( ( m_bRxFlowOff || m_bRxHeld ) && !OnRxFlow() )
+    {
+        return FALSE;
+    }
+
+    // the deadline may have been the flow control retry, a chunk still coalescing waits
+    if ( IsRxDue( GetTimestamp() ) )
+    {
+        DeliverRx();
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialPort::OnRxFlow()
+{
+    m_llRxStarveTime = GetTimestamp();
+
+    // reading again updates the flow as well
+    if ( m_bRxHeld )
+    {
+        return ReceiveChar( this );
+    }
+
+    UpdateRxFlow();
+    return TRUE;
+}
+
+DWORD CSerialPort::GetRxLevel()
+{
+    DWORD nLevel = m_nRxDriverQueue + m_nRxChunkFill;
+
+    // a callback or framer consumes on this thread, only Read() and held pool blocks lag behind
+    if ( m_pRxRing != NULL )
+    {
+        nLevel += GetRxCount();
+    }
+    else if ( m_nRxPoolBlocks > 0 )
+    {
+        nLevel += ( m_nRxPoolBlocks - m_RxPool.GetFreeCount() ) * m_nRxChunkSize;
+    }
+
+    return nLevel;
+}
+
+void CSerialPort::UpdateRxFlow()
+{
+    DWORD nLevel;
+
+    if ( m_FlowControl.dwFlow == 0 )
+    {
+        return;
+    }
+
+    nLevel = GetRxLevel();
+
+    if ( !m_bRxFlowOff && ( nLevel >= m_nRxHighWater ) )
+    {
+        if ( SetPeerFlow( FALSE ) )
+        {
+            m_bRxFlowOff = TRUE;
+            m_llRxStarveTime = GetTimestamp();
+            CSerialStats::Add( &m_Stats.llRxFlowOffs );
+        }
+    }
+    else if ( m_bRxFlowOff && ( nLevel <= m_nRxLowWater ) )
+    {
+        if ( SetPeerFlow( TRUE ) )
+        {
+            m_bRxFlowOff = FALSE;
+        }
+    }
+}
+
+void CSerialPort::SetRxWatermarks()
+{
+    // what fits: the driver's input queue and the ring of Read() or the blocks of the pool
+    DWORD nFits = m_nWriteBufferSize + ( ( m_pRxRing != NULL ) ? m_nRxRingSize : 0 ) + m_nRxPoolBlocks * m_nRxChunkSize;
+
+    m_nRxHighWater = ( m_FlowControl.nHighWater > 0 ) ? m_FlowControl.nHighWater : nFits / 4 * 3;
+    m_nRxLowWater = ( m_FlowControl.nLowWater > 0 ) ? m_FlowControl.nLowWater : nFits / 4;
+
+    // a default that would cross the one given keeps the ratio of the defaults to it instead
+    if ( m_nRxLowWater >= m_nRxHighWater )
+    {
+        if ( m_FlowControl.nLowWater == 0 )
+        {
+            m_nRxLowWater = m_nRxHighWater / 3;
+        }
+        else
+        {
+            m_nRxHighWater = m_nRxLowWater * 3;
+        }
+    }
+}
+
+void CSerialPort::SetFlowDcb( DCB *pDcb )
+{
+    DWORD dwFlow = m_FlowControl.dwFlow;
+
+    // the driver holds our writes back, the engine moves RTS and DTR and sends XON/XOFF itself
+    pDcb->fOutxCtsFlow = ( dwFlow & SERIAL_FLOW_RTSCTS ) ? TRUE : FALSE;
+    pDcb->fRtsControl = ( dwFlow & SERIAL_FLOW_RTSCTS ) ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
+    pDcb->fOutxDsrFlow = ( dwFlow & SERIAL_FLOW_DTRDSR ) ? TRUE : FALSE;
+    pDcb->fDtrControl = ( dwFlow & SERIAL_FLOW_DTRDSR ) ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
+    pDcb->fOutX = ( dwFlow & SERIAL_FLOW_XONXOFF ) ? TRUE : FALSE;
+    pDcb->fInX = FALSE;
+    pDcb->fTXContinueOnXoff = pDcb->fOutX;
+
+    if ( dwFlow & SERIAL_FLOW_XONXOFF )
+    {
+        pDcb->XonChar = SERIAL_XON;
+        pDcb->XoffChar = SERIAL_XOFF;
+    }
+}
+
+BOOL CSerialPort::ApplyTimeouts()
+{
+    COMMTIMEOUTS Timeouts = m_CommTimeouts;
+
+    // a write held back by the peer waits for it, a timeout would cut the batch short
+    if ( m_FlowControl.dwFlow != 0 )
+    {
+        Timeouts.WriteTotalTimeoutMultiplier = 0;
+        Timeouts.WriteTotalTimeoutConstant = 0;
+    }
+
+    return CSerialVirtual::SetCommTimeouts( m_hComm, &Timeouts );
+}
+
+DWORD CSerialPort::GetCommMask()
+{
+    // EV_RXFLAG only so the driver sees EvtChar, it is not reported unless asked for
+    return m_dwCommEvents | ( m_bEventChar ? EV_RXFLAG : 0 ) |
+           ( ( m_FlowControl.dwFlow & SERIAL_FLOW_RTSCTS ) ? EV_CTS : 0 ) |
+           ( ( m_FlowControl.dwFlow & SERIAL_FLOW_DTRDSR ) ? EV_DSR : 0 );
+}
+
+BOOL CSerialPort::SetPeerFlow( BOOL bGo )       // FALSE stops the peer, TRUE lets it go on
+{
+    // a DCB of SetDCB() may have handed a line to the driver's own handshake, it is not ours to move then
+    if ( ( m_FlowControl.dwFlow & SERIAL_FLOW_RTSCTS ) && ( m_dcb.fRtsControl == RTS_CONTROL_ENABLE ) &&
+         !CSerialVirtual::EscapeCommFunction( m_hComm, bGo ? SETRTS : CLRRTS ) )
+    {
+        ReportError( SERIAL_STEP_ESCAPECOMMFUNCTION );
+        return FALSE;
+    }
+
+    if ( ( m_FlowControl.dwFlow & SERIAL_FLOW_DTRDSR ) && ( m_dcb.fDtrControl == DTR_CONTROL_ENABLE ) &&
+         !CSerialVirtual::EscapeCommFunction( m_hComm, bGo ? SETDTR : CLRDTR ) )
+    {
+        ReportError( SERIAL_STEP_ESCAPECOMMFUNCTION );
+        return FALSE;
+    }
+
+    // goes out ahead of the queued writes
+    if ( ( m_FlowControl.dwFlow & SERIAL_FLOW_XONXOFF ) && !m_dcb.fInX &&
+         !CSerialVirtual::TransmitCommChar( m_hComm, bGo ? SERIAL_XON : SERIAL_XOFF ) )
+    {
+        ReportError( SERIAL_STEP_TRANSMITCOMMCHAR );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void CSerialPort::UpdateTxHold( const COMSTAT *pStat )
+{
+    BOOL bHeld = pStat->fCtsHold || pStat->fDsrHold || pStat->fXoffHold;
+
+    // the driver keeps the write pending meanwhile, the thread sleeps until it completes
+    if ( bHeld && !m_bTxHeld )
+    {
+        CSerialStats::Add( &m_Stats.llTxFlowStalls );
+    }
+
+    m_bTxHeld = bHeld;
+}
+
+BOOL CSerialPort::OnDeadline()
+{
+    LONGLONG llNow = GetTimestamp();
+
+    if ( ( GetRxDeadline() <= llNow ) && !OnRxDeadline() )
+    {
+        return FALSE;
+    }
+
+    // after the receive side, so bytes held for coalescing reach the framer first
+    if ( ( m_pFramer != NULL ) && ( m_pFramer->GetDeadline() <= llNow ) )
+    {
+        m_pFramer->OnDeadline( llNow );
+    }
+
+    if ( m_llTxDeadline <= llNow )
+    {
+        // WriteChar() sets it again if the write still has to wait
+        m_llTxDeadline = MAXLONGLONG;
+
+        if ( m_bThreadAlive )
+        {
+            return OnTransmit();
+        }
+    }
+
+    return TRUE;
+}
+
+void CSerialPort::Notify( WPARAM wParam, LPARAM lParam )
+{
+    if ( m_pOwner != NULL )
+    {
+        ::PostMessage( m_pOwner, SERIAL_PORT_MESSAGE, wParam, lParam );
+    }
+}
+
+DWORD CSerialPort::Read( void *Buffer, DWORD nSize )
+{
+    DWORD nMask;
+    DWORD nTail;
+    DWORD nFirst;
+    assert( Buffer != NULL );
+
+    if ( m_pRxRing == NULL )
+    {
+        return 0;
+    }
+
+    nMask = m_nRxRingSize - 1;
+    nTail = ( DWORD )m_nRxTail;
+    nSize = min( nSize, ( DWORD )m_nRxHead - nTail );
+    nFirst = min( nSize, m_nRxRingSize - ( nTail & nMask ) );
+    memcpy( Buffer, m_pRxRing + ( nTail & nMask ), nFirst );
+    memcpy( ( BYTE * )Buffer + nFirst, m_pRxRing, nSize - nFirst );
+    InterlockedExchangeAdd( &m_nRxTail, ( LONG )nSize );
+
+    // the comm thread looks at the watermarks again
+    if ( ( nSize > 0 ) && ( m_bRxFlowOff || m_bRxHeld ) )
+    {
+        WakeUp();
+    }
+
+    return nSize;
+}
+
+DWORD CSerialPort::GetRxCount()
+{
+    return ( DWORD )m_nRxHead - ( DWORD )m_nRxTail;
+}
+
+BOOL CSerialPort::SetRxMode( SERIAL_RX_MODE mode,          // SERIAL_RX_BYTE or SERIAL_RX_CHUNK
+                             UINT nChunkSize,              // largest block read and delivered at once
+                             DWORD dwCoalesceTime,         // ms to keep filling a chunk after its first byte
+                             SERIAL_RX_CALLBACK pfnCallback,
+                             LPVOID pContext,
+                             UINT nRingSize )              // Read() buffer when there is no callback
+{
+    if ( IsOpen() || ( nChunkSize == 0 ) || ( nRingSize == 0 ) )
+    {
+        return FALSE;
+    }
+
+    m_RxMode = mode;
+    m_nRxChunkSize = nChunkSize;
+    m_dwRxCoalesceTime = dwCoalesceTime;
+    m_pfnRxCallback = pfnCallback;
+    m_pRxContext = pContext;
+    m_nRxRingSize = 1;
+
+    while ( m_nRxRingSize < nRingSize )
+    {
+        m_nRxRingSize <<= 1;
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialPort::SetReactor( CSerialReactor *pReactor )     // NULL runs the port on its own thread
+{
+    // a shard does not reconnect, it would hold up every other port of it while the device is gone
+    if ( IsOpen() || ( ( pReactor != NULL ) && ( m_Reconnect.dwInitialDelay != 0 ) ) )
+    {
+        return FALSE;
+    }
+
+    m_pReactor = pReactor;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetFramer( CSerialFramer *pFramer )       // NULL hands out raw chunks, only used with SERIAL_RX_CHUNK
+{
+    if ( IsOpen() )
+    {
+        return FALSE;
+    }
+
+    m_pFramer = pFramer;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetRxPool( UINT nBlocks,                          // receive blocks of the chunk size, 0 reads into one fixed buffer
+                             SERIAL_CHUNK_CALLBACK pfnCallback,      // gets each chunk as a handle it may keep
+                             LPVOID pContext )
+{
+    if ( IsOpen() || ( ( nBlocks == 0 ) && ( pfnCallback != NULL ) ) )
+    {
+        return FALSE;
+    }
+
+    m_nRxPoolBlocks = nBlocks;
+    m_pfnChunkCallback = pfnCallback;
+
+    if ( pfnCallback != NULL )
+    {
+        m_pRxContext = pContext;
+    }
+
+    return TRUE;
+}
+
+DWORD CSerialPort::GetRxExhaustedCount()
+{
+    return m_RxPool.GetExhaustedCount();
+}
+
+BOOL CSerialPort::SetEventChar( BOOL bEnable,            // FTDI and some other USB adapters send their buffer at once on EvtChar
+                                char EvtChar )           // e.g. the delimiter of CSerialDelimiterFramer
+{
+    if ( IsOpen() )
+    {
+        return FALSE;
+    }
+
+    m_bEventChar = bEnable;
+    m_EventChar = EvtChar;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetTxSchedule( const SERIAL_TX_SCHEDULE *pSchedule )     // NULL goes back to strict priority without pacing
+{
+    if ( IsOpen() || ( ( pSchedule != NULL ) && ( pSchedule->nRate > 0 ) && ( pSchedule->nBurst == 0 ) ) )
+    {
+        return FALSE;
+    }
+
+    if ( pSchedule != NULL )
+    {
+        m_TxSchedule = *pSchedule;
+    }
+    else
+    {
+        memset( &m_TxSchedule, 0, sizeof( m_TxSchedule ) );
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialPort::SetCapture( CSerialCapture *pCapture )    // created by the caller, NULL stops capturing at the next Open()
+{
+    if ( IsOpen() )
+    {
+        return FALSE;
+    }
+
+    m_pCapture = pCapture;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetBroadcast( CSerialBroadcast *pBroadcast )  // created by the caller, see CSerialBroadcast::Attach()
+{
+    if ( IsOpen() )
+    {
+        return FALSE;
+    }
+
+    m_pBroadcast = pBroadcast;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetEventRing( CSerialEventRing *pRing,   // created by the caller and shared by any number of ports, NULL falls back to SERIAL_EV_ERROR
+                               UINT nRate )                 // events per second and code, 0 unlimited
+{
+    if ( IsOpen() )
+    {
+        return FALSE;
+    }
+
+    m_pEventRing = pRing;
+    m_nEventRate = nRate;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetReconnect( const SERIAL_RECONNECT *pReconnect )   // NULL or a zero dwInitialDelay stops on the first error as before
+{
+    if ( IsOpen() || ( ( pReconnect != NULL ) && ( pReconnect->dwMaxDelay < pReconnect->dwInitialDelay ) ) )
+    {
+        return FALSE;
+    }
 
-                if ( SetCommState( m_hComm, &m_dcb ) == 0 )
-                {
-                    ProcessErrorMessage( "SetCommState()" );
-                    ret = FALSE;
-                    goto done;
-                }
-            }
-            else
-            {
-                ProcessErrorMessage( "GetCommState()" );
-                ret = FALSE;
-                goto done;
-            }
-        }
-        else
-        {
-            ProcessErrorMessage( "SetCommMask()" );
-            ret = FALSE;
-            goto done;
-        }
+    if ( ( pReconnect != NULL ) && ( pReconnect->dwInitialDelay != 0 ) && ( m_pReactor != NULL ) )
+    {
+        // reconnects run on the comm thread, see SetReactor()
+        return FALSE;
+    }
+
+    if ( pReconnect != NULL )
+    {
+        m_Reconnect = *pReconnect;
     }
     else
     {
-        ProcessErrorMessage( "SetCommTimeouts()" );
-        ret = FALSE;
-        goto done;
+        memset( &m_Reconnect, 0, sizeof( m_Reconnect ) );
     }
 
-    // set the SetupComm parameter into device control.
-    if ( !SetupComm( m_hComm, m_nWriteBufferSize, m_nWriteBufferSize ) )
+    return TRUE;
+}
+
+BOOL CSerialPort::SetTxChecksum( SERIAL_CHECKSUM_TYPE Type )    // appended to every write, commands and empty writes excepted
+{
+    if ( IsOpen() || ( ( UINT )Type >= SERIAL_CHECKSUM_TYPES ) )
     {
-        ProcessErrorMessage( "SetupComm()" );
-        ret = FALSE;
-        goto done;
+        return FALSE;
     }
 
-    // flush the port
-    if ( !PurgeComm( m_hComm, PURGE_RXCLEAR | PURGE_TXCLEAR | PURGE_RXABORT | PURGE_TXABORT ) )
+    m_TxChecksum = Type;
+    return TRUE;
+}
+
+BOOL CSerialPort::SetBusyPoll( const SERIAL_BUSY_POLL *pBusyPoll )    // NULL blocks right away, any core, normal priority
+{
+    if ( IsOpen() || ( ( pBusyPoll != NULL ) && ( pBusyPoll->nCore >= ( int )( 8 * sizeof( DWORD_PTR ) ) ) ) )
     {
-        ProcessErrorMessage( "PurgeComm()" );
-        ret = FALSE;
-        goto done;
+        return FALSE;
     }
 
-    m_bThreadAlive = TRUE;
-    m_bUserRequestClose = FALSE;
-    assert( m_Thread == NULL );
-    m_Thread = ::CreateThread(NULL, 0, CommThread, this, 0, NULL);
+    if ( pBusyPoll != NULL )
+    {
+        m_BusyPoll = *pBusyPoll;
+    }
+    else
+    {
+        m_BusyPoll.dwSpinTime = 0;
+        m_BusyPoll.nCore = -1;
+        m_BusyPoll.nPriority = THREAD_PRIORITY_NORMAL;
+    }
 
-    if (m_Thread == NULL)
+    return TRUE;
+}
+
+BOOL CSerialPort::SetFlowControl( const SERIAL_FLOW_CONTROL *pFlowControl )   // NULL leaves the lines alone as Open() always did
+{
+    // either watermark may be left 0 for its default, two given ones must leave a gap
+    if ( IsOpen() || ( ( pFlowControl != NULL ) && ( pFlowControl->nHighWater > 0 ) && ( pFlowControl->nLowWater > 0 ) &&
+                       ( pFlowControl->nLowWater >= pFlowControl->nHighWater ) ) )
     {
-        ProcessErrorMessage( "CreateThread()" );
-        ret = FALSE;
-        m_bThreadAlive = FALSE;
-        goto done;
+        return FALSE;
     }
 
-done:
-    LeaveCriticalSection( &m_csCommunicationSync );
+    if ( pFlowControl != NULL )
+    {
+        m_FlowControl = *pFlowControl;
+    }
+    else
+    {
+        memset( &m_FlowControl, 0, sizeof( m_FlowControl ) );
+    }
 
-    if ( !ret )
+    return TRUE;
+}
+
+BOOL CSerialPort::SetReplay( CSerialReplay *pReplay,        // opened by the caller, Open() then reads it instead of a device
+                             double dSpeed )                // 1.0 keeps the recorded timing, 4.0 is four times as fast, 0 as fast as possible
+{
+    if ( IsOpen() || ( dSpeed < 0 ) )
     {
-        Close();
+        return FALSE;
     }
 
-    return ret;
+    m_pReplay = pReplay;
+    m_dReplaySpeed = dSpeed;
+    return TRUE;
 }
 
-DWORD WINAPI CSerialPort::CommThread( LPVOID pParam )
+HKEY CSerialPort::OpenDeviceParameters( UINT port, REGSAM samDesired )
 {
-    CSerialPort *pPort = ( CSerialPort * )pParam;
+    HKEY  hBus;
+    HKEY  hDevice;
+    HKEY  hParameters = NULL;
+    TCHAR szDevice[MAX_PATH];
+    TCHAR szInstance[MAX_PATH];
+    TCHAR szPath[MAX_PATH + 32];
+    TCHAR szPortName[32];
+    TCHAR szWanted[32];
+    DWORD cchName;
+    DWORD cbData;
+    DWORD i;
+    DWORD j;
+
+    if ( RegOpenKeyEx( HKEY_LOCAL_MACHINE, SERIAL_FTDI_ENUM_KEY, 0, KEY_READ, &hBus ) != ERROR_SUCCESS )
+    {
+        // no FTDI driver installed
+        return NULL;
+    }
 
-    while ( pPort->m_bThreadAlive )
+    sprintf( szWanted, _T( "%s%d" ), SERIAL_DEVICE_PREFIX, (signed int)port );
+
+    // FTDIBUS\<VID+PID+serial>\<instance>\Device Parameters, PortName tells the COM number
+    for ( i = 0; hParameters == NULL; i++ )
     {
-        if ( pPort->m_bUserRequestClose )
+        cchName = MAX_PATH;
+
+        if ( RegEnumKeyEx( hBus, i, szDevice, &cchName, NULL, NULL, NULL, NULL ) != ERROR_SUCCESS )
         {
             break;
         }
 
-        if (pPort->m_nWriteSize > 0)
+        if ( RegOpenKeyEx( hBus, szDevice, 0, KEY_READ, &hDevice ) != ERROR_SUCCESS )
+        {
+            continue;
+        }
+
+        for ( j = 0; hParameters == NULL; j++ )
         {
-            UINT BytesSent = WriteChar(pPort);
+            cchName = MAX_PATH;
 
-            if (EOF != BytesSent)
+            if ( RegEnumKeyEx( hDevice, j, szInstance, &cchName, NULL, NULL, NULL, NULL ) != ERROR_SUCCESS )
             {
-                ::PostMessage(pPort->m_pOwner, SERIAL_PORT_MESSAGE, ( WPARAM )EV_TXEMPTY, ( LPARAM )BytesSent);
+                break;
             }
-            else
+
+            sprintf( szPath, _T( "%s\\Device Parameters" ), szInstance );
+
+            if ( RegOpenKeyEx( hDevice, szPath, 0, samDesired | KEY_QUERY_VALUE, &hParameters ) != ERROR_SUCCESS )
             {
-                break;
+                hParameters = NULL;
+                continue;
+            }
+
+            cbData = sizeof( szPortName ) - sizeof( TCHAR );
+            memset( szPortName, 0, sizeof( szPortName ) );
+
+            if ( ( RegQueryValueEx( hParameters, _T( "PortName" ), NULL, NULL, ( LPBYTE )szPortName, &cbData ) != ERROR_SUCCESS ) ||
+                 ( lstrcmpi( szPortName, szWanted ) != 0 ) )
+            {
+                RegCloseKey( hParameters );
+                hParameters = NULL;
             }
         }
 
-        ReceiveChar(pPort);
+        RegCloseKey( hDevice );
     }
 
-    pPort->m_bThreadAlive = FALSE;
-    ::ExitThread(0);
-    //return 0;
+    RegCloseKey( hBus );
+    return hParameters;
 }
 
-void CSerialPort::ProcessErrorMessage( char *ErrorText )
+DWORD CSerialPort::GetLatencyTimer( UINT port )           // ms, 0 when the port is not on an FTDI driver
 {
-    char *Temp;
-    char *lpMsgBuf = NULL;
-    DWORD dwError = GetLastError();
+    HKEY  hKey = OpenDeviceParameters( port, KEY_QUERY_VALUE );
+    DWORD dwLatency = 0;
+    DWORD cbData = sizeof( dwLatency );
 
-    if ( FormatMessage(
-                FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM,
-                NULL,
-                dwError,
-                MAKELANGID( LANG_NEUTRAL, SUBLANG_DEFAULT ),
-                ( LPTSTR )&lpMsgBuf,
-                0,
-                NULL
-            ) > 0 )
+    if ( hKey != NULL )
     {
-        if (lpMsgBuf != NULL)
+        if ( RegQueryValueEx( hKey, _T( "LatencyTimer" ), NULL, NULL, ( LPBYTE )&dwLatency, &cbData ) != ERROR_SUCCESS )
         {
-            Temp = ( char * )LocalAlloc( LMEM_ZEROINIT, ( lstrlen( ( LPCTSTR )lpMsgBuf ) + INT16_MAX ) );
-
-            if ( Temp != NULL )
-            {
-                sprintf( Temp, _T( "ERROR:\"%s\" failed with the following error:\n\ndwError=%d\n%s\nPort:%s%d\n" ), ( char * )ErrorText, (signed int)dwError, lpMsgBuf, SERIAL_DEVICE_PREFIX, (signed int)m_nPortNr );
-                AfxMessageBox(Temp, MB_OK | MB_ICONERROR | MB_SYSTEMMODAL | MB_TOPMOST);
-                LocalFree( Temp );
-            }
-
-            LocalFree( lpMsgBuf );
+            dwLatency = 0;
         }
 
-        assert(dwError == ERROR_SUCCESS);
+        RegCloseKey( hKey );
     }
+
+    return dwLatency;
 }
 
-UINT CSerialPort::WriteChar( CSerialPort *pPort )
+BOOL CSerialPort::SetLatencyTimer( UINT port,             // portnumber of an FTDI adapter
+                                   DWORD dwMilliseconds ) // 1..255, how long the chip holds a partly filled USB packet
 {
-    BOOL bResult;
-    DWORD Sent = 0;
-    EnterCriticalSection( &pPort->m_csCommunicationSync );
-    bResult = WriteFile( pPort->m_hComm,
-                         pPort->m_szWriteBuffer,
-                         pPort->m_nWriteSize,
-                         &Sent,
-                         NULL);
-    LeaveCriticalSection( &pPort->m_csCommunicationSync );
+    HKEY hKey;
+    BOOL ret;
 
-    if ( !bResult )
+    if ( ( dwMilliseconds == 0 ) || ( dwMilliseconds > SERIAL_LATENCY_TIMER_MAX ) )
     {
-        pPort->ProcessErrorMessage("WriteFile()");
-        pPort->m_nWriteSize = 0;
-        return (UINT)EOF; //break;
+        return FALSE;
     }
-    else
+
+    // needs administrator rights, the driver reads the value when the port is opened
+    hKey = OpenDeviceParameters( port, KEY_SET_VALUE );
+
+    if ( hKey == NULL )
     {
-        assert ( Sent == (DWORD)pPort->m_nWriteSize );
-        pPort->m_nWriteSize = 0;
-        return (UINT)Sent;
+        return FALSE;
     }
+
+    ret = ( RegSetValueEx( hKey, _T( "LatencyTimer" ), 0, REG_DWORD, ( const BYTE * )&dwMilliseconds, sizeof( dwMilliseconds ) ) == ERROR_SUCCESS );
+    RegCloseKey( hKey );
+    return ret;
 }
 
-BOOL CSerialPort::ReceiveChar( CSerialPort *pPort )
+void CSerialPort::InitOpenRequest( SERIAL_OPEN_REQUEST *pRequest,  // filled with the defaults of Open()
+                                   CSerialPort *pPort,
+                                   HWND hOwner,
+                                   UINT port,
+                                   UINT baud )
 {
-    BOOL  bResult = TRUE;
-    DWORD BytesRead = 0;
-    unsigned char RXBuff;
+    memset( pRequest, 0, sizeof( SERIAL_OPEN_REQUEST ) );
+    pRequest->pPort = pPort;
+    pRequest->hOwner = hOwner;
+    pRequest->nPort = port;
+    pRequest->nBaud = baud;
+    pRequest->Parity = NOPARITY;
+    pRequest->DataBits = 8;
+    pRequest->StopBits = ONESTOPBIT;
+    pRequest->dwCommEvents = EV_RXCHAR;
+    pRequest->nBufferSize = 4096;
+    pRequest->ReadIntervalTimeout = MAXDWORD;
+    pRequest->WriteTotalTimeoutMultiplier = 10;
+    pRequest->WriteTotalTimeoutConstant = 10;
+}
 
-    while ( pPort->m_bThreadAlive )
+// returns the number of ports opened, every request tells its own outcome
+UINT CSerialPort::OpenMany( SERIAL_OPEN_REQUEST *pRequests,
+                            UINT nCount,
+                            UINT nParallel,                 // Open() calls at once, a missing or slow port only holds up one of them
+                            CSerialReactor *pReactor )      // set on every port, so no comm thread is started per port
+{
+    SERIAL_OPEN_BATCH Batch;
+    HANDLE hWorkers[MAXIMUM_WAIT_OBJECTS];
+    UINT nWorkers = 0;
+    UINT nOpened = 0;
+    UINT i;
+
+    Batch.pRequests = pRequests;
+    Batch.nCount = nCount;
+    Batch.nNext = 0;
+    Batch.pReactor = pReactor;
+    nParallel = min( min( nParallel, nCount ), MAXIMUM_WAIT_OBJECTS );
+
+    // the calling thread is one of the workers, fewer threads than asked for only slow the batch down
+    while ( nWorkers + 1 < nParallel )
     {
-        if ( pPort->m_bUserRequestClose )
+        hWorkers[nWorkers] = ::CreateThread( NULL, 0, OpenWorker, &Batch, 0, NULL );
+
+        if ( hWorkers[nWorkers] == NULL )
         {
             break;
         }
 
-        EnterCriticalSection( &pPort->m_csCommunicationSync );
-        bResult = ReadFile( pPort->m_hComm,      // Handle to COMM port
-                            &RXBuff,             // RX Buffer Pointer
-                            sizeof( RXBuff ),    // Read one byte
-                            &BytesRead,          // Stores number of bytes read
-                            NULL);
-        LeaveCriticalSection( &pPort->m_csCommunicationSync );
+        nWorkers++;
+    }
+
+    OpenWorker( &Batch );
+
+    if ( nWorkers > 0 )
+    {
+        WaitForMultipleObjects( nWorkers, hWorkers, TRUE, INFINITE );
+    }
+
+    for ( i = 0; i < nWorkers; i++ )
+    {
+        CloseHandle( hWorkers[i] );
+    }
 
-        if (bResult && (BytesRead > 0) && (BytesRead <= sizeof(RXBuff)))
+    for ( i = 0; i < nCount; i++ )
+    {
+        if ( pRequests[i].bOpened )
         {
-            ::PostMessage( pPort->m_pOwner, SERIAL_PORT_MESSAGE, ( WPARAM )  EV_RXCHAR, ( LPARAM ) RXBuff );
+            nOpened++;
         }
-        else if ((!bResult) && (ERROR_ACCESS_DENIED == GetLastError()))
+    }
+
+    return nOpened;
+}
+
+DWORD WINAPI CSerialPort::OpenWorker( LPVOID pParam )
+{
+    SERIAL_OPEN_BATCH *pBatch = ( SERIAL_OPEN_BATCH * )pParam;
+    SERIAL_OPEN_REQUEST *pRequest;
+    LONGLONG llStart;
+    UINT i;
+
+    while ( ( i = ( UINT )InterlockedIncrement( &pBatch->nNext ) - 1 ) < pBatch->nCount )
+    {
+        pRequest = &pBatch->pRequests[i];
+        llStart = GetTimestamp();
+        pRequest->bOpened = FALSE;
+        pRequest->dwError = ERROR_SUCCESS;
+
+        if ( ( pBatch->pReactor != NULL ) && !pRequest->pPort->SetReactor( pBatch->pReactor ) )
         {
-            pPort->ProcessErrorMessage("ReadFile()");
-            return FALSE;
+            // still open from before, or set up to reconnect
+            pRequest->dwError = pRequest->pPort->IsOpen() ? ERROR_BUSY : ERROR_NOT_SUPPORTED;
         }
         else
         {
-            ::Sleep( MAX_PATH );
-            break;
+            pRequest->bOpened = pRequest->pPort->Open( pRequest->hOwner, pRequest->nPort, pRequest->nBaud,
+                                                       pRequest->Parity, pRequest->DataBits, pRequest->StopBits,
+                                                       pRequest->dwCommEvents, pRequest->nBufferSize,
+                                                       pRequest->ReadIntervalTimeout, pRequest->ReadTotalTimeoutMultiplier,
+                                                       pRequest->ReadTotalTimeoutConstant, pRequest->WriteTotalTimeoutMultiplier,
+                                                       pRequest->WriteTotalTimeoutConstant );
+
+            if ( !pRequest->bOpened )
+            {
+                pRequest->dwError = GetLastError();
+            }
         }
+
+        pRequest->llElapsed = GetTimestamp() - llStart;
     }
 
-    return TRUE;
+    return 0;
+}
+
+LONGLONG CSerialPort::GetTimestamp()
+{
+    static LARGE_INTEGER Frequency = { 0 };
+    LARGE_INTEGER Counter;
+
+    if ( Frequency.QuadPart == 0 )
+    {
+        QueryPerformanceFrequency( &Frequency );
+    }
+
+    QueryPerformanceCounter( &Counter );
+    return ( Counter.QuadPart / Frequency.QuadPart ) * 1000000 + ( ( Counter.QuadPart % Frequency.QuadPart ) * 1000000 ) / Frequency.QuadPart;
 }
 
 DCB *CSerialPort::GetDCB()
@@ -326,239 +2833,406 @@ DCB *CSerialPort::GetDCB()
 
 BOOL CSerialPort::SetDCB( DCB *dcb )
 {
-    BOOL ret = TRUE;
-    assert( m_hComm != INVALID_HANDLE_VALUE );
+    SERIAL_COMMAND Command;
+    SERIAL_COMMAND_DONE Done;
+    assert( IsOpen() );
     assert( dcb != NULL );
 
-    do
+    if ( m_bReplaying )
     {
-        ::Sleep( 0 );
+        // no device behind a replay, the settings are only kept
+        m_dcb = *dcb;
+        return TRUE;
     }
-    while ( m_nWriteSize );
 
-    EnterCriticalSection( &m_csCommunicationSync );
-    m_dcb = *dcb;
+    if ( !m_bThreadAlive && !m_bReconnecting && ( m_Reconnect.dwInitialDelay == 0 ) )
+    {
+        // the thread stopped for good, nothing would apply it
+        return FALSE;
+    }
 
-    if ( SetCommState( m_hComm, &m_dcb ) == 0 )
+    if ( GetCurrentThreadId() == m_dwThreadId )
     {
-        ProcessErrorMessage( "SetCommState()" );
-        ret = FALSE;
+        // a callback on the thread that sends for the port cannot wait for that thread: the driver
+        // gets it at once, ahead of the bytes still queued. Between reconnect attempts it is kept
+        // for the next one
+        EnterCriticalSection( &m_csCommunicationSync );
+        Done.bApplied = ( m_hComm == INVALID_HANDLE_VALUE ) || CSerialVirtual::SetCommState( m_hComm, dcb );
+
+        if ( Done.bApplied )
+        {
+            m_dcb = *dcb;
+        }
+
+        LeaveCriticalSection( &m_csCommunicationSync );
+
+        if ( !Done.bApplied )
+        {
+            ReportError( SERIAL_STEP_SETCOMMSTATE );
+        }
+
+        return Done.bApplied;
     }
 
-    LeaveCriticalSection( &m_csCommunicationSync );
-    return ret;
+    // the comm thread applies it behind the bytes queued so far, new writes stay behind it
+    memset( &Command, 0, sizeof( Command ) );
+    Command.Code = SERIAL_COMMAND_DCB;
+    Command.dcb = *dcb;
+    Done.bApplied = FALSE;
+    Done.hDone = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+    if ( Done.hDone == NULL )
+    {
+        ReportError( SERIAL_STEP_CREATEEVENT );
+        return FALSE;
+    }
+
+    if ( WriteCommand( &Command, SERIAL_PRIORITY_NORMAL, INFINITE, SignalCommandDone, &Done ) == SERIAL_WRITE_OK )
+    {
+        WaitForSingleObject( Done.hDone, INFINITE );
+    }
+
+    CloseHandle( Done.hDone );
+    return Done.bApplied;
 }
 
 BOOL CSerialPort::IsOpen()
 {
-    return m_hComm != INVALID_HANDLE_VALUE;
+    // a port waiting to reconnect stays open until Close()
+    return ( m_hComm != INVALID_HANDLE_VALUE ) || m_bReplaying || m_bReconnecting;
 }
 
 void CSerialPort::Close()
 {
-    if ( (!m_bUserRequestClose) && (m_bThreadAlive) )
-    {
-        m_bUserRequestClose = TRUE;
+    UINT  i;
+    BOOL  bWasOpen = IsOpen();
 
-        do
-        {
-            ::Sleep( 0 );
-        }
-        while ( m_bThreadAlive );
+    // refused from now on, and once every producer committed or gave up nothing reserved is left
+    // in front of the drain below: every write that got in gets its completion
+    for ( i = 0; i < SERIAL_TX_PRIORITIES; i++ )
+    {
+        m_TxQueue[i].Close();
+    }
 
-        m_bUserRequestClose = FALSE;
+    if ( m_Thread != NULL )
+    {
+        SetEvent( m_hCloseEvent );
+        WaitForSingleObject( m_Thread, INFINITE );
+    }
+    else if ( m_hReactorPort != NULL )
+    {
+        // the shard signals m_hCloseEvent once nothing of this port is queued
+        PostQueuedCompletionStatus( m_hReactorPort, SERIAL_SIGNAL_CLOSE, ( ULONG_PTR )this, &m_ovSignal );
+        WaitForSingleObject( m_hCloseEvent, INFINITE );
+        m_hReactorPort = NULL;
     }
 
+    m_ovRead.hEvent = ( HANDLE )( ( DWORD_PTR )m_ovRead.hEvent & ~( DWORD_PTR )1 );
+
     EnterCriticalSection( &m_csCommunicationSync );
 
     if ( m_hComm != INVALID_HANDLE_VALUE )
     {
-        CloseHandle( m_hComm );
+        CSerialVirtual::CloseHandle( m_hComm );
         m_hComm = INVALID_HANDLE_VALUE;
     }
 
+    m_bReplaying = FALSE;
+    m_bReconnecting = FALSE;
+
     if ( m_szWriteBuffer != NULL )
     {
         delete [] m_szWriteBuffer;
         m_szWriteBuffer = NULL;
     }
 
+    // writes that did not make it out still get their completion
+    FailTx();
+
+    for ( i = 0; i < SERIAL_TX_PRIORITIES; i++ )
+    {
+        m_TxQueue[i].Destroy();
+    }
+
+    // a partial frame does not outlive the port, a transactor cancels what still waits for a response;
+    // only once, the destructor closes again after the owner may have freed the framer
+    if ( ( m_pFramer != NULL ) && bWasOpen )
+    {
+        m_pFramer->Reset();
+    }
+
+    if ( m_pRxBlock != NULL )
+    {
+        CSerialPool::Release( m_pRxBlock );
+        m_pRxBlock = NULL;
+        m_pRxChunk = NULL;
+    }
+    else if ( m_pRxChunk != NULL )
+    {
+        delete [] m_pRxChunk;
+        m_pRxChunk = NULL;
+    }
+
+    m_RxPool.Destroy();
+
+    if ( m_pRxRing != NULL )
+    {
+        delete [] m_pRxRing;
+        m_pRxRing = NULL;
+    }
+
     if ( m_Thread != NULL )
     {
         CloseHandle( m_Thread );
         m_Thread = NULL;
     }
 
+    m_dwThreadId = 0;
     LeaveCriticalSection( &m_csCommunicationSync );
 }
 
 void CSerialPort::Write( char *Buffer )
 {
-    int nSize;
-    int ttl;
-    assert( m_hComm != INVALID_HANDLE_VALUE );
     assert( Buffer != NULL );
-    nSize = strlen( Buffer );
-    assert( nSize > 0 );
-    EnterCriticalSection( &m_csCommunicationSync );
-    assert( ( m_nWriteSize + nSize ) < ( int )m_nWriteBufferSize );
-    strcpy( m_szWriteBuffer + m_nWriteSize, Buffer );
-    m_nWriteSize += nSize;
-    ttl = ((1000UL * (m_dcb.ByteSize + m_dcb.StopBits + 1) * m_nWriteSize) / m_dcb.BaudRate) + 1;
-    LeaveCriticalSection( &m_csCommunicationSync );
-
-    do
-    {
-        ::Sleep( 0 );
-    }
-    while ( m_nWriteSize );
-
-    ::Sleep( ttl );
+    Write( Buffer, ( int )strlen( Buffer ) );
 }
 
 void CSerialPort::Write( void *Buffer, int nSize )
 {
-    int ttl;
-    assert( m_hComm != INVALID_HANDLE_VALUE );
+    SERIAL_TX_COMPLETION Completion;
+    SERIAL_WRITE_RESULT ret;
+    assert( IsOpen() );
     assert( Buffer != NULL );
     assert( nSize > 0 );
-    EnterCriticalSection( &m_csCommunicationSync );
-    assert( ( m_nWriteSize + nSize ) < ( int )m_nWriteBufferSize );
-    memcpy( m_szWriteBuffer + m_nWriteSize, Buffer, nSize );
-    m_nWriteSize += nSize;
-    ttl = ((1000UL * (m_dcb.ByteSize + m_dcb.StopBits + 1) * m_nWriteSize) / m_dcb.BaudRate) + 1;
-    LeaveCriticalSection( &m_csCommunicationSync );
+    // returns once the bytes left the driver instead of sleeping for an estimate of the wire time
+    Completion.pfnCallback = SignalWriteDone;
+    Completion.pContext = CreateEvent( NULL, TRUE, FALSE, NULL );
 
-    do
+    if ( Completion.pContext == NULL )
     {
-        ::Sleep( 0 );
+        ReportError( SERIAL_STEP_CREATEEVENT );
+        return;
     }
-    while ( m_nWriteSize );
 
-    ::Sleep( ttl );
+    ret = Enqueue( Buffer, ( DWORD )nSize, SERIAL_PRIORITY_NORMAL, INFINITE, &Completion );
+
+    if ( ret == SERIAL_WRITE_OK )
+    {
+        WaitForSingleObject( ( HANDLE )Completion.pContext, INFINITE );
+    }
+    else
+    {
+        // larger than the nBufferSize of Open() or the port is closing, nothing went out
+        SetLastError( ( ret == SERIAL_WRITE_TOO_LARGE ) ? ERROR_INSUFFICIENT_BUFFER : ERROR_INVALID_HANDLE );
+        ReportError( SERIAL_STEP_ENQUEUE );
+    }
+
+    CloseHandle( ( HANDLE )Completion.pContext );
+}
+
+SERIAL_WRITE_RESULT CSerialPort::WriteAsync( const void *Buffer, DWORD nSize, DWORD dwTimeout )
+{
+    return Enqueue( Buffer, nSize, SERIAL_PRIORITY_NORMAL, dwTimeout, NULL );
+}
+
+SERIAL_WRITE_RESULT CSerialPort::WriteAsync( const void *Buffer,                // copied, may be reused at once
+                                             DWORD nSize,                       // 0 only reports when earlier writes left the driver
+                                             DWORD dwTimeout,                   // ms to wait for room in the queue
+                                             SERIAL_TX_CALLBACK pfnCallback,    // called on the comm thread
+                                             LPVOID pContext )
+{
+    SERIAL_TX_COMPLETION Completion;
+    Completion.pfnCallback = pfnCallback;
+    Completion.pContext = pContext;
+    return Enqueue( Buffer, nSize, SERIAL_PRIORITY_NORMAL, dwTimeout, ( pfnCallback != NULL ) ? &Completion : NULL );
+}
+
+SERIAL_WRITE_RESULT CSerialPort::WriteAsync( const void *Buffer,
+                                             DWORD nSize,
+                                             SERIAL_PRIORITY Priority,          // transmit class, see SetTxSchedule()
+                                             DWORD dwTimeout,
+                                             SERIAL_TX_CALLBACK pfnCallback,
+                                             LPVOID pContext )
+{
+    SERIAL_TX_COMPLETION Completion;
+    Completion.pfnCallback = pfnCallback;
+    Completion.pContext = pContext;
+    return Enqueue( Buffer, nSize, Priority, dwTimeout, ( pfnCallback != NULL ) ? &Completion : NULL );
 }
 
-BOOL CSerialPort::QueryRegistry( HKEY hKey )
+SERIAL_WRITE_RESULT CSerialPort::WriteGather( const SERIAL_SPAN *pSpans,        // copied, may be reused at once
+                                              UINT nSpans,                      // sent back to back as one write
+                                              SERIAL_PRIORITY Priority,
+                                              DWORD dwTimeout,
+                                              SERIAL_TX_CALLBACK pfnCallback,
+                                              LPVOID pContext )
 {
-    TCHAR    achClass[MAX_PATH] = _T( "" );   // buffer for class name
-    DWORD    cchClassName = MAX_PATH;         // size of class string
-    DWORD    cSubKeys = 0;                    // number of subkeys
-    DWORD    cbMaxSubKey;                     // longest subkey size
-    DWORD    cchMaxClass;                     // longest class string
-    DWORD    cValues = 0;                     // number of values for key
-    DWORD    cchMaxValue;                     // longest value name
-    DWORD    cbMaxValueData;                  // longest value data
-    DWORD    cbSecurityDescriptor;            // size of security descriptor
-    FILETIME ftLastWriteTime;                 // last write time
-    DWORD    i;
-    DWORD    retCode;
-    TCHAR    *achValue = NULL;
-    DWORD    cchValue;
-    BOOL     ret = FALSE;
-    achValue = ( TCHAR * )LocalAlloc( LMEM_ZEROINIT, MAX_VALUE_NAME * sizeof( TCHAR ) );
+    SERIAL_TX_COMPLETION Completion;
+    assert( ( pSpans != NULL ) || ( nSpans == 0 ) );
+    Completion.pfnCallback = pfnCallback;
+    Completion.pContext = pContext;
+    return EnqueueGather( pSpans, nSpans, NULL, Priority, dwTimeout, ( pfnCallback != NULL ) ? &Completion : NULL, SERIAL_RECORD_DATA );
+}
+
+SERIAL_WRITE_RESULT CSerialPort::WriteChunk( const CSerialChunk &Chunk,         // not copied, the block must not change until the callback
+                                             SERIAL_PRIORITY Priority,
+                                             DWORD dwTimeout,
+                                             SERIAL_TX_CALLBACK pfnCallback,
+                                             LPVOID pContext )
+{
+    SERIAL_TX_COMPLETION Completion;
+    Completion.pfnCallback = pfnCallback;
+    Completion.pContext = pContext;
+    return EnqueueGather( NULL, 0, Chunk.IsEmpty() ? NULL : &Chunk, Priority, dwTimeout, ( pfnCallback != NULL ) ? &Completion : NULL, SERIAL_RECORD_DATA );
+}
 
-    if ( achValue != NULL )
+SERIAL_WRITE_RESULT CSerialPort::Enqueue( const void *Buffer, DWORD nSize, SERIAL_PRIORITY Priority, DWORD dwTimeout, const SERIAL_TX_COMPLETION *pCompletion,
+                                          DWORD dwType )        // SERIAL_RECORD_DATA or SERIAL_RECORD_COMMAND
+{
+    SERIAL_SPAN Span;
+    assert( ( Buffer != NULL ) || ( nSize == 0 ) );
+    Span.pData = Buffer;
+    Span.nSize = nSize;
+    return EnqueueGather( &Span, 1, NULL, Priority, dwTimeout, pCompletion, dwType );
+}
+
+SERIAL_WRITE_RESULT CSerialPort::EnqueueGather( const SERIAL_SPAN *pSpans,      // copied into the record one after the other
+                                                UINT nSpans,
+                                                const CSerialChunk *pChunk,     // instead of spans, only referenced
+                                                SERIAL_PRIORITY Priority,
+                                                DWORD dwTimeout,
+                                                const SERIAL_TX_COMPLETION *pCompletion,
+                                                DWORD dwType )
+{
+    SERIAL_RECORD *pRecord;
+    SERIAL_WRITE_RESULT ret;
+    SERIAL_TX_CHUNK *pTxChunk;
+    CSerialQueue *pQueue;
+    CSerialChecksum Checksum( m_TxChecksum );
+    BYTE  *pCopy;
+    DWORD nPrefix = ( pCompletion != NULL ) ? sizeof( SERIAL_TX_COMPLETION ) : 0;
+    DWORD nSize = ( pChunk != NULL ) ? pChunk->GetSize() : 0;
+    DWORD nInline;
+    DWORD nTrailer;
+    UINT  i;
+    assert( ( pChunk == NULL ) || ( nSpans == 0 ) );
+    assert( ( UINT )Priority < SERIAL_TX_PRIORITIES );
+
+    for ( i = 0; i < nSpans; i++ )
     {
-        retCode = RegQueryInfoKey(
-                      hKey,                    // key handle
-                      achClass,                // buffer for class name
-                      &cchClassName,           // size of class string
-                      NULL,                    // reserved
-                      &cSubKeys,               // number of subkeys
-                      &cbMaxSubKey,            // longest subkey size
-                      &cchMaxClass,            // longest class string
-                      &cValues,                // number of values for this key
-                      &cchMaxValue,            // longest value name
-                      &cbMaxValueData,         // longest value data
-                      &cbSecurityDescriptor,   // security descriptor
-                      &ftLastWriteTime );      // last write time
+        assert( ( pSpans[i].pData != NULL ) || ( pSpans[i].nSize == 0 ) );
+        nSize += pSpans[i].nSize;
+    }
 
-        if ( retCode == ERROR_SUCCESS )
-        {
-            for ( i = 0; i < sizeof( m_nComArray ) / sizeof( m_nComArray[0] ); i++ )
-            {
-                m_nComArray[i] = -1;
-            }
+    // a port whose thread ended on an error without a reconnect to wait for never sends this;
+    // FailTx() closed the queues, this only answers before reserving
+    if ( !m_bThreadAlive && !m_bReconnecting && ( m_Reconnect.dwInitialDelay == 0 ) )
+    {
+        return SERIAL_WRITE_CLOSED;
+    }
 
-            if ( cValues > 0 )
-            {
-                for ( i = 0; i < cValues; i++ )
-                {
-                    cchValue = MAX_VALUE_NAME;
-                    achValue[0] = '\0';
+    nTrailer = ( ( dwType == SERIAL_RECORD_DATA ) && ( nSize > 0 ) ) ? CSerialChecksum::GetTrailerSize( m_TxChecksum ) : 0;
+    nInline = ( pChunk != NULL ) ? sizeof( SERIAL_TX_CHUNK ) : nSize;
+    pQueue = &m_TxQueue[Priority];
+    ret = pQueue->Reserve( nPrefix + nInline + nTrailer, dwTimeout, &pRecord );
 
-                    if ( ERROR_SUCCESS == RegEnumValue( hKey, i, achValue, &cchValue, NULL, NULL, NULL, NULL ) )
-                    {
-                        CString szName( achValue );
-
-                        if ( szName.MakeUpper().Trim().Find( CString( _T( "\\Device\\" ) ).MakeUpper().Trim() ) == 0 )
-                        {
-                            DWORD    nValueType = 0;
-                            BYTE     strDSName[MAX_PATH];
-                            DWORD    nBuffLen = sizeof( strDSName );
-                            memset( strDSName, 0, sizeof( strDSName ) );
-
-                            if ( ERROR_SUCCESS == RegQueryValueEx( hKey, ( LPCTSTR )achValue, NULL, &nValueType, strDSName, &nBuffLen ) )
-                            {
-                                int nIndex = 0;
-
-                                while ( nIndex < SERIAL_PORT_MAX && CString( strDSName ).MakeUpper().Trim().Find( CString( SERIAL_DEVICE_PREFIX ).MakeUpper().Trim() ) == 0 )
-                                {
-                                    if ( -1 == m_nComArray[nIndex] )
-                                    {
-                                        m_nComArray[nIndex] = atoi( ( char * )( strDSName + strlen( SERIAL_DEVICE_PREFIX ) ) );
-                                        break;
-                                    }
-
-                                    nIndex++;
-                                }
-                            }
-                        }
-                    }
-                }
+    if ( ret == SERIAL_WRITE_OK )
+    {
+        // writes without a completion carry nothing extra
+        if ( pCompletion != NULL )
+        {
+            memcpy( CSerialQueue::GetPayload( pRecord ), pCompletion, nPrefix );
+            pRecord->dwFlags = SERIAL_RECORD_NOTIFY;
+        }
 
-                ret = TRUE;
+        pCopy = CSerialQueue::GetPayload( pRecord ) + nPrefix;
+
+        if ( pChunk != NULL )
+        {
+            // the bytes stay in the block, the reference keeps it out of the pool until they left the driver
+            pTxChunk = ( SERIAL_TX_CHUNK * )pCopy;
+            pTxChunk->pBlock = pChunk->GetBlock();
+            pTxChunk->pData = pChunk->GetData();
+            pTxChunk->nSize = nSize;
+            CSerialPool::AddRef( pTxChunk->pBlock );
+            pRecord->dwFlags |= SERIAL_RECORD_CHUNK;
+
+            if ( nTrailer > 0 )
+            {
+                Checksum.Update( pTxChunk->pData, nSize );
+                Checksum.GetTrailer( pCopy + sizeof( SERIAL_TX_CHUNK ) );
             }
         }
         else
         {
-            OutputDebugString( _T( "Failed to query registry!" ) );
-            assert( FALSE );
+            for ( i = 0; i < nSpans; i++ )
+            {
+                memcpy( pCopy, pSpans[i].pData, pSpans[i].nSize );
+                pCopy += pSpans[i].nSize;
+            }
+
+            if ( dwType == SERIAL_RECORD_DATA )
+            {
+                CSerialStats::Add( &m_Stats.llTxCopied, nSize );
+            }
+
+            // computed over the copy in the queue while it is still in the cache
+            if ( nTrailer > 0 )
+            {
+                CSerialChecksum::Append( m_TxChecksum, CSerialQueue::GetPayload( pRecord ) + nPrefix, nSize );
+            }
         }
 
-        LocalFree( achValue );
+        pRecord->llTimestamp = GetTimestamp();
+        pQueue->Commit( pRecord, dwType );
+        CSerialStats::Max( &m_Stats.llTxQueueHigh, ( LONGLONG )( pQueue->GetHead() - pQueue->GetTail() ) );
+        SignalTx();
     }
 
     return ret;
 }
 
+SERIAL_WRITE_RESULT CSerialPort::WriteCommand( const SERIAL_COMMAND *pCommand,     // copied, applied on the comm thread
+                                               SERIAL_PRIORITY Priority,           // ordered with the writes of this class
+                                               DWORD dwTimeout,                    // ms to wait for room in the queue
+                                               SERIAL_TX_CALLBACK pfnCallback,     // bSent is FALSE when the driver refused the setting
+                                               LPVOID pContext )
+{
+    SERIAL_TX_COMPLETION Completion;
+    assert( pCommand != NULL );
+    Completion.pfnCallback = pfnCallback;
+    Completion.pContext = pContext;
+    return Enqueue( pCommand, sizeof( SERIAL_COMMAND ), Priority, dwTimeout, ( pfnCallback != NULL ) ? &Completion : NULL, SERIAL_RECORD_COMMAND );
+}
+
 void CSerialPort::EnumSerialPort( CComboBox &m_PortNO )
 {
-    HKEY hTestKey;
-    bool Flag = FALSE;
-    int  i = 0;
+    SERIAL_DEVICE_INFO *pDevices;
+    UINT nCount;
+    UINT i;
 
-    if ( ERROR_SUCCESS == RegOpenKeyEx( HKEY_LOCAL_MACHINE, _T( "HARDWARE\\DEVICEMAP\\SERIALCOMM" ), 0, KEY_READ, &hTestKey ) )
+    // CSerialDeviceIndex keeps this list up to date without reading the registry every time
+    pDevices = ( SERIAL_DEVICE_INFO * )LocalAlloc( LMEM_FIXED, SERIAL_PORT_MAX * sizeof( SERIAL_DEVICE_INFO ) );
+
+    if ( pDevices == NULL )
     {
-        if ( QueryRegistry( hTestKey ) )
-        {
-            m_PortNO.ResetContent();
+        return;
+    }
 
-            while ( ( i < SERIAL_PORT_MAX ) && ( -1 != m_nComArray[i] ) )
-            {
-                CString szCom;
-                szCom.Format( _T( "%s%d" ), SERIAL_DEVICE_PREFIX, m_nComArray[i] );
-                m_PortNO.InsertString( i, szCom.GetBuffer() );
-                i++;
+    nCount = CSerialDeviceIndex::Scan( pDevices, SERIAL_PORT_MAX, FALSE );
+    m_PortNO.ResetContent();
 
-                if ( !Flag )
-                {
-                    Flag = TRUE;
-                    m_PortNO.SetCurSel( 0 );
-                }
-            }
-        }
+    for ( i = 0; i < nCount; i++ )
+    {
+        CString szCom;
+        szCom.Format( _T( "%s%u" ), SERIAL_DEVICE_PREFIX, pDevices[i].nPort );
+        m_PortNO.InsertString( i, szCom );
+    }
 
-        RegCloseKey( hTestKey );
+    if ( nCount > 0 )
+    {
+        m_PortNO.SetCurSel( 0 );
     }
+
+    LocalFree( pDevices );
 }
@@ -7,7 +7,7 @@
 **                      program is not blocked.
 **
 **  CREATION DATE       15-09-1997
-**  LAST MODIFICATION   18-03-2018
+**  LAST MODIFICATION   16-10-2026
 **
 **  AUTHOR              Remon Spekreijse
 */
@@ -15,10 +15,189 @@
 #ifndef SERIAL_PORT_H
 #define SERIAL_PORT_H
 
+#if !defined( _WIN32 )
+
+// Linux: open, configure, read and write through termios; CSerialPort is a CSerialTermios there
+#include "SerialTermios.h"
+
+#else
+
 #define SERIAL_PORT_MAX             256UL                   /* http://digital.ni.com/public.nsf/allkb/F7A9002D7B8E31E7862568D6006BD10B */
 #define MAX_VALUE_NAME              16383UL                 /* https://msdn.microsoft.com/en-us/library/ms724872(v=vs.85).aspx */
 #define SERIAL_DEVICE_PREFIX        _T("COM")
 #define WM_SERIAL_PORT_MESSAGE      _T("WM_SERIAL_PORT_MESSAGE_ID")
+#define SERIAL_RX_CHUNK_SIZE        4096UL                  /* default size of one block read */
+#define SERIAL_RX_RING_SIZE         65536UL                 /* default size of the receive ring, rounded up to a power of two */
+#define SERIAL_EV_RXCHUNK           0x00010000UL            /* WPARAM in chunk mode without callback, LPARAM is the number of bytes ready for Read() */
+#define SERIAL_EV_RXSTARVED         0x00020000UL            /* WPARAM when the receive pool runs dry, LPARAM is the exhaustion count */
+#define SERIAL_EV_REPLAYDONE        0x00040000UL            /* WPARAM once the last record of a replay was delivered */
+#define SERIAL_EV_ERROR             0x00080000UL            /* WPARAM of a failed call without event ring, LPARAM is GetLastError() */
+#define SERIAL_RX_STARVED_RETRY     1UL                     /* ms between retries while no receive block is free */
+#define SERIAL_TX_PENDING_MAX       64UL                    /* write completions waiting for the driver to drain */
+#define SERIAL_RECORD_NOTIFY        0x00000001UL            /* SERIAL_RECORD dwFlags: payload starts with a SERIAL_TX_COMPLETION */
+#define SERIAL_RECORD_CHUNK         0x00000002UL            /* SERIAL_RECORD dwFlags: then a SERIAL_TX_CHUNK, the bytes stay in its block */
+#define SERIAL_RECORD_COMMAND       2UL                     /* SERIAL_RECORD dwType: a SERIAL_COMMAND instead of bytes */
+#define SERIAL_FLOW_RTSCTS          0x00000001UL            /* SERIAL_COMMAND_FLOW and SERIAL_FLOW_CONTROL */
+#define SERIAL_FLOW_DTRDSR          0x00000002UL
+#define SERIAL_FLOW_XONXOFF         0x00000004UL
+#define SERIAL_XON                  0x11                    /* DC1, the peer may send again */
+#define SERIAL_XOFF                 0x13                    /* DC3, the peer stops sending */
+#define SERIAL_TX_PRIORITIES        4UL                     /* transmit classes, each with a queue of its own */
+#define SERIAL_FTDI_ENUM_KEY        _T("SYSTEM\\CurrentControlSet\\Enum\\FTDIBUS")
+#define SERIAL_LATENCY_TIMER_MAX    255UL                   /* ms, FTDI default is 16 */
+#define SERIAL_OPEN_PARALLEL        8UL                     /* default ports OpenMany() opens at once */
+
+typedef enum
+{
+    SERIAL_RX_BYTE = 0,                                     /* one SERIAL_PORT_MESSAGE( EV_RXCHAR, char ) per received byte (compatibility) */
+    SERIAL_RX_CHUNK                                         /* block reads, handed out through the callback or Read() */
+} SERIAL_RX_MODE;
+
+typedef enum
+{
+    SERIAL_PRIORITY_URGENT = 0,                             /* served first, e.g. an emergency stop */
+    SERIAL_PRIORITY_HIGH,
+    SERIAL_PRIORITY_NORMAL,                                 /* Write() and WriteAsync() without a priority */
+    SERIAL_PRIORITY_BULK                                    /* firmware images, logs */
+} SERIAL_PRIORITY;
+
+typedef enum
+{
+    SERIAL_COMMAND_BAUD = 0,                                /* dwValue is the baud rate */
+    SERIAL_COMMAND_FORMAT,                                  /* Parity, DataBits, StopBits */
+    SERIAL_COMMAND_FLOW,                                    /* dwValue is SERIAL_FLOW_*, 0 none */
+    SERIAL_COMMAND_DCB,                                     /* the whole dcb, what SetDCB() sends */
+    SERIAL_COMMAND_TIMEOUTS,                                /* Timeouts */
+    SERIAL_COMMAND_ESCAPE,                                  /* dwValue for EscapeCommFunction(): SETBREAK, CLRBREAK, SETDTR, CLRRTS, ... */
+    SERIAL_COMMAND_WAIT                                     /* keeps the line idle for dwValue microseconds */
+} SERIAL_COMMAND_CODE;
+
+/* queued with the data and applied once the bytes before it left the driver, the bytes after it wait */
+typedef struct
+{
+    SERIAL_COMMAND_CODE Code;
+    DWORD               dwValue;
+    BYTE                Parity;
+    BYTE                DataBits;
+    BYTE                StopBits;
+    COMMTIMEOUTS        Timeouts;
+    DCB                 dcb;
+} SERIAL_COMMAND;
+
+typedef struct
+{
+    BOOL                bWeighted;                          /* FALSE: strict priority, TRUE: deficit round robin over nWeight */
+    UINT                nWeight[SERIAL_TX_PRIORITIES];      /* slices per round of each class when weighted */
+    DWORD               nSliceSize;                         /* larger writes go out in pieces of this size, 0 never splits */
+    DWORD               dwFrameGap;                         /* microseconds of idle line before every write, 0 none */
+    DWORD               nRate;                              /* bytes per second of the token bucket, 0 unlimited */
+    DWORD               nBurst;                             /* bytes the token bucket holds */
+} SERIAL_TX_SCHEDULE;
+
+/* the port stops the peer when the bytes it holds reach nHighWater and lets it go on at nLowWater,
+   and its own writes wait while the peer holds them back */
+typedef struct
+{
+    DWORD               dwFlow;                             /* SERIAL_FLOW_RTSCTS, SERIAL_FLOW_DTRDSR, SERIAL_FLOW_XONXOFF */
+    DWORD               nHighWater;                         /* bytes in the driver and not yet consumed, 0 three quarters of what fits */
+    DWORD               nLowWater;                          /* 0 a quarter of what fits, below nHighWater */
+} SERIAL_FLOW_CONTROL;
+
+/* comm thread of a port without a reactor, trading a core for wakeup latency */
+typedef struct
+{
+    DWORD               dwSpinTime;                         /* microseconds it polls before every blocking wait, 0 never spins */
+    int                 nCore;                              /* processor it runs on, -1 any */
+    int                 nPriority;                          /* THREAD_PRIORITY_TIME_CRITICAL, ..., THREAD_PRIORITY_NORMAL leaves it */
+} SERIAL_BUSY_POLL;
+
+typedef struct
+{
+    LONGLONG            llCount;
+    LONGLONG            llMin;                              /* microseconds */
+    LONGLONG            llMax;
+    LONGLONG            llTotal;
+} SERIAL_LATENCY;
+
+/* pData is only valid during the call, llTimestamp is the arrival time of the first byte in microseconds */
+typedef void ( CALLBACK *SERIAL_RX_CALLBACK )( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+
+/* bytes of the write left the driver, bSent is FALSE when the port closed or failed before that */
+typedef void ( CALLBACK *SERIAL_TX_CALLBACK )( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent );
+
+typedef struct
+{
+    SERIAL_TX_CALLBACK  pfnCallback;
+    LPVOID              pContext;
+} SERIAL_TX_COMPLETION;
+
+/* one piece of a WriteGather(), the pieces go out back to back as one write */
+typedef struct
+{
+    const void          *pData;
+    DWORD               nSize;
+} SERIAL_SPAN;
+
+/* context of the completion SetDCB() waits for */
+typedef struct
+{
+    HANDLE              hDone;
+    BOOL                bApplied;
+} SERIAL_COMMAND_DONE;
+
+class CSerialPort;
+class CSerialReactor;
+
+/* one port of CSerialPort::OpenMany(), the parameters of Open() followed by the outcome */
+typedef struct
+{
+    CSerialPort         *pPort;                             /* receive mode, framer etc. already set */
+    HWND                hOwner;
+    UINT                nPort;
+    UINT                nBaud;
+    BYTE                Parity;
+    BYTE                DataBits;
+    BYTE                StopBits;
+    DWORD               dwCommEvents;
+    UINT                nBufferSize;
+    DWORD               ReadIntervalTimeout;
+    DWORD               ReadTotalTimeoutMultiplier;
+    DWORD               ReadTotalTimeoutConstant;
+    DWORD               WriteTotalTimeoutMultiplier;
+    DWORD               WriteTotalTimeoutConstant;
+    BOOL                bOpened;                            /* out */
+    DWORD               dwError;                            /* out, GetLastError() of a failed Open() */
+    LONGLONG            llElapsed;                          /* out, microseconds Open() took */
+} SERIAL_OPEN_REQUEST;
+
+typedef struct
+{
+    SERIAL_OPEN_REQUEST *pRequests;
+    UINT                nCount;
+    volatile LONG       nNext;                              /* next request a worker takes */
+    CSerialReactor      *pReactor;
+} SERIAL_OPEN_BATCH;
+
+#include "SerialQueue.h"
+#include "SerialReactor.h"
+#include "SerialChecksum.h"
+#include "SerialFramer.h"
+#include "SerialPool.h"
+#include "SerialStats.h"
+#include "SerialTransaction.h"
+#include "SerialCapture.h"
+#include "SerialShare.h"
+#include "SerialDevices.h"
+#include "SerialVirtual.h"
+#include "SerialEvents.h"
+
+/* bytes of a WriteChunk(), the record holds a reference to the block until they left the driver */
+typedef struct
+{
+    SERIAL_BLOCK        *pBlock;
+    const BYTE          *pData;
+    DWORD               nSize;
+} SERIAL_TX_CHUNK;
 
 const static UINT  SERIAL_PORT_MESSAGE = ::RegisterWindowMessage( WM_SERIAL_PORT_MESSAGE );
 
@@ -43,34 +222,208 @@ class CSerialPort
                                   DWORD WriteTotalTimeoutConstant = 10 );
         void                Write( char *Buffer );
         void                Write( void *Buffer, int nSize );
+        SERIAL_WRITE_RESULT WriteAsync( const void *Buffer, DWORD nSize, DWORD dwTimeout = 0 );
+        SERIAL_WRITE_RESULT WriteAsync( const void *Buffer, DWORD nSize, DWORD dwTimeout, SERIAL_TX_CALLBACK pfnCallback, LPVOID pContext = NULL );
+        SERIAL_WRITE_RESULT WriteAsync( const void *Buffer, DWORD nSize, SERIAL_PRIORITY Priority, DWORD dwTimeout = 0,
+                                        SERIAL_TX_CALLBACK pfnCallback = NULL, LPVOID pContext = NULL );
+        SERIAL_WRITE_RESULT WriteGather( const SERIAL_SPAN *pSpans, UINT nSpans, SERIAL_PRIORITY Priority = SERIAL_PRIORITY_NORMAL, DWORD dwTimeout = 0,
+                                         SERIAL_TX_CALLBACK pfnCallback = NULL, LPVOID pContext = NULL );
+        SERIAL_WRITE_RESULT WriteChunk( const CSerialChunk &Chunk, SERIAL_PRIORITY Priority = SERIAL_PRIORITY_NORMAL, DWORD dwTimeout = 0,
+                                        SERIAL_TX_CALLBACK pfnCallback = NULL, LPVOID pContext = NULL );
+        SERIAL_WRITE_RESULT WriteCommand( const SERIAL_COMMAND *pCommand, SERIAL_PRIORITY Priority = SERIAL_PRIORITY_NORMAL, DWORD dwTimeout = 0,
+                                          SERIAL_TX_CALLBACK pfnCallback = NULL, LPVOID pContext = NULL );
         void                Close();
+        DWORD               Read( void *Buffer, DWORD nSize );
+        DWORD               GetRxCount();
+        BOOL                SetReactor( CSerialReactor *pReactor );
+        BOOL                SetFramer( CSerialFramer *pFramer );
+        BOOL                SetRxPool( UINT nBlocks, SERIAL_CHUNK_CALLBACK pfnCallback = NULL, LPVOID pContext = NULL );
+        DWORD               GetRxExhaustedCount();
+        BOOL                SetEventChar( BOOL bEnable, char EvtChar = '\n' );
+        BOOL                SetTxSchedule( const SERIAL_TX_SCHEDULE *pSchedule );
+        BOOL                SetCapture( CSerialCapture *pCapture );
+        BOOL                SetReplay( CSerialReplay *pReplay, double dSpeed = 1.0 );
+        BOOL                SetBroadcast( CSerialBroadcast *pBroadcast );
+        BOOL                SetEventRing( CSerialEventRing *pRing, UINT nRate = SERIAL_EVENT_RATE );
+        BOOL                SetReconnect( const SERIAL_RECONNECT *pReconnect );
+        BOOL                SetTxChecksum( SERIAL_CHECKSUM_TYPE Type );
+        BOOL                SetBusyPoll( const SERIAL_BUSY_POLL *pBusyPoll );
+        BOOL                SetFlowControl( const SERIAL_FLOW_CONTROL *pFlowControl );
+        BOOL                SetRxMode( SERIAL_RX_MODE mode,
+                                       UINT  nChunkSize = SERIAL_RX_CHUNK_SIZE,
+                                       DWORD dwCoalesceTime = 0,
+                                       SERIAL_RX_CALLBACK pfnCallback = NULL,
+                                       LPVOID pContext = NULL,
+                                       UINT  nRingSize = SERIAL_RX_RING_SIZE );
 
         DCB                 *GetDCB();
         BOOL                SetDCB( DCB *dcb );
         BOOL                IsOpen();
         void                EnumSerialPort( CComboBox &m_PortNO );
+        void                GetWakeLatency( SERIAL_LATENCY *pLatency, BOOL bReset = FALSE );
+        void                GetStats( SERIAL_STATS *pStats, BOOL bReset = FALSE );
+        void                WakeUp();
+
+        static LONGLONG     GetTimestamp();
+        static DWORD        GetLatencyTimer( UINT port );
+        static BOOL         SetLatencyTimer( UINT port, DWORD dwMilliseconds );
+        static void         InitOpenRequest( SERIAL_OPEN_REQUEST *pRequest, CSerialPort *pPort, HWND hOwner, UINT port, UINT baud = 9600 );
+        static UINT         OpenMany( SERIAL_OPEN_REQUEST *pRequests, UINT nCount, UINT nParallel = SERIAL_OPEN_PARALLEL,
+                                      CSerialReactor *pReactor = NULL );
 
     protected:
+        friend class CSerialReactor;
+
         HANDLE              m_Thread;
+        DWORD               m_dwThreadId;                   /* comm thread or shard, the one thread that sends for the port */
         HANDLE              m_hComm;
         CRITICAL_SECTION    m_csCommunicationSync;
-        COMMTIMEOUTS        m_CommTimeouts;
+        COMMTIMEOUTS        m_CommTimeouts;                 /* as asked for, ApplyTimeouts() drops the write ones under flow control */
         DCB                 m_dcb;
         HWND                m_pOwner;
         volatile BOOL       m_bThreadAlive;
-        volatile BOOL       m_bUserRequestClose;
+        HANDLE              m_hCloseEvent;
+        HANDLE              m_hTxEvent;
+        volatile LONG       m_nTxSignaled;
+        OVERLAPPED          m_ovEvent;
+        OVERLAPPED          m_ovRead;
+        OVERLAPPED          m_ovWrite;
+        BOOL                m_bWritePending;
+        DWORD               m_nWriteEnd;
+        UINT                m_nWriteClass;
+        DWORD               m_nWritePartial;
+        SERIAL_TX_SCHEDULE  m_TxSchedule;
+        DWORD               m_nTxOffset[SERIAL_TX_PRIORITIES];
+        LONGLONG            m_llTxDeficit[SERIAL_TX_PRIORITIES];
+        UINT                m_nTxRound;
+        BOOL                m_bTxDraining;
+        LONGLONG            m_llTxReady;
+        LONGLONG            m_llTxDeadline;
+        LONGLONG            m_llTxTokens;
+        LONGLONG            m_llTxRefill;
+        SERIAL_TX_COMPLETION m_TxPending[SERIAL_TX_PENDING_MAX];
+        UINT                m_nTxPending;
+        BOOL                m_bTxBlocked;
+        DWORD               m_dwEventMask;
+        LONGLONG            m_llWakeTime;
+        CSerialReactor      *m_pReactor;
+        UINT                m_nReactorShard;
+        UINT                m_nReactorSlot;                 /* place in the deadline heap of the shard, SERIAL_PORT_MAX if not in it */
+        LONGLONG            m_llReactorDeadline;            /* the deadline the heap has for the port */
+        HANDLE              m_hReactorPort;
+        OVERLAPPED          m_ovSignal;
+        BOOL                m_bEventPending;
+        BOOL                m_bTxPending;
+        BOOL                m_bClosing;
+        SERIAL_LATENCY      m_WakeLatency;
+        SERIAL_STATS        m_Stats;
+        SERIAL_STATS        m_StatsBase;
+        CRITICAL_SECTION    m_csStats;
         UINT                m_nPortNr;
         DWORD               m_dwCommEvents;
+        BOOL                m_bEventChar;
+        char                m_EventChar;
         DWORD               m_nWriteBufferSize;
         char                *m_szWriteBuffer;
-        volatile int        m_nWriteSize;
-        int                 m_nComArray[SERIAL_PORT_MAX + 1];
+        CSerialQueue        m_TxQueue[SERIAL_TX_PRIORITIES];
+        SERIAL_RX_MODE      m_RxMode;
+        UINT                m_nRxChunkSize;
+        DWORD               m_dwRxCoalesceTime;
+        SERIAL_RX_CALLBACK  m_pfnRxCallback;
+        LPVOID              m_pRxContext;
+        CSerialFramer       *m_pFramer;
+        CSerialPool         m_RxPool;
+        UINT                m_nRxPoolBlocks;
+        SERIAL_CHUNK_CALLBACK m_pfnChunkCallback;
+        SERIAL_BLOCK        *m_pRxBlock;
+        BOOL                m_bRxStarved;
+        LONGLONG            m_llRxStarveTime;
+        BYTE                *m_pRxChunk;
+        DWORD               m_nRxChunkFill;
+        LONGLONG            m_llRxChunkTime;
+        BYTE                *m_pRxRing;
+        DWORD               m_nRxRingSize;
+        volatile LONG       m_nRxHead;
+        volatile LONG       m_nRxTail;
+        CSerialCapture      *m_pCapture;
+        CSerialReplay       *m_pReplay;
+        double              m_dReplaySpeed;
+        BOOL                m_bReplaying;
+        CSerialBroadcast    *m_pBroadcast;
+        CSerialEventRing    *m_pEventRing;
+        UINT                m_nEventRate;
+        volatile LONGLONG   m_llEventWindow[SERIAL_EVENT_CODES];
+        volatile LONG       m_nEventCount[SERIAL_EVENT_CODES];
+        volatile LONG       m_nEventSuppressed[SERIAL_EVENT_CODES];
+        SERIAL_RECONNECT    m_Reconnect;
+        volatile BOOL       m_bReconnecting;
+        SERIAL_CHECKSUM_TYPE m_TxChecksum;
+        SERIAL_BUSY_POLL    m_BusyPoll;
+        SERIAL_FLOW_CONTROL m_FlowControl;
+        DWORD               m_nRxHighWater;
+        DWORD               m_nRxLowWater;
+        volatile BOOL       m_bRxFlowOff;                   /* the peer was told to stop */
+        volatile BOOL       m_bRxHeld;                      /* Read() is behind, bytes wait in the driver */
+        BOOL                m_bTxHeld;                      /* the peer holds our writes back */
+        DWORD               m_nRxDriverQueue;               /* cbInQue of the last ClearCommError() */
 
         static DWORD WINAPI CommThread( LPVOID pParam );
+        static DWORD WINAPI ReplayThread( LPVOID pParam );
         static BOOL         ReceiveChar( CSerialPort *pPort );
-        static UINT         WriteChar( CSerialPort *pPort );
-        void                ProcessErrorMessage( char *ErrorText );
-        BOOL                QueryRegistry( HKEY hKey );
+        static BOOL         WriteChar( CSerialPort *pPort );
+        void                ReportError( SERIAL_STEP Step );
+        void                PostEvent( SERIAL_EVENT_CODE Code, DWORD dwError, DWORD dwDetail, const COMSTAT *pStat = NULL );
+        BOOL                OpenDevice( UINT baud, BYTE parity, BYTE databits, BYTE stopbits );
+        BOOL                Reconnect();
+        void                Notify( WPARAM wParam, LPARAM lParam );
+        SERIAL_WRITE_RESULT Enqueue( const void *Buffer, DWORD nSize, SERIAL_PRIORITY Priority, DWORD dwTimeout, const SERIAL_TX_COMPLETION *pCompletion,
+                                     DWORD dwType = SERIAL_RECORD_DATA );
+        SERIAL_WRITE_RESULT EnqueueGather( const SERIAL_SPAN *pSpans, UINT nSpans, const CSerialChunk *pChunk, SERIAL_PRIORITY Priority, DWORD dwTimeout,
+                                           const SERIAL_TX_COMPLETION *pCompletion, DWORD dwType );
+        BOOL                ApplyCommand( CSerialQueue *pQueue, DWORD nPos, SERIAL_RECORD *pRecord );
+        void                DeliverRx();
+        BOOL                IsRxDue( LONGLONG llNow );
+        BOOL                ReplayRx( const BYTE *pData, DWORD nSize );
+        void                DiscardTx();
+        void                NotifyEvents( DWORD dwEvents );
+        BOOL                AllocRxBlock();
+        BOOL                OnRxDeadline();
+        BOOL                OnDeadline();
+        BOOL                WaitEvent();
+        BOOL                OnEvent();
+        BOOL                OnTransmit();
+        BOOL                OnWriteComplete();
+        void                RetireBatch( DWORD nSent, BOOL bFailed = FALSE );
+        static DWORD        GetTxSize( SERIAL_RECORD *pRecord );
+        static const BYTE   *GetTxData( SERIAL_RECORD *pRecord, DWORD nOffset, DWORD *pnSize, BOOL *pbBorrowed );
+        static void         ReleaseTxRecord( SERIAL_RECORD *pRecord );
+        void                CheckTxDrained();
+        void                CompleteTx( BOOL bSent );
+        void                FailTx();
+        UINT                PickTxClass();
+        DWORD               GetTxSlice();
+        BOOL                PaceTx( DWORD nNeed, DWORD *pnAllowed );
+        static void CALLBACK SignalWriteDone( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent );
+        static void CALLBACK SignalCommandDone( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent );
+        LONGLONG            OnCompletion( LPOVERLAPPED pOverlapped, DWORD nBytes, LONGLONG llNow );
+        void                SignalTx();
+        void                Spin();
+        DWORD               GetRxLevel();
+        void                SetRxWatermarks();
+        void                SetFlowDcb( DCB *pDcb );
+        BOOL                ApplyTimeouts();
+        DWORD               GetCommMask();
+        BOOL                SetPeerFlow( BOOL bGo );
+        void                UpdateRxFlow();
+        BOOL                OnRxFlow();
+        void                UpdateTxHold( const COMSTAT *pStat );
+        DWORD               GetWaitTimeout();
+        LONGLONG            GetRxDeadline();
+        LONGLONG            GetDeadline();
+        static HKEY         OpenDeviceParameters( UINT port, REGSAM samDesired );
+        static DWORD WINAPI OpenWorker( LPVOID pParam );
 };
 
+#endif
+
 #endif SERIAL_PORT_H
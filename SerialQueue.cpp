@@ -0,0 +1,520 @@
+/*
+**  FILENAME            SerialQueue.cpp
+**
+**  PURPOSE             Bounded lock-free multi-producer/single-consumer record queue.
+**                      Application threads reserve and commit variable sized records,
+**                      the comm thread of CSerialPort drains them in order.
+**                      The ring holds only offsets, so it can also live in shared memory
+**                      and take records from other processes.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialQueue.h"
+#include <assert.h>
+
+CSerialQueue::CSerialQueue()
+{
+    m_pHeader = NULL;
+    m_pData = NULL;
+    m_nCapacity = 0;
+    m_nTail = 0;
+    m_bClosed = TRUE;
+    m_nProducers = 0;
+    m_bAttached = FALSE;
+    m_hSpaceEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+}
+
+CSerialQueue::~CSerialQueue()
+{
+    Destroy();
+
+    if ( m_hSpaceEvent != NULL )
+    {
+        CloseHandle( m_hSpaceEvent );
+    }
+}
+
+BOOL CSerialQueue::Create( DWORD nCapacity )
+{
+    DWORD nSize = GetCapacity( nCapacity );
+    Destroy();
+    m_pHeader = ( SERIAL_QUEUE_HEADER * )LocalAlloc( LMEM_ZEROINIT, sizeof( SERIAL_QUEUE_HEADER ) + nSize );
+
+    if ( ( m_pHeader == NULL ) || ( m_hSpaceEvent == NULL ) )
+    {
+        Destroy();
+        return FALSE;
+    }
+
+    m_pHeader->nCapacity = nSize;
+    m_pData = ( BYTE * )( m_pHeader + 1 );
+    m_nCapacity = nSize;
+    m_nTail = 0;
+    m_bClosed = FALSE;
+    return TRUE;
+}
+
+BOOL CSerialQueue::Attach( SERIAL_QUEUE_HEADER *pHeader,  // followed by GetCapacity( nCapacity ) bytes, e.g. in a file mapping
+                           DWORD nCapacity,                 // 0 joins a ring another process set up
+                           LPCTSTR pszSpaceEvent )          // named event shared by every process using the ring
+{
+    HANDLE hSpaceEvent;
+    DWORD nSize;
+    assert( pHeader != NULL );
+    Destroy();
+
+    if ( nCapacity > 0 )
+    {
+        nSize = GetCapacity( nCapacity );
+        memset( pHeader, 0, sizeof( SERIAL_QUEUE_HEADER ) + nSize );
+        pHeader->nCapacity = nSize;
+    }
+    else
+    {
+        // read once, whatever another process writes there later does not move this one out of the mapping
+        nSize = pHeader->nCapacity;
+
+        if ( ( nSize < SERIAL_RECORD_ALIGN * 2 ) || ( nSize & ( nSize - 1 ) ) )
+        {
+            return FALSE;
+        }
+    }
+
+    // producers of one process may wait for space the consumer of another frees
+    hSpaceEvent = CreateEvent( NULL, FALSE, FALSE, pszSpaceEvent );
+
+    if ( hSpaceEvent == NULL )
+    {
+        return FALSE;
+    }
+
+    if ( m_hSpaceEvent != NULL )
+    {
+        CloseHandle( m_hSpaceEvent );
+    }
+
+    m_hSpaceEvent = hSpaceEvent;
+    m_pHeader = pHeader;
+    m_pData = ( BYTE * )( m_pHeader + 1 );
+    m_nCapacity = nSize;
+    m_nTail = ( DWORD )pHeader->nTail;
+    m_bAttached = TRUE;
+    m_bClosed = FALSE;
+    return TRUE;
+}
+
+// refuses new records and returns once every producer of this process committed or gave up,
+// so nothing reserved is left uncommitted and the consumer can drain the ring to its head
+void CSerialQueue::Close()
+{
+    if ( m_pHeader == NULL )
+    {
+        return;
+    }
+
+    // interlocked on both sides: either the producer sees the flag or this sees the producer
+    InterlockedExchange( &m_bClosed, TRUE );
+
+    while ( ( m_nProducers > 0 ) || ( !m_bAttached && ( m_pHeader->nWaiters > 0 ) ) )
+    {
+        SetEvent( m_hSpaceEvent );
+        ::Sleep( 0 );
+    }
+}
+
+void CSerialQueue::Destroy()
+{
+    if ( m_pHeader == NULL )
+    {
+        return;
+    }
+
+    Close();
+
+    if ( m_bAttached )
+    {
+        // waiters of other processes keep the shared event
+        m_bAttached = FALSE;
+        m_pHeader = NULL;
+        m_pData = NULL;
+        m_nCapacity = 0;
+        CloseHandle( m_hSpaceEvent );
+        m_hSpaceEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+        return;
+    }
+
+    LocalFree( m_pHeader );
+    m_pHeader = NULL;
+    m_pData = NULL;
+    m_nCapacity = 0;
+}
+
+SERIAL_WRITE_RESULT CSerialQueue::Reserve( DWORD nSize, DWORD dwTimeout, SERIAL_RECORD **ppRecord, DWORD *pnEnd )
+{
+    DWORD nLength = ( sizeof( SERIAL_RECORD ) + nSize + SERIAL_RECORD_ALIGN - 1 ) & ~( SERIAL_RECORD_ALIGN - 1 );
+    DWORD nHead;
+    DWORD nOffset;
+    DWORD nPad;
+    DWORD nStart = 0;
+    DWORD nElapsed;
+    BOOL  bWaiting = FALSE;
+    SERIAL_WRITE_RESULT ret = SERIAL_WRITE_OK;
+    SERIAL_RECORD *pRecord;
+    assert( ppRecord != NULL );
+
+    // counted before the flag is read, Close() waits for every producer from here to Commit()
+    InterlockedIncrement( &m_nProducers );
+
+    if ( m_bClosed || ( m_pHeader == NULL ) )
+    {
+        InterlockedDecrement( &m_nProducers );
+        return SERIAL_WRITE_CLOSED;
+    }
+
+    if ( nLength > GetMaxRecord() )
+    {
+        InterlockedDecrement( &m_nProducers );
+        return SERIAL_WRITE_TOO_LARGE;
+    }
+
+    for ( ;; )
+    {
+        nHead = ( DWORD )m_pHeader->nHead;
+        nOffset = nHead & ( m_nCapacity - 1 );
+        // a record never wraps, the rest of the ring becomes a pad record instead
+        nPad = ( nOffset + nLength > m_nCapacity ) ? ( m_nCapacity - nOffset ) : 0;
+
+        if ( ( nHead - ( DWORD )m_pHeader->nTail ) + nPad + nLength <= m_nCapacity )
+        {
+            if ( InterlockedCompareExchange( &m_pHeader->nHead, ( LONG )( nHead + nPad + nLength ), ( LONG )nHead ) == ( LONG )nHead )
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        if ( dwTimeout == 0 )
+        {
+            ret = SERIAL_WRITE_WOULD_BLOCK;
+            goto done;
+        }
+
+        if ( m_bClosed )
+        {
+            ret = SERIAL_WRITE_CLOSED;
+            goto done;
+        }
+
+        if ( !bWaiting )
+        {
+            // register first and check again so a release in between is not missed
+            InterlockedIncrement( &m_pHeader->nWaiters );
+            bWaiting = TRUE;
+            nStart = GetTickCount();
+            continue;
+        }
+
+        nElapsed = GetTickCount() - nStart;
+
+        if ( ( dwTimeout != INFINITE ) && ( nElapsed >= dwTimeout ) )
+        {
+            ret = SERIAL_WRITE_TIMEOUT;
+            goto done;
+        }
+
+        WaitForSingleObject( m_hSpaceEvent, ( dwTimeout == INFINITE ) ? INFINITE : ( dwTimeout - nElapsed ) );
+    }
+
+    if ( nPad > 0 )
+    {
+        pRecord = GetRecord( nHead );
+        pRecord->dwType = SERIAL_RECORD_PAD;
+        pRecord->nSize = 0;
+        pRecord->dwFlags = 0;
+        InterlockedExchange( &pRecord->nLength, ( LONG )nPad );
+    }
+
+    // marked as reserved with its length, a consumer can step over it if the producer never commits
+    pRecord = GetRecord( nHead + nPad );
+    InterlockedExchange( &pRecord->nLength, -( LONG )nLength );
+    pRecord->nSize = nSize;
+    pRecord->dwFlags = 0;
+    *ppRecord = pRecord;
+
+    if ( pnEnd != NULL )
+    {
+        *pnEnd = nHead + nPad + nLength;
+    }
+
+done:
+
+    if ( bWaiting && ( InterlockedDecrement( &m_pHeader->nWaiters ) > 0 ) )
+    {
+        // pass the wakeup on, there may be room for the next one too
+        SetEvent( m_hSpaceEvent );
+    }
+
+    if ( ret != SERIAL_WRITE_OK )
+    {
+        InterlockedDecrement( &m_nProducers );
+    }
+
+    return ret;
+}
+
+void CSerialQueue::Commit( SERIAL_RECORD *pRecord, DWORD dwType )
+{
+    DWORD nLength = ( sizeof( SERIAL_RECORD ) + pRecord->nSize + SERIAL_RECORD_ALIGN - 1 ) & ~( SERIAL_RECORD_ALIGN - 1 );
+    pRecord->dwType = dwType;
+    InterlockedExchange( &pRecord->nLength, ( LONG )nLength );
+    InterlockedDecrement( &m_nProducers );
+}
+
+SERIAL_RECORD *CSerialQueue::Peek( DWORD *pnPos )
+{
+    SERIAL_RECORD *pRecord;
+
+    if ( m_pHeader == NULL )
+    {
+        return NULL;
+    }
+
+    for ( ;; )
+    {
+        if ( *pnPos == ( DWORD )m_pHeader->nHead )
+        {
+            return NULL;
+        }
+
+        pRecord = GetRecord( *pnPos );
+
+        if ( pRecord->nLength <= 0 )
+        {
+            // reserved but not committed yet, keeps the order of the producers
+            return NULL;
+        }
+
+        if ( pRecord->dwType != SERIAL_RECORD_PAD )
+        {
+            return pRecord;
+        }
+
+        *pnPos += pRecord->nLength;
+    }
+}
+
+// for a ring other processes write to: reads every field once and checks it against the ring,
+// so a producer that overwrites the header or a record cannot send the consumer outside of it
+SERIAL_PEEK_RESULT CSerialQueue::PeekShared( DWORD *pnPos,              // position of the consumer, moved past pads
+                                             SERIAL_RECORD **ppRecord,
+                                             DWORD *pnSize,             // payload bytes as checked, use this and not the record
+                                             DWORD *pnLength )          // add to the position to pass the record
+{
+    SERIAL_RECORD *pRecord;
+    DWORD nHead;
+    DWORD nOffset;
+    DWORD nSize;
+    LONG  nLength;
+
+    if ( m_pHeader == NULL )
+    {
+        return SERIAL_PEEK_EMPTY;
+    }
+
+    for ( ;; )
+    {
+        nHead = ( DWORD )m_pHeader->nHead;
+
+        if ( *pnPos == nHead )
+        {
+            return SERIAL_PEEK_EMPTY;
+        }
+
+        if ( nHead - *pnPos > m_nCapacity )
+        {
+            return SERIAL_PEEK_CORRUPT;
+        }
+
+        pRecord = GetRecord( *pnPos );
+        nOffset = *pnPos & ( m_nCapacity - 1 );
+        nLength = pRecord->nLength;
+
+        if ( nLength <= 0 )
+        {
+            return SERIAL_PEEK_PENDING;
+        }
+
+        if ( ( ( DWORD )nLength & ( SERIAL_RECORD_ALIGN - 1 ) ) || ( ( DWORD )nLength > nHead - *pnPos ) ||
+             ( nOffset + ( DWORD )nLength > m_nCapacity ) )
+        {
+            return SERIAL_PEEK_CORRUPT;
+        }
+
+        if ( pRecord->dwType == SERIAL_RECORD_PAD )
+        {
+            // a pad always runs to the end of the ring
+            if ( nOffset + ( DWORD )nLength != m_nCapacity )
+            {
+                return SERIAL_PEEK_CORRUPT;
+            }
+
+            *pnPos += nLength;
+            continue;
+        }
+
+        nSize = pRecord->nSize;
+
+        if ( ( pRecord->dwType != SERIAL_RECORD_DATA ) || ( ( DWORD )nLength > GetMaxRecord() ) ||
+             ( nSize > ( DWORD )nLength - sizeof( SERIAL_RECORD ) ) ||
+             ( ( ( sizeof( SERIAL_RECORD ) + nSize + SERIAL_RECORD_ALIGN - 1 ) & ~( SERIAL_RECORD_ALIGN - 1 ) ) != ( DWORD )nLength ) )
+        {
+            return SERIAL_PEEK_CORRUPT;
+        }
+
+        *ppRecord = pRecord;
+        *pnSize = nSize;
+        *pnLength = ( DWORD )nLength;
+        return SERIAL_PEEK_OK;
+    }
+}
+
+// steps over the reserved record at the position whose producer never committed it, e.g. because it died;
+// FALSE if the record does not even carry its reserved length, only Reset() gets past that
+BOOL CSerialQueue::Skip( DWORD *pnPos )
+{
+    DWORD nHead = ( DWORD )m_pHeader->nHead;
+    DWORD nOffset = *pnPos & ( m_nCapacity - 1 );
+    LONG  nLength = -GetRecord( *pnPos )->nLength;
+
+    if ( ( nLength < ( LONG )sizeof( SERIAL_RECORD ) ) || ( ( DWORD )nLength & ( SERIAL_RECORD_ALIGN - 1 ) ) ||
+         ( nHead - *pnPos > m_nCapacity ) || ( ( DWORD )nLength > nHead - *pnPos ) || ( nOffset + ( DWORD )nLength > m_nCapacity ) )
+    {
+        return FALSE;
+    }
+
+    *pnPos += nLength;
+    return TRUE;
+}
+
+void CSerialQueue::Release( DWORD nPos )
+{
+    DWORD nOffset = m_nTail & ( m_nCapacity - 1 );
+    DWORD nSize = nPos - m_nTail;
+    DWORD nFirst = min( nSize, m_nCapacity - nOffset );
+    // a later header can land anywhere in here, old payload must not look committed
+    memset( m_pData + nOffset, 0, nFirst );
+    memset( m_pData, 0, nSize - nFirst );
+    m_nTail = nPos;
+    InterlockedExchange( &m_pHeader->nTail, ( LONG )nPos );
+    WakeWaiters();
+}
+
+// the consumer drops every record up to the head, after PeekShared() found one that cannot be right;
+// records reserved in that range are lost to their producers
+void CSerialQueue::Reset()
+{
+    DWORD nHead = ( DWORD )m_pHeader->nHead;
+
+    if ( nHead - m_nTail > m_nCapacity )
+    {
+        // the head itself was overwritten, start again from the last release
+        nHead = m_nTail;
+        InterlockedExchange( &m_pHeader->nHead, ( LONG )nHead );
+    }
+
+    memset( m_pData, 0, m_nCapacity );
+    m_nTail = nHead;
+    InterlockedExchange( &m_pHeader->nTail, ( LONG )nHead );
+    WakeWaiters();
+}
+
+BOOL CSerialQueue::WaitReleased( DWORD nPos, DWORD dwTimeout )
+{
+    DWORD nStart = GetTickCount();
+    DWORD nElapsed;
+    BOOL  ret = TRUE;
+
+    if ( m_pHeader == NULL )
+    {
+        return TRUE;
+    }
+
+    InterlockedIncrement( &m_pHeader->nWaiters );
+
+    while ( ( LONG )( ( DWORD )m_pHeader->nTail - nPos ) < 0 )
+    {
+        nElapsed = GetTickCount() - nStart;
+
+        if ( m_bClosed || ( ( dwTimeout != INFINITE ) && ( nElapsed >= dwTimeout ) ) )
+        {
+            ret = FALSE;
+            break;
+        }
+
+        WaitForSingleObject( m_hSpaceEvent, ( dwTimeout == INFINITE ) ? INFINITE : ( dwTimeout - nElapsed ) );
+    }
+
+    if ( InterlockedDecrement( &m_pHeader->nWaiters ) > 0 )
+    {
+        SetEvent( m_hSpaceEvent );
+    }
+
+    return ret;
+}
+
+BOOL CSerialQueue::IsEmpty()
+{
+    return ( m_pHeader == NULL ) || ( m_pHeader->nHead == m_pHeader->nTail );
+}
+
+DWORD CSerialQueue::GetHead()
+{
+    return ( m_pHeader != NULL ) ? ( DWORD )m_pHeader->nHead : 0;
+}
+
+DWORD CSerialQueue::GetTail()                                // where the consumer goes on, its own copy of the tail
+{
+    return ( m_pHeader != NULL ) ? m_nTail : 0;
+}
+
+DWORD CSerialQueue::GetMaxRecord()
+{
+    // with at most half the ring per record there is always room on one side of the wrap
+    return m_nCapacity / 2;
+}
+
+BYTE *CSerialQueue::GetPayload( SERIAL_RECORD *pRecord )
+{
+    return ( BYTE * )( pRecord + 1 );
+}
+
+DWORD CSerialQueue::GetCapacity( DWORD nCapacity )          // data bytes of a ring asked for nCapacity, a power of two
+{
+    DWORD nSize = SERIAL_RECORD_ALIGN * 2;
+
+    while ( nSize < nCapacity )
+    {
+        nSize <<= 1;
+    }
+
+    return nSize;
+}
+
+SERIAL_RECORD *CSerialQueue::GetRecord( DWORD nPos )
+{
+    return ( SERIAL_RECORD * )( m_pData + ( nPos & ( m_nCapacity - 1 ) ) );
+}
+
+void CSerialQueue::WakeWaiters()
+{
+    if ( m_pHeader->nWaiters > 0 )
+    {
+        SetEvent( m_hSpaceEvent );
+    }
+}
@@ -0,0 +1,103 @@
+/*
+**  FILENAME            SerialQueue.h
+**
+**  PURPOSE             Bounded lock-free multi-producer/single-consumer record queue.
+**                      Application threads reserve and commit variable sized records,
+**                      the comm thread of CSerialPort drains them in order.
+**                      The ring holds only offsets, so it can also live in shared memory
+**                      and take records from other processes.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_QUEUE_H
+#define SERIAL_QUEUE_H
+
+#define SERIAL_RECORD_PAD           0UL                     /* filler up to the end of the ring, skipped by Peek() */
+#define SERIAL_RECORD_DATA          1UL                     /* payload bytes to transmit */
+#define SERIAL_RECORD_ALIGN         16UL                    /* pads hold at least the fields Peek() reads */
+#define SERIAL_CACHE_LINE           64
+
+typedef enum
+{
+    SERIAL_WRITE_OK = 0,
+    SERIAL_WRITE_WOULD_BLOCK,                               /* queue full and no timeout given */
+    SERIAL_WRITE_TIMEOUT,                                   /* queue still full after the timeout */
+    SERIAL_WRITE_TOO_LARGE,                                 /* record can never fit, see GetMaxRecord() */
+    SERIAL_WRITE_CLOSED                                     /* queue not created or being destroyed */
+} SERIAL_WRITE_RESULT;
+
+typedef enum
+{
+    SERIAL_PEEK_OK = 0,                                     /* a committed record, checked against the ring */
+    SERIAL_PEEK_EMPTY,                                      /* nothing after the position */
+    SERIAL_PEEK_PENDING,                                    /* the next record is reserved but not committed */
+    SERIAL_PEEK_CORRUPT                                     /* the next record or the head cannot be right, see Reset() */
+} SERIAL_PEEK_RESULT;
+
+typedef struct
+{
+    volatile LONG       nLength;                            /* aligned record length, negated while reserved, 0 before */
+    DWORD               dwType;                             /* SERIAL_RECORD_* */
+    DWORD               nSize;                              /* payload bytes following the header */
+    DWORD               dwFlags;                            /* producer defined */
+    LONGLONG            llTimestamp;                        /* producer defined, CSerialPort stores the enqueue time */
+} SERIAL_RECORD;
+
+typedef struct
+{
+    volatile LONG       nHead;                              /* end of the reserved space, moved by producers */
+    BYTE                Pad1[SERIAL_CACHE_LINE - sizeof( LONG )];
+    volatile LONG       nTail;                              /* end of the released space, moved by the consumer */
+    BYTE                Pad2[SERIAL_CACHE_LINE - sizeof( LONG )];
+    volatile LONG       nWaiters;                           /* producers blocked in Reserve() or WaitReleased() */
+    DWORD               nCapacity;                          /* data bytes, power of two */
+    BYTE                Pad3[SERIAL_CACHE_LINE - sizeof( LONG ) - sizeof( DWORD )];
+} SERIAL_QUEUE_HEADER;
+
+class CSerialQueue
+{
+    public:
+        CSerialQueue();
+        virtual             ~CSerialQueue();
+
+        BOOL                Create( DWORD nCapacity );
+        BOOL                Attach( SERIAL_QUEUE_HEADER *pHeader, DWORD nCapacity, LPCTSTR pszSpaceEvent );
+        void                Close();
+        void                Destroy();
+
+        SERIAL_WRITE_RESULT Reserve( DWORD nSize, DWORD dwTimeout, SERIAL_RECORD **ppRecord, DWORD *pnEnd = NULL );
+        void                Commit( SERIAL_RECORD *pRecord, DWORD dwType = SERIAL_RECORD_DATA );
+        SERIAL_RECORD       *Peek( DWORD *pnPos );
+        SERIAL_PEEK_RESULT  PeekShared( DWORD *pnPos, SERIAL_RECORD **ppRecord, DWORD *pnSize, DWORD *pnLength );
+        BOOL                Skip( DWORD *pnPos );
+        void                Release( DWORD nPos );
+        void                Reset();
+        BOOL                WaitReleased( DWORD nPos, DWORD dwTimeout );
+
+        BOOL                IsEmpty();
+        DWORD               GetHead();
+        DWORD               GetTail();
+        DWORD               GetMaxRecord();
+
+        static BYTE         *GetPayload( SERIAL_RECORD *pRecord );
+        static DWORD        GetCapacity( DWORD nCapacity );
+
+    protected:
+        SERIAL_QUEUE_HEADER *m_pHeader;
+        BYTE                *m_pData;
+        DWORD               m_nCapacity;                    /* data bytes, the copy in a shared header is not trusted */
+        DWORD               m_nTail;                        /* released by the consumer here, the shared one may be overwritten */
+        HANDLE              m_hSpaceEvent;
+        volatile LONG       m_bClosed;
+        volatile LONG       m_nProducers;                   /* inside Reserve() or between it and Commit() */
+        BOOL                m_bAttached;                    /* the ring belongs to a mapping of the caller */
+
+        SERIAL_RECORD       *GetRecord( DWORD nPos );
+        void                WakeWaiters();
+};
+
+#endif SERIAL_QUEUE_H
@@ -0,0 +1,370 @@
+/*
+**  FILENAME            SerialReactor.cpp
+**
+**  PURPOSE             Shared I/O completion port threads servicing many serial ports.
+**                      Every port is bound to one shard so its callbacks stay in order,
+**                      the shards can be pinned to separate cores.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+CSerialReactor::CSerialReactor()
+{
+    m_pShards = NULL;
+    m_nShards = 0;
+}
+
+CSerialReactor::~CSerialReactor()
+{
+    Destroy();
+}
+
+BOOL CSerialReactor::Create( UINT nThreads,             // number of shards, one thread each
+                             BOOL bPinThreads )         // pin shard i to core i modulo the core count
+{
+    UINT i;
+    SYSTEM_INFO Info;
+    Destroy();
+    assert( ( nThreads > 0 ) && ( nThreads <= SERIAL_REACTOR_MAX_THREADS ) );
+    GetSystemInfo( &Info );
+    m_pShards = new SERIAL_REACTOR_SHARD[nThreads];
+
+    if ( m_pShards == NULL )
+    {
+        return FALSE;
+    }
+
+    memset( m_pShards, 0, sizeof( SERIAL_REACTOR_SHARD ) * nThreads );
+
+    for ( i = 0; i < nThreads; i++ )
+    {
+        InitializeCriticalSection( &m_pShards[i].csPorts );
+    }
+
+    m_nShards = nThreads;
+
+    for ( i = 0; i < nThreads; i++ )
+    {
+        m_pShards[i].hCompletionPort = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+
+        if ( m_pShards[i].hCompletionPort == NULL )
+        {
+            Destroy();
+            return FALSE;
+        }
+
+        m_pShards[i].hThread = ::CreateThread( NULL, 0, ReactorThread, &m_pShards[i], CREATE_SUSPENDED, &m_pShards[i].dwThreadId );
+
+        if ( m_pShards[i].hThread == NULL )
+        {
+            Destroy();
+            return FALSE;
+        }
+
+        if ( bPinThreads )
+        {
+            SetThreadAffinityMask( m_pShards[i].hThread, ( DWORD_PTR )1 << ( i % Info.dwNumberOfProcessors ) );
+        }
+
+        ResumeThread( m_pShards[i].hThread );
+    }
+
+    return TRUE;
+}
+
+void CSerialReactor::Destroy()
+{
+    UINT i;
+
+    if ( m_pShards == NULL )
+    {
+        return;
+    }
+
+    for ( i = 0; i < m_nShards; i++ )
+    {
+        // close the ports first, their overlapped structures are still queued here
+        assert( m_pShards[i].nPorts == 0 );
+
+        if ( m_pShards[i].hThread != NULL )
+        {
+            PostQueuedCompletionStatus( m_pShards[i].hCompletionPort, 0, 0, NULL );
+            WaitForSingleObject( m_pShards[i].hThread, INFINITE );
+            CloseHandle( m_pShards[i].hThread );
+        }
+
+        if ( m_pShards[i].hCompletionPort != NULL )
+        {
+            CloseHandle( m_pShards[i].hCompletionPort );
+        }
+
+        DeleteCriticalSection( &m_pShards[i].csPorts );
+    }
+
+    delete [] m_pShards;
+    m_pShards = NULL;
+    m_nShards = 0;
+}
+
+UINT CSerialReactor::GetThreadCount()
+{
+    return m_nShards;
+}
+
+BOOL CSerialReactor::Attach( CSerialPort *pPort )
+{
+    UINT i;
+    UINT nShard = 0;
+    SERIAL_REACTOR_SHARD *pShard;
+
+    if ( m_pShards == NULL )
+    {
+        return FALSE;
+    }
+
+    // least loaded shard
+    for ( i = 1; i < m_nShards; i++ )
+    {
+        if ( m_pShards[i].nPorts < m_pShards[nShard].nPorts )
+        {
+            nShard = i;
+        }
+    }
+
+    pShard = &m_pShards[nShard];
+    EnterCriticalSection( &pShard->csPorts );
+
+    if ( ( pShard->nPorts >= SERIAL_PORT_MAX ) ||
+         ( CSerialVirtual::CreateIoCompletionPort( pPort->m_hComm, pShard->hCompletionPort, ( ULONG_PTR )pPort, 0 ) == NULL ) )
+    {
+        LeaveCriticalSection( &pShard->csPorts );
+        return FALSE;
+    }
+
+    pShard->pPorts[pShard->nPorts++] = pPort;
+    pPort->m_nReactorShard = nShard;
+    pPort->m_hReactorPort = pShard->hCompletionPort;
+    pPort->m_dwThreadId = pShard->dwThreadId;
+    LeaveCriticalSection( &pShard->csPorts );
+    // the first WaitCommEvent is issued from the shard thread
+    return PostQueuedCompletionStatus( pShard->hCompletionPort, SERIAL_SIGNAL_START, ( ULONG_PTR )pPort, &pPort->m_ovSignal );
+}
+
+// called by the shard thread once nothing of the port is queued, so it can take the port out of the heap too
+void CSerialReactor::Remove( CSerialPort *pPort )
+{
+    UINT i;
+    SERIAL_REACTOR_SHARD *pShard = &m_pShards[pPort->m_nReactorShard];
+    Unschedule( pShard, pPort );
+    EnterCriticalSection( &pShard->csPorts );
+
+    for ( i = 0; i < pShard->nPorts; i++ )
+    {
+        if ( pShard->pPorts[i] == pPort )
+        {
+            pShard->pPorts[i] = pShard->pPorts[--pShard->nPorts];
+            break;
+        }
+    }
+
+    LeaveCriticalSection( &pShard->csPorts );
+}
+
+DWORD WINAPI CSerialReactor::ReactorThread( LPVOID pParam )
+{
+    SERIAL_REACTOR_SHARD *pShard = ( SERIAL_REACTOR_SHARD * )pParam;
+    DWORD        nBytes;
+    DWORD        dwTimeout;
+    ULONG_PTR    Key;
+    LPOVERLAPPED pOverlapped;
+    LONGLONG     llNow;
+    LONGLONG     llDeadline;                              // earliest deadline of a port, top of the heap
+    LONGLONG     llPort;
+    BOOL         bResult;
+
+    for ( ;; )
+    {
+        llNow = CSerialPort::GetTimestamp();
+        llDeadline = ( pShard->nDeadlines > 0 ) ? pShard->pDeadlines[0]->m_llReactorDeadline : MAXLONGLONG;
+
+        if ( llDeadline == MAXLONGLONG )
+        {
+            dwTimeout = INFINITE;
+        }
+        else
+        {
+            dwTimeout = ( llDeadline <= llNow ) ? 0 : ( DWORD )( ( llDeadline - llNow + 999 ) / 1000 );
+        }
+
+        pOverlapped = NULL;
+        bResult = GetQueuedCompletionStatus( pShard->hCompletionPort, &nBytes, &Key, &pOverlapped, dwTimeout );
+        llNow = CSerialPort::GetTimestamp();
+
+        if ( pOverlapped != NULL )
+        {
+            // failed I/O comes back with bResult FALSE, the port reads the status itself
+            llPort = ( ( CSerialPort * )Key )->OnCompletion( pOverlapped, nBytes, llNow );
+
+            // a closed port left the heap in Remove() and may be gone already, it always returns MAXLONGLONG;
+            // an entry of a port that has no deadline any more is dropped when it comes up in Expire()
+            if ( llPort != MAXLONGLONG )
+            {
+                Schedule( pShard, ( CSerialPort * )Key, llPort );
+            }
+        }
+        else if ( bResult )
+        {
+            // Destroy()
+            break;
+        }
+
+        Expire( pShard, llNow );
+    }
+
+    return 0;
+}
+
+// runs the ports whose deadline passed, earliest first; no lock is held, so OnDeadline() and the
+// callbacks behind it do not hold up Attach() or Close() of the other ports of the shard
+void CSerialReactor::Expire( SERIAL_REACTOR_SHARD *pShard, LONGLONG llNow )
+{
+    LONGLONG llPort;
+    CSerialPort *pPort;
+
+    while ( ( pShard->nDeadlines > 0 ) && ( pShard->pDeadlines[0]->m_llReactorDeadline <= llNow ) )
+    {
+        pPort = pShard->pDeadlines[0];
+
+        if ( pPort->GetDeadline() <= llNow )
+        {
+            pPort->m_llWakeTime = llNow;
+            CSerialStats::Add( &pPort->m_Stats.llWakeups );
+            pPort->OnDeadline();
+        }
+
+        // a starved pool or a paced write sets the next one at once, one still due waits for the next round
+        llPort = pPort->GetDeadline();
+
+        if ( llPort == MAXLONGLONG )
+        {
+            Unschedule( pShard, pPort );
+        }
+        else
+        {
+            Schedule( pShard, pPort, max( llPort, llNow + 1 ) );
+        }
+    }
+}
+
+void CSerialReactor::Schedule( SERIAL_REACTOR_SHARD *pShard, CSerialPort *pPort, LONGLONG llDeadline )
+{
+    UINT nSlot = pPort->m_nReactorSlot;
+    LONGLONG llOld = pPort->m_llReactorDeadline;
+
+    if ( nSlot == SERIAL_PORT_MAX )
+    {
+        nSlot = pShard->nDeadlines++;
+        pShard->pDeadlines[nSlot] = pPort;
+        pPort->m_nReactorSlot = nSlot;
+        llOld = MAXLONGLONG;
+    }
+
+    pPort->m_llReactorDeadline = llDeadline;
+
+    if ( llDeadline < llOld )
+    {
+        SiftUp( pShard, nSlot );
+    }
+    else
+    {
+        SiftDown( pShard, nSlot );
+    }
+}
+
+void CSerialReactor::Unschedule( SERIAL_REACTOR_SHARD *pShard, CSerialPort *pPort )
+{
+    UINT nSlot = pPort->m_nReactorSlot;
+    CSerialPort *pLast;
+
+    if ( nSlot == SERIAL_PORT_MAX )
+    {
+        return;
+    }
+
+    pPort->m_nReactorSlot = SERIAL_PORT_MAX;
+    pPort->m_llReactorDeadline = MAXLONGLONG;
+    pLast = pShard->pDeadlines[--pShard->nDeadlines];
+
+    if ( pLast != pPort )
+    {
+        // the last entry fills the hole and moves whichever way its deadline says
+        pShard->pDeadlines[nSlot] = pLast;
+        pLast->m_nReactorSlot = nSlot;
+        SiftUp( pShard, nSlot );
+        SiftDown( pShard, pLast->m_nReactorSlot );
+    }
+}
+
+void CSerialReactor::SiftUp( SERIAL_REACTOR_SHARD *pShard, UINT nSlot )
+{
+    CSerialPort *pPort = pShard->pDeadlines[nSlot];
+    UINT nParent;
+
+    while ( nSlot > 0 )
+    {
+        nParent = ( nSlot - 1 ) / 2;
+
+        if ( pShard->pDeadlines[nParent]->m_llReactorDeadline <= pPort->m_llReactorDeadline )
+        {
+            break;
+        }
+
+        pShard->pDeadlines[nSlot] = pShard->pDeadlines[nParent];
+        pShard->pDeadlines[nSlot]->m_nReactorSlot = nSlot;
+        nSlot = nParent;
+    }
+
+    pShard->pDeadlines[nSlot] = pPort;
+    pPort->m_nReactorSlot = nSlot;
+}
+
+void CSerialReactor::SiftDown( SERIAL_REACTOR_SHARD *pShard, UINT nSlot )
+{
+    CSerialPort *pPort = pShard->pDeadlines[nSlot];
+    UINT nChild;
+
+    for ( ;; )
+    {
+        nChild = nSlot * 2 + 1;
+
+        if ( nChild >= pShard->nDeadlines )
+        {
+            break;
+        }
+
+        if ( ( nChild + 1 < pShard->nDeadlines ) &&
+             ( pShard->pDeadlines[nChild + 1]->m_llReactorDeadline < pShard->pDeadlines[nChild]->m_llReactorDeadline ) )
+        {
+            nChild++;
+        }
+
+        if ( pPort->m_llReactorDeadline <= pShard->pDeadlines[nChild]->m_llReactorDeadline )
+        {
+            break;
+        }
+
+        pShard->pDeadlines[nSlot] = pShard->pDeadlines[nChild];
+        pShard->pDeadlines[nSlot]->m_nReactorSlot = nSlot;
+        nSlot = nChild;
+    }
+
+    pShard->pDeadlines[nSlot] = pPort;
+    pPort->m_nReactorSlot = nSlot;
+}
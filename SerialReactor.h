@@ -0,0 +1,62 @@
+/*
+**  FILENAME            SerialReactor.h
+**
+**  PURPOSE             Shared I/O completion port threads servicing many serial ports.
+**                      Every port is bound to one shard so its callbacks stay in order,
+**                      the shards can be pinned to separate cores.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_REACTOR_H
+#define SERIAL_REACTOR_H
+
+#define SERIAL_REACTOR_MAX_THREADS  64UL
+#define SERIAL_SIGNAL_START         1UL                     /* completion packets posted to a shard, in dwNumberOfBytesTransferred */
+#define SERIAL_SIGNAL_TX            2UL
+#define SERIAL_SIGNAL_CLOSE         3UL
+
+class CSerialPort;
+
+typedef struct
+{
+    HANDLE              hCompletionPort;
+    HANDLE              hThread;
+    DWORD               dwThreadId;
+    CRITICAL_SECTION    csPorts;
+    CSerialPort         *pPorts[SERIAL_PORT_MAX];
+    UINT                nPorts;
+    CSerialPort         *pDeadlines[SERIAL_PORT_MAX];       /* min-heap on the next deadline, used by the shard thread only */
+    UINT                nDeadlines;
+} SERIAL_REACTOR_SHARD;
+
+class CSerialReactor
+{
+    public:
+        CSerialReactor();
+        virtual             ~CSerialReactor();
+
+        BOOL                Create( UINT nThreads = 1, BOOL bPinThreads = FALSE );
+        void                Destroy();
+        UINT                GetThreadCount();
+
+    protected:
+        friend class CSerialPort;
+
+        SERIAL_REACTOR_SHARD *m_pShards;
+        UINT                m_nShards;
+
+        BOOL                Attach( CSerialPort *pPort );
+        void                Remove( CSerialPort *pPort );
+        static DWORD WINAPI ReactorThread( LPVOID pParam );
+        static void         Expire( SERIAL_REACTOR_SHARD *pShard, LONGLONG llNow );
+        static void         Schedule( SERIAL_REACTOR_SHARD *pShard, CSerialPort *pPort, LONGLONG llDeadline );
+        static void         Unschedule( SERIAL_REACTOR_SHARD *pShard, CSerialPort *pPort );
+        static void         SiftUp( SERIAL_REACTOR_SHARD *pShard, UINT nSlot );
+        static void         SiftDown( SERIAL_REACTOR_SHARD *pShard, UINT nSlot );
+};
+
+#endif SERIAL_REACTOR_H
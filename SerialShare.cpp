@@ -0,0 +1,786 @@
+/*
+**  FILENAME            SerialShare.cpp
+**
+**  PURPOSE             Fan-out of the received data of one port to other local processes.
+**                      The owning process publishes every chunk into a single-writer ring in a
+**                      named file mapping; subscribers keep their own cursor, read the chunks
+**                      in place and notice when the writer lapped them. Injectors may queue
+**                      frames for transmission through a second mapping of their own.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+#pragma warning(disable:4996)
+
+// 64 bit positions are read whole on 32 bit builds too, and not moved across the accesses around them
+static LONGLONG LoadPosition( volatile LONGLONG *pPosition )
+{
+    return InterlockedCompareExchange64( pPosition, 0, 0 );
+}
+
+CSerialBroadcast::CSerialBroadcast()
+{
+    m_szName[0] = '\0';
+    m_pPort = NULL;
+    m_hMapping = NULL;
+    m_pHeader = NULL;
+    m_pRing = NULL;
+    m_hInjectMapping = NULL;
+    m_pInjectHeader = NULL;
+    m_hInjectEvent = NULL;
+    m_hStopEvent = NULL;
+    m_hInjectThread = NULL;
+    m_InjectPriority = SERIAL_PRIORITY_NORMAL;
+    m_nInjectDropped = 0;
+    memset( m_hWake, 0, sizeof( m_hWake ) );
+    memset( m_nWakeGeneration, 0, sizeof( m_nWakeGeneration ) );
+}
+
+CSerialBroadcast::~CSerialBroadcast()
+{
+    Destroy();
+}
+
+BOOL CSerialBroadcast::Create( LPCTSTR pszName,                         // e.g. "Local\\COM7", subscribers open the same name
+                               DWORD nRingSize,                         // rounded up to a power of two
+                               DWORD nInjectSize,                       // transmit queue for other processes, 0 allows none
+                               LPSECURITY_ATTRIBUTES pRxSecurity,       // who may subscribe, NULL is the default DACL of the caller
+                               LPSECURITY_ATTRIBUTES pInjectSecurity )  // who may inject, kept apart from the readers
+{
+    char szName[MAX_PATH];
+    DWORD nCapacity = SERIAL_SHARE_RING_MIN;
+    BOOL ret = TRUE;
+    assert( pszName != NULL );
+    Destroy();
+
+    if ( strlen( pszName ) + 32 > MAX_PATH )
+    {
+        return FALSE;
+    }
+
+    strcpy( m_szName, pszName );
+
+    while ( nCapacity < nRingSize )
+    {
+        nCapacity <<= 1;
+    }
+
+    m_hMapping = CreateFileMapping( INVALID_HANDLE_VALUE, pRxSecurity, PAGE_READWRITE, 0, sizeof( SERIAL_SHARE_HEADER ) + nCapacity, m_szName );
+
+    // a second publisher under the same name would corrupt the ring of the first
+    if ( ( m_hMapping == NULL ) || ( GetLastError() == ERROR_ALREADY_EXISTS ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    m_pHeader = ( SERIAL_SHARE_HEADER * )MapViewOfFile( m_hMapping, FILE_MAP_WRITE, 0, 0, 0 );
+
+    if ( m_pHeader == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    memset( m_pHeader, 0, sizeof( SERIAL_SHARE_HEADER ) );
+    m_pHeader->nCapacity = nCapacity;
+    m_pHeader->dwOwner = GetCurrentProcessId();
+    m_pHeader->dwVersion = SERIAL_SHARE_VERSION;
+    m_pRing = ( BYTE * )( m_pHeader + 1 );
+    InterlockedExchange( ( volatile LONG * )&m_pHeader->dwMagic, ( LONG )SERIAL_SHARE_MAGIC );
+
+    if ( nInjectSize == 0 )
+    {
+        goto done;
+    }
+
+    sprintf( szName, "%s.tx", m_szName );
+    m_hInjectMapping = CreateFileMapping( INVALID_HANDLE_VALUE, pInjectSecurity, PAGE_READWRITE, 0,
+                                          sizeof( SERIAL_QUEUE_HEADER ) + CSerialQueue::GetCapacity( nInjectSize ), szName );
+
+    if ( ( m_hInjectMapping == NULL ) || ( GetLastError() == ERROR_ALREADY_EXISTS ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    m_pInjectHeader = ( SERIAL_QUEUE_HEADER * )MapViewOfFile( m_hInjectMapping, FILE_MAP_WRITE, 0, 0, 0 );
+    sprintf( szName, "%s.tx.space", m_szName );
+
+    if ( ( m_pInjectHeader == NULL ) || !m_InjectQueue.Attach( m_pInjectHeader, nInjectSize, szName ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    sprintf( szName, "%s.tx.ready", m_szName );
+    m_hInjectEvent = CreateEvent( pInjectSecurity, FALSE, FALSE, szName );
+    m_hStopEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+    if ( ( m_hInjectEvent == NULL ) || ( m_hStopEvent == NULL ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    m_hInjectThread = ::CreateThread( NULL, 0, InjectThread, this, 0, NULL );
+    ret = ( m_hInjectThread != NULL );
+
+done:
+
+    if ( !ret )
+    {
+        Destroy();
+    }
+
+    return ret;
+}
+
+void CSerialBroadcast::Destroy()
+{
+    UINT i;
+
+    if ( m_hInjectThread != NULL )
+    {
+        SetEvent( m_hStopEvent );
+        WaitForSingleObject( m_hInjectThread, INFINITE );
+        CloseHandle( m_hInjectThread );
+        m_hInjectThread = NULL;
+    }
+
+    m_InjectQueue.Destroy();
+
+    if ( m_pInjectHeader != NULL )
+    {
+        UnmapViewOfFile( m_pInjectHeader );
+        m_pInjectHeader = NULL;
+    }
+
+    if ( m_hInjectMapping != NULL )
+    {
+        CloseHandle( m_hInjectMapping );
+        m_hInjectMapping = NULL;
+    }
+
+    if ( m_hInjectEvent != NULL )
+    {
+        CloseHandle( m_hInjectEvent );
+        m_hInjectEvent = NULL;
+    }
+
+    if ( m_hStopEvent != NULL )
+    {
+        CloseHandle( m_hStopEvent );
+        m_hStopEvent = NULL;
+    }
+
+    for ( i = 0; i < SERIAL_SHARE_SUBSCRIBERS_MAX; i++ )
+    {
+        if ( m_hWake[i] != NULL )
+        {
+            CloseHandle( m_hWake[i] );
+            m_hWake[i] = NULL;
+        }
+    }
+
+    // subscribers keep their view of the last data, no more is published
+    if ( m_pHeader != NULL )
+    {
+        UnmapViewOfFile( m_pHeader );
+        m_pHeader = NULL;
+        m_pRing = NULL;
+    }
+
+    if ( m_hMapping != NULL )
+    {
+        CloseHandle( m_hMapping );
+        m_hMapping = NULL;
+    }
+}
+
+BOOL CSerialBroadcast::Attach( CSerialPort *pPort )        // before Open(), the port publishes every chunk it delivers
+{
+    assert( pPort != NULL );
+
+    if ( !pPort->SetBroadcast( this ) )
+    {
+        return FALSE;
+    }
+
+    m_pPort = pPort;
+    return TRUE;
+}
+
+void CSerialBroadcast::SetInjectPriority( SERIAL_PRIORITY Priority )    // transmit class of injected frames
+{
+    assert( ( UINT )Priority < SERIAL_TX_PRIORITIES );
+    m_InjectPriority = Priority;
+}
+
+void CSerialBroadcast::Publish( const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    DWORD nPiece;
+
+    if ( ( m_pHeader == NULL ) || ( nSize == 0 ) )
+    {
+        return;
+    }
+
+    // a chunk larger than a quarter of the ring goes out in pieces, so a reader is not lapped by one record
+    do
+    {
+        nPiece = min( nSize, m_pHeader->nCapacity / 4 );
+        Append( pData, nPiece, llTimestamp );
+        pData += nPiece;
+        nSize -= nPiece;
+    }
+    while ( nSize > 0 );
+
+    WakeSubscribers();
+}
+
+UINT CSerialBroadcast::GetSubscriberCount()
+{
+    UINT nCount = 0;
+    UINT i;
+
+    for ( i = 0; ( m_pHeader != NULL ) && ( i < SERIAL_SHARE_SUBSCRIBERS_MAX ); i++ )
+    {
+        if ( m_pHeader->Slots[i].nState == SERIAL_SHARE_SLOT_ACTIVE )
+        {
+            nCount++;
+        }
+    }
+
+    return nCount;
+}
+
+DWORD CSerialBroadcast::GetInjectDroppedCount()
+{
+    return ( DWORD )m_nInjectDropped;
+}
+
+void CSerialBroadcast::Append( const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    SERIAL_SHARE_RECORD *pRecord;
+    DWORD nCapacity = m_pHeader->nCapacity;
+    DWORD nLength = ( sizeof( SERIAL_SHARE_RECORD ) + nSize + SERIAL_SHARE_ALIGN - 1 ) & ~( SERIAL_SHARE_ALIGN - 1 );
+    LONGLONG llHead = m_pHeader->llHead;
+    DWORD nOffset = ( DWORD )llHead & ( nCapacity - 1 );
+    // a record never wraps, the rest of the ring becomes a pad record instead
+    DWORD nPad = ( nOffset + nLength > nCapacity ) ? ( nCapacity - nOffset ) : 0;
+
+    Reclaim( llHead + nPad + nLength );
+
+    if ( nPad > 0 )
+    {
+        pRecord = ( SERIAL_SHARE_RECORD * )( m_pRing + nOffset );
+        pRecord->nLength = nPad;
+        pRecord->nSize = SERIAL_SHARE_PAD;
+        pRecord->llTimestamp = 0;
+        nOffset = 0;
+    }
+
+    pRecord = ( SERIAL_SHARE_RECORD * )( m_pRing + nOffset );
+    pRecord->nLength = nLength;
+    pRecord->nSize = nSize;
+    pRecord->llTimestamp = llTimestamp;
+    memcpy( pRecord + 1, pData, nSize );
+    InterlockedExchange64( &m_pHeader->llHead, llHead + nPad + nLength );
+}
+
+void CSerialBroadcast::Reclaim( LONGLONG llEnd )
+{
+    LONGLONG llTail = m_pHeader->llTail;
+    LONGLONG llOld = llTail;
+
+    // readers check the tail after they are done with a record, so it moves before the bytes are reused
+    while ( llEnd - llTail > ( LONGLONG )m_pHeader->nCapacity )
+    {
+        llTail += ( ( SERIAL_SHARE_RECORD * )( m_pRing + ( ( DWORD )llTail & ( m_pHeader->nCapacity - 1 ) ) ) )->nLength;
+    }
+
+    if ( llTail != llOld )
+    {
+        InterlockedExchange64( &m_pHeader->llTail, llTail );
+    }
+}
+
+void CSerialBroadcast::WakeSubscribers()
+{
+    char szName[MAX_PATH];
+    SERIAL_SHARE_SLOT *pSlot;
+    UINT i;
+
+    for ( i = 0; i < SERIAL_SHARE_SUBSCRIBERS_MAX; i++ )
+    {
+        pSlot = &m_pHeader->Slots[i];
+
+        if ( ( pSlot->nState != SERIAL_SHARE_SLOT_ACTIVE ) || !pSlot->bWaiting )
+        {
+            continue;
+        }
+
+        // the event of a slot is opened once per subscriber
+        if ( ( m_hWake[i] == NULL ) || ( m_nWakeGeneration[i] != pSlot->nGeneration ) )
+        {
+            if ( m_hWake[i] != NULL )
+            {
+                CloseHandle( m_hWake[i] );
+            }
+
+            m_nWakeGeneration[i] = pSlot->nGeneration;
+            sprintf( szName, "%s.rx.%u.%lu", m_szName, i, m_nWakeGeneration[i] );
+            m_hWake[i] = OpenEvent( EVENT_MODIFY_STATE, FALSE, szName );
+        }
+
+        if ( m_hWake[i] != NULL )
+        {
+            SetEvent( m_hWake[i] );
+        }
+    }
+}
+
+DWORD WINAPI CSerialBroadcast::InjectThread( LPVOID pParam )
+{
+    CSerialBroadcast *pBroadcast = ( CSerialBroadcast * )pParam;
+    CSerialQueue *pQueue = &pBroadcast->m_InjectQueue;
+    SERIAL_RECORD *pRecord;
+    SERIAL_PEEK_RESULT Result;
+    HANDLE hEvents[2];
+    DWORD dwWait;
+    DWORD dwTimeout = INFINITE;
+    DWORD nPos = pQueue->GetTail();
+    DWORD nSize;
+    DWORD nLength;
+    DWORD nStallPos = 0;
+    DWORD dwStallStart = 0;
+    BOOL  bStalled = FALSE;
+    hEvents[0] = pBroadcast->m_hStopEvent;
+    hEvents[1] = pBroadcast->m_hInjectEvent;
+
+    // every injected record becomes one write of the port, so frames of different injectors do not interleave;
+    // the ring is writable by every injector, so nothing in it is used before PeekShared() checked it
+    for ( ;; )
+    {
+        dwWait = WaitForMultipleObjects( 2, hEvents, FALSE, dwTimeout );
+
+        if ( ( dwWait != WAIT_OBJECT_0 + 1 ) && ( dwWait != WAIT_TIMEOUT ) )
+        {
+            break;
+        }
+
+        dwTimeout = INFINITE;
+
+        while ( ( Result = pQueue->PeekShared( &nPos, &pRecord, &nSize, &nLength ) ) == SERIAL_PEEK_OK )
+        {
+            if ( ( pBroadcast->m_pPort == NULL ) ||
+                 ( pBroadcast->m_pPort->WriteAsync( CSerialQueue::GetPayload( pRecord ), nSize, pBroadcast->m_InjectPriority,
+                                                    SERIAL_SHARE_INJECT_TIMEOUT ) != SERIAL_WRITE_OK ) )
+            {
+                InterlockedIncrement( &pBroadcast->m_nInjectDropped );
+            }
+
+            nPos += nLength;
+            pQueue->Release( nPos );
+            bStalled = FALSE;
+        }
+
+        if ( Result == SERIAL_PEEK_PENDING )
+        {
+            if ( !bStalled || ( nStallPos != nPos ) )
+            {
+                // an injector is between Reserve() and Commit(), look again once it had its time
+                bStalled = TRUE;
+                nStallPos = nPos;
+                dwStallStart = GetTickCount();
+                dwTimeout = SERIAL_SHARE_INJECT_STALL;
+                continue;
+            }
+
+            if ( GetTickCount() - dwStallStart < SERIAL_SHARE_INJECT_STALL )
+            {
+                dwTimeout = SERIAL_SHARE_INJECT_STALL - ( GetTickCount() - dwStallStart );
+                continue;
+            }
+
+            // the injector died or hangs there, its frame is dropped so the others get through
+            bStalled = FALSE;
+            InterlockedIncrement( &pBroadcast->m_nInjectDropped );
+
+            if ( pQueue->Skip( &nPos ) )
+            {
+                pQueue->Release( nPos );
+                dwTimeout = 0;
+                continue;
+            }
+
+            Result = SERIAL_PEEK_CORRUPT;
+        }
+
+        if ( Result == SERIAL_PEEK_CORRUPT )
+        {
+            // an injector wrote where it should not, whatever is queued cannot be trusted
+            InterlockedIncrement( &pBroadcast->m_nInjectDropped );
+            pQueue->Reset();
+            nPos = pQueue->GetTail();
+            bStalled = FALSE;
+        }
+    }
+
+    return 0;
+}
+
+CSerialSubscriber::CSerialSubscriber()
+{
+    m_hMapping = NULL;
+    m_pHeader = NULL;
+    m_pRing = NULL;
+    m_nSlot = SERIAL_SHARE_SUBSCRIBERS_MAX;
+    m_hWake = NULL;
+    m_llCursor = 0;
+    m_nPeekLength = 0;
+    m_llLost = 0;
+    m_nOverruns = 0;
+}
+
+CSerialSubscriber::~CSerialSubscriber()
+{
+    Close();
+}
+
+BOOL CSerialSubscriber::Open( LPCTSTR pszName,             // the name given to CSerialBroadcast::Create()
+                              BOOL bFromOldest )            // start with what is still in the ring instead of new data
+{
+    assert( pszName != NULL );
+    Close();
+
+    if ( strlen( pszName ) + 32 > MAX_PATH )
+    {
+        return FALSE;
+    }
+
+    // the slot table is written by the subscribers, so the view is not read-only
+    m_hMapping = OpenFileMapping( FILE_MAP_WRITE, FALSE, pszName );
+    m_pHeader = ( m_hMapping != NULL ) ? ( SERIAL_SHARE_HEADER * )MapViewOfFile( m_hMapping, FILE_MAP_WRITE, 0, 0, 0 ) : NULL;
+
+    if ( ( m_pHeader == NULL ) || ( m_pHeader->dwMagic != SERIAL_SHARE_MAGIC ) || ( m_pHeader->dwVersion != SERIAL_SHARE_VERSION ) ||
+         !ClaimSlot( pszName ) )
+    {
+        Close();
+        return FALSE;
+    }
+
+    m_pRing = ( BYTE * )( m_pHeader + 1 );
+    m_llCursor = LoadPosition( bFromOldest ? &m_pHeader->llTail : &m_pHeader->llHead );
+    m_nPeekLength = 0;
+    m_llLost = 0;
+    m_nOverruns = 0;
+    return TRUE;
+}
+
+void CSerialSubscriber::Close()
+{
+    if ( m_nSlot < SERIAL_SHARE_SUBSCRIBERS_MAX )
+    {
+        m_pHeader->Slots[m_nSlot].bWaiting = FALSE;
+        InterlockedExchange( &m_pHeader->Slots[m_nSlot].nState, SERIAL_SHARE_SLOT_FREE );
+        m_nSlot = SERIAL_SHARE_SUBSCRIBERS_MAX;
+    }
+
+    if ( m_hWake != NULL )
+    {
+        CloseHandle( m_hWake );
+        m_hWake = NULL;
+    }
+
+    if ( m_pHeader != NULL )
+    {
+        UnmapViewOfFile( m_pHeader );
+        m_pHeader = NULL;
+        m_pRing = NULL;
+    }
+
+    if ( m_hMapping != NULL )
+    {
+        CloseHandle( m_hMapping );
+        m_hMapping = NULL;
+    }
+}
+
+SERIAL_SHARE_RESULT CSerialSubscriber::Peek( const BYTE **ppData,      // points into the ring, valid until Advance() says otherwise
+                                             DWORD *pnSize,
+                                             LONGLONG *pllTimestamp )
+{
+    SERIAL_SHARE_RECORD *pRecord;
+    LONGLONG llTail;
+    DWORD nLength;
+    DWORD nSize;
+    LONGLONG llTimestamp;
+    assert( ( ppData != NULL ) && ( pnSize != NULL ) );
+
+    if ( m_pRing == NULL )
+    {
+        return SERIAL_SHARE_CLOSED;
+    }
+
+    m_nPeekLength = 0;
+
+    for ( ;; )
+    {
+        llTail = LoadPosition( &m_pHeader->llTail );
+
+        if ( m_llCursor < llTail )
+        {
+            m_llLost += llTail - m_llCursor;
+            m_nOverruns++;
+            m_llCursor = llTail;
+            return SERIAL_SHARE_OVERRUN;
+        }
+
+        if ( m_llCursor == LoadPosition( &m_pHeader->llHead ) )
+        {
+            return SERIAL_SHARE_EMPTY;
+        }
+
+        pRecord = ( SERIAL_SHARE_RECORD * )( m_pRing + ( ( DWORD )m_llCursor & ( m_pHeader->nCapacity - 1 ) ) );
+        nLength = pRecord->nLength;
+        nSize = pRecord->nSize;
+        llTimestamp = pRecord->llTimestamp;
+
+        // the header is only trusted if the writer did not reclaim it while it was read
+        if ( LoadPosition( &m_pHeader->llTail ) > m_llCursor )
+        {
+            continue;
+        }
+
+        if ( nSize == SERIAL_SHARE_PAD )
+        {
+            m_llCursor += nLength;
+            continue;
+        }
+
+        *ppData = ( const BYTE * )( pRecord + 1 );
+        *pnSize = nSize;
+
+        if ( pllTimestamp != NULL )
+        {
+            *pllTimestamp = llTimestamp;
+        }
+
+        m_nPeekLength = nLength;
+        return SERIAL_SHARE_OK;
+    }
+}
+
+BOOL CSerialSubscriber::Advance()                          // FALSE: the chunk was overwritten while in use, discard what was taken from it
+{
+    BOOL bIntact;
+
+    if ( m_nPeekLength == 0 )
+    {
+        return FALSE;
+    }
+
+    bIntact = ( LoadPosition( &m_pHeader->llTail ) <= m_llCursor );
+    m_llCursor += m_nPeekLength;
+    m_nPeekLength = 0;
+    return bIntact;
+}
+
+BOOL CSerialSubscriber::Wait( DWORD dwTimeout )            // FALSE when nothing was published within the timeout
+{
+    SERIAL_SHARE_SLOT *pSlot;
+    BOOL ret = TRUE;
+
+    if ( m_nSlot >= SERIAL_SHARE_SUBSCRIBERS_MAX )
+    {
+        return FALSE;
+    }
+
+    pSlot = &m_pHeader->Slots[m_nSlot];
+    // announce first and check again, the publisher looks at the flag after it moved the head
+    InterlockedExchange( &pSlot->bWaiting, TRUE );
+
+    if ( m_llCursor == LoadPosition( &m_pHeader->llHead ) )
+    {
+        ret = ( WaitForSingleObject( m_hWake, dwTimeout ) == WAIT_OBJECT_0 );
+    }
+
+    InterlockedExchange( &pSlot->bWaiting, FALSE );
+    return ret;
+}
+
+LONGLONG CSerialSubscriber::GetLostCount()
+{
+    return m_llLost;
+}
+
+DWORD CSerialSubscriber::GetOverrunCount()
+{
+    return m_nOverruns;
+}
+
+BOOL CSerialSubscriber::ClaimSlot( LPCTSTR pszName )
+{
+    char szName[MAX_PATH];
+    SERIAL_SHARE_SLOT *pSlot;
+    HANDLE hProcess;
+    LONG nState;
+    BOOL bGone;
+    UINT i;
+
+    for ( i = 0; i < SERIAL_SHARE_SUBSCRIBERS_MAX; i++ )
+    {
+        pSlot = &m_pHeader->Slots[i];
+        nState = pSlot->nState;
+        bGone = FALSE;
+
+        if ( nState == SERIAL_SHARE_SLOT_ACTIVE )
+        {
+            // a subscriber that exited without Close() leaves its slot behind
+            hProcess = OpenProcess( SYNCHRONIZE, FALSE, pSlot->dwProcess );
+            bGone = ( hProcess != NULL ) ? ( WaitForSingleObject( hProcess, 0 ) == WAIT_OBJECT_0 ) : ( GetLastError() == ERROR_INVALID_PARAMETER );
+
+            if ( hProcess != NULL )
+            {
+                CloseHandle( hProcess );
+            }
+        }
+
+        if ( ( ( nState == SERIAL_SHARE_SLOT_FREE ) || bGone ) &&
+             ( InterlockedCompareExchange( &pSlot->nState, SERIAL_SHARE_SLOT_CLAIMED, nState ) == nState ) )
+        {
+            break;
+        }
+    }
+
+    if ( i == SERIAL_SHARE_SUBSCRIBERS_MAX )
+    {
+        return FALSE;
+    }
+
+    // a new generation, so the publisher does not signal the event of the previous subscriber
+    pSlot->dwProcess = GetCurrentProcessId();
+    pSlot->nGeneration++;
+    pSlot->bWaiting = FALSE;
+    sprintf( szName, "%s.rx.%u.%lu", pszName, i, pSlot->nGeneration );
+    m_hWake = CreateEvent( NULL, FALSE, FALSE, szName );
+
+    if ( m_hWake == NULL )
+    {
+        InterlockedExchange( &pSlot->nState, SERIAL_SHARE_SLOT_FREE );
+        return FALSE;
+    }
+
+    m_nSlot = i;
+    InterlockedExchange( &pSlot->nState, SERIAL_SHARE_SLOT_ACTIVE );
+    return TRUE;
+}
+
+CSerialInjector::CSerialInjector()
+{
+    m_hMapping = NULL;
+    m_pHeader = NULL;
+    m_hInjectEvent = NULL;
+}
+
+CSerialInjector::~CSerialInjector()
+{
+    Close();
+}
+
+// an injector that dies between Reserve() and Commit() holds the queue up for SERIAL_SHARE_INJECT_STALL ms,
+// then the publisher drops its frame
+BOOL CSerialInjector::Open( LPCTSTR pszName )              // the name given to CSerialBroadcast::Create()
+{
+    char szName[MAX_PATH];
+    BOOL ret = TRUE;
+    assert( pszName != NULL );
+    Close();
+
+    if ( strlen( pszName ) + 32 > MAX_PATH )
+    {
+        return FALSE;
+    }
+
+    sprintf( szName, "%s.tx", pszName );
+    m_hMapping = OpenFileMapping( FILE_MAP_WRITE, FALSE, szName );
+
+    if ( m_hMapping == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    m_pHeader = ( SERIAL_QUEUE_HEADER * )MapViewOfFile( m_hMapping, FILE_MAP_WRITE, 0, 0, 0 );
+    sprintf( szName, "%s.tx.space", pszName );
+
+    if ( ( m_pHeader == NULL ) || !m_Queue.Attach( m_pHeader, 0, szName ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    sprintf( szName, "%s.tx.ready", pszName );
+    m_hInjectEvent = OpenEvent( EVENT_MODIFY_STATE, FALSE, szName );
+    ret = ( m_hInjectEvent != NULL );
+
+done:
+
+    if ( !ret )
+    {
+        Close();
+    }
+
+    return ret;
+}
+
+void CSerialInjector::Close()
+{
+    m_Queue.Destroy();
+
+    if ( m_hInjectEvent != NULL )
+    {
+        CloseHandle( m_hInjectEvent );
+        m_hInjectEvent = NULL;
+    }
+
+    if ( m_pHeader != NULL )
+    {
+        UnmapViewOfFile( m_pHeader );
+        m_pHeader = NULL;
+    }
+
+    if ( m_hMapping != NULL )
+    {
+        CloseHandle( m_hMapping );
+        m_hMapping = NULL;
+    }
+}
+
+SERIAL_WRITE_RESULT CSerialInjector::Inject( const void *pData,     // one frame, written to the port in one piece
+                                             DWORD nSize,
+                                             DWORD dwTimeout )      // ms to wait for room, 0 fails at once
+{
+    SERIAL_RECORD *pRecord;
+    SERIAL_WRITE_RESULT Result = m_Queue.Reserve( nSize, dwTimeout, &pRecord );
+
+    if ( Result != SERIAL_WRITE_OK )
+    {
+        return Result;
+    }
+
+    memcpy( CSerialQueue::GetPayload( pRecord ), pData, nSize );
+    pRecord->llTimestamp = CSerialPort::GetTimestamp();
+    m_Queue.Commit( pRecord );
+    SetEvent( m_hInjectEvent );
+    return SERIAL_WRITE_OK;
+}
@@ -0,0 +1,164 @@
+/*
+**  FILENAME            SerialShare.h
+**
+**  PURPOSE             Fan-out of the received data of one port to other local processes.
+**                      The owning process publishes every chunk into a single-writer ring in a
+**                      named file mapping; subscribers keep their own cursor, read the chunks
+**                      in place and notice when the writer lapped them. Injectors may queue
+**                      frames for transmission through a second mapping of their own.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_SHARE_H
+#define SERIAL_SHARE_H
+
+#define SERIAL_SHARE_MAGIC          0x52485353UL            /* "SSHR" */
+#define SERIAL_SHARE_VERSION        1UL
+#define SERIAL_SHARE_RING_SIZE      ( 1024UL * 1024 )       /* default bytes of the receive ring */
+#define SERIAL_SHARE_RING_MIN       4096UL
+#define SERIAL_SHARE_ALIGN          16UL                    /* a record header always fits before the end of the ring */
+#define SERIAL_SHARE_PAD            MAXDWORD                /* nSize of the filler up to the end of the ring */
+#define SERIAL_SHARE_SUBSCRIBERS_MAX 16UL
+#define SERIAL_SHARE_INJECT_TIMEOUT 1000UL                  /* ms an injected frame waits for room in the transmit queue */
+#define SERIAL_SHARE_INJECT_STALL   500UL                   /* ms a reserved frame may stay uncommitted before the publisher skips it */
+
+typedef enum
+{
+    SERIAL_SHARE_OK = 0,                                    /* a chunk is ready, call Advance() once done with it */
+    SERIAL_SHARE_EMPTY,                                     /* nothing new */
+    SERIAL_SHARE_OVERRUN,                                   /* the writer lapped the cursor, it moved on to the oldest chunk */
+    SERIAL_SHARE_CLOSED                                     /* not attached */
+} SERIAL_SHARE_RESULT;
+
+typedef enum
+{
+    SERIAL_SHARE_SLOT_FREE = 0,
+    SERIAL_SHARE_SLOT_CLAIMED,                              /* a subscriber is setting up its wake event */
+    SERIAL_SHARE_SLOT_ACTIVE
+} SERIAL_SHARE_SLOT_STATE;
+
+typedef struct
+{
+    volatile LONG       nState;                             /* SERIAL_SHARE_SLOT_STATE */
+    volatile LONG       bWaiting;                           /* the subscriber sleeps on its event */
+    DWORD               dwProcess;                          /* a slot of a process that exited is taken over */
+    DWORD               nGeneration;                        /* part of the event name, renewed with every subscriber */
+} SERIAL_SHARE_SLOT;
+
+typedef struct
+{
+    DWORD               dwMagic;
+    DWORD               dwVersion;
+    DWORD               nCapacity;                          /* ring bytes, power of two */
+    DWORD               dwOwner;                            /* process id of the publisher */
+    BYTE                Pad1[SERIAL_CACHE_LINE - 4 * sizeof( DWORD )];
+    volatile LONGLONG   llHead;                             /* bytes published, never wraps */
+    BYTE                Pad2[SERIAL_CACHE_LINE - sizeof( LONGLONG )];
+    volatile LONGLONG   llTail;                             /* oldest record not yet overwritten, moved before the writer reuses space */
+    BYTE                Pad3[SERIAL_CACHE_LINE - sizeof( LONGLONG )];
+    SERIAL_SHARE_SLOT   Slots[SERIAL_SHARE_SUBSCRIBERS_MAX];
+} SERIAL_SHARE_HEADER;
+
+typedef struct
+{
+    DWORD               nLength;                            /* aligned record length */
+    DWORD               nSize;                              /* bytes following, SERIAL_SHARE_PAD for the filler */
+    LONGLONG            llTimestamp;                        /* arrival of the first byte, CSerialPort::GetTimestamp() */
+} SERIAL_SHARE_RECORD;
+
+class CSerialPort;
+
+/* publisher, lives in the process that owns the port */
+class CSerialBroadcast
+{
+    public:
+        CSerialBroadcast();
+        virtual             ~CSerialBroadcast();
+
+        BOOL                Create( LPCTSTR pszName,
+                                    DWORD nRingSize = SERIAL_SHARE_RING_SIZE,
+                                    DWORD nInjectSize = 0,
+                                    LPSECURITY_ATTRIBUTES pRxSecurity = NULL,
+                                    LPSECURITY_ATTRIBUTES pInjectSecurity = NULL );
+        void                Destroy();
+        BOOL                Attach( CSerialPort *pPort );
+        void                SetInjectPriority( SERIAL_PRIORITY Priority );
+        void                Publish( const BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        UINT                GetSubscriberCount();
+        DWORD               GetInjectDroppedCount();
+
+    protected:
+        char                m_szName[MAX_PATH];
+        CSerialPort         *m_pPort;
+        HANDLE              m_hMapping;
+        SERIAL_SHARE_HEADER *m_pHeader;
+        BYTE                *m_pRing;
+        HANDLE              m_hWake[SERIAL_SHARE_SUBSCRIBERS_MAX];
+        DWORD               m_nWakeGeneration[SERIAL_SHARE_SUBSCRIBERS_MAX];
+        HANDLE              m_hInjectMapping;
+        SERIAL_QUEUE_HEADER *m_pInjectHeader;
+        CSerialQueue        m_InjectQueue;
+        HANDLE              m_hInjectEvent;
+        HANDLE              m_hStopEvent;
+        HANDLE              m_hInjectThread;
+        SERIAL_PRIORITY     m_InjectPriority;
+        volatile LONG       m_nInjectDropped;
+
+        void                Append( const BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        void                Reclaim( LONGLONG llEnd );
+        void                WakeSubscribers();
+        static DWORD WINAPI InjectThread( LPVOID pParam );
+};
+
+/* reader in any local process, one cursor per subscriber */
+class CSerialSubscriber
+{
+    public:
+        CSerialSubscriber();
+        virtual             ~CSerialSubscriber();
+
+        BOOL                Open( LPCTSTR pszName, BOOL bFromOldest = FALSE );
+        void                Close();
+        SERIAL_SHARE_RESULT Peek( const BYTE **ppData, DWORD *pnSize, LONGLONG *pllTimestamp = NULL );
+        BOOL                Advance();
+        BOOL                Wait( DWORD dwTimeout );
+        LONGLONG            GetLostCount();
+        DWORD               GetOverrunCount();
+
+    protected:
+        HANDLE              m_hMapping;
+        SERIAL_SHARE_HEADER *m_pHeader;
+        BYTE                *m_pRing;
+        UINT                m_nSlot;
+        HANDLE              m_hWake;
+        LONGLONG            m_llCursor;
+        DWORD               m_nPeekLength;                  /* record handed out by Peek(), 0 if none */
+        LONGLONG            m_llLost;                       /* bytes of records overwritten before they were read */
+        DWORD               m_nOverruns;
+
+        BOOL                ClaimSlot( LPCTSTR pszName );
+};
+
+/* writer in any local process that was given access to the injection mapping */
+class CSerialInjector
+{
+    public:
+        CSerialInjector();
+        virtual             ~CSerialInjector();
+
+        BOOL                Open( LPCTSTR pszName );
+        void                Close();
+        SERIAL_WRITE_RESULT Inject( const void *pData, DWORD nSize, DWORD dwTimeout = 0 );
+
+    protected:
+        HANDLE              m_hMapping;
+        SERIAL_QUEUE_HEADER *m_pHeader;
+        CSerialQueue        m_Queue;
+        HANDLE              m_hInjectEvent;
+};
+
+#endif SERIAL_SHARE_H
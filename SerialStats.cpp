@@ -0,0 +1,191 @@
+/*
+**  FILENAME            SerialStats.cpp
+**
+**  PURPOSE             Performance counters and latency histograms of one serial port.
+**                      Updated with interlocked operations by whichever thread does the work,
+**                      read through snapshots that can also reset them.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialStats.h"
+#include <assert.h>
+#include <intrin.h>
+
+void CSerialStats::Add( volatile LONGLONG *pCounter, LONGLONG llValue )
+{
+    InterlockedExchangeAdd64( pCounter, llValue );
+}
+
+void CSerialStats::Max( volatile LONGLONG *pMark, LONGLONG llValue )
+{
+    LONGLONG llMark = *pMark;
+
+    // a plain read first, the mark rarely moves
+    while ( llValue > llMark )
+    {
+        LONGLONG llSeen = InterlockedCompareExchange64( pMark, llValue, llMark );
+
+        if ( llSeen == llMark )
+        {
+            break;
+        }
+
+        llMark = llSeen;
+    }
+}
+
+void CSerialStats::Record( SERIAL_HISTOGRAM *pHistogram, LONGLONG llValue )
+{
+    if ( llValue < 0 )
+    {
+        llValue = 0;
+    }
+
+    InterlockedIncrement64( &pHistogram->llBuckets[GetBucket( llValue )] );
+    InterlockedIncrement64( &pHistogram->llCount );
+    InterlockedExchangeAdd64( &pHistogram->llTotal, llValue );
+    Max( &pHistogram->llMax, llValue );
+}
+
+void CSerialStats::AddErrors( SERIAL_STATS *pStats, DWORD dwErrors )
+{
+    if ( dwErrors == 0 )
+    {
+        return;
+    }
+
+    if ( dwErrors & ( CE_OVERRUN | CE_RXOVER ) )
+    {
+        Add( &pStats->llOverruns );
+    }
+
+    if ( dwErrors & CE_FRAME )
+    {
+        Add( &pStats->llFramingErrors );
+    }
+
+    if ( dwErrors & CE_RXPARITY )
+    {
+        Add( &pStats->llParityErrors );
+    }
+
+    if ( dwErrors & CE_BREAK )
+    {
+        Add( &pStats->llBreaks );
+    }
+}
+
+void CSerialStats::Snapshot( SERIAL_STATS *pStats,      // live counters
+                             SERIAL_STATS *pBase,       // values at the last reset
+                             SERIAL_STATS *pSnapshot,
+                             BOOL bReset )
+{
+    // every field is a LONGLONG, walk them as one array; counters are never written
+    // here, a reset moves the base instead so no update of another thread is lost
+    volatile LONGLONG *pLive = ( volatile LONGLONG * )pStats;
+    LONGLONG *pFrom = ( LONGLONG * )pBase;
+    LONGLONG *pTo = ( LONGLONG * )pSnapshot;
+    LONGLONG llValue;
+    DWORD i;
+    assert( ( pStats != NULL ) && ( pBase != NULL ) && ( pSnapshot != NULL ) );
+
+    for ( i = 0; i < sizeof( SERIAL_STATS ) / sizeof( LONGLONG ); i++ )
+    {
+        llValue = InterlockedCompareExchange64( &pLive[i], 0, 0 );
+        pTo[i] = llValue - pFrom[i];
+
+        if ( bReset )
+        {
+            pFrom[i] = llValue;
+        }
+    }
+
+    // high-water marks are not sums, they start over from zero
+    pSnapshot->llRxQueueHigh = bReset ? InterlockedExchange64( &pStats->llRxQueueHigh, 0 ) : pStats->llRxQueueHigh;
+    pSnapshot->llTxQueueHigh = bReset ? InterlockedExchange64( &pStats->llTxQueueHigh, 0 ) : pStats->llTxQueueHigh;
+    pSnapshot->TxLatency.llMax = bReset ? InterlockedExchange64( &pStats->TxLatency.llMax, 0 ) : pStats->TxLatency.llMax;
+    pSnapshot->TxUrgentLatency.llMax = bReset ? InterlockedExchange64( &pStats->TxUrgentLatency.llMax, 0 ) : pStats->TxUrgentLatency.llMax;
+    pSnapshot->RxLatency.llMax = bReset ? InterlockedExchange64( &pStats->RxLatency.llMax, 0 ) : pStats->RxLatency.llMax;
+
+    if ( bReset )
+    {
+        pBase->llRxQueueHigh = 0;
+        pBase->llTxQueueHigh = 0;
+        pBase->TxLatency.llMax = 0;
+        pBase->TxUrgentLatency.llMax = 0;
+        pBase->RxLatency.llMax = 0;
+    }
+}
+
+DWORD CSerialStats::GetBucket( LONGLONG llValue )
+{
+    ULONGLONG ullValue = ( ULONGLONG )llValue;
+    DWORD nBit;
+    DWORD nShift;
+
+    if ( ullValue < SERIAL_HISTOGRAM_SUB_COUNT )
+    {
+        return ( DWORD )ullValue;
+    }
+
+    if ( ( DWORD )( ullValue >> 32 ) != 0 )
+    {
+        _BitScanReverse( &nBit, ( DWORD )( ullValue >> 32 ) );
+        nBit += 32;
+    }
+    else
+    {
+        _BitScanReverse( &nBit, ( DWORD )ullValue );
+    }
+
+    // power of two picks the row, the next bits below the top one the column
+    nShift = nBit - SERIAL_HISTOGRAM_SUB_BITS;
+    return ( nShift + 1 ) * SERIAL_HISTOGRAM_SUB_COUNT + ( DWORD )( ( ullValue >> nShift ) - SERIAL_HISTOGRAM_SUB_COUNT );
+}
+
+LONGLONG CSerialStats::GetBucketLimit( DWORD nBucket )
+{
+    DWORD nShift;
+    ULONGLONG ullNext;
+
+    if ( nBucket < SERIAL_HISTOGRAM_SUB_COUNT )
+    {
+        return nBucket;
+    }
+
+    nShift = nBucket / SERIAL_HISTOGRAM_SUB_COUNT - 1;
+    ullNext = ( ULONGLONG )( SERIAL_HISTOGRAM_SUB_COUNT + nBucket % SERIAL_HISTOGRAM_SUB_COUNT + 1 ) << nShift;
+    return ( ullNext > ( ULONGLONG )MAXLONGLONG ) ? MAXLONGLONG : ( LONGLONG )( ullNext - 1 );
+}
+
+LONGLONG CSerialStats::GetPercentile( const SERIAL_HISTOGRAM *pHistogram, double dPercent )
+{
+    LONGLONG llRank = ( LONGLONG )( ( double )pHistogram->llCount * dPercent / 100.0 + 0.5 );
+    LONGLONG llSeen = 0;
+    DWORD i;
+
+    if ( pHistogram->llCount == 0 )
+    {
+        return 0;
+    }
+
+    llRank = max( llRank, ( LONGLONG )1 );
+
+    for ( i = 0; i < SERIAL_HISTOGRAM_BUCKETS; i++ )
+    {
+        llSeen += pHistogram->llBuckets[i];
+
+        if ( llSeen >= llRank )
+        {
+            // upper edge of the bucket, never above the largest value seen
+            return ( pHistogram->llMax > 0 ) ? min( GetBucketLimit( i ), pHistogram->llMax ) : GetBucketLimit( i );
+        }
+    }
+
+    return pHistogram->llMax;
+}
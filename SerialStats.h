@@ -0,0 +1,67 @@
+/*
+**  FILENAME            SerialStats.h
+**
+**  PURPOSE             Performance counters and latency histograms of one serial port.
+**                      Updated with interlocked operations by whichever thread does the work,
+**                      read through snapshots that can also reset them.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_STATS_H
+#define SERIAL_STATS_H
+
+#define SERIAL_HISTOGRAM_SUB_BITS   3UL                     /* 8 linear buckets per power of two, 12.5% resolution */
+#define SERIAL_HISTOGRAM_SUB_COUNT  ( 1UL << SERIAL_HISTOGRAM_SUB_BITS )
+#define SERIAL_HISTOGRAM_BUCKETS    ( ( 63UL - SERIAL_HISTOGRAM_SUB_BITS + 1 ) * SERIAL_HISTOGRAM_SUB_COUNT )    /* up to MAXLONGLONG */
+
+typedef struct
+{
+    volatile LONGLONG   llCount;
+    volatile LONGLONG   llTotal;                            /* microseconds */
+    volatile LONGLONG   llMax;                              /* since the last reset */
+    volatile LONGLONG   llBuckets[SERIAL_HISTOGRAM_BUCKETS];
+} SERIAL_HISTOGRAM;
+
+typedef struct
+{
+    volatile LONGLONG   llRxBytes;
+    volatile LONGLONG   llTxBytes;                          /* confirmed by write completion */
+    volatile LONGLONG   llReadCalls;                        /* ReadFile */
+    volatile LONGLONG   llWriteCalls;                       /* WriteFile */
+    volatile LONGLONG   llWakeups;                          /* comm thread or reactor woken for this port */
+    volatile LONGLONG   llEmptyPolls;                       /* woken by a line event with nothing to read */
+    volatile LONGLONG   llSpinWakeups;                      /* wakeups found by busy polling, without a blocking wait */
+    volatile LONGLONG   llOverruns;                         /* CE_OVERRUN, CE_RXOVER */
+    volatile LONGLONG   llFramingErrors;                    /* CE_FRAME */
+    volatile LONGLONG   llParityErrors;                     /* CE_RXPARITY */
+    volatile LONGLONG   llBreaks;                           /* CE_BREAK */
+    volatile LONGLONG   llRxDropped;                        /* bytes Read() fell too far behind for, without flow control */
+    volatile LONGLONG   llRxFlowOffs;                       /* the peer was stopped at the high watermark */
+    volatile LONGLONG   llTxFlowStalls;                     /* the peer held our writes back, CTS, DSR or XOFF */
+    volatile LONGLONG   llTxCopied;                         /* bytes copied on the way to the driver, into the queue and into a batch */
+    volatile LONGLONG   llRxQueueHigh;                      /* driver input queue high-water mark, bytes */
+    volatile LONGLONG   llTxQueueHigh;                      /* transmit queue high-water mark, bytes */
+    SERIAL_HISTOGRAM    TxLatency;                          /* WriteAsync() to write completion */
+    SERIAL_HISTOGRAM    TxUrgentLatency;                    /* the same for SERIAL_PRIORITY_URGENT only, head-of-line delay */
+    SERIAL_HISTOGRAM    RxLatency;                          /* first byte read to delivery */
+} SERIAL_STATS;
+
+class CSerialStats
+{
+    public:
+        static void         Add( volatile LONGLONG *pCounter, LONGLONG llValue = 1 );
+        static void         Max( volatile LONGLONG *pMark, LONGLONG llValue );
+        static void         Record( SERIAL_HISTOGRAM *pHistogram, LONGLONG llValue );
+        static void         AddErrors( SERIAL_STATS *pStats, DWORD dwErrors );
+        static void         Snapshot( SERIAL_STATS *pStats, SERIAL_STATS *pBase, SERIAL_STATS *pSnapshot, BOOL bReset );
+
+        static DWORD        GetBucket( LONGLONG llValue );
+        static LONGLONG     GetBucketLimit( DWORD nBucket );
+        static LONGLONG     GetPercentile( const SERIAL_HISTOGRAM *pHistogram, double dPercent );
+};
+
+#endif SERIAL_STATS_H
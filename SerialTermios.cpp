@@ -0,0 +1,772 @@
+/*
+**  FILENAME            SerialTermios.cpp
+**
+**  PURPOSE             The Linux backend of CSerialPort: open, configure, read and write one
+**                      serial port through termios. The DCB of Open() and SetDCB() becomes a
+**                      termios2 with BOTHER so any baud rate goes to the driver, the read
+**                      timeouts become VMIN and VTIME where the kernel can wait for them.
+**                      No thread, no messages: the owner reads with Read().
+**                      Compiles to nothing under Windows.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#if !defined( _WIN32 )
+
+#include "SerialTermios.h"
+#include <sys/ioctl.h>
+#include <asm/termbits.h>                                   /* termios2, not <termios.h>: both define struct termios */
+#include <linux/serial.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+static cc_t GetVtime( DWORD dwMilliseconds )               // rounded up to the next step, 0 is no timer
+{
+    return ( cc_t )( ( dwMilliseconds >= SERIAL_VMIN_MAX * SERIAL_VTIME_UNIT ) ? SERIAL_VMIN_MAX :
+                     ( dwMilliseconds + SERIAL_VTIME_UNIT - 1 ) / SERIAL_VTIME_UNIT );
+}
+
+static int GetPollTimeout( LONGLONG llWait )             // us to the ms of poll(), rounded up; MAXLONGLONG waits for ever
+{
+    return ( llWait == MAXLONGLONG ) ? -1 : ( int )( ( llWait >= ( LONGLONG )INT_MAX * 1000 ) ? INT_MAX : ( llWait + 999 ) / 1000 );
+}
+
+CSerialTermios::CSerialTermios()
+{
+    m_nReadFd = -1;
+    m_nWriteFd = -1;
+    m_bReadPoll = FALSE;
+    m_pOwner = NULL;
+    m_nPortNr = 0;
+    m_szDevice[0] = '\0';
+    memset( &m_dcb, 0, sizeof( m_dcb ) );
+    memset( &m_CommTimeouts, 0, sizeof( m_CommTimeouts ) );
+    pthread_mutex_init( &m_csCommunicationSync, NULL );
+}
+
+CSerialTermios::~CSerialTermios()
+{
+    Close();
+    pthread_mutex_destroy( &m_csCommunicationSync );
+}
+
+BOOL CSerialTermios::Open( HWND    pPortOwner,      // kept for the interface, no messages are sent
+                           UINT    port,            // portnumber, ttyS(port - 1)
+                           UINT    baud,            // baudrate, any value the driver accepts
+                           BYTE    parity,          // parity
+                           BYTE    databits,        // databits
+                           BYTE    stopbits,        // stopbits
+                           DWORD   dwCommEvents,    // unused, Read() is the only receive path
+                           UINT    nBufferSize,     // unused, the tty buffers are the kernel's
+                           DWORD   ReadIntervalTimeout,
+                           DWORD   ReadTotalTimeoutMultiplier,
+                           DWORD   ReadTotalTimeoutConstant,
+                           DWORD   WriteTotalTimeoutMultiplier,
+                           DWORD   WriteTotalTimeoutConstant )
+{
+    char szDevice[64];
+    assert( ( port > 0 ) && ( port <= SERIAL_PORT_MAX ) );
+    GetDeviceName( port, szDevice, sizeof( szDevice ) );
+
+    if ( !Open( pPortOwner, szDevice, baud, parity, databits, stopbits, dwCommEvents, nBufferSize, ReadIntervalTimeout,
+                ReadTotalTimeoutMultiplier, ReadTotalTimeoutConstant, WriteTotalTimeoutMultiplier, WriteTotalTimeoutConstant ) )
+    {
+        return FALSE;
+    }
+
+    m_nPortNr = port;
+    return TRUE;
+}
+
+BOOL CSerialTermios::Open( HWND    pPortOwner,
+                           const char *szDevice,    // /dev/ttyUSB0, /dev/serial/by-id/..., a pty
+                           UINT    baud,
+                           BYTE    parity,
+                           BYTE    databits,
+                           BYTE    stopbits,
+                           DWORD   dwCommEvents,
+                           UINT    nBufferSize,
+                           DWORD   ReadIntervalTimeout,
+                           DWORD   ReadTotalTimeoutMultiplier,
+                           DWORD   ReadTotalTimeoutConstant,
+                           DWORD   WriteTotalTimeoutMultiplier,
+                           DWORD   WriteTotalTimeoutConstant )
+{
+    const char *szCall = NULL;
+    int nError;
+    assert( szDevice != NULL );
+    Close();
+    pthread_mutex_lock( &m_csCommunicationSync );
+    m_pOwner = pPortOwner;
+    m_nPortNr = 0;
+    snprintf( m_szDevice, sizeof( m_szDevice ), "%s", szDevice );
+
+    // O_NONBLOCK so a missing carrier cannot hold the open; the read side blocks again below.
+    // The write side is a second description of the same tty: O_NONBLOCK belongs to the
+    // description, so the reads keep waiting in the kernel while a write waits in poll()
+    if ( ( m_nReadFd = open( szDevice, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC ) ) < 0 )
+    {
+        szCall = "open";
+        goto failed;
+    }
+
+    if ( ( m_nWriteFd = open( szDevice, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC ) ) < 0 )
+    {
+        szCall = "open";
+        goto failed;
+    }
+
+    if ( fcntl( m_nReadFd, F_SETFL, 0 ) < 0 )
+    {
+        szCall = "fcntl";
+        goto failed;
+    }
+
+    // comm devices are exclusive under Windows, any further open fails with EBUSY
+    if ( ioctl( m_nReadFd, TIOCEXCL ) < 0 )
+    {
+        szCall = "TIOCEXCL";
+        goto failed;
+    }
+
+    // the settings Open() of the Windows port starts from
+    memset( &m_dcb, 0, sizeof( m_dcb ) );
+    m_dcb.DCBlength = sizeof( m_dcb );
+    m_dcb.BaudRate = baud;
+    m_dcb.Parity   = parity;
+    m_dcb.ByteSize = databits;
+    m_dcb.StopBits = stopbits;
+    m_dcb.fBinary = TRUE;
+    m_dcb.fRtsControl = RTS_CONTROL_DISABLE;
+    m_dcb.fDtrControl = DTR_CONTROL_DISABLE;
+    m_dcb.XonChar = 0x11;
+    m_dcb.XoffChar = 0x13;
+
+    if ( !ApplyDCB( &m_dcb ) )
+    {
+        goto failed;
+    }
+
+    m_CommTimeouts.ReadIntervalTimeout         = ReadIntervalTimeout;
+    m_CommTimeouts.ReadTotalTimeoutMultiplier  = ReadTotalTimeoutMultiplier;
+    m_CommTimeouts.ReadTotalTimeoutConstant    = ReadTotalTimeoutConstant;
+    m_CommTimeouts.WriteTotalTimeoutMultiplier = WriteTotalTimeoutMultiplier;
+    m_CommTimeouts.WriteTotalTimeoutConstant   = WriteTotalTimeoutConstant;
+
+    if ( !ApplyTimeouts() )
+    {
+        goto failed;
+    }
+
+    // flush the port
+    if ( ioctl( m_nReadFd, TCFLSH, TCIOFLUSH ) < 0 )
+    {
+        szCall = "TCFLSH";
+        goto failed;
+    }
+
+    pthread_mutex_unlock( &m_csCommunicationSync );
+    return TRUE;
+
+failed:
+    if ( szCall != NULL )
+    {
+        ReportError( szCall );
+    }
+
+    nError = errno;
+
+    if ( m_nWriteFd >= 0 )
+    {
+        close( m_nWriteFd );
+        m_nWriteFd = -1;
+    }
+
+    if ( m_nReadFd >= 0 )
+    {
+        close( m_nReadFd );
+        m_nReadFd = -1;
+    }
+
+    pthread_mutex_unlock( &m_csCommunicationSync );
+    errno = nError;
+    return FALSE;
+}
+
+BOOL CSerialTermios::ApplyDCB( const DCB *dcb )        // under m_csCommunicationSync
+{
+    struct termios2 Termios;
+    int nSet;
+    int nClear;
+
+    // termios has no DTR/DSR handshake and leaves RTS toggling to TIOCSRS485
+    if ( dcb->fOutxDsrFlow || dcb->fDsrSensitivity || ( dcb->fDtrControl == DTR_CONTROL_HANDSHAKE ) ||
+         ( dcb->fRtsControl == RTS_CONTROL_TOGGLE ) || ( dcb->BaudRate == 0 ) || ( dcb->ByteSize < 5 ) ||
+         ( dcb->ByteSize > 8 ) || ( dcb->Parity > SPACEPARITY ) || ( dcb->StopBits > TWOSTOPBITS ) )
+    {
+        errno = EINVAL;
+        ReportError( "SetDCB" );
+        return FALSE;
+    }
+
+    if ( ioctl( m_nReadFd, TCGETS2, &Termios ) < 0 )
+    {
+        ReportError( "TCGETS2" );
+        return FALSE;
+    }
+
+    // raw: no line editing, echo, signals or translation, the bytes go through as they are;
+    // VMIN and VTIME stay as ApplyTimeouts() set them
+    Termios.c_iflag &= ~( IGNBRK | BRKINT | IGNPAR | PARMRK | INPCK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY );
+    Termios.c_oflag &= ~OPOST;
+    Termios.c_lflag &= ~( ECHO | ECHONL | ICANON | ISIG | IEXTEN );
+    Termios.c_cflag &= ~( CSIZE | PARENB | PARODD | CMSPAR | CSTOPB | CRTSCTS | CBAUD | ( CBAUD << IBSHIFT ) );
+    Termios.c_cflag |= CREAD | CLOCAL;
+
+    // BOTHER hands the driver the rate itself instead of one of the Bnnn codes
+    Termios.c_cflag |= BOTHER | ( BOTHER << IBSHIFT );
+    Termios.c_ospeed = dcb->BaudRate;
+    Termios.c_ispeed = dcb->BaudRate;
+
+    switch ( dcb->ByteSize )
+    {
+        case 5:
+            Termios.c_cflag |= CS5;
+            break;
+
+        case 6:
+            Termios.c_cflag |= CS6;
+            break;
+
+        case 7:
+            Termios.c_cflag |= CS7;
+            break;
+
+        default:
+            Termios.c_cflag |= CS8;
+            break;
+    }
+
+    switch ( dcb->Parity )
+    {
+        case ODDPARITY:
+            Termios.c_cflag |= PARENB | PARODD;
+            break;
+
+        case EVENPARITY:
+            Termios.c_cflag |= PARENB;
+            break;
+
+        case MARKPARITY:
+            Termios.c_cflag |= PARENB | CMSPAR | PARODD;
+            break;
+
+        case SPACEPARITY:
+            Termios.c_cflag |= PARENB | CMSPAR;
+            break;
+    }
+
+    if ( dcb->fParity )
+    {
+        Termios.c_iflag |= INPCK;
+    }
+
+    // CSTOPB is 1.5 stop bits with 5 data bits
+    if ( dcb->StopBits != ONESTOPBIT )
+    {
+        Termios.c_cflag |= CSTOPB;
+    }
+
+    if ( dcb->fOutxCtsFlow || ( dcb->fRtsControl == RTS_CONTROL_HANDSHAKE ) )
+    {
+        Termios.c_cflag |= CRTSCTS;
+    }
+
+    if ( dcb->fOutX )
+    {
+        Termios.c_iflag |= IXON;
+    }
+
+    if ( dcb->fInX )
+    {
+        Termios.c_iflag |= IXOFF;
+    }
+
+    Termios.c_cc[VSTART] = dcb->XonChar;
+    Termios.c_cc[VSTOP] = dcb->XoffChar;
+
+    if ( ioctl( m_nReadFd, TCSETS2, &Termios ) < 0 )
+    {
+        ReportError( "TCSETS2" );
+        return FALSE;
+    }
+
+    // DTR and RTS as the DCB says, under CRTSCTS the driver moves RTS;
+    // a pty or an adapter without the lines answers ENOTTY or EINVAL, that is no error
+    nSet = ( ( dcb->fDtrControl == DTR_CONTROL_ENABLE ) ? TIOCM_DTR : 0 ) | ( ( dcb->fRtsControl == RTS_CONTROL_ENABLE ) ? TIOCM_RTS : 0 );
+    nClear = ( ( dcb->fDtrControl == DTR_CONTROL_DISABLE ) ? TIOCM_DTR : 0 ) | ( ( dcb->fRtsControl == RTS_CONTROL_DISABLE ) ? TIOCM_RTS : 0 );
+
+    if ( ( nSet != 0 ) && ( ioctl( m_nReadFd, TIOCMBIS, &nSet ) < 0 ) && ( errno != ENOTTY ) && ( errno != EINVAL ) )
+    {
+        ReportError( "TIOCMBIS" );
+        return FALSE;
+    }
+
+    if ( ( nClear != 0 ) && ( ioctl( m_nReadFd, TIOCMBIC, &nClear ) < 0 ) && ( errno != ENOTTY ) && ( errno != EINVAL ) )
+    {
+        ReportError( "TIOCMBIC" );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialTermios::ApplyTimeouts()                    // under m_csCommunicationSync
+{
+    struct termios2 Termios;
+    DWORD dwInterval = m_CommTimeouts.ReadIntervalTimeout;
+    DWORD dwMultiplier = m_CommTimeouts.ReadTotalTimeoutMultiplier;
+    DWORD dwConstant = m_CommTimeouts.ReadTotalTimeoutConstant;
+
+    if ( ioctl( m_nReadFd, TCGETS2, &Termios ) < 0 )
+    {
+        ReportError( "TCGETS2" );
+        return FALSE;
+    }
+
+    m_bReadPoll = FALSE;
+
+    if ( ( dwInterval == MAXDWORD ) && ( dwMultiplier == 0 ) && ( dwConstant == 0 ) )
+    {
+        // return at once with what is there
+        Termios.c_cc[VMIN] = 0;
+        Termios.c_cc[VTIME] = 0;
+    }
+    else if ( ( dwInterval == MAXDWORD ) && ( dwMultiplier == MAXDWORD ) && ( dwConstant > 0 ) && ( dwConstant < MAXDWORD ) )
+    {
+        // return with the first bytes, or empty once the constant ran out
+        Termios.c_cc[VMIN] = 0;
+        Termios.c_cc[VTIME] = GetVtime( dwConstant );
+    }
+    else if ( ( dwMultiplier == 0 ) && ( dwConstant == 0 ) && ( dwInterval < MAXDWORD ) )
+    {
+        // wait for the first byte, then until the buffer is full or the line was quiet for the
+        // interval; one read() waits for at most SERIAL_VMIN_MAX bytes. Without an interval
+        // Read() goes on until the buffer is full
+        Termios.c_cc[VMIN] = SERIAL_VMIN_MAX;
+        Termios.c_cc[VTIME] = GetVtime( dwInterval );
+    }
+    else
+    {
+        // a total timeout has no VMIN/VTIME form, Read() keeps the deadline in poll()
+        Termios.c_cc[VMIN] = 0;
+        Termios.c_cc[VTIME] = 0;
+        m_bReadPoll = TRUE;
+    }
+
+    if ( ioctl( m_nReadFd, TCSETS2, &Termios ) < 0 )
+    {
+        ReportError( "TCSETS2" );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void CSerialTermios::Write( char *Buffer )
+{
+    Write( Buffer, ( int )strlen( Buffer ) );
+}
+
+void CSerialTermios::Write( void *Buffer, int nSize )   // returns once the driver took every byte or the write timeout ran out
+{
+    const BYTE *pData = ( const BYTE * )Buffer;
+    DWORD    nWritten = 0;
+    ssize_t  nResult;
+    LONGLONG llNow = GetTimestamp();
+    LONGLONG llDeadline = MAXLONGLONG;
+    LONGLONG llWait;
+    struct pollfd Poll;
+    assert( IsOpen() );
+
+    if ( ( m_CommTimeouts.WriteTotalTimeoutMultiplier > 0 ) || ( m_CommTimeouts.WriteTotalTimeoutConstant > 0 ) )
+    {
+        llDeadline = llNow + ( ( LONGLONG )m_CommTimeouts.WriteTotalTimeoutMultiplier * nSize + m_CommTimeouts.WriteTotalTimeoutConstant ) * 1000;
+    }
+
+    while ( nWritten < ( DWORD )nSize )
+    {
+        nResult = write( m_nWriteFd, pData + nWritten, nSize - nWritten );
+
+        if ( nResult > 0 )
+        {
+            nWritten += ( DWORD )nResult;
+            continue;
+        }
+
+        if ( ( nResult < 0 ) && ( errno == EINTR ) )
+        {
+            continue;
+        }
+
+        if ( ( nResult < 0 ) && ( errno != EAGAIN ) )
+        {
+            ReportError( "write" );
+            return;
+        }
+
+        // the driver is full, a stopped peer holds it so until the timeout
+        llNow = GetTimestamp();
+        llWait = llDeadline - llNow;
+
+        if ( llWait <= 0 )
+        {
+            errno = ETIMEDOUT;
+            ReportError( "write" );
+            return;
+        }
+
+        Poll.fd = m_nWriteFd;
+        Poll.events = POLLOUT;
+        Poll.revents = 0;
+
+        if ( ( poll( &Poll, 1, GetPollTimeout( ( llDeadline == MAXLONGLONG ) ? MAXLONGLONG : llWait ) ) < 0 ) && ( errno != EINTR ) )
+        {
+            ReportError( "poll" );
+            return;
+        }
+    }
+}
+
+DWORD CSerialTermios::Read( void *Buffer, DWORD nSize )  // what arrived within the read timeouts
+{
+    DWORD   nRead = 0;
+    ssize_t nResult;
+    BOOL    bFill = ( m_CommTimeouts.ReadIntervalTimeout == 0 ) && ( m_CommTimeouts.ReadTotalTimeoutMultiplier == 0 ) &&
+                    ( m_CommTimeouts.ReadTotalTimeoutConstant == 0 );
+    assert( IsOpen() );
+
+    if ( m_bReadPoll )
+    {
+        return ReadPoll( ( BYTE * )Buffer, nSize );
+    }
+
+    // the kernel waits as VMIN and VTIME say
+    while ( nRead < nSize )
+    {
+        nResult = read( m_nReadFd, ( BYTE * )Buffer + nRead, nSize - nRead );
+
+        if ( nResult < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            ReportError( "read" );
+            break;
+        }
+
+        nRead += ( DWORD )nResult;
+
+        // without any timeout ReadFile() fills the buffer, a hangup ends it
+        if ( !bFill || ( nResult == 0 ) )
+        {
+            break;
+        }
+    }
+
+    return nRead;
+}
+
+DWORD CSerialTermios::ReadPoll( BYTE *pBuffer, DWORD nSize )
+{
+    DWORD    nRead = 0;
+    DWORD    dwInterval = m_CommTimeouts.ReadIntervalTimeout;
+    ssize_t  nResult;
+    int      nReady;
+    LONGLONG llNow = GetTimestamp();
+    LONGLONG llDeadline = MAXLONGLONG;
+    LONGLONG llWait;
+    struct pollfd Poll;
+
+    if ( ( m_CommTimeouts.ReadTotalTimeoutMultiplier > 0 ) || ( m_CommTimeouts.ReadTotalTimeoutConstant > 0 ) )
+    {
+        llDeadline = llNow + ( ( LONGLONG )m_CommTimeouts.ReadTotalTimeoutMultiplier * nSize + m_CommTimeouts.ReadTotalTimeoutConstant ) * 1000;
+    }
+
+    while ( nRead < nSize )
+    {
+        llWait = ( llDeadline == MAXLONGLONG ) ? MAXLONGLONG : llDeadline - llNow;
+
+        // the interval runs from the last byte
+        if ( ( nRead > 0 ) && ( dwInterval > 0 ) && ( dwInterval < MAXDWORD ) && ( llWait > ( LONGLONG )dwInterval * 1000 ) )
+        {
+            llWait = ( LONGLONG )dwInterval * 1000;
+        }
+
+        if ( llWait <= 0 )
+        {
+            break;
+        }
+
+        Poll.fd = m_nReadFd;
+        Poll.events = POLLIN;
+        Poll.revents = 0;
+        nReady = poll( &Poll, 1, GetPollTimeout( llWait ) );
+
+        if ( nReady < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                llNow = GetTimestamp();
+                continue;
+            }
+
+            ReportError( "poll" );
+            break;
+        }
+
+        if ( nReady == 0 )
+        {
+            break;
+        }
+
+        // VMIN and VTIME are 0 here, the read takes what is queued
+        nResult = read( m_nReadFd, pBuffer + nRead, nSize - nRead );
+
+        if ( nResult < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            ReportError( "read" );
+            break;
+        }
+
+        if ( nResult == 0 )
+        {
+            // readable and empty is a hangup
+            break;
+        }
+
+        nRead += ( DWORD )nResult;
+        llNow = GetTimestamp();
+    }
+
+    return nRead;
+}
+
+DWORD CSerialTermios::GetRxCount()
+{
+    int nQueued = 0;
+
+    if ( !IsOpen() || ( ioctl( m_nReadFd, FIONREAD, &nQueued ) < 0 ) )
+    {
+        return 0;
+    }
+
+    return ( DWORD )nQueued;
+}
+
+DCB *CSerialTermios::GetDCB()
+{
+    return &m_dcb;
+}
+
+BOOL CSerialTermios::SetDCB( DCB *dcb )
+{
+    BOOL ret;
+    assert( IsOpen() );
+    assert( dcb != NULL );
+    pthread_mutex_lock( &m_csCommunicationSync );
+
+    // no queue in front of the driver here, it applies at once
+    if ( ( ret = ApplyDCB( dcb ) ) )
+    {
+        m_dcb = *dcb;
+    }
+
+    pthread_mutex_unlock( &m_csCommunicationSync );
+    return ret;
+}
+
+BOOL CSerialTermios::SetCommTimeouts( const COMMTIMEOUTS *pTimeouts )
+{
+    COMMTIMEOUTS Timeouts;
+    BOOL ret;
+    assert( IsOpen() );
+    assert( pTimeouts != NULL );
+    pthread_mutex_lock( &m_csCommunicationSync );
+    Timeouts = m_CommTimeouts;
+    m_CommTimeouts = *pTimeouts;
+
+    if ( !( ret = ApplyTimeouts() ) )
+    {
+        m_CommTimeouts = Timeouts;
+    }
+
+    pthread_mutex_unlock( &m_csCommunicationSync );
+    return ret;
+}
+
+BOOL CSerialTermios::SetLowLatency( BOOL bEnable )      // ASYNC_LOW_LATENCY, FALSE on a tty that is not a serial driver
+{
+    struct serial_struct Serial;
+    BOOL ret = FALSE;
+    assert( IsOpen() );
+    pthread_mutex_lock( &m_csCommunicationSync );
+
+    // the driver hands received bytes to the reader at once instead of through a work queue
+    if ( ioctl( m_nReadFd, TIOCGSERIAL, &Serial ) < 0 )
+    {
+        ReportError( "TIOCGSERIAL" );
+    }
+    else
+    {
+        Serial.flags = bEnable ? ( Serial.flags | ASYNC_LOW_LATENCY ) : ( Serial.flags & ~ASYNC_LOW_LATENCY );
+
+        if ( ioctl( m_nReadFd, TIOCSSERIAL, &Serial ) < 0 )
+        {
+            ReportError( "TIOCSSERIAL" );
+        }
+        else
+        {
+            ret = TRUE;
+        }
+    }
+
+    pthread_mutex_unlock( &m_csCommunicationSync );
+    return ret;
+}
+
+BOOL CSerialTermios::IsOpen()
+{
+    return ( m_nReadFd >= 0 );
+}
+
+void CSerialTermios::Close()
+{
+    pthread_mutex_lock( &m_csCommunicationSync );
+
+    // close() lets the driver send what it holds first
+    if ( m_nWriteFd >= 0 )
+    {
+        close( m_nWriteFd );
+        m_nWriteFd = -1;
+    }
+
+    if ( m_nReadFd >= 0 )
+    {
+        close( m_nReadFd );
+        m_nReadFd = -1;
+    }
+
+    pthread_mutex_unlock( &m_csCommunicationSync );
+}
+
+LONGLONG CSerialTermios::GetTimestamp()
+{
+    struct timespec Now;
+    clock_gettime( CLOCK_MONOTONIC, &Now );
+    return ( LONGLONG )Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+}
+
+void CSerialTermios::GetDeviceName( UINT port, char *szDevice, UINT nSize )
+{
+    snprintf( szDevice, nSize, "%s%u", SERIAL_DEVICE_PREFIX, port - 1 );
+}
+
+BOOL CSerialTermios::GetLatencyTimerPath( const char *szDevice, char *szPath, UINT nSize )
+{
+    char szReal[PATH_MAX];
+    const char *szName;
+
+    // a /dev/serial/by-id link resolves to the ttyUSB node, sysfs knows the adapter by that name
+    if ( realpath( szDevice, szReal ) == NULL )
+    {
+        return FALSE;
+    }
+
+    szName = strrchr( szReal, '/' );
+    szName = ( szName != NULL ) ? szName + 1 : szReal;
+    return ( snprintf( szPath, nSize, SERIAL_LATENCY_TIMER_PATH, szName ) < ( int )nSize );
+}
+
+DWORD CSerialTermios::GetLatencyTimer( UINT port )
+{
+    char szDevice[64];
+    GetDeviceName( port, szDevice, sizeof( szDevice ) );
+    return GetLatencyTimer( szDevice );
+}
+
+DWORD CSerialTermios::GetLatencyTimer( const char *szDevice )   // ms, 0 when the port is not on an FTDI driver
+{
+    char szPath[PATH_MAX];
+    FILE *pFile;
+    unsigned int nLatency = 0;
+
+    if ( !GetLatencyTimerPath( szDevice, szPath, sizeof( szPath ) ) || ( ( pFile = fopen( szPath, "r" ) ) == NULL ) )
+    {
+        return 0;
+    }
+
+    if ( fscanf( pFile, "%u", &nLatency ) != 1 )
+    {
+        nLatency = 0;
+    }
+
+    fclose( pFile );
+    return nLatency;
+}
+
+BOOL CSerialTermios::SetLatencyTimer( UINT port, DWORD dwMilliseconds )
+{
+    char szDevice[64];
+    GetDeviceName( port, szDevice, sizeof( szDevice ) );
+    return SetLatencyTimer( szDevice, dwMilliseconds );
+}
+
+BOOL CSerialTermios::SetLatencyTimer( const char *szDevice,    // tty of an FTDI adapter
+                                      DWORD dwMilliseconds )   // 1..255, how long the chip holds a partly filled USB packet
+{
+    char szPath[PATH_MAX];
+    FILE *pFile;
+    BOOL ret;
+
+    if ( ( dwMilliseconds == 0 ) || ( dwMilliseconds > SERIAL_LATENCY_TIMER_MAX ) )
+    {
+        return FALSE;
+    }
+
+    // needs root or a udev rule; unlike the registry value the driver takes it at once
+    if ( !GetLatencyTimerPath( szDevice, szPath, sizeof( szPath ) ) || ( ( pFile = fopen( szPath, "w" ) ) == NULL ) )
+    {
+        return FALSE;
+    }
+
+    ret = ( fprintf( pFile, "%u", ( unsigned int )dwMilliseconds ) > 0 );
+    return ( fclose( pFile ) == 0 ) && ret;
+}
+
+void CSerialTermios::ReportError( const char *szCall )  // errno is kept for the caller
+{
+    int nError = errno;
+    fprintf( stderr, "%s: %s() failed with error %d (%s)\n", m_szDevice, szCall, nError, strerror( nError ) );
+    errno = nError;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*
+**  FILENAME            SerialTermios.h
+**
+**  PURPOSE             The Linux backend of CSerialPort: open, configure, read and write one
+**                      serial port through termios. The DCB of Open() and SetDCB() becomes a
+**                      termios2 with BOTHER so any baud rate goes to the driver, the read
+**                      timeouts become VMIN and VTIME where the kernel can wait for them.
+**                      No thread, no messages: the owner reads with Read().
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_TERMIOS_H
+#define SERIAL_TERMIOS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define SERIAL_PORT_MAX             256UL
+#define SERIAL_DEVICE_PREFIX        "/dev/ttyS"             /* port n is ttyS(n - 1), COM1 is ttyS0 as under Wine */
+#define SERIAL_LATENCY_TIMER_MAX    255UL                   /* ms, FTDI default is 16 */
+#define SERIAL_LATENCY_TIMER_PATH   "/sys/class/tty/%s/device/latency_timer"
+#define SERIAL_VMIN_MAX             255UL                   /* bytes one read() can wait for */
+#define SERIAL_VTIME_UNIT           100UL                   /* ms per VTIME step */
+
+// the Win32 types and constants of the CSerialPort interface
+typedef int                 BOOL;
+typedef unsigned char       BYTE;
+typedef unsigned short      WORD;
+typedef uint32_t            DWORD;
+typedef unsigned int        UINT;
+typedef long long           LONGLONG;
+typedef void                *LPVOID;
+typedef void                *HWND;
+
+#ifndef TRUE
+#define TRUE                        1
+#define FALSE                       0
+#endif
+
+#define MAXDWORD                    0xFFFFFFFFUL
+#define MAXLONGLONG                 0x7FFFFFFFFFFFFFFFLL
+#define NOPARITY                    0
+#define ODDPARITY                   1
+#define EVENPARITY                  2
+#define MARKPARITY                  3
+#define SPACEPARITY                 4
+#define ONESTOPBIT                  0
+#define ONE5STOPBITS                1
+#define TWOSTOPBITS                 2
+#define DTR_CONTROL_DISABLE         0
+#define DTR_CONTROL_ENABLE          1
+#define DTR_CONTROL_HANDSHAKE       2
+#define RTS_CONTROL_DISABLE         0
+#define RTS_CONTROL_ENABLE          1
+#define RTS_CONTROL_HANDSHAKE       2
+#define RTS_CONTROL_TOGGLE          3
+#define EV_RXCHAR                   0x0001
+
+typedef struct
+{
+    DWORD               DCBlength;
+    DWORD               BaudRate;
+    DWORD               fBinary: 1;
+    DWORD               fParity: 1;                         /* INPCK */
+    DWORD               fOutxCtsFlow: 1;                    /* CRTSCTS, with RTS_CONTROL_HANDSHAKE */
+    DWORD               fOutxDsrFlow: 1;                    /* no DTR/DSR handshake in termios, refused */
+    DWORD               fDtrControl: 2;
+    DWORD               fDsrSensitivity: 1;
+    DWORD               fTXContinueOnXoff: 1;
+    DWORD               fOutX: 1;                           /* IXON */
+    DWORD               fInX: 1;                            /* IXOFF */
+    DWORD               fErrorChar: 1;
+    DWORD               fNull: 1;
+    DWORD               fRtsControl: 2;
+    DWORD               fAbortOnError: 1;
+    DWORD               fDummy2: 17;
+    WORD                wReserved;
+    WORD                XonLim;
+    WORD                XoffLim;
+    BYTE                ByteSize;
+    BYTE                Parity;
+    BYTE                StopBits;
+    char                XonChar;
+    char                XoffChar;
+    char                ErrorChar;
+    char                EofChar;
+    char                EvtChar;
+    WORD                wReserved1;
+} DCB;
+
+typedef struct
+{
+    DWORD               ReadIntervalTimeout;
+    DWORD               ReadTotalTimeoutMultiplier;
+    DWORD               ReadTotalTimeoutConstant;
+    DWORD               WriteTotalTimeoutMultiplier;
+    DWORD               WriteTotalTimeoutConstant;
+} COMMTIMEOUTS;
+
+class CSerialTermios
+{
+    public:
+        CSerialTermios();
+        virtual             ~CSerialTermios();
+
+        BOOL                Open( HWND  pPortOwner,
+                                  UINT  port = 8,
+                                  UINT  baud = 9600,
+                                  BYTE  parity = NOPARITY,
+                                  BYTE  databits = 8,
+                                  BYTE  stopbits = ONESTOPBIT,
+                                  DWORD dwCommEvents = EV_RXCHAR,
+                                  UINT  nBufferSize = 4096,
+                                  DWORD ReadIntervalTimeout = MAXDWORD,
+                                  DWORD ReadTotalTimeoutMultiplier = 0,
+                                  DWORD ReadTotalTimeoutConstant = 0,
+                                  DWORD WriteTotalTimeoutMultiplier = 10,
+                                  DWORD WriteTotalTimeoutConstant = 10 );
+        BOOL                Open( HWND  pPortOwner,
+                                  const char *szDevice,
+                                  UINT  baud = 9600,
+                                  BYTE  parity = NOPARITY,
+                                  BYTE  databits = 8,
+                                  BYTE  stopbits = ONESTOPBIT,
+                                  DWORD dwCommEvents = EV_RXCHAR,
+                                  UINT  nBufferSize = 4096,
+                                  DWORD ReadIntervalTimeout = MAXDWORD,
+                                  DWORD ReadTotalTimeoutMultiplier = 0,
+                                  DWORD ReadTotalTimeoutConstant = 0,
+                                  DWORD WriteTotalTimeoutMultiplier = 10,
+                                  DWORD WriteTotalTimeoutConstant = 10 );
+        void                Write( char *Buffer );
+        void                Write( void *Buffer, int nSize );
+        void                Close();
+        DWORD               Read( void *Buffer, DWORD nSize );
+        DWORD               GetRxCount();
+
+        DCB                 *GetDCB();
+        BOOL                SetDCB( DCB *dcb );
+        BOOL                SetCommTimeouts( const COMMTIMEOUTS *pTimeouts );
+        BOOL                SetLowLatency( BOOL bEnable );
+        BOOL                IsOpen();
+
+        static LONGLONG     GetTimestamp();
+        static DWORD        GetLatencyTimer( UINT port );
+        static DWORD        GetLatencyTimer( const char *szDevice );
+        static BOOL         SetLatencyTimer( UINT port, DWORD dwMilliseconds );
+        static BOOL         SetLatencyTimer( const char *szDevice, DWORD dwMilliseconds );
+
+    protected:
+        int                 m_nReadFd;                      /* blocking, VMIN and VTIME apply */
+        int                 m_nWriteFd;                     /* the same tty opened again non-blocking, for the write timeouts */
+        pthread_mutex_t     m_csCommunicationSync;
+        DCB                 m_dcb;
+        COMMTIMEOUTS        m_CommTimeouts;
+        BOOL                m_bReadPoll;                    /* the read timeouts have no VMIN/VTIME form, Read() waits in poll() */
+        HWND                m_pOwner;
+        UINT                m_nPortNr;
+        char                m_szDevice[256];
+
+        BOOL                ApplyDCB( const DCB *dcb );
+        BOOL                ApplyTimeouts();
+        DWORD               ReadPoll( BYTE *pBuffer, DWORD nSize );
+        void                ReportError( const char *szCall );
+
+        static void         GetDeviceName( UINT port, char *szDevice, UINT nSize );
+        static BOOL         GetLatencyTimerPath( const char *szDevice, char *szPath, UINT nSize );
+};
+
+typedef CSerialTermios CSerialPort;
+
+#endif SERIAL_TERMIOS_H
@@ -0,0 +1,493 @@
+/*
+**  FILENAME            SerialTransaction.cpp
+**
+**  PURPOSE             Request/response transactions on top of CSerialPort.
+**                      Requests are written through the transmit queue, responses are cut
+**                      by inter-character silence or another framer, paired with their
+**                      request by a matcher and completed through a callback, with timeouts,
+**                      retries and several requests outstanding where the protocol allows.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+CSerialMatcher::~CSerialMatcher()
+{
+}
+
+BOOL CSerialMatcher::IsValid( const BYTE *pResponse, DWORD nSize )
+{
+    return TRUE;
+}
+
+BOOL CSerialMatcher::Match( const BYTE *pRequest, DWORD nRequest, const BYTE *pResponse, DWORD nResponse )
+{
+    // strictly alternating protocols, the oldest request gets the response
+    return TRUE;
+}
+
+CSerialTagMatcher::CSerialTagMatcher( DWORD nRequestOffset, DWORD nResponseOffset, DWORD nTagSize )
+{
+    m_nRequestOffset = nRequestOffset;
+    m_nResponseOffset = nResponseOffset;
+    m_nTagSize = nTagSize;
+}
+
+BOOL CSerialTagMatcher::Match( const BYTE *pRequest, DWORD nRequest, const BYTE *pResponse, DWORD nResponse )
+{
+    return ( m_nRequestOffset + m_nTagSize <= nRequest ) && ( m_nResponseOffset + m_nTagSize <= nResponse ) &&
+           ( memcmp( pRequest + m_nRequestOffset, pResponse + m_nResponseOffset, m_nTagSize ) == 0 );
+}
+
+BOOL CSerialModbusMatcher::IsValid( const BYTE *pResponse, DWORD nSize )
+{
+    // address, function, at least one byte of data or the exception code, CRC low byte first
+    return ( nSize >= 5 ) && ( GetCrc( pResponse, nSize - 2 ) == ( WORD )( pResponse[nSize - 2] | ( pResponse[nSize - 1] << 8 ) ) );
+}
+
+BOOL CSerialModbusMatcher::Match( const BYTE *pRequest, DWORD nRequest, const BYTE *pResponse, DWORD nResponse )
+{
+    // an exception response sets the top bit of the function code
+    return ( nRequest >= 2 ) && ( pResponse[0] == pRequest[0] ) && ( ( pResponse[1] & 0x7F ) == pRequest[1] );
+}
+
+WORD CSerialModbusMatcher::GetCrc( const BYTE *pData, DWORD nSize )
+{
+    return ( WORD )CSerialChecksum::Compute( SERIAL_CHECKSUM_CRC16_MODBUS, pData, nSize );
+}
+
+CSerialTransactor::CSerialTransactor( DWORD nMaxFrame )
+    : CSerialFramer( nMaxFrame )
+{
+    UINT i;
+    m_pPort = NULL;
+    m_pMatcher = &m_FifoMatcher;
+    m_pFramer = NULL;
+    m_dwSilence = 0;
+    m_llSilenceDeadline = MAXLONGLONG;
+    m_nWindow = 1;
+    m_nActive = 0;
+    m_nSequence = 0;
+    m_nSendOrder = 0;
+    m_nUnmatched = 0;
+    memset( m_Transactions, 0, sizeof( m_Transactions ) );
+
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        m_Transactions[i].pOwner = this;
+    }
+
+    InitializeCriticalSection( &m_csTransactions );
+}
+
+CSerialTransactor::~CSerialTransactor()
+{
+    DeleteCriticalSection( &m_csTransactions );
+}
+
+BOOL CSerialTransactor::Attach( CSerialPort *pPort )        // before Open(), the port needs SERIAL_RX_CHUNK
+{
+    assert( pPort != NULL );
+    m_pPort = pPort;
+    return pPort->SetFramer( this );
+}
+
+void CSerialTransactor::SetMatcher( CSerialMatcher *pMatcher )     // NULL: the oldest outstanding request gets each response
+{
+    m_pMatcher = ( pMatcher != NULL ) ? pMatcher : &m_FifoMatcher;
+}
+
+void CSerialTransactor::SetFramer( CSerialFramer *pFramer )       // cuts the responses instead of the silence
+{
+    m_pFramer = pFramer;
+
+    if ( pFramer != NULL )
+    {
+        pFramer->SetCallback( OnFrame, this );
+    }
+}
+
+void CSerialTransactor::SetSilence( DWORD dwSilence )             // us without a byte that end a response, see GetModbusSilence()
+{
+    m_dwSilence = dwSilence;
+}
+
+void CSerialTransactor::SetWindow( UINT nWindow )                 // requests outstanding at once, 1 for polled buses
+{
+    m_nWindow = min( max( nWindow, 1 ), SERIAL_TRANSACTION_MAX );
+}
+
+SERIAL_WRITE_RESULT CSerialTransactor::Submit( const void *pRequest,                   // copied, kept for retries
+                                               DWORD nSize,
+                                               DWORD dwTimeout,                        // ms for the response after the request was sent, 0 expects none
+                                               UINT  nRetries,                         // writes of the request after the first one times out
+                                               SERIAL_TRANSACTION_CALLBACK pfnCallback,
+                                               LPVOID pContext )
+{
+    SERIAL_TRANSACTION_COMPLETION Completions[SERIAL_TRANSACTION_MAX];
+    SERIAL_TRANSACTION *pTransaction = NULL;
+    UINT nCompletions = 0;
+    UINT i;
+    assert( ( pRequest != NULL ) && ( pfnCallback != NULL ) );
+
+    if ( ( nSize == 0 ) || ( nSize > SERIAL_TRANSACTION_REQUEST_MAX ) )
+    {
+        return SERIAL_WRITE_TOO_LARGE;
+    }
+
+    if ( ( m_pPort == NULL ) || !m_pPort->IsOpen() )
+    {
+        return SERIAL_WRITE_CLOSED;
+    }
+
+    EnterCriticalSection( &m_csTransactions );
+
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        if ( m_Transactions[i].State == SERIAL_TRANSACTION_FREE )
+        {
+            pTransaction = &m_Transactions[i];
+            break;
+        }
+    }
+
+    if ( pTransaction == NULL )
+    {
+        LeaveCriticalSection( &m_csTransactions );
+        return SERIAL_WRITE_WOULD_BLOCK;
+    }
+
+    memcpy( pTransaction->Request, pRequest, nSize );
+    pTransaction->nRequestSize = nSize;
+    pTransaction->dwTimeout = dwTimeout;
+    pTransaction->nRetries = nRetries;
+    pTransaction->nSequence = m_nSequence++;
+    pTransaction->llSubmitTime = CSerialPort::GetTimestamp();
+    pTransaction->llDeadline = MAXLONGLONG;
+    pTransaction->pfnCallback = pfnCallback;
+    pTransaction->pContext = pContext;
+    pTransaction->State = SERIAL_TRANSACTION_QUEUED;
+    Dispatch( Completions, &nCompletions );
+    LeaveCriticalSection( &m_csTransactions );
+    // once Submit() succeeded the callback always comes, here if the write failed at once
+    Complete( Completions, nCompletions );
+    return SERIAL_WRITE_OK;
+}
+
+void CSerialTransactor::Cancel()
+{
+    SERIAL_TRANSACTION_COMPLETION Completions[SERIAL_TRANSACTION_MAX];
+    LONGLONG llNow = CSerialPort::GetTimestamp();
+    UINT nCompletions = 0;
+    UINT i;
+    EnterCriticalSection( &m_csTransactions );
+
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        if ( ( m_Transactions[i].State == SERIAL_TRANSACTION_QUEUED ) || ( m_Transactions[i].State == SERIAL_TRANSACTION_ACTIVE ) )
+        {
+            Finish( &m_Transactions[i], SERIAL_TRANSACTION_CANCELLED, &Completions[nCompletions++], llNow );
+        }
+    }
+
+    LeaveCriticalSection( &m_csTransactions );
+    Complete( Completions, nCompletions );
+}
+
+UINT CSerialTransactor::GetOutstanding()
+{
+    UINT n = 0;
+    UINT i;
+    EnterCriticalSection( &m_csTransactions );
+
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        if ( ( m_Transactions[i].State == SERIAL_TRANSACTION_QUEUED ) || ( m_Transactions[i].State == SERIAL_TRANSACTION_ACTIVE ) )
+        {
+            n++;
+        }
+    }
+
+    LeaveCriticalSection( &m_csTransactions );
+    return n;
+}
+
+DWORD CSerialTransactor::GetUnmatchedCount()
+{
+    return m_nUnmatched;
+}
+
+void CSerialTransactor::Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    if ( m_pFramer != NULL )
+    {
+        m_pFramer->Feed( pData, nSize, llTimestamp );
+    }
+    else if ( m_dwSilence == 0 )
+    {
+        // no way to tell where a response ends, every chunk is one
+        OnResponse( pData, nSize, llTimestamp, 0 );
+    }
+    else
+    {
+        // the response ends when no byte followed for the silence time
+        Append( pData, nSize, llTimestamp );
+        m_llSilenceDeadline = CSerialPort::GetTimestamp() + m_dwSilence;
+    }
+}
+
+void CSerialTransactor::Reset()
+{
+    // the port opens or closes, nothing outstanding can be answered any more
+    CSerialFramer::Reset();
+    m_llSilenceDeadline = MAXLONGLONG;
+
+    if ( m_pFramer != NULL )
+    {
+        m_pFramer->Reset();
+    }
+
+    Cancel();
+}
+
+LONGLONG CSerialTransactor::GetDeadline()
+{
+    LONGLONG llDeadline = m_llSilenceDeadline;
+    UINT i;
+    EnterCriticalSection( &m_csTransactions );
+
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        if ( m_Transactions[i].State == SERIAL_TRANSACTION_ACTIVE )
+        {
+            llDeadline = min( llDeadline, m_Transactions[i].llDeadline );
+        }
+    }
+
+    LeaveCriticalSection( &m_csTransactions );
+    return llDeadline;
+}
+
+void CSerialTransactor::OnDeadline( LONGLONG llNow )
+{
+    SERIAL_TRANSACTION_COMPLETION Completions[SERIAL_TRANSACTION_MAX];
+    SERIAL_TRANSACTION *pTransaction;
+    UINT nCompletions = 0;
+    UINT i;
+
+    if ( m_llSilenceDeadline <= llNow )
+    {
+        m_llSilenceDeadline = MAXLONGLONG;
+        OnResponse( m_pAssembly, m_nAssembly, m_llFrameTime, m_dwFrameFlags );
+        m_nAssembly = 0;
+        m_dwFrameFlags = 0;
+    }
+
+    EnterCriticalSection( &m_csTransactions );
+
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        pTransaction = &m_Transactions[i];
+
+        if ( ( pTransaction->State != SERIAL_TRANSACTION_ACTIVE ) || ( pTransaction->llDeadline > llNow ) )
+        {
+            continue;
+        }
+
+        if ( pTransaction->nRetries == 0 )
+        {
+            Finish( pTransaction, SERIAL_TRANSACTION_TIMEOUT, &Completions[nCompletions++], llNow );
+        }
+        else
+        {
+            pTransaction->nRetries--;
+
+            if ( !Send( pTransaction ) )
+            {
+                Finish( pTransaction, SERIAL_TRANSACTION_FAILED, &Completions[nCompletions++], llNow );
+            }
+        }
+    }
+
+    Dispatch( Completions, &nCompletions );
+    LeaveCriticalSection( &m_csTransactions );
+    Complete( Completions, nCompletions );
+}
+
+DWORD CSerialTransactor::GetModbusSilence( DWORD baud )
+{
+    // t3.5: three and a half characters of 11 bits, fixed above 19200 baud
+    return ( baud > 19200 ) ? SERIAL_MODBUS_SILENCE_MIN : ( DWORD )( ( 38500000ULL + baud - 1 ) / baud );
+}
+
+void CSerialTransactor::OnResponse( const BYTE *pResponse, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags )
+{
+    SERIAL_TRANSACTION_COMPLETION Completions[SERIAL_TRANSACTION_MAX + 1];
+    SERIAL_TRANSACTION *pMatch = NULL;
+    SERIAL_TRANSACTION *pTransaction;
+    UINT nCompletions = 0;
+    UINT i;
+
+    if ( ( nSize == 0 ) || ( dwFlags != 0 ) || !m_pMatcher->IsValid( pResponse, nSize ) )
+    {
+        m_nErrors++;
+        return;
+    }
+
+    EnterCriticalSection( &m_csTransactions );
+
+    // every outstanding request that fits, the one longest on the line wins
+    for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+    {
+        pTransaction = &m_Transactions[i];
+
+        if ( ( pTransaction->State == SERIAL_TRANSACTION_ACTIVE ) && ( pTransaction->dwTimeout > 0 ) &&
+             ( ( pMatch == NULL ) || ( ( LONG )( pTransaction->nSendOrder - pMatch->nSendOrder ) < 0 ) ) &&
+             m_pMatcher->Match( pTransaction->Request, pTransaction->nRequestSize, pResponse, nSize ) )
+        {
+            pMatch = pTransaction;
+        }
+    }
+
+    if ( pMatch == NULL )
+    {
+        LeaveCriticalSection( &m_csTransactions );
+        // late answers to a retried request, or unsolicited frames, go to the framer callback
+        m_nUnmatched++;
+        Emit( pResponse, nSize, llTimestamp );
+        return;
+    }
+
+    Finish( pMatch, SERIAL_TRANSACTION_OK, &Completions[nCompletions++], CSerialPort::GetTimestamp() );
+    Dispatch( Completions, &nCompletions );
+    LeaveCriticalSection( &m_csTransactions );
+    Completions[0].pfnCallback( Completions[0].pContext, SERIAL_TRANSACTION_OK, pResponse, nSize, Completions[0].llLatency );
+    Complete( Completions + 1, nCompletions - 1 );
+}
+
+BOOL CSerialTransactor::Send( SERIAL_TRANSACTION *pTransaction )
+{
+    // under the lock, so requests enter the transmit queue in the order they are counted
+    pTransaction->nSendOrder = m_nSendOrder++;
+    pTransaction->llDeadline = MAXLONGLONG;
+    pTransaction->nTxPending++;
+
+    if ( m_pPort->WriteAsync( pTransaction->Request, pTransaction->nRequestSize, 0, OnSent, pTransaction ) != SERIAL_WRITE_OK )
+    {
+        pTransaction->nTxPending--;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void CSerialTransactor::Dispatch( SERIAL_TRANSACTION_COMPLETION *pCompletions, UINT *pnCompletions )
+{
+    SERIAL_TRANSACTION *pNext;
+    UINT i;
+
+    while ( m_nActive < m_nWindow )
+    {
+        pNext = NULL;
+
+        for ( i = 0; i < SERIAL_TRANSACTION_MAX; i++ )
+        {
+            if ( ( m_Transactions[i].State == SERIAL_TRANSACTION_QUEUED ) &&
+                 ( ( pNext == NULL ) || ( ( LONG )( m_Transactions[i].nSequence - pNext->nSequence ) < 0 ) ) )
+            {
+                pNext = &m_Transactions[i];
+            }
+        }
+
+        if ( pNext == NULL )
+        {
+            break;
+        }
+
+        pNext->State = SERIAL_TRANSACTION_ACTIVE;
+        m_nActive++;
+
+        if ( !Send( pNext ) )
+        {
+            Finish( pNext, SERIAL_TRANSACTION_FAILED, &pCompletions[( *pnCompletions )++], CSerialPort::GetTimestamp() );
+        }
+    }
+}
+
+void CSerialTransactor::Finish( SERIAL_TRANSACTION *pTransaction, SERIAL_TRANSACTION_RESULT Result,
+                                SERIAL_TRANSACTION_COMPLETION *pCompletion, LONGLONG llNow )
+{
+    pCompletion->pfnCallback = pTransaction->pfnCallback;
+    pCompletion->pContext = pTransaction->pContext;
+    pCompletion->Result = Result;
+    pCompletion->llLatency = llNow - pTransaction->llSubmitTime;
+
+    if ( pTransaction->State == SERIAL_TRANSACTION_ACTIVE )
+    {
+        m_nActive--;
+    }
+
+    // the slot is reused only after OnSent() of its last write, that one still points here
+    pTransaction->State = ( pTransaction->nTxPending > 0 ) ? SERIAL_TRANSACTION_DONE : SERIAL_TRANSACTION_FREE;
+}
+
+void CSerialTransactor::Complete( SERIAL_TRANSACTION_COMPLETION *pCompletions, UINT nCompletions )
+{
+    UINT i;
+
+    for ( i = 0; i < nCompletions; i++ )
+    {
+        pCompletions[i].pfnCallback( pCompletions[i].pContext, pCompletions[i].Result, NULL, 0, pCompletions[i].llLatency );
+    }
+}
+
+void CALLBACK CSerialTransactor::OnSent( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent )
+{
+    SERIAL_TRANSACTION *pTransaction = ( SERIAL_TRANSACTION * )pContext;
+    CSerialTransactor *pThis = pTransaction->pOwner;
+    SERIAL_TRANSACTION_COMPLETION Completions[SERIAL_TRANSACTION_MAX];
+    UINT nCompletions = 0;
+    EnterCriticalSection( &pThis->m_csTransactions );
+    pTransaction->nTxPending--;
+
+    if ( pTransaction->State == SERIAL_TRANSACTION_DONE )
+    {
+        if ( pTransaction->nTxPending == 0 )
+        {
+            pTransaction->State = SERIAL_TRANSACTION_FREE;
+        }
+    }
+    else if ( ( pTransaction->State == SERIAL_TRANSACTION_ACTIVE ) && ( pTransaction->nTxPending == 0 ) )
+    {
+        if ( !bSent )
+        {
+            // the port closed or failed, Reset() cancels whatever is still queued
+            pThis->Finish( pTransaction, SERIAL_TRANSACTION_FAILED, &Completions[nCompletions++], llTimestamp );
+        }
+        else if ( pTransaction->dwTimeout == 0 )
+        {
+            // broadcast, nothing comes back
+            pThis->Finish( pTransaction, SERIAL_TRANSACTION_OK, &Completions[nCompletions++], llTimestamp );
+            pThis->Dispatch( Completions, &nCompletions );
+        }
+        else
+        {
+            // the response timeout runs from the moment the request left the driver
+            pTransaction->llDeadline = llTimestamp + ( LONGLONG )pTransaction->dwTimeout * 1000;
+        }
+    }
+
+    LeaveCriticalSection( &pThis->m_csTransactions );
+    Complete( Completions, nCompletions );
+}
+
+void CALLBACK CSerialTransactor::OnFrame( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags )
+{
+    ( ( CSerialTransactor * )pContext )->OnResponse( pFrame, nSize, llTimestamp, dwFlags );
+}
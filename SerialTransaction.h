@@ -0,0 +1,159 @@
+/*
+**  FILENAME            SerialTransaction.h
+**
+**  PURPOSE             Request/response transactions on top of CSerialPort.
+**                      Requests are written through the transmit queue, responses are cut
+**                      by inter-character silence or another framer, paired with their
+**                      request by a matcher and completed through a callback, with timeouts,
+**                      retries and several requests outstanding where the protocol allows.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_TRANSACTION_H
+#define SERIAL_TRANSACTION_H
+
+#define SERIAL_TRANSACTION_MAX      64UL                    /* requests queued or outstanding per transactor */
+#define SERIAL_TRANSACTION_REQUEST_MAX 256UL                /* bytes, kept for retries; a Modbus RTU ADU is at most 256 */
+#define SERIAL_MODBUS_SILENCE_MIN   1750UL                  /* us, fixed t3.5 above 19200 baud */
+
+typedef enum
+{
+    SERIAL_TRANSACTION_OK = 0,                              /* pResponse holds the matching response */
+    SERIAL_TRANSACTION_TIMEOUT,                             /* no response after the last retry */
+    SERIAL_TRANSACTION_FAILED,                              /* the request could not be written */
+    SERIAL_TRANSACTION_CANCELLED                            /* Cancel(), or the port closed */
+} SERIAL_TRANSACTION_RESULT;
+
+typedef enum
+{
+    SERIAL_TRANSACTION_FREE = 0,
+    SERIAL_TRANSACTION_QUEUED,                              /* waiting for room in the window */
+    SERIAL_TRANSACTION_ACTIVE,                              /* written, waiting for its response */
+    SERIAL_TRANSACTION_DONE                                 /* completed, a write of it is still in the transmit queue */
+} SERIAL_TRANSACTION_STATE;
+
+/* called on the comm thread, pResponse is only valid during the call, llLatency runs from Submit() */
+typedef void ( CALLBACK *SERIAL_TRANSACTION_CALLBACK )( LPVOID pContext, SERIAL_TRANSACTION_RESULT Result,
+                                                        const BYTE *pResponse, DWORD nSize, LONGLONG llLatency );
+
+class CSerialPort;
+class CSerialTransactor;
+
+typedef struct
+{
+    CSerialTransactor   *pOwner;
+    SERIAL_TRANSACTION_STATE State;
+    BYTE                Request[SERIAL_TRANSACTION_REQUEST_MAX];
+    DWORD               nRequestSize;
+    DWORD               dwTimeout;                          /* ms from the request leaving the driver, 0 expects no response */
+    UINT                nRetries;                           /* left */
+    UINT                nTxPending;                         /* writes whose SERIAL_TX_CALLBACK did not come yet */
+    DWORD               nSequence;                          /* submission order */
+    DWORD               nSendOrder;                         /* order on the line, renewed by a retry */
+    LONGLONG            llSubmitTime;
+    LONGLONG            llDeadline;                         /* MAXLONGLONG until the request left the driver */
+    SERIAL_TRANSACTION_CALLBACK pfnCallback;
+    LPVOID              pContext;
+} SERIAL_TRANSACTION;
+
+typedef struct
+{
+    SERIAL_TRANSACTION_CALLBACK pfnCallback;
+    LPVOID              pContext;
+    SERIAL_TRANSACTION_RESULT Result;
+    LONGLONG            llLatency;
+} SERIAL_TRANSACTION_COMPLETION;
+
+/* pairs a response with an outstanding request, the oldest one on the line is asked first */
+class CSerialMatcher
+{
+    public:
+        virtual             ~CSerialMatcher();
+
+        virtual BOOL        IsValid( const BYTE *pResponse, DWORD nSize );
+        virtual BOOL        Match( const BYTE *pRequest, DWORD nRequest, const BYTE *pResponse, DWORD nResponse );
+};
+
+/* pipelined protocols: request and response carry the same tag, e.g. a transaction id */
+class CSerialTagMatcher : public CSerialMatcher
+{
+    public:
+        CSerialTagMatcher( DWORD nRequestOffset, DWORD nResponseOffset, DWORD nTagSize );
+
+        virtual BOOL        Match( const BYTE *pRequest, DWORD nRequest, const BYTE *pResponse, DWORD nResponse );
+
+    protected:
+        DWORD               m_nRequestOffset;
+        DWORD               m_nResponseOffset;
+        DWORD               m_nTagSize;
+};
+
+/* Modbus RTU: CRC-16 of the response, same slave address, same function or its exception */
+class CSerialModbusMatcher : public CSerialMatcher
+{
+    public:
+        virtual BOOL        IsValid( const BYTE *pResponse, DWORD nSize );
+        virtual BOOL        Match( const BYTE *pRequest, DWORD nRequest, const BYTE *pResponse, DWORD nResponse );
+
+        static WORD         GetCrc( const BYTE *pData, DWORD nSize );
+};
+
+class CSerialTransactor : public CSerialFramer
+{
+    public:
+        CSerialTransactor( DWORD nMaxFrame = SERIAL_FRAME_MAX );
+        virtual             ~CSerialTransactor();
+
+        BOOL                Attach( CSerialPort *pPort );
+        void                SetMatcher( CSerialMatcher *pMatcher );
+        void                SetFramer( CSerialFramer *pFramer );
+        void                SetSilence( DWORD dwSilence );
+        void                SetWindow( UINT nWindow );
+
+        SERIAL_WRITE_RESULT Submit( const void *pRequest,
+                                    DWORD nSize,
+                                    DWORD dwTimeout,
+                                    UINT  nRetries,
+                                    SERIAL_TRANSACTION_CALLBACK pfnCallback,
+                                    LPVOID pContext = NULL );
+        void                Cancel();
+        UINT                GetOutstanding();
+        DWORD               GetUnmatchedCount();
+
+        virtual void        Feed( BYTE *pData, DWORD nSize, LONGLONG llTimestamp );
+        virtual void        Reset();
+        virtual LONGLONG    GetDeadline();
+        virtual void        OnDeadline( LONGLONG llNow );
+
+        static DWORD        GetModbusSilence( DWORD baud );
+
+    protected:
+        CSerialPort         *m_pPort;
+        CSerialMatcher      *m_pMatcher;
+        CSerialMatcher      m_FifoMatcher;
+        CSerialFramer       *m_pFramer;
+        DWORD               m_dwSilence;
+        LONGLONG            m_llSilenceDeadline;
+        UINT                m_nWindow;
+        UINT                m_nActive;
+        DWORD               m_nSequence;
+        DWORD               m_nSendOrder;
+        DWORD               m_nUnmatched;
+        CRITICAL_SECTION    m_csTransactions;
+        SERIAL_TRANSACTION  m_Transactions[SERIAL_TRANSACTION_MAX];
+
+        void                OnResponse( const BYTE *pResponse, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags );
+        BOOL                Send( SERIAL_TRANSACTION *pTransaction );
+        void                Dispatch( SERIAL_TRANSACTION_COMPLETION *pCompletions, UINT *pnCompletions );
+        void                Finish( SERIAL_TRANSACTION *pTransaction, SERIAL_TRANSACTION_RESULT Result,
+                                    SERIAL_TRANSACTION_COMPLETION *pCompletion, LONGLONG llNow );
+        static void         Complete( SERIAL_TRANSACTION_COMPLETION *pCompletions, UINT nCompletions );
+        static void CALLBACK OnSent( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent );
+        static void CALLBACK OnFrame( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags );
+};
+
+#endif SERIAL_TRANSACTION_H
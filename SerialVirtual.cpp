@@ -0,0 +1,1296 @@
+/*
+**  FILENAME            SerialVirtual.cpp
+**
+**  PURPOSE             Two connected serial ports inside the process, opened by port number
+**                      in place of a device. A line thread moves the bytes with the wire time
+**                      of the baud rate and format, the latency and jitter of an adapter and
+**                      the faults asked for, so the whole port runs without hardware.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "SerialPort.h"
+#include <assert.h>
+
+// the pair that claimed a port number, CSerialPort::Open() looks here before the device
+static CSerialVirtual * volatile s_pPorts[SERIAL_PORT_MAX];
+
+CSerialVirtual::CSerialVirtual()
+{
+    InitializeCriticalSection( &m_csLine );
+    memset( &m_Line, 0, sizeof( m_Line ) );
+    memset( m_End, 0, sizeof( m_End ) );
+    m_nPort[0] = m_nPort[1] = SERIAL_PORT_MAX;
+    m_hWake = NULL;
+    m_hThread = NULL;
+    m_bStop = FALSE;
+    m_dwRandom = 0;
+}
+
+CSerialVirtual::~CSerialVirtual()
+{
+    Destroy();
+    DeleteCriticalSection( &m_csLine );
+}
+
+// the ports are opened with CSerialPort::Open() as usual; close them before Destroy()
+BOOL CSerialVirtual::Create( UINT nPortA,                       // 1 = COM1
+                             UINT nPortB,
+                             const SERIAL_VIRTUAL_LINE *pLine ) // NULL a perfect line without latency
+{
+    BOOL ret = TRUE;
+    UINT n;
+    Destroy();
+
+    if ( ( nPortA == nPortB ) || ( nPortA >= SERIAL_PORT_MAX ) || ( nPortB >= SERIAL_PORT_MAX ) )
+    {
+        SetLastError( ERROR_INVALID_PARAMETER );
+        return FALSE;
+    }
+
+    if ( pLine != NULL )
+    {
+        m_Line = *pLine;
+    }
+    else
+    {
+        memset( &m_Line, 0, sizeof( m_Line ) );
+    }
+
+    if ( m_Line.nQueueSize == 0 )
+    {
+        m_Line.nQueueSize = SERIAL_VIRTUAL_QUEUE;
+    }
+
+    m_dwRandom = ( m_Line.dwSeed != 0 ) ? m_Line.dwSeed : 0x2545F491;
+
+    for ( n = 0; n < 2; n++ )
+    {
+        m_End[n].pPair = this;
+        m_End[n].nIndex = n;
+        m_End[n].pQueue = new BYTE[m_Line.nQueueSize];
+        m_End[n].pWire = new SERIAL_VIRTUAL_BYTE[SERIAL_VIRTUAL_WIRE];
+        m_End[n].bIdle = TRUE;
+    }
+
+    m_bStop = FALSE;
+    m_hWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+    if ( m_hWake == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    if ( ( m_hThread = ::CreateThread( NULL, 0, LineThread, this, 0, NULL ) ) == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    // claimed last, no port is opened on a pair that is not running
+    if ( InterlockedCompareExchangePointer( ( PVOID volatile * )&s_pPorts[nPortA], this, NULL ) != NULL )
+    {
+        SetLastError( ERROR_ACCESS_DENIED );
+        ret = FALSE;
+        goto done;
+    }
+
+    m_nPort[0] = nPortA;
+
+    if ( InterlockedCompareExchangePointer( ( PVOID volatile * )&s_pPorts[nPortB], this, NULL ) != NULL )
+    {
+        SetLastError( ERROR_ACCESS_DENIED );
+        ret = FALSE;
+        goto done;
+    }
+
+    m_nPort[1] = nPortB;
+
+done:
+    if ( !ret )
+    {
+        Destroy();
+    }
+
+    return ret;
+}
+
+void CSerialVirtual::Destroy()
+{
+    UINT n;
+
+    for ( n = 0; n < 2; n++ )
+    {
+        if ( m_nPort[n] < SERIAL_PORT_MAX )
+        {
+            InterlockedCompareExchangePointer( ( PVOID volatile * )&s_pPorts[m_nPort[n]], NULL, this );
+            m_nPort[n] = SERIAL_PORT_MAX;
+        }
+    }
+
+    if ( m_hThread != NULL )
+    {
+        m_bStop = TRUE;
+        SetEvent( m_hWake );
+        WaitForSingleObject( m_hThread, INFINITE );
+        ::CloseHandle( m_hThread );
+        m_hThread = NULL;
+    }
+
+    if ( m_hWake != NULL )
+    {
+        ::CloseHandle( m_hWake );
+        m_hWake = NULL;
+    }
+
+    for ( n = 0; n < 2; n++ )
+    {
+        assert( !m_End[n].bOpen );
+        delete [] m_End[n].pQueue;
+        delete [] m_End[n].pWire;
+    }
+
+    memset( m_End, 0, sizeof( m_End ) );
+}
+
+// the port breaks like an unplugged adapter: pending I/O fails, every call after it fails,
+// the peer sees CTS and DSR drop and the port number does not open again for a while
+BOOL CSerialVirtual::Disconnect( UINT nPort,                    // one of the ports of Create()
+                                 DWORD dwDownTime )             // ms CreateFile() fails after it
+{
+    SERIAL_VIRTUAL_END *pEnd;
+    UINT n;
+
+    for ( n = 0; n < 2; n++ )
+    {
+        if ( m_nPort[n] == nPort )
+        {
+            break;
+        }
+    }
+
+    if ( n == 2 )
+    {
+        return FALSE;
+    }
+
+    pEnd = &m_End[n];
+    EnterCriticalSection( &m_csLine );
+    pEnd->llDownUntil = CSerialPort::GetTimestamp() + ( LONGLONG )dwDownTime * 1000;
+
+    if ( pEnd->bOpen && !pEnd->bBroken )
+    {
+        pEnd->bBroken = TRUE;
+        Abort( n, ERROR_BAD_COMMAND );
+        SetLines( n, FALSE, FALSE );
+    }
+
+    LeaveCriticalSection( &m_csLine );
+    return TRUE;
+}
+
+// the faults the line injected into what the port sent, to check a receiver against
+BOOL CSerialVirtual::GetFaults( UINT nPort,                     // one of the ports of Create()
+                                SERIAL_VIRTUAL_FAULTS *pFaults )
+{
+    UINT n;
+
+    for ( n = 0; n < 2; n++ )
+    {
+        if ( m_nPort[n] == nPort )
+        {
+            break;
+        }
+    }
+
+    if ( n == 2 )
+    {
+        return FALSE;
+    }
+
+    EnterCriticalSection( &m_csLine );
+    *pFaults = m_End[n].Faults;
+    LeaveCriticalSection( &m_csLine );
+    return TRUE;
+}
+
+// NULL when no pair claimed the port, INVALID_HANDLE_VALUE with the error of a device
+HANDLE CSerialVirtual::CreateFile( UINT nPort )                 // 1 = COM1
+{
+    CSerialVirtual *pPair = ( nPort < SERIAL_PORT_MAX ) ? s_pPorts[nPort] : NULL;
+    SERIAL_VIRTUAL_END *pEnd;
+    HANDLE hComm = INVALID_HANDLE_VALUE;
+
+    if ( pPair == NULL )
+    {
+        return NULL;
+    }
+
+    pEnd = &pPair->m_End[( pPair->m_nPort[0] == nPort ) ? 0 : 1];
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pEnd->bOpen )
+    {
+        SetLastError( ERROR_ACCESS_DENIED );
+        goto done;
+    }
+
+    if ( CSerialPort::GetTimestamp() < pEnd->llDownUntil )
+    {
+        SetLastError( ERROR_FILE_NOT_FOUND );
+        goto done;
+    }
+
+    // bytes still on the wire towards it arrive as usual
+    pEnd->bOpen = TRUE;
+    pEnd->bBroken = FALSE;
+    pEnd->hCompletionPort = NULL;
+    pEnd->dwMask = 0;
+    pEnd->dwEvents = 0;
+    pEnd->dwErrors = 0;
+    pEnd->nTxChar = -1;
+    pEnd->bBreak = FALSE;
+    pEnd->bXoffHeld = FALSE;
+    pEnd->bXoffSent = FALSE;
+    pEnd->nHead = pEnd->nTail = 0;
+    memset( &pEnd->Timeouts, 0, sizeof( COMMTIMEOUTS ) );
+    memset( &pEnd->dcb, 0, sizeof( DCB ) );
+    pEnd->dcb.DCBlength = sizeof( DCB );
+    pEnd->dcb.BaudRate = 9600;
+    pEnd->dcb.ByteSize = 8;
+    pEnd->dcb.Parity = NOPARITY;
+    pEnd->dcb.StopBits = ONESTOPBIT;
+    pEnd->dcb.fBinary = TRUE;
+    pEnd->dcb.fRtsControl = RTS_CONTROL_ENABLE;
+    pEnd->dcb.fDtrControl = DTR_CONTROL_ENABLE;
+    pEnd->dcb.XonChar = 0x11;
+    pEnd->dcb.XoffChar = 0x13;
+    pPair->SetLines( pEnd->nIndex, TRUE, TRUE );
+    hComm = ( HANDLE )( ( DWORD_PTR )pEnd | SERIAL_VIRTUAL_TAG );
+
+done:
+    LeaveCriticalSection( &pPair->m_csLine );
+    return hComm;
+}
+
+BOOL CSerialVirtual::CloseHandle( HANDLE hComm )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::CloseHandle( hComm );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+    pPair->Abort( pEnd->nIndex, ERROR_OPERATION_ABORTED );
+    pPair->SetLines( pEnd->nIndex, FALSE, FALSE );
+    pEnd->hCompletionPort = NULL;
+    pEnd->bOpen = FALSE;
+    pEnd->bBroken = FALSE;
+    pEnd->nHead = pEnd->nTail = 0;
+    LeaveCriticalSection( &pPair->m_csLine );
+    return TRUE;
+}
+
+// the write timeouts complete a held write short like the driver does, the read timeouts are not simulated
+BOOL CSerialVirtual::SetCommTimeouts( HANDLE hComm, LPCOMMTIMEOUTS pTimeouts )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+
+    if ( pEnd == NULL )
+    {
+        return ::SetCommTimeouts( hComm, pTimeouts );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    EnterCriticalSection( &pEnd->pPair->m_csLine );
+    pEnd->Timeouts = *pTimeouts;
+    LeaveCriticalSection( &pEnd->pPair->m_csLine );
+    return TRUE;
+}
+
+BOOL CSerialVirtual::SetCommMask( HANDLE hComm, DWORD dwMask )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BOOL ret = TRUE;
+
+    if ( pEnd == NULL )
+    {
+        return ::SetCommMask( hComm, dwMask );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        ret = FALSE;
+        goto done;
+    }
+
+    // like the driver, a pending wait completes with no events
+    pEnd->dwMask = dwMask;
+    pEnd->dwEvents &= dwMask;
+
+    if ( pEnd->pWait != NULL )
+    {
+        *pEnd->pdwWaitMask = 0;
+        Complete( pEnd, pEnd->pWait, 0, 0 );
+        pEnd->pWait = NULL;
+    }
+
+done:
+    LeaveCriticalSection( &pPair->m_csLine );
+    return ret;
+}
+
+BOOL CSerialVirtual::GetCommState( HANDLE hComm, LPDCB pDcb )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::GetCommState( hComm, pDcb );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+    *pDcb = pEnd->dcb;
+    LeaveCriticalSection( &pPair->m_csLine );
+    return TRUE;
+}
+
+// both ends keep their own settings, a mismatch is not detected here
+BOOL CSerialVirtual::SetCommState( HANDLE hComm, LPDCB pDcb )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BOOL bRts;
+    BOOL bDtr;
+
+    if ( pEnd == NULL )
+    {
+        return ::SetCommState( hComm, pDcb );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    if ( ( pDcb->BaudRate == 0 ) || ( pDcb->ByteSize < 5 ) || ( pDcb->ByteSize > 8 ) )
+    {
+        SetLastError( ERROR_INVALID_PARAMETER );
+        return FALSE;
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+    pEnd->dcb = *pDcb;
+
+    // handshake lines start raised and follow the queue from here on
+    bRts = ( pDcb->fRtsControl == RTS_CONTROL_DISABLE ) ? FALSE : ( pDcb->fRtsControl == RTS_CONTROL_HANDSHAKE ) ? pEnd->bRts : TRUE;
+    bDtr = ( pDcb->fDtrControl == DTR_CONTROL_DISABLE ) ? FALSE : ( pDcb->fDtrControl == DTR_CONTROL_HANDSHAKE ) ? pEnd->bDtr : TRUE;
+    pPair->SetLines( pEnd->nIndex, bRts, bDtr );
+    pPair->Handshake( pEnd->nIndex );
+    LeaveCriticalSection( &pPair->m_csLine );
+    SetEvent( pPair->m_hWake );
+    return TRUE;
+}
+
+// the queue sizes are fixed by SERIAL_VIRTUAL_LINE
+BOOL CSerialVirtual::SetupComm( HANDLE hComm, DWORD nInQueue, DWORD nOutQueue )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+
+    if ( pEnd == NULL )
+    {
+        return ::SetupComm( hComm, nInQueue, nOutQueue );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL CSerialVirtual::PurgeComm( HANDLE hComm, DWORD dwFlags )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::PurgeComm( hComm, dwFlags );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( ( dwFlags & PURGE_TXABORT ) && ( pEnd->pWrite != NULL ) )
+    {
+        Complete( pEnd, pEnd->pWrite, ERROR_OPERATION_ABORTED, pEnd->nWritten );
+        pEnd->pWrite = NULL;
+    }
+
+    if ( dwFlags & PURGE_RXCLEAR )
+    {
+        pEnd->nTail = pEnd->nHead;
+        pPair->Handshake( pEnd->nIndex );
+    }
+
+    LeaveCriticalSection( &pPair->m_csLine );
+    SetEvent( pPair->m_hWake );
+    return TRUE;
+}
+
+BOOL CSerialVirtual::WaitCommEvent( HANDLE hComm, LPDWORD pdwMask, LPOVERLAPPED pOverlapped )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BOOL ret = FALSE;
+
+    if ( pEnd == NULL )
+    {
+        return ::WaitCommEvent( hComm, pdwMask, pOverlapped );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        goto done;
+    }
+
+    if ( pEnd->pWait != NULL )
+    {
+        SetLastError( ERROR_INVALID_PARAMETER );
+        goto done;
+    }
+
+    // events seen in between complete it at once, the event is signaled as the driver does
+    if ( ( pEnd->dwEvents & pEnd->dwMask ) != 0 )
+    {
+        *pdwMask = pEnd->dwEvents & pEnd->dwMask;
+        pEnd->dwEvents = 0;
+        Complete( pEnd, pOverlapped, 0, 0 );
+        ret = TRUE;
+        goto done;
+    }
+
+    ResetEvent( pOverlapped->hEvent );
+    pOverlapped->Internal = STATUS_PENDING;
+    pEnd->pWait = pOverlapped;
+    pEnd->pdwWaitMask = pdwMask;
+    SetLastError( ERROR_IO_PENDING );
+
+done:
+    LeaveCriticalSection( &pPair->m_csLine );
+    return ret;
+}
+
+BOOL CSerialVirtual::GetOverlappedResult( HANDLE hComm, LPOVERLAPPED pOverlapped, LPDWORD pnBytes, BOOL bWait )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BOOL bPending;
+
+    if ( pEnd == NULL )
+    {
+        return ::GetOverlappedResult( hComm, pOverlapped, pnBytes, bWait );
+    }
+
+    pPair = pEnd->pPair;
+
+    for ( ;; )
+    {
+        EnterCriticalSection( &pPair->m_csLine );
+        bPending = ( pOverlapped->Internal == STATUS_PENDING );
+        LeaveCriticalSection( &pPair->m_csLine );
+
+        if ( !bPending )
+        {
+            break;
+        }
+
+        if ( !bWait )
+        {
+            SetLastError( ERROR_IO_INCOMPLETE );
+            return FALSE;
+        }
+
+        // also copes with an auto-reset event another thread already consumed
+        WaitForSingleObject( pOverlapped->hEvent, 1 );
+    }
+
+    *pnBytes = ( DWORD )pOverlapped->InternalHigh;
+
+    if ( pOverlapped->Internal != 0 )
+    {
+        SetLastError( ( DWORD )pOverlapped->Internal );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// reads complete at once with what the receiving driver holds
+BOOL CSerialVirtual::ReadFile( HANDLE hComm, LPVOID pBuffer, DWORD nSize, LPDWORD pnRead, LPOVERLAPPED pOverlapped )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BYTE *pData = ( BYTE * )pBuffer;
+    DWORD nRead;
+    DWORD nPos;
+    DWORD nPart;
+
+    if ( pEnd == NULL )
+    {
+        return ::ReadFile( hComm, pBuffer, nSize, pnRead, pOverlapped );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pEnd->bBroken )
+    {
+        LeaveCriticalSection( &pPair->m_csLine );
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    nRead = min( nSize, pEnd->nHead - pEnd->nTail );
+    nPos = pEnd->nTail % pPair->m_Line.nQueueSize;
+    nPart = min( nRead, pPair->m_Line.nQueueSize - nPos );
+    memcpy( pData, pEnd->pQueue + nPos, nPart );
+    memcpy( pData + nPart, pEnd->pQueue, nRead - nPart );
+    pEnd->nTail += nRead;
+    pPair->Handshake( pEnd->nIndex );
+    LeaveCriticalSection( &pPair->m_csLine );
+
+    if ( pnRead != NULL )
+    {
+        *pnRead = nRead;
+    }
+
+    if ( pOverlapped != NULL )
+    {
+        pOverlapped->Internal = 0;
+        pOverlapped->InternalHigh = nRead;
+    }
+
+    SetEvent( pPair->m_hWake );
+    return TRUE;
+}
+
+// one write at a time, sent straight from the caller's buffer that stays valid until it completes
+BOOL CSerialVirtual::WriteFile( HANDLE hComm, LPCVOID pBuffer, DWORD nSize, LPDWORD pnWritten, LPOVERLAPPED pOverlapped )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BOOL ret = FALSE;
+
+    if ( pEnd == NULL )
+    {
+        return ::WriteFile( hComm, pBuffer, nSize, pnWritten, pOverlapped );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        goto done;
+    }
+
+    if ( pEnd->pWrite != NULL )
+    {
+        SetLastError( ERROR_INVALID_PARAMETER );
+        goto done;
+    }
+
+    if ( nSize == 0 )
+    {
+        if ( pnWritten != NULL )
+        {
+            *pnWritten = 0;
+        }
+
+        Complete( pEnd, pOverlapped, 0, 0 );
+        ret = TRUE;
+        goto done;
+    }
+
+    ResetEvent( pOverlapped->hEvent );
+    pOverlapped->Internal = STATUS_PENDING;
+    pEnd->pWrite = pOverlapped;
+    pEnd->pWriteData = ( const BYTE * )pBuffer;
+    pEnd->nWriteSize = nSize;
+    pEnd->nWritten = 0;
+    pEnd->llWriteDeadline = MAXLONGLONG;
+
+    if ( ( pEnd->Timeouts.WriteTotalTimeoutMultiplier != 0 ) || ( pEnd->Timeouts.WriteTotalTimeoutConstant != 0 ) )
+    {
+        pEnd->llWriteDeadline = CSerialPort::GetTimestamp() + ( ( LONGLONG )pEnd->Timeouts.WriteTotalTimeoutMultiplier * nSize + pEnd->Timeouts.WriteTotalTimeoutConstant ) * 1000;
+    }
+
+    SetEvent( pPair->m_hWake );
+    SetLastError( ERROR_IO_PENDING );
+
+done:
+    LeaveCriticalSection( &pPair->m_csLine );
+    return ret;
+}
+
+BOOL CSerialVirtual::ClearCommError( HANDLE hComm, LPDWORD pdwErrors, LPCOMSTAT pStat )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::ClearCommError( hComm, pdwErrors, pStat );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pdwErrors != NULL )
+    {
+        *pdwErrors = pEnd->dwErrors;
+    }
+
+    pEnd->dwErrors = 0;
+
+    if ( pStat != NULL )
+    {
+        memset( pStat, 0, sizeof( COMSTAT ) );
+        pStat->cbInQue = pEnd->nHead - pEnd->nTail;
+        pStat->cbOutQue = ( ( pEnd->pWrite != NULL ) ? pEnd->nWriteSize - pEnd->nWritten : 0 ) + ( ( pEnd->nTxChar >= 0 ) ? 1 : 0 );
+        pStat->fCtsHold = pEnd->dcb.fOutxCtsFlow && !pPair->m_End[1 - pEnd->nIndex].bRts;
+        pStat->fDsrHold = pEnd->dcb.fOutxDsrFlow && !pPair->m_End[1 - pEnd->nIndex].bDtr;
+        pStat->fXoffHold = pEnd->bXoffHeld;
+        pStat->fXoffSent = pEnd->bXoffSent;
+        pStat->fTxim = ( pEnd->nTxChar >= 0 );
+    }
+
+    LeaveCriticalSection( &pPair->m_csLine );
+    return TRUE;
+}
+
+BOOL CSerialVirtual::EscapeCommFunction( HANDLE hComm, DWORD dwFunction )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    SERIAL_VIRTUAL_END *pPeer;
+    CSerialVirtual *pPair;
+    BOOL ret = TRUE;
+
+    if ( pEnd == NULL )
+    {
+        return ::EscapeCommFunction( hComm, dwFunction );
+    }
+
+    pPair = pEnd->pPair;
+    pPeer = &pPair->m_End[1 - pEnd->nIndex];
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        ret = FALSE;
+        goto done;
+    }
+
+    switch ( dwFunction )
+    {
+        case SETRTS:
+        case CLRRTS:
+            pPair->SetLines( pEnd->nIndex, dwFunction == SETRTS, pEnd->bDtr );
+            break;
+
+        case SETDTR:
+        case CLRDTR:
+            pPair->SetLines( pEnd->nIndex, pEnd->bRts, dwFunction == SETDTR );
+            break;
+
+        case SETBREAK:
+            // the peer sees the break at once, what was on the wire still arrives
+            pEnd->bBreak = TRUE;
+
+            if ( pPeer->bOpen )
+            {
+                pPeer->dwErrors |= CE_BREAK;
+                pPair->Signal( 1 - pEnd->nIndex, EV_BREAK | EV_ERR );
+            }
+
+            break;
+
+        case CLRBREAK:
+            pEnd->bBreak = FALSE;
+            break;
+
+        case SETXOFF:
+            pEnd->bXoffHeld = TRUE;
+            break;
+
+        case SETXON:
+            pEnd->bXoffHeld = FALSE;
+            break;
+
+        default:
+            SetLastError( ERROR_INVALID_PARAMETER );
+            ret = FALSE;
+            break;
+    }
+
+done:
+    LeaveCriticalSection( &pPair->m_csLine );
+    SetEvent( pPair->m_hWake );
+    return ret;
+}
+
+// goes out ahead of a pending write, even while the write is held
+BOOL CSerialVirtual::TransmitCommChar( HANDLE hComm, char cChar )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::TransmitCommChar( hComm, cChar );
+    }
+
+    if ( pEnd->bBroken )
+    {
+        SetLastError( ERROR_BAD_COMMAND );
+        return FALSE;
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+    pEnd->nTxChar = ( BYTE )cChar;
+    LeaveCriticalSection( &pPair->m_csLine );
+    SetEvent( pPair->m_hWake );
+    return TRUE;
+}
+
+BOOL CSerialVirtual::CancelIo( HANDLE hComm )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::CancelIo( hComm );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+    pPair->Abort( pEnd->nIndex, ERROR_OPERATION_ABORTED );
+    LeaveCriticalSection( &pPair->m_csLine );
+    return TRUE;
+}
+
+BOOL CSerialVirtual::CancelIoEx( HANDLE hComm, LPOVERLAPPED pOverlapped )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+    BOOL ret = FALSE;
+
+    if ( pEnd == NULL )
+    {
+        return ::CancelIoEx( hComm, pOverlapped );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+
+    if ( ( pEnd->pWait != NULL ) && ( pEnd->pWait == pOverlapped ) )
+    {
+        *pEnd->pdwWaitMask = 0;
+        Complete( pEnd, pEnd->pWait, ERROR_OPERATION_ABORTED, 0 );
+        pEnd->pWait = NULL;
+        ret = TRUE;
+    }
+
+    if ( ( pEnd->pWrite != NULL ) && ( pEnd->pWrite == pOverlapped ) )
+    {
+        Complete( pEnd, pEnd->pWrite, ERROR_OPERATION_ABORTED, pEnd->nWritten );
+        pEnd->pWrite = NULL;
+        ret = TRUE;
+    }
+
+    LeaveCriticalSection( &pPair->m_csLine );
+
+    if ( !ret )
+    {
+        SetLastError( ERROR_NOT_FOUND );
+    }
+
+    return ret;
+}
+
+// an end joins the completion port of a reactor shard, its waits and writes then complete there
+HANDLE CSerialVirtual::CreateIoCompletionPort( HANDLE hComm, HANDLE hCompletionPort, ULONG_PTR CompletionKey, DWORD nThreads )
+{
+    SERIAL_VIRTUAL_END *pEnd = GetEnd( hComm );
+    CSerialVirtual *pPair;
+
+    if ( pEnd == NULL )
+    {
+        return ::CreateIoCompletionPort( hComm, hCompletionPort, CompletionKey, nThreads );
+    }
+
+    pPair = pEnd->pPair;
+    EnterCriticalSection( &pPair->m_csLine );
+    pEnd->hCompletionPort = hCompletionPort;
+    pEnd->CompletionKey = CompletionKey;
+    LeaveCriticalSection( &pPair->m_csLine );
+    return hCompletionPort;
+}
+
+BOOL CSerialVirtual::IsVirtual( HANDLE hComm )
+{
+    return GetEnd( hComm ) != NULL;
+}
+
+DWORD WINAPI CSerialVirtual::LineThread( LPVOID pParam )
+{
+    CSerialVirtual *pPair = ( CSerialVirtual * )pParam;
+    LONGLONG    llNext;
+    LONGLONG    llNow;
+    DWORD       dwTimeout;
+
+    while ( !pPair->m_bStop )
+    {
+        EnterCriticalSection( &pPair->m_csLine );
+        llNext = pPair->Run( CSerialPort::GetTimestamp() );
+        LeaveCriticalSection( &pPair->m_csLine );
+        llNow = CSerialPort::GetTimestamp();
+
+        // sleep in milliseconds while the next byte is far off, poll the last stretch like a replay
+        if ( llNext == MAXLONGLONG )
+        {
+            dwTimeout = INFINITE;
+        }
+        else
+        {
+            dwTimeout = ( llNext - llNow > ( LONGLONG )SERIAL_VIRTUAL_SPIN ) ? ( DWORD )( ( llNext - llNow - ( LONGLONG )SERIAL_VIRTUAL_SPIN / 2 ) / 1000 ) : 0;
+        }
+
+        if ( ( dwTimeout != 0 ) || ( llNext > llNow ) )
+        {
+            if ( ( WaitForSingleObject( pPair->m_hWake, dwTimeout ) == WAIT_TIMEOUT ) && ( dwTimeout == 0 ) )
+            {
+                // the last stretch is polled, but a core is shared with the ports and the other lines
+                ::Sleep( 0 );
+            }
+        }
+    }
+
+    return 0;
+}
+
+SERIAL_VIRTUAL_END *CSerialVirtual::GetEnd( HANDLE hComm )      // NULL for a handle of a device
+{
+    if ( ( ( DWORD_PTR )hComm & 3 ) != SERIAL_VIRTUAL_TAG )
+    {
+        return NULL;
+    }
+
+    return ( SERIAL_VIRTUAL_END * )( ( DWORD_PTR )hComm & ~( DWORD_PTR )3 );
+}
+
+void CSerialVirtual::Complete( SERIAL_VIRTUAL_END *pEnd, LPOVERLAPPED pOverlapped, DWORD dwError, DWORD nBytes )
+{
+    pOverlapped->InternalHigh = nBytes;
+    pOverlapped->Internal = dwError;
+    SetEvent( pOverlapped->hEvent );
+
+    // a port on a reactor gets the packet the driver would queue, unless the event asked it not to
+    if ( ( pEnd->hCompletionPort != NULL ) && !( ( DWORD_PTR )pOverlapped->hEvent & 1 ) )
+    {
+        PostQueuedCompletionStatus( pEnd->hCompletionPort, nBytes, pEnd->CompletionKey, pOverlapped );
+    }
+}
+
+LONGLONG CSerialVirtual::Run( LONGLONG llNow )                 // when it has to run again, MAXLONGLONG for a change only
+{
+    LONGLONG llNext = MAXLONGLONG;
+    SERIAL_VIRTUAL_END *pEnd;
+    UINT n;
+
+    for ( n = 0; n < 2; n++ )
+    {
+        Transmit( n, llNow );
+    }
+
+    // an XON or XOFF that arrives changes what the other end may send next round
+    for ( n = 0; n < 2; n++ )
+    {
+        Arrive( n, llNow );
+    }
+
+    for ( n = 0; n < 2; n++ )
+    {
+        pEnd = &m_End[n];
+
+        // the driver gives up on a write that did not get out in time and reports what did
+        if ( ( pEnd->pWrite != NULL ) && ( llNow >= pEnd->llWriteDeadline ) )
+        {
+            Complete( pEnd, pEnd->pWrite, 0, pEnd->nWritten );
+            pEnd->pWrite = NULL;
+        }
+
+        if ( pEnd->pWrite != NULL )
+        {
+            llNext = min( llNext, pEnd->llWriteDeadline );
+        }
+
+        if ( IsSending( n ) && !pEnd->bBreak && ( pEnd->nWireHead - pEnd->nWireTail < SERIAL_VIRTUAL_WIRE ) )
+        {
+            llNext = min( llNext, ( pEnd->llLineFree + GetByteTime( n ) + 999 ) / 1000 );
+        }
+
+        if ( pEnd->nWireHead != pEnd->nWireTail )
+        {
+            llNext = min( llNext, pEnd->pWire[pEnd->nWireTail % SERIAL_VIRTUAL_WIRE].llArrival );
+        }
+    }
+
+    return llNext;
+}
+
+// puts the bytes whose last bit went out by now on the wire, with the faults of the line
+void CSerialVirtual::Transmit( UINT nFrom, LONGLONG llNow )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nFrom];
+    SERIAL_VIRTUAL_BYTE *pByte;
+    LONGLONG llByte = GetByteTime( nFrom );
+    LONGLONG llArrival;
+    DWORD dwFaults = m_Line.dwDropRate + m_Line.dwCorruptRate + m_Line.dwFramingRate;
+    DWORD dwDice;
+    BYTE  Data;
+    WORD  wErrors;
+
+    if ( !IsSending( nFrom ) || pEnd->bBreak )
+    {
+        pEnd->bIdle = TRUE;
+        return;
+    }
+
+    // a line that was idle starts with the first byte now, not where it stopped
+    if ( pEnd->bIdle )
+    {
+        pEnd->llLineFree = max( pEnd->llLineFree, llNow * 1000 );
+        pEnd->bIdle = FALSE;
+    }
+
+    while ( IsSending( nFrom ) && ( pEnd->llLineFree + llByte <= llNow * 1000 ) && ( pEnd->nWireHead - pEnd->nWireTail < SERIAL_VIRTUAL_WIRE ) )
+    {
+        if ( pEnd->nTxChar >= 0 )
+        {
+            Data = ( BYTE )pEnd->nTxChar;
+            pEnd->nTxChar = -1;
+        }
+        else
+        {
+            Data = pEnd->pWriteData[pEnd->nWritten++];
+        }
+
+        pEnd->llLineFree += llByte;
+        pEnd->Faults.nSent++;
+        wErrors = 0;
+
+        if ( dwFaults != 0 )
+        {
+            dwDice = GetRandom() % 1000000;
+
+            if ( dwDice < m_Line.dwDropRate )
+            {
+                pEnd->Faults.nDropped++;
+                goto sent;
+            }
+            else if ( dwDice < m_Line.dwDropRate + m_Line.dwCorruptRate )
+            {
+                Data ^= ( BYTE )( 1 << ( GetRandom() % pEnd->dcb.ByteSize ) );
+                wErrors = ( pEnd->dcb.Parity != NOPARITY ) ? CE_RXPARITY : 0;
+                pEnd->Faults.nCorrupted++;
+            }
+            else if ( dwDice < dwFaults )
+            {
+                wErrors = CE_FRAME;
+                pEnd->Faults.nFramed++;
+            }
+        }
+
+        llArrival = pEnd->llLineFree / 1000 + m_Line.dwLatency;
+
+        if ( m_Line.dwJitter != 0 )
+        {
+            llArrival += GetRandom() % ( m_Line.dwJitter + 1 );
+        }
+
+        // jitter moves bursts, a byte never overtakes the one before it
+        pEnd->llLastArrival = llArrival = max( llArrival, pEnd->llLastArrival );
+        pByte = &pEnd->pWire[pEnd->nWireHead++ % SERIAL_VIRTUAL_WIRE];
+        pByte->llArrival = llArrival;
+        pByte->Data = Data;
+        pByte->wErrors = wErrors;
+
+sent:
+        if ( ( pEnd->pWrite != NULL ) && ( pEnd->nWritten == pEnd->nWriteSize ) )
+        {
+            Complete( pEnd, pEnd->pWrite, 0, pEnd->nWriteSize );
+            pEnd->pWrite = NULL;
+            Signal( nFrom, EV_TXEMPTY );
+        }
+    }
+}
+
+// moves the bytes that arrived by now into the receiving driver of the end
+void CSerialVirtual::Arrive( UINT nTo, LONGLONG llNow )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nTo];
+    SERIAL_VIRTUAL_END *pFrom = &m_End[1 - nTo];
+    SERIAL_VIRTUAL_BYTE *pByte;
+    DWORD dwEvents = 0;
+
+    while ( pFrom->nWireHead != pFrom->nWireTail )
+    {
+        pByte = &pFrom->pWire[pFrom->nWireTail % SERIAL_VIRTUAL_WIRE];
+
+        if ( pByte->llArrival > llNow )
+        {
+            break;
+        }
+
+        pFrom->nWireTail++;
+
+        if ( !pEnd->bOpen || pEnd->bBroken )
+        {
+            continue;
+        }
+
+        // with fOutX the driver takes XON and XOFF out of the data
+        if ( pEnd->dcb.fOutX && ( pByte->wErrors == 0 ) &&
+             ( ( pByte->Data == ( BYTE )pEnd->dcb.XonChar ) || ( pByte->Data == ( BYTE )pEnd->dcb.XoffChar ) ) )
+        {
+            pEnd->bXoffHeld = ( pByte->Data == ( BYTE )pEnd->dcb.XoffChar );
+            continue;
+        }
+
+        if ( pEnd->nHead - pEnd->nTail >= m_Line.nQueueSize )
+        {
+            pFrom->Faults.nOverrun++;
+            pEnd->dwErrors |= CE_RXOVER;
+            dwEvents |= EV_ERR;
+            continue;
+        }
+
+        pEnd->pQueue[pEnd->nHead++ % m_Line.nQueueSize] = pByte->Data;
+        dwEvents |= EV_RXCHAR;
+
+        if ( pByte->wErrors != 0 )
+        {
+            pEnd->dwErrors |= pByte->wErrors;
+            dwEvents |= EV_ERR;
+        }
+
+        if ( pByte->Data == ( BYTE )pEnd->dcb.EvtChar )
+        {
+            dwEvents |= EV_RXFLAG;
+        }
+    }
+
+    if ( dwEvents != 0 )
+    {
+        Signal( nTo, dwEvents );
+        Handshake( nTo );
+    }
+}
+
+// completes the pending wait of the end, or keeps the events for the next one
+void CSerialVirtual::Signal( UINT nEnd, DWORD dwEvents )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nEnd];
+
+    if ( ( dwEvents &= pEnd->dwMask ) == 0 )
+    {
+        return;
+    }
+
+    if ( pEnd->pWait != NULL )
+    {
+        *pEnd->pdwWaitMask = dwEvents | ( pEnd->dwEvents & pEnd->dwMask );
+        pEnd->dwEvents = 0;
+        Complete( pEnd, pEnd->pWait, 0, 0 );
+        pEnd->pWait = NULL;
+    }
+    else
+    {
+        pEnd->dwEvents |= dwEvents;
+    }
+}
+
+// RTS of one end is CTS of the other, DTR is DSR
+void CSerialVirtual::SetLines( UINT nEnd, BOOL bRts, BOOL bDtr )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nEnd];
+    DWORD dwEvents = 0;
+
+    if ( !pEnd->bRts != !bRts )
+    {
+        pEnd->bRts = bRts;
+        dwEvents |= EV_CTS;
+    }
+
+    if ( !pEnd->bDtr != !bDtr )
+    {
+        pEnd->bDtr = bDtr;
+        dwEvents |= EV_DSR;
+    }
+
+    if ( ( dwEvents != 0 ) && m_End[1 - nEnd].bOpen )
+    {
+        Signal( 1 - nEnd, dwEvents );
+    }
+}
+
+// the automatic flow control of the receiving driver, at 3/4 and 1/4 of its queue
+void CSerialVirtual::Handshake( UINT nEnd )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nEnd];
+    DWORD nCount = GetQueueCount( nEnd );
+    BOOL bFull = ( nCount >= m_Line.nQueueSize / 4 * 3 );
+    BOOL bEmpty = ( nCount <= m_Line.nQueueSize / 4 );
+    BOOL bRts = pEnd->bRts;
+    BOOL bDtr = pEnd->bDtr;
+
+    if ( pEnd->dcb.fRtsControl == RTS_CONTROL_HANDSHAKE )
+    {
+        bRts = bFull ? FALSE : bEmpty ? TRUE : bRts;
+    }
+
+    if ( pEnd->dcb.fDtrControl == DTR_CONTROL_HANDSHAKE )
+    {
+        bDtr = bFull ? FALSE : bEmpty ? TRUE : bDtr;
+    }
+
+    SetLines( nEnd, bRts, bDtr );
+
+    if ( pEnd->dcb.fInX )
+    {
+        if ( bFull && !pEnd->bXoffSent )
+        {
+            pEnd->nTxChar = ( BYTE )pEnd->dcb.XoffChar;
+            pEnd->bXoffSent = TRUE;
+        }
+        else if ( bEmpty && pEnd->bXoffSent )
+        {
+            pEnd->nTxChar = ( BYTE )pEnd->dcb.XonChar;
+            pEnd->bXoffSent = FALSE;
+        }
+    }
+}
+
+// completes the pending wait and write of the end with the error
+void CSerialVirtual::Abort( UINT nEnd, DWORD dwError )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nEnd];
+
+    if ( pEnd->pWait != NULL )
+    {
+        *pEnd->pdwWaitMask = 0;
+        Complete( pEnd, pEnd->pWait, dwError, 0 );
+        pEnd->pWait = NULL;
+    }
+
+    if ( pEnd->pWrite != NULL )
+    {
+        Complete( pEnd, pEnd->pWrite, dwError, pEnd->nWritten );
+        pEnd->pWrite = NULL;
+    }
+
+    pEnd->nTxChar = -1;
+}
+
+DWORD CSerialVirtual::GetQueueCount( UINT nEnd )
+{
+    return m_End[nEnd].nHead - m_End[nEnd].nTail;
+}
+
+DWORD CSerialVirtual::GetRandom()                               // xorshift, the seed of the line repeats a run
+{
+    m_dwRandom ^= m_dwRandom << 13;
+    m_dwRandom ^= m_dwRandom >> 17;
+    m_dwRandom ^= m_dwRandom << 5;
+    return m_dwRandom;
+}
+
+LONGLONG CSerialVirtual::GetByteTime( UINT nEnd )               // ns, start bit, data, parity and stop bits
+{
+    const DCB *pDcb = &m_End[nEnd].dcb;
+    DWORD nHalfBits = 2 * ( 1 + pDcb->ByteSize + ( ( pDcb->Parity != NOPARITY ) ? 1 : 0 ) );
+    nHalfBits += ( pDcb->StopBits == ONESTOPBIT ) ? 2 : ( pDcb->StopBits == ONE5STOPBITS ) ? 3 : 4;
+    return ( LONGLONG )nHalfBits * 500000000 / ( ( pDcb->BaudRate != 0 ) ? pDcb->BaudRate : 9600 );
+}
+
+BOOL CSerialVirtual::IsHeld( UINT nEnd )                        // the handshake of the peer stops the write
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nEnd];
+    SERIAL_VIRTUAL_END *pPeer = &m_End[1 - nEnd];
+
+    return ( pEnd->dcb.fOutxCtsFlow && !pPeer->bRts ) ||
+           ( pEnd->dcb.fOutxDsrFlow && !pPeer->bDtr ) ||
+           pEnd->bXoffHeld;
+}
+
+BOOL CSerialVirtual::IsSending( UINT nEnd )
+{
+    SERIAL_VIRTUAL_END *pEnd = &m_End[nEnd];
+
+    return pEnd->bOpen && !pEnd->bBroken &&
+           ( ( pEnd->nTxChar >= 0 ) || ( ( pEnd->pWrite != NULL ) && !IsHeld( nEnd ) ) );
+}
@@ -0,0 +1,152 @@
+/*
+**  FILENAME            SerialVirtual.h
+**
+**  PURPOSE             Two connected serial ports inside the process, opened by port number
+**                      in place of a device. A line thread moves the bytes with the wire time
+**                      of the baud rate and format, the latency and jitter of an adapter and
+**                      the faults asked for, so the whole port runs without hardware.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef SERIAL_VIRTUAL_H
+#define SERIAL_VIRTUAL_H
+
+#define SERIAL_VIRTUAL_TAG          2UL                     /* low handle bits, kernel handles always have them clear */
+#define SERIAL_VIRTUAL_QUEUE        4096UL                  /* default bytes the receiving driver holds */
+#define SERIAL_VIRTUAL_WIRE         16384UL                 /* bytes sent and not yet arrived, per direction */
+#define SERIAL_VIRTUAL_SPIN         2000UL                  /* us, the line thread polls when the next byte is closer */
+
+typedef struct
+{
+    DWORD               nQueueSize;                         /* bytes the receiving driver holds, more are lost with CE_RXOVER; 0 default */
+    DWORD               dwLatency;                          /* us from the last bit to the receiving driver, USB adapters 1000 and more */
+    DWORD               dwJitter;                           /* us added to the latency at random, the order of the bytes is kept */
+    DWORD               dwDropRate;                         /* bytes per million lost on the wire */
+    DWORD               dwCorruptRate;                      /* bytes per million with one bit flipped, CE_RXPARITY when parity is on */
+    DWORD               dwFramingRate;                      /* bytes per million received with CE_FRAME */
+    DWORD               dwSeed;                             /* the same seed gives the same faults and jitter */
+} SERIAL_VIRTUAL_LINE;
+
+typedef struct
+{
+    LONGLONG            llArrival;                          /* us, GetTimestamp() */
+    BYTE                Data;
+    BYTE                Reserved;
+    WORD                wErrors;                            /* CE_FRAME, CE_RXPARITY the byte arrives with */
+} SERIAL_VIRTUAL_BYTE;
+
+/* what the line did to the bytes one end sent since Create(), GetFaults() */
+typedef struct
+{
+    DWORD               nSent;                              /* bytes put on the line, XON and XOFF included */
+    DWORD               nDropped;                           /* lost on the wire, dwDropRate */
+    DWORD               nCorrupted;                         /* arrived with one bit flipped, dwCorruptRate */
+    DWORD               nFramed;                            /* arrived with CE_FRAME, dwFramingRate */
+    DWORD               nOverrun;                           /* lost with CE_RXOVER, the receiving driver was full */
+} SERIAL_VIRTUAL_FAULTS;
+
+typedef struct
+{
+    class CSerialVirtual *pPair;
+    UINT                nIndex;                             /* 0 the first port of Create(), 1 the second */
+    BOOL                bOpen;
+    BOOL                bBroken;                            /* Disconnect(): calls fail until the handle is closed */
+    LONGLONG            llDownUntil;                        /* us, CreateFile() fails before */
+    DCB                 dcb;
+    DWORD               dwMask;                             /* SetCommMask() */
+    DWORD               dwEvents;                           /* seen while no WaitCommEvent() was pending */
+    DWORD               dwErrors;                           /* CE_*, cleared by ClearCommError() */
+    HANDLE              hCompletionPort;                    /* CreateIoCompletionPort(), the shard of a reactor */
+    ULONG_PTR           CompletionKey;
+    LPOVERLAPPED        pWait;                              /* pending WaitCommEvent() */
+    LPDWORD             pdwWaitMask;
+    LPOVERLAPPED        pWrite;                             /* pending WriteFile(), sent straight from the caller's buffer */
+    const BYTE          *pWriteData;
+    DWORD               nWriteSize;
+    DWORD               nWritten;
+    LONGLONG            llWriteDeadline;                    /* us, the write timeout completes the write short, MAXLONGLONG none */
+    COMMTIMEOUTS        Timeouts;                           /* SetCommTimeouts(), only the write timeouts are simulated */
+    int                 nTxChar;                            /* TransmitCommChar() or automatic XON/XOFF, -1 none */
+    BOOL                bRts;
+    BOOL                bDtr;
+    BOOL                bBreak;
+    BOOL                bXoffHeld;                          /* XOFF received with fOutX */
+    BOOL                bXoffSent;                          /* XOFF sent with fInX */
+    BOOL                bIdle;                              /* nothing to send, the next byte starts when it comes */
+    LONGLONG            llLineFree;                         /* ns, the last byte sent so far has left the wire */
+    LONGLONG            llLastArrival;                      /* us, jitter never reorders */
+    BYTE                *pQueue;                            /* receiving driver */
+    DWORD               nHead;
+    DWORD               nTail;
+    SERIAL_VIRTUAL_BYTE *pWire;                             /* bytes this end sent, on the way to the other end */
+    DWORD               nWireHead;
+    DWORD               nWireTail;
+    SERIAL_VIRTUAL_FAULTS Faults;                           /* of the bytes this end sent */
+} SERIAL_VIRTUAL_END;
+
+/* one pair; Create() claims both port numbers, Open() of a CSerialPort then connects to the pair */
+class CSerialVirtual
+{
+    public:
+        CSerialVirtual();
+        virtual             ~CSerialVirtual();
+
+        BOOL                Create( UINT nPortA, UINT nPortB, const SERIAL_VIRTUAL_LINE *pLine = NULL );
+        void                Destroy();
+        BOOL                Disconnect( UINT nPort, DWORD dwDownTime );
+        BOOL                GetFaults( UINT nPort, SERIAL_VIRTUAL_FAULTS *pFaults );
+
+        // the device calls of CSerialPort; a handle that is not an end goes straight to the driver
+        static HANDLE       CreateFile( UINT nPort );
+        static BOOL         CloseHandle( HANDLE hComm );
+        static BOOL         SetCommTimeouts( HANDLE hComm, LPCOMMTIMEOUTS pTimeouts );
+        static BOOL         SetCommMask( HANDLE hComm, DWORD dwMask );
+        static BOOL         GetCommState( HANDLE hComm, LPDCB pDcb );
+        static BOOL         SetCommState( HANDLE hComm, LPDCB pDcb );
+        static BOOL         SetupComm( HANDLE hComm, DWORD nInQueue, DWORD nOutQueue );
+        static BOOL         PurgeComm( HANDLE hComm, DWORD dwFlags );
+        static BOOL         WaitCommEvent( HANDLE hComm, LPDWORD pdwMask, LPOVERLAPPED pOverlapped );
+        static BOOL         GetOverlappedResult( HANDLE hComm, LPOVERLAPPED pOverlapped, LPDWORD pnBytes, BOOL bWait );
+        static BOOL         ReadFile( HANDLE hComm, LPVOID pBuffer, DWORD nSize, LPDWORD pnRead, LPOVERLAPPED pOverlapped );
+        static BOOL         WriteFile( HANDLE hComm, LPCVOID pBuffer, DWORD nSize, LPDWORD pnWritten, LPOVERLAPPED pOverlapped );
+        static BOOL         ClearCommError( HANDLE hComm, LPDWORD pdwErrors, LPCOMSTAT pStat );
+        static BOOL         EscapeCommFunction( HANDLE hComm, DWORD dwFunction );
+        static BOOL         TransmitCommChar( HANDLE hComm, char cChar );
+        static BOOL         CancelIo( HANDLE hComm );
+        static BOOL         CancelIoEx( HANDLE hComm, LPOVERLAPPED pOverlapped );
+        static HANDLE       CreateIoCompletionPort( HANDLE hComm, HANDLE hCompletionPort, ULONG_PTR CompletionKey, DWORD nThreads );
+        static BOOL         IsVirtual( HANDLE hComm );
+
+    protected:
+        SERIAL_VIRTUAL_LINE m_Line;
+        SERIAL_VIRTUAL_END  m_End[2];
+        UINT                m_nPort[2];
+        CRITICAL_SECTION    m_csLine;
+        HANDLE              m_hWake;                        /* a write, a control line or Destroy() */
+        HANDLE              m_hThread;
+        volatile BOOL       m_bStop;
+        DWORD               m_dwRandom;
+
+        static DWORD WINAPI LineThread( LPVOID pParam );
+        static SERIAL_VIRTUAL_END *GetEnd( HANDLE hComm );
+        static void         Complete( SERIAL_VIRTUAL_END *pEnd, LPOVERLAPPED pOverlapped, DWORD dwError, DWORD nBytes );
+
+        LONGLONG            Run( LONGLONG llNow );
+        void                Transmit( UINT nFrom, LONGLONG llNow );
+        void                Arrive( UINT nTo, LONGLONG llNow );
+        void                Signal( UINT nEnd, DWORD dwEvents );
+        void                SetLines( UINT nEnd, BOOL bRts, BOOL bDtr );
+        void                Handshake( UINT nEnd );
+        void                Abort( UINT nEnd, DWORD dwError );
+        DWORD               GetQueueCount( UINT nEnd );
+        DWORD               GetRandom();
+        LONGLONG            GetByteTime( UINT nEnd );
+        BOOL                IsHeld( UINT nEnd );
+        BOOL                IsSending( UINT nEnd );
+};
+
+#endif SERIAL_VIRTUAL_H
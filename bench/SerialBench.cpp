@@ -0,0 +1,3503 @@
+/*
+**  FILENAME            SerialBench.cpp
+**
+**  PURPOSE             Benchmark of CSerialPort over pairs of connected ports, a null-modem
+**                      cable, a virtual pair such as com0com or CSerialVirtual. Sweeps the write size, the
+**                      write buffer size, the read timeouts and the number of port pairs and
+**                      prints one JSON (or CSV) line per case, so runs of two versions can be
+**                      compared by a script.
+**
+**                      cl /EHsc /MD /D_AFXDLL /Ibench bench\SerialBench.cpp Serial*.cpp
+**                      SerialBench --pairs 11:12,13:14 --baud 921600 --sizes 16,256,4096 > run.json
+**                      SerialBench --pairs 11:12 --command --sizes 1,8,16,32,64 > write.json
+**                      SerialBench --pairs 11:12 --priority --sizes 4096 --slices 0,256 > priority.json
+**                      SerialBench --pairs 11:12 --poll --slaves 4 --windows 1,4 > poll.json
+**                      SerialBench --pairs 11:12 --sizes 256 --capture run > run.json
+**                      SerialBench --replay run --speeds 1,4,0 > replay.json
+**                      SerialBench --pairs 11:12,13:14 --startup --missing 40,41 --parallel 1,8 > startup.json
+**                      SerialBench --checksum --sizes 8,256,4096,65536 > checksum.json
+**                      SerialBench --framers --sizes 16,256,4096 --buffers 4096 > framers.json
+**                      SerialBench --pairs 11:12 --virtual --pool --sizes 64,1024 > pool.json
+**                      SerialBench --pairs 11:12 --pingpong --spins 0,50,1000 --core 2 --realtime > rtt.json
+**                      SerialBench --pairs 11:12 --await --sizes 1,64,1024 > await.json
+**                      SerialBench --pairs 11:12 --flow --delays 0,2,20 --sizes 1024 > flow.json
+**                      SerialBench --pairs 11:12,13:14 --virtual --latency 1000 --faults 100:10:10 --seed 7 > virtual.json
+**                      SerialBench --pairs 11:12 --virtual --verify --faults 1000:1000:1000 --seed 7 > verify.json
+**                      SerialBench --pairs 11:12 --image --sizes 262144 --pieces 0,1024 --baud 921600 > image.json
+**                      SerialBench --pairs 0-255 --virtual --reactor 2 --sizes 64 --interval 10 > reactor.json
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "stdafx.h"
+#include "../SerialPort.h"
+#include "../SerialAwait.h"
+
+#define BENCH_MAX_PAIRS         128                     /* 256 ports, SERIAL_PORT_MAX */
+#define BENCH_MAX_VALUES        16
+#define BENCH_MAX_MESSAGE       65537UL                 /* 2 byte length prefix plus its largest value */
+#define BENCH_HEADER_SIZE       14UL                    /* length, sequence number, send time */
+#define BENCH_DRAIN_TIME        2000UL                  /* ms to wait for bytes still on the line */
+#define BENCH_URGENT_INTERVAL   10UL                    /* ms between urgent messages in --priority mode */
+#define BENCH_MAX_LATENCY       60000000LL              /* us, a send time further back came from a misframed message */
+#define BENCH_POLL_REQUEST      8UL                     /* Modbus RTU read of one holding register */
+#define BENCH_POLL_RESPONSE     7UL                     /* address, function, byte count, register, CRC */
+#define BENCH_POLL_TIMEOUT      100UL                   /* ms for a response in --poll mode */
+#define BENCH_MAX_STARTUP       ( 2 * BENCH_MAX_PAIRS + BENCH_MAX_VALUES )  /* both ports of every pair and the missing ones */
+#define BENCH_CHECKSUM_TIME     200UL                   /* ms per checksum, size and method in --checksum mode */
+#define BENCH_FLOW_BLOCKS       16UL                    /* receive blocks the slow consumer may hold in --flow mode */
+#define BENCH_IMAGE_HEADER      8UL                     /* offset and length ahead of every piece in --image mode */
+#define BENCH_IMAGE_COPY        0                       /* --image: header and piece assembled, then WriteAsync() */
+#define BENCH_IMAGE_GATHER      1                       /* --image: header and piece as two spans of WriteGather() */
+#define BENCH_IMAGE_CHUNK       2                       /* --image: header by WriteAsync(), the piece by WriteChunk() */
+#define BENCH_IMAGE_METHODS     3
+#define BENCH_FRAMER_TIME       200UL                   /* ms per framer, scan and frame size in --framers mode */
+#define BENCH_FRAMER_STREAM     1048576UL               /* bytes of encoded frames fed per pass in --framers mode */
+#define BENCH_FRAMER_DELIMITER  0
+#define BENCH_FRAMER_LENGTH     1
+#define BENCH_FRAMER_SLIP       2
+#define BENCH_FRAMER_COBS       3
+#define BENCH_FRAMERS           4
+#define BENCH_POOL_CYCLES       200000UL                /* alloc, slice and release rounds in --pool mode */
+#define BENCH_AWAIT_TIMEOUT     1000UL                  /* ms for an echo in --await mode */
+#define BENCH_AWAIT_WARMUP      10                      /* round trips before the allocations are counted */
+#define BENCH_AWAIT_QUIET       20UL                    /* ms without a byte that end a damaged echo */
+#define BENCH_POOL_KEPT         ( BENCH_FLOW_BLOCKS / 2 )   /* slices still held while the next blocks go round */
+#define BENCH_VERIFY_CODES      16                      /* codewords the --verify stream cycles through */
+#define BENCH_VERIFY_RUNS       2                       /* --verify sends twice, the same seed has to give the same faults */
+
+typedef struct
+{
+    DWORD               dwInterval;                     /* ReadIntervalTimeout */
+    DWORD               dwMultiplier;                   /* ReadTotalTimeoutMultiplier */
+    DWORD               dwConstant;                     /* ReadTotalTimeoutConstant */
+} BENCH_TIMEOUTS;
+
+typedef struct
+{
+    UINT                nTxPort[BENCH_MAX_PAIRS];
+    UINT                nRxPort[BENCH_MAX_PAIRS];
+    UINT                nPairs;
+    UINT                baud;
+    DWORD               dwDuration;                     /* ms of sending per case */
+    DWORD               dwInterval;                     /* ms between the messages of a pair, 0 back to back */
+    DWORD               nSizes[BENCH_MAX_VALUES];
+    UINT                nSizeCount;
+    DWORD               nBuffers[BENCH_MAX_VALUES];
+    UINT                nBufferCount;
+    BENCH_TIMEOUTS      Timeouts[BENCH_MAX_VALUES];
+    UINT                nTimeoutCount;
+    DWORD               nCounts[BENCH_MAX_VALUES];      /* pairs used at once */
+    UINT                nCountCount;
+    BOOL                bCsv;
+    BOOL                bCommand;                       /* time blocking Write() calls instead of streaming */
+    BOOL                bPriority;                      /* urgent messages against a bulk stream */
+    DWORD               nSlices[BENCH_MAX_VALUES];      /* SERIAL_TX_SCHEDULE nSliceSize, 0 never splits */
+    UINT                nSliceCount;
+    DWORD               nFrameSize;                     /* length-prefixed messages inside one bulk write */
+    BOOL                bPoll;                          /* request/response polls of simulated slaves */
+    UINT                nSlaves;                        /* addresses answered on the receive port */
+    DWORD               nWindows[BENCH_MAX_VALUES];     /* requests outstanding at once */
+    UINT                nWindowCount;
+    CSerialCapture      *pCapture;                      /* receive side of the first pair, every case */
+    const char          *pszReplay;                     /* capture fed through a framer instead of ports */
+    DWORD               nSpeeds[BENCH_MAX_VALUES];      /* multiples of the recorded timing, 0 as fast as possible */
+    UINT                nSpeedCount;
+    BOOL                bStartup;                       /* time opening every port instead of traffic */
+    DWORD               nParallels[BENCH_MAX_VALUES];   /* Open() calls at once, 1 is one port after the other */
+    UINT                nParallelCount;
+    DWORD               nMissing[BENCH_MAX_VALUES];     /* port numbers without a device, each open fails */
+    UINT                nMissingCount;
+    UINT                nReactorThreads;                /* 0 starts a comm thread per port */
+    BOOL                bChecksum;                      /* checksum kernels against the bitwise loop, no ports */
+    BOOL                bFramers;                       /* every framer over an in-memory stream, per scan method, no ports */
+    BOOL                bPool;                          /* heap allocations of the receive pool, cycled and on the first pair */
+    BOOL                bPing;                          /* round trips of one message echoed by the receive port */
+    BOOL                bAwait;                         /* the same round trips from a coroutine on CSerialStream */
+    DWORD               nSpins[BENCH_MAX_VALUES];       /* SERIAL_BUSY_POLL dwSpinTime of both ports */
+    UINT                nSpinCount;
+    int                 nCore;                          /* comm thread of the first port, the echo port on the next core; -1 any */
+    BOOL                bRealtime;                      /* THREAD_PRIORITY_TIME_CRITICAL comm threads */
+    BOOL                bFlow;                          /* a stream into a consumer slower than the line, per flow control */
+    DWORD               nDelays[BENCH_MAX_VALUES];      /* ms the consumer sleeps per chunk */
+    UINT                nDelayCount;
+    BOOL                bImage;                         /* an image sent in pieces, copied, gathered and referenced */
+    DWORD               nPieces[BENCH_MAX_VALUES];      /* bytes behind each header, 0 the whole image at once */
+    UINT                nPieceCount;
+    BOOL                bVirtual;                       /* every pair is a CSerialVirtual, no hardware */
+    BOOL                bVerify;                        /* the first virtual pair checked byte by byte against its faults */
+    SERIAL_VIRTUAL_LINE Line;                           /* latency, jitter and faults of the virtual pairs */
+    const char          *pszLabel;                      /* build or version under test */
+    FILE                *pOut;
+} BENCH_CONFIG;
+
+typedef struct
+{
+    CSerialPort         Tx;
+    CSerialPort         Rx;
+    CSerialLengthFramer *pFramer;
+    HANDLE              hThread;
+    DWORD               nWriteSize;
+    DWORD               dwDuration;
+    DWORD               dwInterval;
+    volatile LONG       bTooLarge;
+    volatile LONGLONG   llSent;                         /* bytes, written by the sender thread */
+    LONGLONG            llMessages;
+    volatile LONGLONG   llReceived;                     /* bytes, written by the receive callback */
+    LONGLONG            llFrames;
+    LONGLONG            llErrors;                       /* damaged frames and sequence gaps */
+    DWORD               nNextSeq;
+    SERIAL_HISTOGRAM    Latency;                        /* send to frame callback, microseconds */
+} BENCH_PAIR;
+
+typedef struct
+{
+    CSerialPort         *pTx;
+    DWORD               nWriteSize;                     /* bytes per WriteAsync() */
+    DWORD               nFrameSize;                     /* length-prefixed messages inside one write */
+    SERIAL_PRIORITY     Priority;
+    DWORD               dwInterval;                     /* ms between writes, 0 back to back */
+    DWORD               dwDuration;
+    LONGLONG            llSent;
+    LONGLONG            llMessages;
+} BENCH_STREAM;
+
+typedef struct
+{
+    volatile LONGLONG   llReceived;                     /* bytes, written by the receive callback */
+    LONGLONG            llErrors;
+    SERIAL_HISTOGRAM    UrgentLatency;                  /* frames of BENCH_HEADER_SIZE bytes */
+    SERIAL_HISTOGRAM    BulkLatency;
+} BENCH_PRIORITY;
+
+typedef struct
+{
+    CSerialPort         *pPort;
+    UINT                nSlaves;
+    BYTE                Request[BENCH_POLL_REQUEST];
+    DWORD               nRequest;                       /* bytes of the request collected so far */
+} BENCH_SLAVE;
+
+typedef struct
+{
+    HANDLE              hEvent;                         /* a response arrived or a transaction completed */
+    volatile LONG       nOutstanding;
+    volatile LONG       nResponse;                      /* bytes, hand-written loop */
+    BYTE                Response[BENCH_POLL_RESPONSE];
+    LONGLONG            llPolls;
+    LONGLONG            llTimeouts;
+    LONGLONG            llErrors;
+    SERIAL_HISTOGRAM    Latency;
+} BENCH_POLL;
+
+typedef struct
+{
+    LONGLONG            llFrames;                       /* written by the frame callback on the replay thread */
+    LONGLONG            llBytes;
+    LONGLONG            llErrors;
+} BENCH_REPLAY;
+
+typedef struct
+{
+    CSerialPort         *pPing;
+    CSerialPort         *pEcho;                         /* sends every chunk it reads back */
+    BYTE                *pMessage;
+    DWORD               nSize;
+    volatile LONG       bStop;
+    DWORD               nReceived;                      /* bytes of the current round trip back so far */
+    LONGLONG            llSent;                         /* send time of the current round trip */
+    volatile LONGLONG   llRoundTrips;
+    SERIAL_HISTOGRAM    Latency;
+} BENCH_PING;
+
+typedef struct
+{
+    CSerialPort         *pTx;
+    DWORD               nWriteSize;
+    DWORD               dwDuration;
+    volatile LONG       bDone;                          /* the sender thread wrote its last byte */
+    volatile LONGLONG   llSent;                         /* bytes, written by the sender thread */
+    CSerialChunk        Chunks[BENCH_FLOW_BLOCKS + 1];  /* handed over by the comm thread, each holds a block */
+    volatile LONG       nHead;
+    volatile LONG       nTail;
+    LONGLONG            llReceived;
+    LONGLONG            llGaps;                         /* places the byte sequence broke */
+} BENCH_FLOW;
+
+typedef struct
+{
+    CSerialChecksum     Received;                       /* CRC-32 of every byte that arrived, on the comm thread */
+    volatile LONGLONG   llReceived;
+    HANDLE              hSent;                          /* the last piece left the driver */
+} BENCH_IMAGE;
+
+typedef struct
+{
+    LONGLONG            llFrames;
+    LONGLONG            llBytes;                        /* decoded, the length framer counts its header */
+    LONGLONG            llErrors;                       /* frames with flags */
+} BENCH_FRAMES;
+
+typedef struct
+{
+    BYTE                *pReceived;
+    DWORD               nCapacity;
+    volatile LONG       nReceived;                      /* may pass nCapacity, the rest is not kept */
+} BENCH_VERIFY;
+
+#ifdef SERIAL_AWAIT_ENABLED
+typedef struct
+{
+    CSerialStream       *pStream;
+    DWORD               nSize;
+    BYTE                *pMessage;
+    BYTE                *pEcho;
+    volatile LONG       bStop;
+    volatile LONGLONG   llRounds;                       /* written by the coroutine */
+    LONGLONG            llErrors;                       /* timeouts and wrong echoes, a failed write ends the loop */
+    SERIAL_HISTOGRAM    Latency;                        /* write to the last byte read back */
+    HANDLE              hDone;                          /* the coroutine returned */
+} BENCH_AWAIT;
+#endif SERIAL_AWAIT_ENABLED
+
+typedef struct
+{
+    DWORD               nWriteSize;
+    DWORD               nBufferSize;
+    BENCH_TIMEOUTS      Timeouts;
+    UINT                nPairs;
+    UINT                nReactorThreads;                /* 0 a comm thread per port */
+    double              dSeconds;
+    LONGLONG            llSent;
+    LONGLONG            llReceived;
+    LONGLONG            llMessages;
+    LONGLONG            llFrames;
+    LONGLONG            llErrors;
+    double              dCpuMs;
+    SERIAL_STATS        Stats;                          /* summed over every port of the case */
+    SERIAL_HISTOGRAM    Latency;
+} BENCH_RESULT;
+
+static volatile LONG g_bCountNew = FALSE;               /* --pool: operator new counts while set */
+static volatile LONG g_nNew = 0;
+
+// every allocation of the process, any thread; a release build, debug MFC brings its own operator new
+void *operator new( size_t nSize )
+{
+    void *p;
+
+    if ( g_bCountNew )
+    {
+        InterlockedIncrement( &g_nNew );
+    }
+
+    p = malloc( ( nSize != 0 ) ? nSize : 1 );
+
+    if ( p == NULL )
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void *operator new[]( size_t nSize )
+{
+    return operator new( nSize );
+}
+
+void operator delete( void *p ) noexcept
+{
+    free( p );
+}
+
+void operator delete[]( void *p ) noexcept
+{
+    free( p );
+}
+
+static void CALLBACK OnFrame( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags )
+{
+    BENCH_PAIR *pPair = ( BENCH_PAIR * )pContext;
+    DWORD nSeq;
+    LONGLONG llSent;
+
+    if ( ( dwFlags != 0 ) || ( nSize < BENCH_HEADER_SIZE ) )
+    {
+        pPair->llErrors++;
+        return;
+    }
+
+    memcpy( &nSeq, pFrame + 2, sizeof( nSeq ) );
+    memcpy( &llSent, pFrame + 6, sizeof( llSent ) );
+
+    if ( nSeq != pPair->nNextSeq )
+    {
+        pPair->llErrors++;
+    }
+
+    pPair->nNextSeq = nSeq + 1;
+    pPair->llReceived += nSize;
+    pPair->llFrames++;
+    CSerialStats::Record( &pPair->Latency, CSerialPort::GetTimestamp() - llSent );
+}
+
+static void CALLBACK OnDiscard( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    // the sending side of a pair receives nothing
+}
+
+static DWORD WINAPI SenderThread( LPVOID pParam )
+{
+    BENCH_PAIR *pPair = ( BENCH_PAIR * )pParam;
+    BYTE *pMessage = new BYTE[pPair->nWriteSize];
+    DWORD nSeq = 0;
+    DWORD dwStart = GetTickCount();
+    DWORD i;
+    LONGLONG llNow;
+    SERIAL_WRITE_RESULT ret;
+
+    pMessage[0] = ( BYTE )( ( pPair->nWriteSize - 2 ) >> 8 );
+    pMessage[1] = ( BYTE )( pPair->nWriteSize - 2 );
+
+    for ( i = BENCH_HEADER_SIZE; i < pPair->nWriteSize; i++ )
+    {
+        pMessage[i] = ( BYTE )i;
+    }
+
+    // closed loop: the queue applies backpressure, so the latency includes the time spent queued;
+    // with an interval the ports are mostly idle and the latency is the wakeup of the receiver
+    while ( ( GetTickCount() - dwStart ) < pPair->dwDuration )
+    {
+        llNow = CSerialPort::GetTimestamp();
+        memcpy( pMessage + 2, &nSeq, sizeof( nSeq ) );
+        memcpy( pMessage + 6, &llNow, sizeof( llNow ) );
+        ret = pPair->Tx.WriteAsync( pMessage, pPair->nWriteSize, 100 );
+
+        if ( ret == SERIAL_WRITE_OK )
+        {
+            nSeq++;
+            pPair->llMessages++;
+            pPair->llSent += pPair->nWriteSize;
+        }
+        else if ( ret != SERIAL_WRITE_TIMEOUT )
+        {
+            pPair->bTooLarge = ( ret == SERIAL_WRITE_TOO_LARGE );
+            break;
+        }
+
+        if ( pPair->dwInterval > 0 )
+        {
+            ::Sleep( pPair->dwInterval );
+        }
+    }
+
+    delete [] pMessage;
+    return 0;
+}
+
+static void CALLBACK OnPriorityFrame( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags )
+{
+    BENCH_PRIORITY *pResult = ( BENCH_PRIORITY * )pContext;
+    LONGLONG llSent;
+    LONGLONG llLatency;
+
+    if ( ( dwFlags != 0 ) || ( nSize < BENCH_HEADER_SIZE ) )
+    {
+        pResult->llErrors++;
+        return;
+    }
+
+    memcpy( &llSent, pFrame + 6, sizeof( llSent ) );
+    llLatency = CSerialPort::GetTimestamp() - llSent;
+
+    // a byte lost under --faults shifts the length prefix, the frame after it carries no send time
+    if ( ( llLatency < 0 ) || ( llLatency > BENCH_MAX_LATENCY ) )
+    {
+        pResult->llErrors++;
+        return;
+    }
+
+    // urgent messages are bare headers, bulk frames are always longer
+    CSerialStats::Record( ( nSize == BENCH_HEADER_SIZE ) ? &pResult->UrgentLatency : &pResult->BulkLatency, llLatency );
+    pResult->llReceived += nSize;
+}
+
+static void MakePoll( BYTE *pRequest, BYTE Address )
+{
+    WORD Crc;
+
+    pRequest[0] = Address;
+    pRequest[1] = 0x03;
+    pRequest[2] = 0x00;
+    pRequest[3] = 0x00;
+    pRequest[4] = 0x00;
+    pRequest[5] = 0x01;
+    Crc = CSerialModbusMatcher::GetCrc( pRequest, BENCH_POLL_REQUEST - 2 );
+    pRequest[6] = ( BYTE )Crc;
+    pRequest[7] = ( BYTE )( Crc >> 8 );
+}
+
+static void CALLBACK OnSlaveChunk( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BENCH_SLAVE *pSlave = ( BENCH_SLAVE * )pContext;
+    BYTE Response[BENCH_POLL_RESPONSE];
+    DWORD nCopy;
+    WORD Crc;
+
+    // every request has the same size, the slaves answer in the order they were asked
+    while ( nSize > 0 )
+    {
+        nCopy = min( nSize, BENCH_POLL_REQUEST - pSlave->nRequest );
+        memcpy( pSlave->Request + pSlave->nRequest, pData, nCopy );
+        pSlave->nRequest += nCopy;
+        pData += nCopy;
+        nSize -= nCopy;
+
+        if ( pSlave->nRequest < BENCH_POLL_REQUEST )
+        {
+            break;
+        }
+
+        Crc = CSerialModbusMatcher::GetCrc( pSlave->Request, BENCH_POLL_REQUEST - 2 );
+
+        // a byte lost under --faults shifts every request after it, slide on until one checks out again
+        if ( ( pSlave->Request[0] == 0 ) || ( pSlave->Request[0] > pSlave->nSlaves ) ||
+             ( Crc != ( WORD )( pSlave->Request[6] | ( pSlave->Request[7] << 8 ) ) ) )
+        {
+            memmove( pSlave->Request, pSlave->Request + 1, BENCH_POLL_REQUEST - 1 );
+            pSlave->nRequest = BENCH_POLL_REQUEST - 1;
+            continue;
+        }
+
+        pSlave->nRequest = 0;
+
+        Response[0] = pSlave->Request[0];
+        Response[1] = 0x03;
+        Response[2] = 0x02;
+        Response[3] = 0x12;
+        Response[4] = pSlave->Request[0];
+        Crc = CSerialModbusMatcher::GetCrc( Response, BENCH_POLL_RESPONSE - 2 );
+        Response[5] = ( BYTE )Crc;
+        Response[6] = ( BYTE )( Crc >> 8 );
+        pSlave->pPort->WriteAsync( Response, BENCH_POLL_RESPONSE );
+    }
+}
+
+static void CALLBACK OnLoopChunk( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BENCH_POLL *pPoll = ( BENCH_POLL * )pContext;
+    DWORD nCopy = min( nSize, BENCH_POLL_RESPONSE - ( DWORD )pPoll->nResponse );
+
+    memcpy( pPoll->Response + pPoll->nResponse, pData, nCopy );
+    pPoll->nResponse += nCopy;
+
+    if ( pPoll->nResponse == ( LONG )BENCH_POLL_RESPONSE )
+    {
+        SetEvent( pPoll->hEvent );
+    }
+}
+
+static void CALLBACK OnPollDone( LPVOID pContext, SERIAL_TRANSACTION_RESULT Result, const BYTE *pResponse, DWORD nSize, LONGLONG llLatency )
+{
+    BENCH_POLL *pPoll = ( BENCH_POLL * )pContext;
+
+    if ( Result == SERIAL_TRANSACTION_OK )
+    {
+        pPoll->llPolls++;
+        CSerialStats::Record( &pPoll->Latency, llLatency );
+    }
+    else if ( Result == SERIAL_TRANSACTION_TIMEOUT )
+    {
+        pPoll->llTimeouts++;
+    }
+    else
+    {
+        pPoll->llErrors++;
+    }
+
+    InterlockedDecrement( &pPoll->nOutstanding );
+    SetEvent( pPoll->hEvent );
+}
+
+static void CALLBACK OnReplayFrame( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags )
+{
+    BENCH_REPLAY *pReplay = ( BENCH_REPLAY * )pContext;
+
+    // the send times in the frames belong to the recorded run, only count
+    if ( dwFlags != 0 )
+    {
+        pReplay->llErrors++;
+        return;
+    }
+
+    pReplay->llFrames++;
+    pReplay->llBytes += nSize;
+}
+
+static void CALLBACK OnEchoChunk( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BENCH_PING *pPing = ( BENCH_PING * )pContext;
+
+    pPing->pEcho->WriteAsync( pData, nSize, 0 );
+}
+
+static void CALLBACK OnPingChunk( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BENCH_PING *pPing = ( BENCH_PING * )pContext;
+    LONGLONG llNow;
+
+    pPing->nReceived += nSize;
+
+    if ( pPing->nReceived < pPing->nSize )
+    {
+        return;
+    }
+
+    // the next message goes out from the comm thread, no other thread takes part in a round trip
+    llNow = CSerialPort::GetTimestamp();
+    CSerialStats::Record( &pPing->Latency, llNow - pPing->llSent );
+    pPing->llRoundTrips++;
+    pPing->nReceived = 0;
+
+    if ( !pPing->bStop )
+    {
+        pPing->llSent = llNow;
+        pPing->pPing->WriteAsync( pPing->pMessage, pPing->nSize, 0 );
+    }
+}
+
+static DWORD WINAPI StreamThread( LPVOID pParam )
+{
+    BENCH_STREAM *pStream = ( BENCH_STREAM * )pParam;
+    BYTE *pWrite = new BYTE[pStream->nWriteSize];
+    DWORD nSeq = 0;
+    DWORD dwStart = GetTickCount();
+    DWORD nFrame;
+    DWORD i;
+    LONGLONG llNow;
+    SERIAL_WRITE_RESULT ret;
+
+    for ( i = 0; i < pStream->nWriteSize; i++ )
+    {
+        pWrite[i] = ( BYTE )i;
+    }
+
+    while ( ( GetTickCount() - dwStart ) < pStream->dwDuration )
+    {
+        llNow = CSerialPort::GetTimestamp();
+
+        // every frame of the write carries the time the write was queued
+        for ( i = 0; i < pStream->nWriteSize; i += pStream->nFrameSize )
+        {
+            nFrame = min( pStream->nFrameSize, pStream->nWriteSize - i );
+            pWrite[i] = ( BYTE )( ( nFrame - 2 ) >> 8 );
+            pWrite[i + 1] = ( BYTE )( nFrame - 2 );
+            memcpy( pWrite + i + 2, &nSeq, sizeof( nSeq ) );
+            memcpy( pWrite + i + 6, &llNow, sizeof( llNow ) );
+            nSeq++;
+        }
+
+        ret = pStream->pTx->WriteAsync( pWrite, pStream->nWriteSize, pStream->Priority, 100 );
+
+        if ( ret == SERIAL_WRITE_OK )
+        {
+            pStream->llMessages++;
+            pStream->llSent += pStream->nWriteSize;
+        }
+        else if ( ret != SERIAL_WRITE_TIMEOUT )
+        {
+            break;
+        }
+
+        if ( pStream->dwInterval > 0 )
+        {
+            ::Sleep( pStream->dwInterval );
+        }
+    }
+
+    delete [] pWrite;
+    return 0;
+}
+
+static void CALLBACK OnFlowChunk( LPVOID pContext, const CSerialChunk &Chunk )
+{
+    BENCH_FLOW *pFlow = ( BENCH_FLOW * )pContext;
+    LONG nHead = pFlow->nHead;
+
+    // never full, the pool has fewer blocks than the ring has slots
+    pFlow->Chunks[nHead % ( BENCH_FLOW_BLOCKS + 1 )] = Chunk;
+    InterlockedExchange( &pFlow->nHead, nHead + 1 );
+}
+
+static DWORD WINAPI FlowSenderThread( LPVOID pParam )
+{
+    BENCH_FLOW *pFlow = ( BENCH_FLOW * )pParam;
+    BYTE *pWrite = new BYTE[pFlow->nWriteSize];
+    DWORD dwStart = GetTickCount();
+    DWORD i;
+    SERIAL_WRITE_RESULT ret;
+
+    while ( ( GetTickCount() - dwStart ) < pFlow->dwDuration )
+    {
+        // a running byte count, the consumer finds every byte lost or doubled;
+        // kept at 0x80 and up, a driver with fOutX takes XON and XOFF out of the data
+        for ( i = 0; i < pFlow->nWriteSize; i++ )
+        {
+            pWrite[i] = ( BYTE )( ( pFlow->llSent + i ) | 0x80 );
+        }
+
+        ret = pFlow->pTx->WriteAsync( pWrite, pFlow->nWriteSize, 100 );
+
+        if ( ret == SERIAL_WRITE_OK )
+        {
+            pFlow->llSent += pFlow->nWriteSize;
+        }
+        else if ( ret != SERIAL_WRITE_TIMEOUT )
+        {
+            break;
+        }
+    }
+
+    delete [] pWrite;
+    InterlockedExchange( &pFlow->bDone, TRUE );
+    return 0;
+}
+
+static void CALLBACK OnImageChunk( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BENCH_IMAGE *pImage = ( BENCH_IMAGE * )pContext;
+
+    pImage->Received.Update( pData, nSize );
+    pImage->llReceived += nSize;
+}
+
+static void CALLBACK OnImageSent( LPVOID pContext, LONGLONG llTimestamp, BOOL bSent )
+{
+    SetEvent( ( ( BENCH_IMAGE * )pContext )->hSent );
+}
+
+static void MakeImageHeader( BYTE *pHeader, DWORD nOffset, DWORD nSize )
+{
+    memcpy( pHeader, &nOffset, sizeof( nOffset ) );
+    memcpy( pHeader + 4, &nSize, sizeof( nSize ) );
+}
+
+static void MergeHistogram( SERIAL_HISTOGRAM *pTo, const SERIAL_HISTOGRAM *pFrom )
+{
+    DWORD i;
+
+    for ( i = 0; i < SERIAL_HISTOGRAM_BUCKETS; i++ )
+    {
+        pTo->llBuckets[i] += pFrom->llBuckets[i];
+    }
+
+    pTo->llCount += pFrom->llCount;
+    pTo->llTotal += pFrom->llTotal;
+    pTo->llMax = max( pTo->llMax, pFrom->llMax );
+}
+
+static void MergeStats( SERIAL_STATS *pTo, const SERIAL_STATS *pFrom )
+{
+    pTo->llRxBytes += pFrom->llRxBytes;
+    pTo->llTxBytes += pFrom->llTxBytes;
+    pTo->llReadCalls += pFrom->llReadCalls;
+    pTo->llWriteCalls += pFrom->llWriteCalls;
+    pTo->llWakeups += pFrom->llWakeups;
+    pTo->llEmptyPolls += pFrom->llEmptyPolls;
+    pTo->llSpinWakeups += pFrom->llSpinWakeups;
+    pTo->llOverruns += pFrom->llOverruns;
+    pTo->llFramingErrors += pFrom->llFramingErrors;
+    pTo->llParityErrors += pFrom->llParityErrors;
+    pTo->llBreaks += pFrom->llBreaks;
+    pTo->llRxDropped += pFrom->llRxDropped;
+    pTo->llRxFlowOffs += pFrom->llRxFlowOffs;
+    pTo->llTxFlowStalls += pFrom->llTxFlowStalls;
+    pTo->llTxCopied += pFrom->llTxCopied;
+    pTo->llRxQueueHigh = max( pTo->llRxQueueHigh, pFrom->llRxQueueHigh );
+    pTo->llTxQueueHigh = max( pTo->llTxQueueHigh, pFrom->llTxQueueHigh );
+}
+
+static double GetCpuMs()
+{
+    FILETIME ftCreate;
+    FILETIME ftExit;
+    FILETIME ftKernel;
+    FILETIME ftUser;
+    ULARGE_INTEGER Kernel;
+    ULARGE_INTEGER User;
+
+    GetProcessTimes( GetCurrentProcess(), &ftCreate, &ftExit, &ftKernel, &ftUser );
+    Kernel.LowPart = ftKernel.dwLowDateTime;
+    Kernel.HighPart = ftKernel.dwHighDateTime;
+    User.LowPart = ftUser.dwLowDateTime;
+    User.HighPart = ftUser.dwHighDateTime;
+    // 100 ns units
+    return ( double )( Kernel.QuadPart + User.QuadPart ) / 10000.0;
+}
+
+static void PrintResult( BENCH_CONFIG *pConfig, BENCH_RESULT *pResult )
+{
+    double dMegabytes = ( double )pResult->llReceived / ( 1024.0 * 1024.0 );
+    const SERIAL_STATS *pStats = &pResult->Stats;
+    static BOOL bHeader = FALSE;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,write_size,buffer_size,read_interval,read_multiplier,read_constant,pairs,reactor_threads,interval_ms,baud,"
+                                    "seconds,sent_bytes,received_bytes,messages,frames,errors,mb_per_s,"
+                                    "lat_p50_us,lat_p90_us,lat_p99_us,lat_p999_us,lat_max_us,cpu_ms,cpu_ms_per_mb,"
+                                    "read_calls,write_calls,wakeups,empty_polls,overruns,line_errors\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,%lu,%lu,%lu,%lu,%lu,%u,%u,%lu,%u,%.3f,%lld,%lld,%lld,%lld,%lld,%.4f,%lld,%lld,%lld,%lld,%lld,%.1f,%.2f,%lld,%lld,%lld,%lld,%lld,%lld\n",
+                 pConfig->pszLabel, pResult->nWriteSize, pResult->nBufferSize,
+                 pResult->Timeouts.dwInterval, pResult->Timeouts.dwMultiplier, pResult->Timeouts.dwConstant,
+                 pResult->nPairs, pResult->nReactorThreads, pConfig->dwInterval, pConfig->baud, pResult->dSeconds,
+                 pResult->llSent, pResult->llReceived, pResult->llMessages, pResult->llFrames, pResult->llErrors,
+                 dMegabytes / pResult->dSeconds,
+                 CSerialStats::GetPercentile( &pResult->Latency, 50.0 ), CSerialStats::GetPercentile( &pResult->Latency, 90.0 ),
+                 CSerialStats::GetPercentile( &pResult->Latency, 99.0 ), CSerialStats::GetPercentile( &pResult->Latency, 99.9 ),
+                 pResult->Latency.llMax, pResult->dCpuMs, ( dMegabytes > 0 ) ? pResult->dCpuMs / dMegabytes : 0.0,
+                 pStats->llReadCalls, pStats->llWriteCalls, pStats->llWakeups, pStats->llEmptyPolls, pStats->llOverruns,
+                 pStats->llFramingErrors + pStats->llParityErrors + pStats->llBreaks );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"write_size\":%lu,\"buffer_size\":%lu,"
+                                "\"read_interval\":%lu,\"read_multiplier\":%lu,\"read_constant\":%lu,\"pairs\":%u,\"reactor_threads\":%u,\"interval_ms\":%lu,\"baud\":%u,"
+                                "\"seconds\":%.3f,\"sent_bytes\":%lld,\"received_bytes\":%lld,\"messages\":%lld,\"frames\":%lld,\"errors\":%lld,"
+                                "\"mb_per_s\":%.4f,\"lat_p50_us\":%lld,\"lat_p90_us\":%lld,\"lat_p99_us\":%lld,\"lat_p999_us\":%lld,\"lat_max_us\":%lld,"
+                                "\"cpu_ms\":%.1f,\"cpu_ms_per_mb\":%.2f,\"read_calls\":%lld,\"write_calls\":%lld,\"wakeups\":%lld,\"empty_polls\":%lld,"
+                                "\"overruns\":%lld,\"line_errors\":%lld}\n",
+                 pConfig->pszLabel, pResult->nWriteSize, pResult->nBufferSize,
+                 pResult->Timeouts.dwInterval, pResult->Timeouts.dwMultiplier, pResult->Timeouts.dwConstant,
+                 pResult->nPairs, pResult->nReactorThreads, pConfig->dwInterval, pConfig->baud, pResult->dSeconds,
+                 pResult->llSent, pResult->llReceived, pResult->llMessages, pResult->llFrames, pResult->llErrors,
+                 dMegabytes / pResult->dSeconds,
+                 CSerialStats::GetPercentile( &pResult->Latency, 50.0 ), CSerialStats::GetPercentile( &pResult->Latency, 90.0 ),
+                 CSerialStats::GetPercentile( &pResult->Latency, 99.0 ), CSerialStats::GetPercentile( &pResult->Latency, 99.9 ),
+                 pResult->Latency.llMax, pResult->dCpuMs, ( dMegabytes > 0 ) ? pResult->dCpuMs / dMegabytes : 0.0,
+                 pStats->llReadCalls, pStats->llWriteCalls, pStats->llWakeups, pStats->llEmptyPolls, pStats->llOverruns,
+                 pStats->llFramingErrors + pStats->llParityErrors + pStats->llBreaks );
+    }
+
+    fflush( pConfig->pOut );
+}
+
+static BOOL RunCase( BENCH_CONFIG *pConfig, DWORD nWriteSize, DWORD nBufferSize, const BENCH_TIMEOUTS *pTimeouts, UINT nPairs,
+                     CSerialReactor *pReactor )
+{
+    BENCH_PAIR *pPairs = new BENCH_PAIR[nPairs];
+    BENCH_RESULT *pResult = new BENCH_RESULT;
+    SERIAL_STATS Stats;
+    LONGLONG llStart;
+    DWORD dwDrain;
+    BOOL bDrained;
+    BOOL ret = TRUE;
+    UINT i;
+
+    memset( pResult, 0, sizeof( BENCH_RESULT ) );
+    pResult->nWriteSize = nWriteSize;
+    pResult->nBufferSize = nBufferSize;
+    pResult->Timeouts = *pTimeouts;
+    pResult->nPairs = nPairs;
+    pResult->nReactorThreads = ( pReactor != NULL ) ? pConfig->nReactorThreads : 0;
+
+    for ( i = 0; i < nPairs; i++ )
+    {
+        BENCH_PAIR *pPair = &pPairs[i];
+        pPair->pFramer = new CSerialLengthFramer( 0, 2, TRUE, 0, BENCH_MAX_MESSAGE );
+        pPair->pFramer->SetCallback( OnFrame, pPair );
+        pPair->hThread = NULL;
+        pPair->nWriteSize = nWriteSize;
+        pPair->dwDuration = pConfig->dwDuration;
+        pPair->dwInterval = pConfig->dwInterval;
+        pPair->bTooLarge = FALSE;
+        pPair->llSent = 0;
+        pPair->llMessages = 0;
+        pPair->llReceived = 0;
+        pPair->llFrames = 0;
+        pPair->llErrors = 0;
+        pPair->nNextSeq = 0;
+        memset( &pPair->Latency, 0, sizeof( pPair->Latency ) );
+        pPair->Rx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize );
+        pPair->Rx.SetFramer( pPair->pFramer );
+        pPair->Rx.SetCapture( ( i == 0 ) ? pConfig->pCapture : NULL );
+        pPair->Tx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnDiscard, NULL );
+        pPair->Tx.SetReactor( pReactor );
+        pPair->Rx.SetReactor( pReactor );
+
+        if ( !pPair->Tx.Open( NULL, pConfig->nTxPort[i], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                              pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) ||
+             !pPair->Rx.Open( NULL, pConfig->nRxPort[i], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                              pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) )
+        {
+            fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[i], pConfig->nRxPort[i] );
+            ret = FALSE;
+            goto done;
+        }
+    }
+
+    pResult->dCpuMs = GetCpuMs();
+    llStart = CSerialPort::GetTimestamp();
+
+    for ( i = 0; i < nPairs; i++ )
+    {
+        pPairs[i].hThread = CreateThread( NULL, 0, SenderThread, &pPairs[i], 0, NULL );
+    }
+
+    // more senders than WaitForMultipleObjects() takes at once
+    for ( i = 0; i < nPairs; i++ )
+    {
+        WaitForSingleObject( pPairs[i].hThread, INFINITE );
+    }
+
+    // sending stopped, wait until the receivers caught up or nothing more arrives
+    for ( dwDrain = GetTickCount(); ( GetTickCount() - dwDrain ) < BENCH_DRAIN_TIME; )
+    {
+        bDrained = TRUE;
+
+        for ( i = 0; i < nPairs; i++ )
+        {
+            bDrained = bDrained && ( pPairs[i].llReceived >= pPairs[i].llSent );
+        }
+
+        if ( bDrained )
+        {
+            break;
+        }
+
+        ::Sleep( 1 );
+    }
+
+    pResult->dSeconds = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000000.0;
+    pResult->dCpuMs = GetCpuMs() - pResult->dCpuMs;
+
+    for ( i = 0; i < nPairs; i++ )
+    {
+        if ( pPairs[i].bTooLarge )
+        {
+            fprintf( stderr, "write size %lu does not fit a buffer of %lu, case skipped\n", nWriteSize, nBufferSize );
+            ret = FALSE;
+        }
+
+        pPairs[i].Tx.GetStats( &Stats );
+        MergeStats( &pResult->Stats, &Stats );
+        pPairs[i].Rx.GetStats( &Stats );
+        MergeStats( &pResult->Stats, &Stats );
+        MergeHistogram( &pResult->Latency, &pPairs[i].Latency );
+        pResult->llSent += pPairs[i].llSent;
+        pResult->llReceived += pPairs[i].llReceived;
+        pResult->llMessages += pPairs[i].llMessages;
+        pResult->llFrames += pPairs[i].llFrames;
+        pResult->llErrors += pPairs[i].llErrors + ( pPairs[i].llMessages - pPairs[i].llFrames );
+    }
+
+    if ( ret )
+    {
+        PrintResult( pConfig, pResult );
+    }
+
+done:
+
+    for ( i = 0; i < nPairs; i++ )
+    {
+        pPairs[i].Tx.Close();
+        pPairs[i].Rx.Close();
+        pPairs[i].Tx.SetReactor( NULL );
+        pPairs[i].Rx.SetReactor( NULL );
+
+        if ( pPairs[i].hThread != NULL )
+        {
+            CloseHandle( pPairs[i].hThread );
+        }
+
+        delete pPairs[i].pFramer;
+    }
+
+    delete pResult;
+    delete [] pPairs;
+    return ret;
+}
+
+static UINT ParseList( const char *pszList, DWORD *pValues, UINT nMax )
+{
+    UINT n = 0;
+    char *pEnd;
+
+    while ( ( *pszList != '\0' ) && ( n < nMax ) )
+    {
+        pValues[n++] = strtoul( pszList, &pEnd, 0 );
+        pszList = ( *pEnd == ',' ) ? pEnd + 1 : pEnd + strlen( pEnd );
+    }
+
+    return n;
+}
+
+static DWORD ParseTimeout( const char **ppsz )
+{
+    char *pEnd;
+    DWORD dwValue;
+
+    if ( _strnicmp( *ppsz, "max", 3 ) == 0 )
+    {
+        *ppsz += 3;
+        return MAXDWORD;
+    }
+
+    dwValue = strtoul( *ppsz, &pEnd, 0 );
+    *ppsz = pEnd;
+    return dwValue;
+}
+
+static UINT ParseTimeouts( const char *pszList, BENCH_TIMEOUTS *pTimeouts, UINT nMax )
+{
+    UINT n = 0;
+
+    // interval:multiplier:constant[,...], "max" for MAXDWORD
+    while ( ( *pszList != '\0' ) && ( n < nMax ) )
+    {
+        pTimeouts[n].dwInterval = ParseTimeout( &pszList );
+        pTimeouts[n].dwMultiplier = ( *pszList == ':' ) ? ( pszList++, ParseTimeout( &pszList ) ) : 0;
+        pTimeouts[n].dwConstant = ( *pszList == ':' ) ? ( pszList++, ParseTimeout( &pszList ) ) : 0;
+        n++;
+
+        while ( ( *pszList != '\0' ) && ( *pszList++ != ',' ) )
+        {
+        }
+    }
+
+    return n;
+}
+
+static void ParseFaults( const char *pszList, SERIAL_VIRTUAL_LINE *pLine )
+{
+    char *pEnd;
+
+    // drop:corrupt:framing, bytes per million
+    pLine->dwDropRate = strtoul( pszList, &pEnd, 0 );
+    pLine->dwCorruptRate = ( *pEnd == ':' ) ? strtoul( pEnd + 1, &pEnd, 0 ) : 0;
+    pLine->dwFramingRate = ( *pEnd == ':' ) ? strtoul( pEnd + 1, &pEnd, 0 ) : 0;
+}
+
+static BOOL IsCleanLine( BENCH_CONFIG *pConfig )
+{
+    // a cable or a virtual pair without --faults, every lost or damaged message is a failure
+    return !pConfig->bVirtual ||
+           ( ( pConfig->Line.dwDropRate == 0 ) && ( pConfig->Line.dwCorruptRate == 0 ) && ( pConfig->Line.dwFramingRate == 0 ) );
+}
+
+static UINT ParsePairs( const char *pszList, BENCH_CONFIG *pConfig )
+{
+    UINT n = 0;
+    char *pEnd;
+
+    UINT nFirst;
+    UINT nLast;
+
+    // tx:rx[,...] port numbers, first-last pairs every two neighbours of the range
+    while ( ( *pszList != '\0' ) && ( n < BENCH_MAX_PAIRS ) )
+    {
+        nFirst = strtoul( pszList, &pEnd, 10 );
+
+        if ( *pEnd == '-' )
+        {
+            for ( nLast = strtoul( pEnd + 1, &pEnd, 10 ); ( nFirst < nLast ) && ( n < BENCH_MAX_PAIRS ); nFirst += 2 )
+            {
+                pConfig->nTxPort[n] = nFirst;
+                pConfig->nRxPort[n] = nFirst + 1;
+                n++;
+            }
+        }
+        else
+        {
+            pConfig->nTxPort[n] = nFirst;
+            pConfig->nRxPort[n] = ( *pEnd == ':' ) ? strtoul( pEnd + 1, &pEnd, 10 ) : nFirst;
+            n++;
+        }
+
+        pszList = ( *pEnd == ',' ) ? pEnd + 1 : pEnd + strlen( pEnd );
+    }
+
+    return n;
+}
+
+static BOOL RunCommandCase( BENCH_CONFIG *pConfig, DWORD nWriteSize, DWORD nBufferSize, const BENCH_TIMEOUTS *pTimeouts )
+{
+    CSerialPort Tx;
+    CSerialPort Rx;
+    SERIAL_HISTOGRAM *pLatency = new SERIAL_HISTOGRAM;
+    BYTE *pCommand = new BYTE[nWriteSize];
+    DWORD dwStart;
+    DWORD nWrites = 0;
+    DWORD nSleep;
+    LONGLONG llStart;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    memset( pLatency, 0, sizeof( SERIAL_HISTOGRAM ) );
+    memset( pCommand, 'A', nWriteSize );
+    Tx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnDiscard, NULL );
+    Rx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnDiscard, NULL );
+
+    if ( !Tx.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                   pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) ||
+         !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                   pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    // one command at a time, Write() returns when the bytes left the driver
+    for ( dwStart = GetTickCount(); ( GetTickCount() - dwStart ) < pConfig->dwDuration; nWrites++ )
+    {
+        llStart = CSerialPort::GetTimestamp();
+        Tx.Write( pCommand, ( int )nWriteSize );
+        CSerialStats::Record( pLatency, CSerialPort::GetTimestamp() - llStart );
+    }
+
+    // what the old Write() slept for: ByteSize + StopBits enum + 1 bits per byte, whole ms, plus one
+    nSleep = ( ( 1000UL * ( 8 + ONESTOPBIT + 1 ) * nWriteSize ) / pConfig->baud ) + 1;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,write_size,baud,writes,lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us,wire_time_us,sleep_estimate_us\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,command,%lu,%u,%lu,%lld,%lld,%lld,%lld,%lu,%lu\n",
+                 pConfig->pszLabel, nWriteSize, pConfig->baud, nWrites,
+                 CSerialStats::GetPercentile( pLatency, 50.0 ), CSerialStats::GetPercentile( pLatency, 90.0 ),
+                 CSerialStats::GetPercentile( pLatency, 99.0 ), pLatency->llMax,
+                 ( DWORD )( 10000000ULL * nWriteSize / pConfig->baud ), nSleep * 1000 );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"command\",\"write_size\":%lu,\"baud\":%u,\"writes\":%lu,"
+                                "\"lat_p50_us\":%lld,\"lat_p90_us\":%lld,\"lat_p99_us\":%lld,\"lat_max_us\":%lld,"
+                                "\"wire_time_us\":%lu,\"sleep_estimate_us\":%lu}\n",
+                 pConfig->pszLabel, nWriteSize, pConfig->baud, nWrites,
+                 CSerialStats::GetPercentile( pLatency, 50.0 ), CSerialStats::GetPercentile( pLatency, 90.0 ),
+                 CSerialStats::GetPercentile( pLatency, 99.0 ), pLatency->llMax,
+                 ( DWORD )( 10000000ULL * nWriteSize / pConfig->baud ), nSleep * 1000 );
+    }
+
+    fflush( pConfig->pOut );
+
+done:
+    Tx.Close();
+    Rx.Close();
+    delete [] pCommand;
+    delete pLatency;
+    return ret;
+}
+
+static BOOL RunPriorityCase( BENCH_CONFIG *pConfig, DWORD nWriteSize, DWORD nSlice, DWORD nBufferSize, const BENCH_TIMEOUTS *pTimeouts )
+{
+    CSerialPort Tx;
+    CSerialPort Rx;
+    CSerialLengthFramer Framer( 0, 2, TRUE, 0, BENCH_MAX_MESSAGE );
+    BENCH_PRIORITY *pResult = new BENCH_PRIORITY;
+    SERIAL_STATS *pStats = new SERIAL_STATS;
+    SERIAL_TX_SCHEDULE Schedule;
+    BENCH_STREAM Bulk;
+    BENCH_STREAM Urgent;
+    HANDLE hThreads[2] = { NULL, NULL };
+    LONGLONG llStart;
+    DWORD dwDrain;
+    double dSeconds;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    memset( pResult, 0, sizeof( BENCH_PRIORITY ) );
+    memset( &Schedule, 0, sizeof( Schedule ) );
+    Schedule.nSliceSize = nSlice;
+    Framer.SetCallback( OnPriorityFrame, pResult );
+    Rx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize );
+    Rx.SetFramer( &Framer );
+    Tx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnDiscard, NULL );
+    Tx.SetTxSchedule( &Schedule );
+
+    if ( !Tx.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                   pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) ||
+         !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                   pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    // a closed loop of bulk writes keeps the queue full, an urgent header goes in every few ms
+    memset( &Bulk, 0, sizeof( Bulk ) );
+    Bulk.pTx = &Tx;
+    Bulk.nWriteSize = nWriteSize;
+    Bulk.nFrameSize = pConfig->nFrameSize;
+    Bulk.Priority = SERIAL_PRIORITY_BULK;
+    Bulk.dwDuration = pConfig->dwDuration;
+    Urgent = Bulk;
+    Urgent.nWriteSize = BENCH_HEADER_SIZE;
+    Urgent.nFrameSize = BENCH_HEADER_SIZE;
+    Urgent.Priority = SERIAL_PRIORITY_URGENT;
+    Urgent.dwInterval = BENCH_URGENT_INTERVAL;
+    llStart = CSerialPort::GetTimestamp();
+    hThreads[0] = CreateThread( NULL, 0, StreamThread, &Bulk, 0, NULL );
+    hThreads[1] = CreateThread( NULL, 0, StreamThread, &Urgent, 0, NULL );
+    WaitForMultipleObjects( 2, hThreads, TRUE, INFINITE );
+
+    for ( dwDrain = GetTickCount(); ( GetTickCount() - dwDrain ) < BENCH_DRAIN_TIME; )
+    {
+        if ( pResult->llReceived >= Bulk.llSent + Urgent.llSent )
+        {
+            break;
+        }
+
+        ::Sleep( 1 );
+    }
+
+    dSeconds = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000000.0;
+    Tx.GetStats( pStats );
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,write_size,frame_size,slice,baud,seconds,bulk_mb_per_s,urgent_messages,"
+                                    "urgent_p50_us,urgent_p99_us,urgent_max_us,urgent_queue_p99_us,bulk_p50_us,bulk_p99_us,errors\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,priority,%lu,%lu,%lu,%u,%.3f,%.4f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+                 pConfig->pszLabel, nWriteSize, pConfig->nFrameSize, nSlice, pConfig->baud, dSeconds,
+                 ( double )Bulk.llSent / ( 1024.0 * 1024.0 ) / dSeconds, Urgent.llMessages,
+                 CSerialStats::GetPercentile( &pResult->UrgentLatency, 50.0 ), CSerialStats::GetPercentile( &pResult->UrgentLatency, 99.0 ),
+                 pResult->UrgentLatency.llMax, CSerialStats::GetPercentile( &pStats->TxUrgentLatency, 99.0 ),
+                 CSerialStats::GetPercentile( &pResult->BulkLatency, 50.0 ), CSerialStats::GetPercentile( &pResult->BulkLatency, 99.0 ),
+                 pResult->llErrors + ( Urgent.llMessages - pResult->UrgentLatency.llCount ) );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"priority\",\"write_size\":%lu,\"frame_size\":%lu,\"slice\":%lu,\"baud\":%u,"
+                                "\"seconds\":%.3f,\"bulk_mb_per_s\":%.4f,\"urgent_messages\":%lld,"
+                                "\"urgent_p50_us\":%lld,\"urgent_p99_us\":%lld,\"urgent_max_us\":%lld,\"urgent_queue_p99_us\":%lld,"
+                                "\"bulk_p50_us\":%lld,\"bulk_p99_us\":%lld,\"errors\":%lld}\n",
+                 pConfig->pszLabel, nWriteSize, pConfig->nFrameSize, nSlice, pConfig->baud, dSeconds,
+                 ( double )Bulk.llSent / ( 1024.0 * 1024.0 ) / dSeconds, Urgent.llMessages,
+                 CSerialStats::GetPercentile( &pResult->UrgentLatency, 50.0 ), CSerialStats::GetPercentile( &pResult->UrgentLatency, 99.0 ),
+                 pResult->UrgentLatency.llMax, CSerialStats::GetPercentile( &pStats->TxUrgentLatency, 99.0 ),
+                 CSerialStats::GetPercentile( &pResult->BulkLatency, 50.0 ), CSerialStats::GetPercentile( &pResult->BulkLatency, 99.0 ),
+                 pResult->llErrors + ( Urgent.llMessages - pResult->UrgentLatency.llCount ) );
+    }
+
+    fflush( pConfig->pOut );
+
+    if ( ( Urgent.llMessages == 0 ) ||
+         ( IsCleanLine( pConfig ) && ( ( pResult->llErrors > 0 ) || ( pResult->UrgentLatency.llCount != Urgent.llMessages ) ) ) )
+    {
+        fprintf( stderr, "priority: %lld of %lld urgent messages arrived, %lld damaged frames\n",
+                 pResult->UrgentLatency.llCount, Urgent.llMessages, pResult->llErrors );
+        ret = FALSE;
+    }
+
+done:
+    Tx.Close();
+    Rx.Close();
+
+    if ( hThreads[0] != NULL )
+    {
+        CloseHandle( hThreads[0] );
+    }
+
+    if ( hThreads[1] != NULL )
+    {
+        CloseHandle( hThreads[1] );
+    }
+
+    delete pStats;
+    delete pResult;
+    return ret;
+}
+
+static BOOL RunPollCase( BENCH_CONFIG *pConfig, UINT nWindow, DWORD nBufferSize, const BENCH_TIMEOUTS *pTimeouts )
+{
+    CSerialPort Master;
+    CSerialPort Rx;
+    CSerialTransactor Transactor;
+    CSerialModbusMatcher Matcher;
+    CSerialLengthFramer Framer( 2, 1, TRUE, 2, BENCH_POLL_RESPONSE );
+    BENCH_POLL *pPoll = new BENCH_POLL;
+    BENCH_SLAVE Slave;
+    BYTE Request[BENCH_POLL_REQUEST];
+    BYTE Address = 1;
+    DWORD dwStart;
+    LONGLONG llStart;
+    double dSeconds;
+    SERIAL_WRITE_RESULT Result;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    memset( pPoll, 0, sizeof( BENCH_POLL ) );
+    pPoll->hEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    memset( &Slave, 0, sizeof( Slave ) );
+    Slave.pPort = &Rx;
+    Slave.nSlaves = pConfig->nSlaves;
+    Rx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnSlaveChunk, &Slave );
+
+    if ( nWindow == 0 )
+    {
+        // today's loop: blocking Write(), then wait for the expected number of bytes
+        Master.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnLoopChunk, pPoll );
+    }
+    else
+    {
+        // one request at a time is plain RTU and ends responses by t3.5 silence, a pipeline needs the byte count
+        Master.SetRxMode( SERIAL_RX_CHUNK, nBufferSize );
+        Transactor.Attach( &Master );
+        Transactor.SetMatcher( &Matcher );
+        Transactor.SetWindow( nWindow );
+
+        if ( nWindow == 1 )
+        {
+            Transactor.SetSilence( CSerialTransactor::GetModbusSilence( pConfig->baud ) );
+        }
+        else
+        {
+            Transactor.SetFramer( &Framer );
+        }
+    }
+
+    if ( !Master.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                       pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) ||
+         !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize,
+                   pTimeouts->dwInterval, pTimeouts->dwMultiplier, pTimeouts->dwConstant ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    llStart = CSerialPort::GetTimestamp();
+
+    // round robin over the slave addresses, never more than the window outstanding
+    for ( dwStart = GetTickCount(); ( GetTickCount() - dwStart ) < pConfig->dwDuration; )
+    {
+        MakePoll( Request, Address );
+
+        if ( nWindow == 0 )
+        {
+            LONGLONG llSent = CSerialPort::GetTimestamp();
+            pPoll->nResponse = 0;
+            Master.Write( Request, BENCH_POLL_REQUEST );
+
+            if ( WaitForSingleObject( pPoll->hEvent, BENCH_POLL_TIMEOUT ) != WAIT_OBJECT_0 )
+            {
+                pPoll->llTimeouts++;
+            }
+            else if ( !Matcher.IsValid( pPoll->Response, BENCH_POLL_RESPONSE ) || !Matcher.Match( Request, BENCH_POLL_REQUEST, pPoll->Response, BENCH_POLL_RESPONSE ) )
+            {
+                pPoll->llErrors++;
+            }
+            else
+            {
+                pPoll->llPolls++;
+                CSerialStats::Record( &pPoll->Latency, CSerialPort::GetTimestamp() - llSent );
+            }
+        }
+        else
+        {
+            if ( pPoll->nOutstanding >= ( LONG )nWindow )
+            {
+                WaitForSingleObject( pPoll->hEvent, BENCH_POLL_TIMEOUT );
+                continue;
+            }
+
+            InterlockedIncrement( &pPoll->nOutstanding );
+            Result = Transactor.Submit( Request, BENCH_POLL_REQUEST, BENCH_POLL_TIMEOUT, 0, OnPollDone, pPoll );
+
+            if ( Result != SERIAL_WRITE_OK )
+            {
+                InterlockedDecrement( &pPoll->nOutstanding );
+                fprintf( stderr, "Submit() failed with %d\n", Result );
+                ret = FALSE;
+                break;
+            }
+        }
+
+        Address = ( BYTE )( ( Address % pConfig->nSlaves ) + 1 );
+    }
+
+    // the last responses or their timeouts
+    for ( dwStart = GetTickCount(); ( pPoll->nOutstanding > 0 ) && ( ( GetTickCount() - dwStart ) < BENCH_DRAIN_TIME ); )
+    {
+        WaitForSingleObject( pPoll->hEvent, BENCH_POLL_TIMEOUT );
+    }
+
+    dSeconds = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000000.0;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,method,window,slaves,baud,seconds,polls,polls_per_s,lat_p50_us,lat_p99_us,lat_max_us,timeouts,errors,unmatched\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,poll,%s,%u,%u,%u,%.3f,%lld,%.1f,%lld,%lld,%lld,%lld,%lld,%lu\n",
+                 pConfig->pszLabel, ( nWindow == 0 ) ? "loop" : "transactor", nWindow, pConfig->nSlaves, pConfig->baud, dSeconds,
+                 pPoll->llPolls, ( double )pPoll->llPolls / dSeconds,
+                 CSerialStats::GetPercentile( &pPoll->Latency, 50.0 ), CSerialStats::GetPercentile( &pPoll->Latency, 99.0 ),
+                 pPoll->Latency.llMax, pPoll->llTimeouts, pPoll->llErrors, Transactor.GetUnmatchedCount() );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"poll\",\"method\":\"%s\",\"window\":%u,\"slaves\":%u,\"baud\":%u,"
+                                "\"seconds\":%.3f,\"polls\":%lld,\"polls_per_s\":%.1f,"
+                                "\"lat_p50_us\":%lld,\"lat_p99_us\":%lld,\"lat_max_us\":%lld,\"timeouts\":%lld,\"errors\":%lld,\"unmatched\":%lu}\n",
+                 pConfig->pszLabel, ( nWindow == 0 ) ? "loop" : "transactor", nWindow, pConfig->nSlaves, pConfig->baud, dSeconds,
+                 pPoll->llPolls, ( double )pPoll->llPolls / dSeconds,
+                 CSerialStats::GetPercentile( &pPoll->Latency, 50.0 ), CSerialStats::GetPercentile( &pPoll->Latency, 99.0 ),
+                 pPoll->Latency.llMax, pPoll->llTimeouts, pPoll->llErrors, Transactor.GetUnmatchedCount() );
+    }
+
+    fflush( pConfig->pOut );
+
+    if ( ( pPoll->llPolls == 0 ) ||
+         ( IsCleanLine( pConfig ) && ( ( pPoll->llTimeouts > 0 ) || ( pPoll->llErrors > 0 ) || ( Transactor.GetUnmatchedCount() > 0 ) ) ) )
+    {
+        fprintf( stderr, "poll: %lld polls, %lld timeouts, %lld errors, %lu unmatched\n",
+                 pPoll->llPolls, pPoll->llTimeouts, pPoll->llErrors, Transactor.GetUnmatchedCount() );
+        ret = FALSE;
+    }
+
+done:
+    Master.Close();
+    Rx.Close();
+    CloseHandle( pPoll->hEvent );
+    delete pPoll;
+    return ret;
+}
+
+static BOOL RunReplayCase( BENCH_CONFIG *pConfig, CSerialReplay *pReplay, DWORD nSpeed, DWORD nBufferSize )
+{
+    CSerialPort Port;
+    CSerialLengthFramer Framer( 0, 2, TRUE, 0, BENCH_MAX_MESSAGE );
+    BENCH_REPLAY Result;
+    LONGLONG llStart;
+    double dSeconds;
+    double dCpuMs;
+    static BOOL bHeader = FALSE;
+
+    memset( &Result, 0, sizeof( Result ) );
+    Framer.SetCallback( OnReplayFrame, &Result );
+    Port.SetRxMode( SERIAL_RX_CHUNK, nBufferSize );
+    Port.SetFramer( &Framer );
+    Port.SetReplay( pReplay, ( double )nSpeed );
+    dCpuMs = GetCpuMs();
+    llStart = CSerialPort::GetTimestamp();
+
+    if ( !Port.Open( NULL, 0, pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+    {
+        fprintf( stderr, "cannot replay %s\n", pConfig->pszReplay );
+        return FALSE;
+    }
+
+    while ( !pReplay->IsFinished() )
+    {
+        ::Sleep( 1 );
+    }
+
+    dSeconds = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000000.0;
+    dCpuMs = GetCpuMs() - dCpuMs;
+    Port.Close();
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,speed,buffer,seconds,frames,frames_per_s,mb_per_s,errors,cpu_ms\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,replay,%lu,%lu,%.3f,%lld,%.1f,%.3f,%lld,%.1f\n",
+                 pConfig->pszLabel, nSpeed, nBufferSize, dSeconds, Result.llFrames, ( double )Result.llFrames / dSeconds,
+                 ( double )Result.llBytes / dSeconds / 1000000.0, Result.llErrors, dCpuMs );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"replay\",\"speed\":%lu,\"buffer\":%lu,\"seconds\":%.3f,"
+                                "\"frames\":%lld,\"frames_per_s\":%.1f,\"mb_per_s\":%.3f,\"errors\":%lld,\"cpu_ms\":%.1f}\n",
+                 pConfig->pszLabel, nSpeed, nBufferSize, dSeconds, Result.llFrames, ( double )Result.llFrames / dSeconds,
+                 ( double )Result.llBytes / dSeconds / 1000000.0, Result.llErrors, dCpuMs );
+    }
+
+    fflush( pConfig->pOut );
+    return TRUE;
+}
+
+static BOOL RunStartupCase( BENCH_CONFIG *pConfig, UINT nParallel, CSerialReactor *pReactor )
+{
+    CSerialPort *pPorts = new CSerialPort[BENCH_MAX_STARTUP];
+    SERIAL_OPEN_REQUEST Requests[BENCH_MAX_STARTUP];
+    UINT nPorts = 0;
+    UINT nOpened;
+    UINT i;
+    LONGLONG llStart;
+    double dMs;
+    double dSlowestMs = 0;
+    double dMissingMs = 0;
+    static BOOL bHeader = FALSE;
+
+    for ( i = 0; i < pConfig->nPairs; i++ )
+    {
+        CSerialPort::InitOpenRequest( &Requests[nPorts], &pPorts[nPorts], NULL, pConfig->nTxPort[i], pConfig->baud );
+        nPorts++;
+
+        if ( pConfig->nRxPort[i] != pConfig->nTxPort[i] )
+        {
+            CSerialPort::InitOpenRequest( &Requests[nPorts], &pPorts[nPorts], NULL, pConfig->nRxPort[i], pConfig->baud );
+            nPorts++;
+        }
+    }
+
+    // an unplugged adapter, the open that holds up a sequential startup
+    for ( i = 0; i < pConfig->nMissingCount; i++ )
+    {
+        CSerialPort::InitOpenRequest( &Requests[nPorts], &pPorts[nPorts], NULL, pConfig->nMissing[i], pConfig->baud );
+        nPorts++;
+    }
+
+    for ( i = 0; i < nPorts; i++ )
+    {
+        pPorts[i].SetRxMode( SERIAL_RX_CHUNK, SERIAL_RX_CHUNK_SIZE, 0, OnDiscard, NULL );
+    }
+
+    llStart = CSerialPort::GetTimestamp();
+    nOpened = CSerialPort::OpenMany( Requests, nPorts, nParallel, pReactor );
+    dMs = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000.0;
+
+    for ( i = 0; i < nPorts; i++ )
+    {
+        dSlowestMs = max( dSlowestMs, ( double )Requests[i].llElapsed / 1000.0 );
+
+        if ( i >= nPorts - pConfig->nMissingCount )
+        {
+            dMissingMs += ( double )Requests[i].llElapsed / 1000.0;
+        }
+
+        pPorts[i].Close();
+        pPorts[i].SetReactor( NULL );
+    }
+
+    delete [] pPorts;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,parallel,reactor_threads,ports,opened,ms,slowest_ms,missing_ms\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,startup,%u,%u,%u,%u,%.3f,%.3f,%.3f\n",
+                 pConfig->pszLabel, nParallel, pConfig->nReactorThreads, nPorts, nOpened, dMs, dSlowestMs, dMissingMs );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"startup\",\"parallel\":%u,\"reactor_threads\":%u,\"ports\":%u,"
+                                "\"opened\":%u,\"ms\":%.3f,\"slowest_ms\":%.3f,\"missing_ms\":%.3f}\n",
+                 pConfig->pszLabel, nParallel, pConfig->nReactorThreads, nPorts, nOpened, dMs, dSlowestMs, dMissingMs );
+    }
+
+    fflush( pConfig->pOut );
+    // every port of a pair is expected to open, the missing ones not
+    return ( nOpened == nPorts - pConfig->nMissingCount );
+}
+
+static BOOL RunPingCase( BENCH_CONFIG *pConfig, DWORD nSize, DWORD nSpin, DWORD nBufferSize )
+{
+    CSerialPort Ping;
+    CSerialPort Echo;
+    SERIAL_BUSY_POLL BusyPoll;
+    SERIAL_STATS Stats;
+    BENCH_PING *pPing = new BENCH_PING;
+    double dCpuMs;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    memset( pPing, 0, sizeof( BENCH_PING ) );
+    pPing->pPing = &Ping;
+    pPing->pEcho = &Echo;
+    pPing->nSize = nSize;
+    pPing->pMessage = new BYTE[nSize];
+    memset( pPing->pMessage, 'P', nSize );
+    Ping.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnPingChunk, pPing );
+    Echo.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnEchoChunk, pPing );
+    BusyPoll.dwSpinTime = nSpin;
+    BusyPoll.nPriority = pConfig->bRealtime ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL;
+    BusyPoll.nCore = pConfig->nCore;
+    Ping.SetBusyPoll( &BusyPoll );
+    BusyPoll.nCore = ( pConfig->nCore >= 0 ) ? pConfig->nCore + 1 : -1;
+    Echo.SetBusyPoll( &BusyPoll );
+
+    if ( !Ping.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) ||
+         !Echo.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    dCpuMs = GetCpuMs();
+    pPing->llSent = CSerialPort::GetTimestamp();
+    Ping.WriteAsync( pPing->pMessage, nSize, 0 );
+    ::Sleep( pConfig->dwDuration );
+    pPing->bStop = TRUE;
+    ::Sleep( BENCH_POLL_TIMEOUT );
+    dCpuMs = GetCpuMs() - dCpuMs;
+    Ping.GetStats( &Stats );
+    Ping.Close();
+    Echo.Close();
+
+    // a lost byte stops the exchange for good
+    if ( pPing->llRoundTrips == 0 )
+    {
+        fprintf( stderr, "no round trip on COM%u/COM%u, size %lu\n", pConfig->nTxPort[0], pConfig->nRxPort[0], nSize );
+        ret = FALSE;
+        goto done;
+    }
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,size,baud,spin_us,core,realtime,round_trips,rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_max_us,spin_wakeups,wakeups,cpu_ms\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,pingpong,%lu,%u,%lu,%d,%d,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%.1f\n",
+                 pConfig->pszLabel, nSize, pConfig->baud, nSpin, pConfig->nCore, pConfig->bRealtime, pPing->llRoundTrips,
+                 CSerialStats::GetPercentile( &pPing->Latency, 50.0 ), CSerialStats::GetPercentile( &pPing->Latency, 90.0 ),
+                 CSerialStats::GetPercentile( &pPing->Latency, 99.0 ), pPing->Latency.llMax,
+                 Stats.llSpinWakeups, Stats.llWakeups, dCpuMs );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"pingpong\",\"size\":%lu,\"baud\":%u,\"spin_us\":%lu,\"core\":%d,\"realtime\":%d,"
+                                "\"round_trips\":%lld,\"rtt_p50_us\":%lld,\"rtt_p90_us\":%lld,\"rtt_p99_us\":%lld,\"rtt_max_us\":%lld,"
+                                "\"spin_wakeups\":%lld,\"wakeups\":%lld,\"cpu_ms\":%.1f}\n",
+                 pConfig->pszLabel, nSize, pConfig->baud, nSpin, pConfig->nCore, pConfig->bRealtime, pPing->llRoundTrips,
+                 CSerialStats::GetPercentile( &pPing->Latency, 50.0 ), CSerialStats::GetPercentile( &pPing->Latency, 90.0 ),
+                 CSerialStats::GetPercentile( &pPing->Latency, 99.0 ), pPing->Latency.llMax,
+                 Stats.llSpinWakeups, Stats.llWakeups, dCpuMs );
+    }
+
+    fflush( pConfig->pOut );
+
+done:
+    Ping.Close();
+    Echo.Close();
+    delete [] pPing->pMessage;
+    delete pPing;
+    return ret;
+}
+
+#ifdef SERIAL_AWAIT_ENABLED
+static void CALLBACK OnAwaitEcho( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    ( ( CSerialPort * )pContext )->WriteAsync( pData, nSize, 0 );
+}
+
+static CSerialTask AwaitLoop( BENCH_AWAIT *pAwait )
+{
+    SERIAL_AWAIT_READ Read;
+    SERIAL_WRITE_RESULT Written;
+    LONGLONG llSent;
+    DWORD nRead;
+    DWORD i;
+
+    while ( !pAwait->bStop )
+    {
+        // 0x80 and up, the newline only at the end for ReadUntil()
+        for ( i = 0; i + 1 < pAwait->nSize; i++ )
+        {
+            pAwait->pMessage[i] = ( BYTE )( ( pAwait->llRounds + i ) | 0x80 );
+        }
+
+        pAwait->pMessage[pAwait->nSize - 1] = '\n';
+        llSent = CSerialPort::GetTimestamp();
+        Written = co_await pAwait->pStream->Write( pAwait->pMessage, pAwait->nSize );
+
+        if ( Written != SERIAL_WRITE_OK )
+        {
+            pAwait->llErrors++;
+            break;
+        }
+
+        // the three reads take turns on the echo
+        switch ( pAwait->llRounds % 3 )
+        {
+            case 0:
+                Read = co_await pAwait->pStream->ReadExactly( pAwait->pEcho, pAwait->nSize, BENCH_AWAIT_TIMEOUT );
+                break;
+
+            case 1:
+                Read = co_await pAwait->pStream->ReadUntil( pAwait->pEcho, pAwait->nSize, '\n', BENCH_AWAIT_TIMEOUT );
+                break;
+
+            default:
+                Read.Status = SERIAL_AWAIT_OK;
+
+                for ( nRead = 0; ( nRead < pAwait->nSize ) && ( Read.Status == SERIAL_AWAIT_OK ); nRead += Read.nSize )
+                {
+                    Read = co_await pAwait->pStream->ReadSome( pAwait->pEcho + nRead, pAwait->nSize - nRead, BENCH_AWAIT_TIMEOUT );
+                }
+
+                Read.nSize = nRead;
+                break;
+        }
+
+        if ( Read.Status == SERIAL_AWAIT_CLOSED )
+        {
+            break;
+        }
+
+        if ( ( Read.Status != SERIAL_AWAIT_OK ) || ( Read.nSize != pAwait->nSize ) || ( memcmp( pAwait->pEcho, pAwait->pMessage, pAwait->nSize ) != 0 ) )
+        {
+            // under --faults: what is left of the echo goes, the next round starts on a quiet line
+            pAwait->llErrors++;
+
+            do
+            {
+                Read = co_await pAwait->pStream->ReadSome( pAwait->pEcho, pAwait->nSize, BENCH_AWAIT_QUIET );
+            }
+            while ( Read.Status == SERIAL_AWAIT_OK );
+
+            if ( Read.Status == SERIAL_AWAIT_CLOSED )
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        CSerialStats::Record( &pAwait->Latency, CSerialPort::GetTimestamp() - llSent );
+        pAwait->llRounds++;
+    }
+
+    SetEvent( pAwait->hDone );
+}
+
+static BOOL RunAwaitCase( BENCH_CONFIG *pConfig, DWORD nSize, DWORD nBufferSize )
+{
+    CSerialPort Port;
+    CSerialPort Echo;
+    CSerialStream Stream;
+    BENCH_AWAIT *pAwait = new BENCH_AWAIT;
+    DWORD dwStart;
+    LONGLONG llStart;
+    LONGLONG llRounds;
+    double dSeconds;
+    double dCpuMs;
+    LONG nNew = -1;
+    BOOL bStarted = FALSE;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    memset( pAwait, 0, sizeof( BENCH_AWAIT ) );
+    pAwait->pStream = &Stream;
+    pAwait->nSize = nSize;
+    pAwait->pMessage = new BYTE[nSize];
+    pAwait->pEcho = new BYTE[nSize];
+    pAwait->hDone = CreateEvent( NULL, TRUE, FALSE, NULL );
+    Port.SetRxMode( SERIAL_RX_CHUNK, nBufferSize );
+    Stream.Attach( &Port );
+    Echo.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnAwaitEcho, &Echo );
+
+    if ( !Port.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) ||
+         !Echo.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    // the coroutine frame is allocated here, once; from then on it runs on the comm thread
+    AwaitLoop( pAwait );
+    bStarted = TRUE;
+
+    for ( dwStart = GetTickCount(); ( pAwait->llRounds < BENCH_AWAIT_WARMUP ) && ( WaitForSingleObject( pAwait->hDone, 0 ) != WAIT_OBJECT_0 ) &&
+                                    ( ( GetTickCount() - dwStart ) < pConfig->dwDuration ); )
+    {
+        ::Sleep( 1 );
+    }
+
+    llRounds = pAwait->llRounds;
+    llStart = CSerialPort::GetTimestamp();
+    dCpuMs = GetCpuMs();
+    InterlockedExchange( &g_nNew, 0 );
+    InterlockedExchange( &g_bCountNew, TRUE );
+    WaitForSingleObject( pAwait->hDone, pConfig->dwDuration );
+    InterlockedExchange( &g_bCountNew, FALSE );
+    nNew = g_nNew;
+    dCpuMs = GetCpuMs() - dCpuMs;
+    dSeconds = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000000.0;
+    llRounds = pAwait->llRounds - llRounds;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,size,baud,seconds,rounds,rounds_per_s,rtt_p50_us,rtt_p99_us,rtt_max_us,errors,allocs,cpu_ms\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,await,%lu,%u,%.3f,%lld,%.1f,%lld,%lld,%lld,%lld,%ld,%.1f\n",
+                 pConfig->pszLabel, nSize, pConfig->baud, dSeconds, llRounds, ( double )llRounds / dSeconds,
+                 CSerialStats::GetPercentile( &pAwait->Latency, 50.0 ), CSerialStats::GetPercentile( &pAwait->Latency, 99.0 ),
+                 pAwait->Latency.llMax, pAwait->llErrors, nNew, dCpuMs );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"await\",\"size\":%lu,\"baud\":%u,\"seconds\":%.3f,\"rounds\":%lld,\"rounds_per_s\":%.1f,"
+                                "\"rtt_p50_us\":%lld,\"rtt_p99_us\":%lld,\"rtt_max_us\":%lld,\"errors\":%lld,\"allocs\":%ld,\"cpu_ms\":%.1f}\n",
+                 pConfig->pszLabel, nSize, pConfig->baud, dSeconds, llRounds, ( double )llRounds / dSeconds,
+                 CSerialStats::GetPercentile( &pAwait->Latency, 50.0 ), CSerialStats::GetPercentile( &pAwait->Latency, 99.0 ),
+                 pAwait->Latency.llMax, pAwait->llErrors, nNew, dCpuMs );
+    }
+
+    fflush( pConfig->pOut );
+
+    if ( ( llRounds == 0 ) || ( nNew > 0 ) || ( IsCleanLine( pConfig ) && ( pAwait->llErrors > 0 ) ) )
+    {
+        fprintf( stderr, "await: %lld rounds, %lld errors, %ld heap allocations\n", llRounds, pAwait->llErrors, nNew );
+        ret = FALSE;
+    }
+
+done:
+    // the loop ends after its round, a read still waiting completes with SERIAL_AWAIT_CLOSED
+    InterlockedExchange( &pAwait->bStop, TRUE );
+
+    if ( bStarted && ( WaitForSingleObject( pAwait->hDone, BENCH_AWAIT_TIMEOUT + BENCH_DRAIN_TIME ) != WAIT_OBJECT_0 ) )
+    {
+        Port.Close();
+        WaitForSingleObject( pAwait->hDone, INFINITE );
+    }
+
+    Port.Close();
+    Echo.Close();
+    CloseHandle( pAwait->hDone );
+    delete [] pAwait->pMessage;
+    delete [] pAwait->pEcho;
+    delete pAwait;
+    return ret;
+}
+#endif SERIAL_AWAIT_ENABLED
+
+static BOOL RunFlowCase( BENCH_CONFIG *pConfig, DWORD dwFlow, DWORD nDelay, DWORD nWriteSize, DWORD nBufferSize )
+{
+    CSerialPort Tx;
+    CSerialPort Rx;
+    SERIAL_FLOW_CONTROL FlowControl;
+    SERIAL_STATS TxStats;
+    SERIAL_STATS RxStats;
+    BENCH_FLOW *pFlow = new BENCH_FLOW;
+    CSerialChunk *pChunk;
+    const BYTE *pData;
+    const char *pszFlow = ( dwFlow == SERIAL_FLOW_RTSCTS ) ? "rtscts" : ( dwFlow == SERIAL_FLOW_XONXOFF ) ? "xonxoff" : "none";
+    HANDLE hThread = NULL;
+    DWORD dwIdle = 0;
+    DWORD i;
+    double dCpuMs;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    pFlow->pTx = &Tx;
+    pFlow->nWriteSize = nWriteSize;
+    pFlow->dwDuration = pConfig->dwDuration;
+    pFlow->bDone = FALSE;
+    pFlow->llSent = 0;
+    pFlow->nHead = 0;
+    pFlow->nTail = 0;
+    pFlow->llReceived = 0;
+    pFlow->llGaps = 0;
+    FlowControl.dwFlow = dwFlow;
+    FlowControl.nHighWater = 0;
+    FlowControl.nLowWater = 0;
+    Tx.SetRxMode( SERIAL_RX_CHUNK, SERIAL_RX_CHUNK_SIZE, 0, OnDiscard, NULL );
+    Tx.SetFlowControl( &FlowControl );
+    // every block the consumer holds on to counts against the watermarks
+    Rx.SetRxMode( SERIAL_RX_CHUNK, 256 );
+    Rx.SetRxPool( BENCH_FLOW_BLOCKS, OnFlowChunk, pFlow );
+    Rx.SetFlowControl( &FlowControl );
+
+    if ( !Tx.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) ||
+         !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    dCpuMs = GetCpuMs();
+    hThread = CreateThread( NULL, 0, FlowSenderThread, pFlow, 0, NULL );
+
+    if ( hThread == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    // the consumer: check every byte, then take its time before giving the block back
+    while ( !pFlow->bDone || ( ( pFlow->llReceived < pFlow->llSent ) && ( dwIdle < BENCH_DRAIN_TIME ) ) )
+    {
+        if ( pFlow->nTail == pFlow->nHead )
+        {
+            ::Sleep( 1 );
+            dwIdle++;
+            continue;
+        }
+
+        pChunk = &pFlow->Chunks[pFlow->nTail % ( BENCH_FLOW_BLOCKS + 1 )];
+        pData = pChunk->GetData();
+
+        for ( i = 0; i < pChunk->GetSize(); i++ )
+        {
+            if ( pData[i] != ( BYTE )( pFlow->llReceived | 0x80 ) )
+            {
+                // skip ahead to the byte that did arrive
+                pFlow->llGaps++;
+                pFlow->llReceived += ( pData[i] - pFlow->llReceived ) & 0x7F;
+            }
+
+            pFlow->llReceived++;
+        }
+
+        ::Sleep( nDelay );
+        pChunk->Reset();
+        InterlockedIncrement( &pFlow->nTail );
+        dwIdle = 0;
+    }
+
+    dCpuMs = GetCpuMs() - dCpuMs;
+    WaitForSingleObject( hThread, INFINITE );
+    Tx.GetStats( &TxStats );
+    Rx.GetStats( &RxStats );
+    Tx.Close();
+    Rx.Close();
+
+    // a gap longer than 128 bytes looks shorter to the consumer, the port counts exactly
+    pFlow->llReceived = RxStats.llRxBytes;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,flow,delay_ms,size,buffer,baud,sent,received,lost,gaps,flow_offs,tx_stalls,overruns,rx_queue_high,cpu_ms\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,flow,%s,%lu,%lu,%lu,%u,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%.1f\n",
+                 pConfig->pszLabel, pszFlow, nDelay, nWriteSize, nBufferSize, pConfig->baud, pFlow->llSent, pFlow->llReceived,
+                 pFlow->llSent - pFlow->llReceived, pFlow->llGaps, RxStats.llRxFlowOffs, TxStats.llTxFlowStalls, RxStats.llOverruns,
+                 RxStats.llRxQueueHigh, dCpuMs );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"flow\",\"flow\":\"%s\",\"delay_ms\":%lu,\"size\":%lu,\"buffer\":%lu,\"baud\":%u,"
+                                "\"sent\":%lld,\"received\":%lld,\"lost\":%lld,\"gaps\":%lld,\"flow_offs\":%lld,\"tx_stalls\":%lld,"
+                                "\"overruns\":%lld,\"rx_queue_high\":%lld,\"cpu_ms\":%.1f}\n",
+                 pConfig->pszLabel, pszFlow, nDelay, nWriteSize, nBufferSize, pConfig->baud, pFlow->llSent, pFlow->llReceived,
+                 pFlow->llSent - pFlow->llReceived, pFlow->llGaps, RxStats.llRxFlowOffs, TxStats.llTxFlowStalls, RxStats.llOverruns,
+                 RxStats.llRxQueueHigh, dCpuMs );
+    }
+
+    fflush( pConfig->pOut );
+
+    // without flow control losses are the point of the baseline, with it a single one fails the case
+    if ( ( dwFlow != 0 ) && ( ( pFlow->llSent != pFlow->llReceived ) || ( pFlow->llGaps > 0 ) || ( RxStats.llOverruns > 0 ) ) )
+    {
+        fprintf( stderr, "%s lost bytes on COM%u/COM%u, delay %lu\n", pszFlow, pConfig->nTxPort[0], pConfig->nRxPort[0], nDelay );
+        ret = FALSE;
+    }
+
+done:
+    if ( hThread != NULL )
+    {
+        WaitForSingleObject( hThread, INFINITE );
+        CloseHandle( hThread );
+    }
+
+    Tx.Close();
+    Rx.Close();
+    delete pFlow;
+    return ret;
+}
+
+static BOOL RunPoolCase( BENCH_CONFIG *pConfig, DWORD nWriteSize, DWORD nBufferSize )
+{
+    CSerialPool Pool;
+    CSerialChunk Chunk;
+    CSerialChunk Kept[BENCH_POOL_KEPT];
+    CSerialChunk Slice;
+    CSerialPort Tx;
+    CSerialPort Rx;
+    SERIAL_STATS RxStats;
+    BENCH_FLOW *pFlow = new BENCH_FLOW;
+    SERIAL_BLOCK *pBlock;
+    SERIAL_BLOCK *pHeld[BENCH_FLOW_BLOCKS];
+    CSerialChunk *pChunk;
+    const BYTE *pData;
+    HANDLE hThread = NULL;
+    DWORD nBlockSize = SERIAL_RX_CHUNK_SIZE;
+    DWORD nSize = min( nWriteSize, nBlockSize );
+    DWORD dwIdle = 0;
+    DWORD nExhausted;
+    DWORD i;
+    LONG nCycleNew = -1;
+    LONG nRxNew = -1;
+    LONGLONG llChunks = 0;
+    double dCpuMs = 0.0;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    pFlow->pTx = &Tx;
+    pFlow->nWriteSize = nWriteSize;
+    pFlow->dwDuration = pConfig->dwDuration;
+    pFlow->bDone = FALSE;
+    pFlow->llSent = 0;
+    pFlow->nHead = 0;
+    pFlow->nTail = 0;
+    pFlow->llReceived = 0;
+    pFlow->llGaps = 0;
+    memset( &RxStats, 0, sizeof( RxStats ) );
+
+    if ( !Pool.Create( BENCH_FLOW_BLOCKS, nBlockSize ) )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    // the consumer side of a pool on its own: a block comes in, a slice of it is kept for a while
+    InterlockedExchange( &g_nNew, 0 );
+    InterlockedExchange( &g_bCountNew, TRUE );
+
+    for ( i = 0; i < BENCH_POOL_CYCLES; i++ )
+    {
+        pBlock = Pool.Alloc();
+
+        if ( pBlock == NULL )
+        {
+            fprintf( stderr, "pool ran dry after %lu cycles\n", i );
+            ret = FALSE;
+            break;
+        }
+
+        pBlock->nSize = nSize;
+        CSerialPool::GetData( pBlock )[0] = ( BYTE )i;
+        Chunk = CSerialChunk( pBlock, 0, nSize );
+        CSerialPool::Release( pBlock );
+        Kept[i % BENCH_POOL_KEPT] = Chunk.Slice( nSize / 2, nSize );
+        Chunk.Reset();
+    }
+
+    // an empty pool is a counter, not an allocation
+    nExhausted = Pool.GetExhaustedCount();
+
+    for ( i = 0; i < BENCH_FLOW_BLOCKS; i++ )
+    {
+        pHeld[i] = Pool.Alloc();
+    }
+
+    nExhausted = Pool.GetExhaustedCount() - nExhausted;
+
+    for ( i = 0; i < BENCH_FLOW_BLOCKS; i++ )
+    {
+        if ( pHeld[i] != NULL )
+        {
+            CSerialPool::Release( pHeld[i] );
+        }
+    }
+
+    InterlockedExchange( &g_bCountNew, FALSE );
+    nCycleNew = g_nNew;
+
+    if ( ( i = Pool.GetFreeCount() ) != BENCH_FLOW_BLOCKS - BENCH_POOL_KEPT )
+    {
+        fprintf( stderr, "pool has %lu free blocks with %u slices held\n", i, BENCH_POOL_KEPT );
+        ret = FALSE;
+    }
+
+    if ( nExhausted != BENCH_POOL_KEPT )
+    {
+        fprintf( stderr, "pool counted %lu exhausted allocs, %u expected\n", nExhausted, BENCH_POOL_KEPT );
+        ret = FALSE;
+    }
+
+    if ( pConfig->nPairs == 0 )
+    {
+        goto report;
+    }
+
+    // and fed by a port: opening allocates, the count starts with the first chunk
+    Tx.SetRxMode( SERIAL_RX_CHUNK, SERIAL_RX_CHUNK_SIZE, 0, OnDiscard, NULL );
+    Rx.SetRxMode( SERIAL_RX_CHUNK, nBlockSize );
+    Rx.SetRxPool( BENCH_FLOW_BLOCKS, OnFlowChunk, pFlow );
+
+    if ( !Tx.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) ||
+         !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    dCpuMs = GetCpuMs();
+    hThread = CreateThread( NULL, 0, FlowSenderThread, pFlow, 0, NULL );
+
+    if ( hThread == NULL )
+    {
+        ret = FALSE;
+        goto done;
+    }
+
+    while ( !pFlow->bDone || ( ( pFlow->llReceived < pFlow->llSent ) && ( dwIdle < BENCH_DRAIN_TIME ) ) )
+    {
+        if ( pFlow->nTail == pFlow->nHead )
+        {
+            ::Sleep( 1 );
+            dwIdle++;
+            continue;
+        }
+
+        if ( llChunks++ == 0 )
+        {
+            InterlockedExchange( &g_nNew, 0 );
+            InterlockedExchange( &g_bCountNew, TRUE );
+        }
+
+        pChunk = &pFlow->Chunks[pFlow->nTail % ( BENCH_FLOW_BLOCKS + 1 )];
+        pData = pChunk->GetData();
+
+        for ( i = 0; i < pChunk->GetSize(); i++ )
+        {
+            if ( pData[i] != ( BYTE )( pFlow->llReceived | 0x80 ) )
+            {
+                pFlow->llGaps++;
+                pFlow->llReceived += ( pData[i] - pFlow->llReceived ) & 0x7F;
+            }
+
+            pFlow->llReceived++;
+        }
+
+        // the second half outlives the chunk for a round, as a consumer passing it on would
+        Slice = pChunk->Slice( pChunk->GetSize() / 2, pChunk->GetSize() );
+        pChunk->Reset();
+        InterlockedIncrement( &pFlow->nTail );
+        dwIdle = 0;
+    }
+
+    InterlockedExchange( &g_bCountNew, FALSE );
+    nRxNew = g_nNew;
+    dCpuMs = GetCpuMs() - dCpuMs;
+    Slice.Reset();
+    WaitForSingleObject( hThread, INFINITE );
+    Rx.GetStats( &RxStats );
+
+    if ( llChunks == 0 )
+    {
+        fprintf( stderr, "nothing received on COM%u\n", pConfig->nRxPort[0] );
+        ret = FALSE;
+    }
+
+report:
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,size,blocks,block_size,cycles,cycle_allocs,exhausted,received,chunks,gaps,rx_exhausted,rx_allocs,cpu_ms\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,pool,%lu,%lu,%lu,%lu,%ld,%lu,%lld,%lld,%lld,%lu,%ld,%.1f\n",
+                 pConfig->pszLabel, nWriteSize, BENCH_FLOW_BLOCKS, nBlockSize, BENCH_POOL_CYCLES, nCycleNew, nExhausted,
+                 RxStats.llRxBytes, llChunks, pFlow->llGaps, Rx.GetRxExhaustedCount(), nRxNew, dCpuMs );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"pool\",\"size\":%lu,\"blocks\":%lu,\"block_size\":%lu,\"cycles\":%lu,"
+                                "\"cycle_allocs\":%ld,\"exhausted\":%lu,\"received\":%lld,\"chunks\":%lld,\"gaps\":%lld,"
+                                "\"rx_exhausted\":%lu,\"rx_allocs\":%ld,\"cpu_ms\":%.1f}\n",
+                 pConfig->pszLabel, nWriteSize, BENCH_FLOW_BLOCKS, nBlockSize, BENCH_POOL_CYCLES, nCycleNew, nExhausted,
+                 RxStats.llRxBytes, llChunks, pFlow->llGaps, Rx.GetRxExhaustedCount(), nRxNew, dCpuMs );
+    }
+
+    fflush( pConfig->pOut );
+
+    // -1 is a part that did not run
+    if ( ( nCycleNew > 0 ) || ( nRxNew > 0 ) )
+    {
+        fprintf( stderr, "%ld heap allocations while cycling the pool, %ld while receiving\n", nCycleNew, nRxNew );
+        ret = FALSE;
+    }
+
+done:
+    InterlockedExchange( &g_bCountNew, FALSE );
+
+    if ( hThread != NULL )
+    {
+        WaitForSingleObject( hThread, INFINITE );
+        CloseHandle( hThread );
+    }
+
+    Tx.Close();
+    Rx.Close();
+    delete pFlow;
+    return ret;
+}
+
+static BOOL RunImageCase( BENCH_CONFIG *pConfig, UINT nMethod, DWORD nImageSize, DWORD nPiece, DWORD nBufferSize )
+{
+    static const char *pszMethods[BENCH_IMAGE_METHODS] = { "copy", "gather", "chunk" };
+    CSerialPort Tx;
+    CSerialPort Rx;
+    CSerialPool Pool;
+    CSerialChunk Image;
+    CSerialChecksum Expected;
+    SERIAL_STATS TxStats;
+    SERIAL_SPAN Spans[2];
+    SERIAL_TX_CALLBACK pfnSent;
+    SERIAL_WRITE_RESULT Result = SERIAL_WRITE_OK;
+    SERIAL_BLOCK *pBlock;
+    BENCH_IMAGE *pImage = new BENCH_IMAGE;
+    BYTE Header[BENCH_IMAGE_HEADER];
+    BYTE *pPacket = NULL;
+    BYTE *pFill;
+    LONGLONG llStart;
+    LONGLONG llStream = 0;
+    LONGLONG llAssembled = 0;                           /* bytes the caller copied itself */
+    LONGLONG llCopied;
+    DWORD nOffset;
+    DWORD nSize;
+    DWORD dwIdle = 0;
+    DWORD i;
+    double dSeconds;
+    double dCpuMs;
+    BOOL ret = TRUE;
+    static BOOL bHeader = FALSE;
+
+    nPiece = ( nPiece == 0 ) ? nImageSize : min( nPiece, nImageSize );
+    pImage->llReceived = 0;
+    pImage->hSent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+    // the image sits in a block of a pool, every method sends it from there
+    if ( ( pImage->hSent == NULL ) || !Pool.Create( 1, nImageSize ) || ( ( pBlock = Pool.Alloc() ) == NULL ) )
+    {
+        fprintf( stderr, "cannot allocate an image of %lu bytes\n", nImageSize );
+        ret = FALSE;
+        goto done;
+    }
+
+    pFill = CSerialPool::GetData( pBlock );
+
+    for ( i = 0; i < nImageSize; i++ )
+    {
+        pFill[i] = ( BYTE )( i * 2654435761UL >> 13 );
+    }
+
+    pBlock->nSize = nImageSize;
+    Image = CSerialChunk( pBlock, 0, nImageSize );
+    CSerialPool::Release( pBlock );
+
+    // what the receiver has to see, every piece behind its header
+    for ( nOffset = 0; nOffset < nImageSize; nOffset += nPiece )
+    {
+        nSize = min( nPiece, nImageSize - nOffset );
+        MakeImageHeader( Header, nOffset, nSize );
+        Expected.Update( Header, BENCH_IMAGE_HEADER );
+        Expected.Update( Image.GetData() + nOffset, nSize );
+        llStream += BENCH_IMAGE_HEADER + nSize;
+    }
+
+    pPacket = new BYTE[BENCH_IMAGE_HEADER + nPiece];
+    Tx.SetRxMode( SERIAL_RX_CHUNK, SERIAL_RX_CHUNK_SIZE, 0, OnDiscard, NULL );
+    Rx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnImageChunk, pImage );
+
+    if ( !Tx.Open( NULL, pConfig->nTxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) ||
+         !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, NOPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+    {
+        fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    dCpuMs = GetCpuMs();
+    llStart = CSerialPort::GetTimestamp();
+
+    for ( nOffset = 0; ( nOffset < nImageSize ) && ( Result == SERIAL_WRITE_OK ); nOffset += nPiece )
+    {
+        nSize = min( nPiece, nImageSize - nOffset );
+        MakeImageHeader( Header, nOffset, nSize );
+        // the last piece tells when the whole image left the driver
+        pfnSent = ( nOffset + nSize == nImageSize ) ? OnImageSent : NULL;
+
+        switch ( nMethod )
+        {
+            case BENCH_IMAGE_COPY:
+                // the usual way, a packet buffer of its own that WriteAsync() copies again
+                memcpy( pPacket, Header, BENCH_IMAGE_HEADER );
+                memcpy( pPacket + BENCH_IMAGE_HEADER, Image.GetData() + nOffset, nSize );
+                llAssembled += BENCH_IMAGE_HEADER + nSize;
+                Result = Tx.WriteAsync( pPacket, BENCH_IMAGE_HEADER + nSize, SERIAL_PRIORITY_BULK, INFINITE, pfnSent, pImage );
+                break;
+
+            case BENCH_IMAGE_GATHER:
+                Spans[0].pData = Header;
+                Spans[0].nSize = BENCH_IMAGE_HEADER;
+                Spans[1].pData = Image.GetData() + nOffset;
+                Spans[1].nSize = nSize;
+                Result = Tx.WriteGather( Spans, 2, SERIAL_PRIORITY_BULK, INFINITE, pfnSent, pImage );
+                break;
+
+            default:
+                // only the header is copied, the piece goes out of the block
+                Result = Tx.WriteAsync( Header, BENCH_IMAGE_HEADER, SERIAL_PRIORITY_BULK, INFINITE );
+
+                if ( Result == SERIAL_WRITE_OK )
+                {
+                    Result = Tx.WriteChunk( Image.Slice( nOffset, nSize ), SERIAL_PRIORITY_BULK, INFINITE, pfnSent, pImage );
+                }
+
+                break;
+        }
+    }
+
+    if ( Result == SERIAL_WRITE_TOO_LARGE )
+    {
+        fprintf( stderr, "skipping %s of %lu byte pieces, larger than the transmit queue of %lu byte buffers\n",
+                 pszMethods[nMethod], nPiece, nBufferSize );
+        goto done;
+    }
+
+    if ( Result != SERIAL_WRITE_OK )
+    {
+        fprintf( stderr, "%s failed on COM%u\n", pszMethods[nMethod], pConfig->nTxPort[0] );
+        ret = FALSE;
+        goto done;
+    }
+
+    // the wire time of the image at 10 bits per byte, then as long as a drain may take
+    WaitForSingleObject( pImage->hSent, ( DWORD )( llStream * 10000 / pConfig->baud ) + BENCH_DRAIN_TIME );
+    dSeconds = ( double )( CSerialPort::GetTimestamp() - llStart ) / 1000000.0;
+    dCpuMs = GetCpuMs() - dCpuMs;
+
+    while ( ( pImage->llReceived < llStream ) && ( dwIdle < BENCH_DRAIN_TIME ) )
+    {
+        ::Sleep( 1 );
+        dwIdle++;
+    }
+
+    Tx.GetStats( &TxStats );
+    Tx.Close();
+    Rx.Close();
+    llCopied = llAssembled + TxStats.llTxCopied;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,method,image,piece,buffer,baud,seconds,kb_per_s,write_calls,copied,copied_per_byte,cpu_ms,received,intact\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,image,%s,%lu,%lu,%lu,%u,%.3f,%.1f,%lld,%lld,%.2f,%.1f,%lld,%d\n",
+                 pConfig->pszLabel, pszMethods[nMethod], nImageSize, nPiece, nBufferSize, pConfig->baud, dSeconds,
+                 ( double )llStream / 1024.0 / dSeconds, TxStats.llWriteCalls, llCopied, ( double )llCopied / ( double )llStream, dCpuMs,
+                 pImage->llReceived, pImage->Received.GetValue() == Expected.GetValue() );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"image\",\"method\":\"%s\",\"image\":%lu,\"piece\":%lu,\"buffer\":%lu,\"baud\":%u,"
+                                "\"seconds\":%.3f,\"kb_per_s\":%.1f,\"write_calls\":%lld,\"copied\":%lld,\"copied_per_byte\":%.2f,"
+                                "\"cpu_ms\":%.1f,\"received\":%lld,\"intact\":%s}\n",
+                 pConfig->pszLabel, pszMethods[nMethod], nImageSize, nPiece, nBufferSize, pConfig->baud, dSeconds,
+                 ( double )llStream / 1024.0 / dSeconds, TxStats.llWriteCalls, llCopied, ( double )llCopied / ( double )llStream, dCpuMs,
+                 pImage->llReceived, ( pImage->Received.GetValue() == Expected.GetValue() ) ? "true" : "false" );
+    }
+
+    fflush( pConfig->pOut );
+
+    if ( ( pImage->llReceived != llStream ) || ( pImage->Received.GetValue() != Expected.GetValue() ) )
+    {
+        fprintf( stderr, "%s image arrived damaged on COM%u, %lld of %lld bytes\n", pszMethods[nMethod], pConfig->nRxPort[0], pImage->llReceived, llStream );
+        ret = FALSE;
+    }
+
+done:
+    // the port gives its references to the image back on close
+    Tx.Close();
+    Rx.Close();
+    delete [] pPacket;
+
+    if ( pImage->hSent != NULL )
+    {
+        CloseHandle( pImage->hSent );
+    }
+
+    delete pImage;
+    return ret;
+}
+
+// extended Hamming(8,4): any two differ in 4 bits, a byte with one bit flipped still names its codeword
+static const BYTE s_VerifyCodes[BENCH_VERIFY_CODES] =
+{
+    0x00, 0x87, 0x99, 0x1E, 0xAA, 0x2D, 0x33, 0xB4, 0x4B, 0xCC, 0xD2, 0x55, 0xE1, 0x66, 0x78, 0xFF
+};
+
+static void CALLBACK OnVerifyChunk( LPVOID pContext, const BYTE *pData, DWORD nSize, LONGLONG llTimestamp )
+{
+    BENCH_VERIFY *pVerify = ( BENCH_VERIFY * )pContext;
+    DWORD nReceived = ( DWORD )pVerify->nReceived;
+
+    if ( nReceived < pVerify->nCapacity )
+    {
+        memcpy( pVerify->pReceived + nReceived, pData, min( nSize, pVerify->nCapacity - nReceived ) );
+    }
+
+    InterlockedExchangeAdd( &pVerify->nReceived, ( LONG )nSize );
+}
+
+// walks the received bytes along the codewords sent: codewords skipped were lost, a byte one bit
+// off its codeword was flipped, a byte near none of the next ones is unmatched
+static void CompareVerify( const BYTE *pReceived, DWORD nReceived, DWORD nSent, DWORD *pnLost, DWORD *pnFlipped, DWORD *pnUnmatched )
+{
+    DWORD nNext = 0;
+    DWORD i;
+    UINT  k;
+    UINT  nBits = 0;
+    BYTE  Diff;
+
+    *pnLost = *pnFlipped = *pnUnmatched = 0;
+
+    for ( i = 0; i < nReceived; i++ )
+    {
+        for ( k = 0; k < BENCH_VERIFY_CODES; k++ )
+        {
+            Diff = pReceived[i] ^ s_VerifyCodes[( nNext + k ) % BENCH_VERIFY_CODES];
+
+            for ( nBits = 0; Diff != 0; Diff &= Diff - 1 )
+            {
+                nBits++;
+            }
+
+            if ( nBits <= 1 )
+            {
+                break;
+            }
+        }
+
+        if ( k == BENCH_VERIFY_CODES )
+        {
+            ( *pnUnmatched )++;
+            continue;
+        }
+
+        *pnLost += k;
+        *pnFlipped += nBits;
+        nNext += k + 1;
+    }
+
+    // 16 and more lost in a row shift the count by 16, they show up as a count that does not match
+    *pnLost += ( nSent > nNext ) ? nSent - nNext : 0;
+    *pnUnmatched += ( nNext > nSent ) ? nNext - nSent : 0;
+}
+
+static BOOL RunVerifyCase( BENCH_CONFIG *pConfig, CSerialVirtual *pVirtual, DWORD nWriteSize, DWORD nBufferSize )
+{
+    CSerialPort Tx;
+    CSerialPort Rx;
+    SERIAL_STATS Stats;
+    SERIAL_VIRTUAL_FAULTS Faults[BENCH_VERIFY_RUNS];
+    BENCH_VERIFY Verify;
+    BYTE *pStream;
+    DWORD nTotal;
+    DWORD nWritten;
+    DWORD nLost = 0;
+    DWORD nFlipped = 0;
+    DWORD nUnmatched = 0;
+    DWORD dwStart;
+    BOOL bRepeatable;
+    BOOL bExact;
+    BOOL ret = TRUE;
+    UINT r;
+    static BOOL bHeader = FALSE;
+
+    // what the line carries in --time, whole writes; a fixed count, so the seed repeats every fault
+    nTotal = ( pConfig->baud / 11 * pConfig->dwDuration / 1000 + nWriteSize - 1 ) / nWriteSize * nWriteSize;
+    pStream = new BYTE[nWriteSize + BENCH_VERIFY_CODES];
+    Verify.nCapacity = nTotal;
+    Verify.pReceived = new BYTE[nTotal];
+
+    for ( nWritten = 0; nWritten < nWriteSize + BENCH_VERIFY_CODES; nWritten++ )
+    {
+        pStream[nWritten] = s_VerifyCodes[nWritten % BENCH_VERIFY_CODES];
+    }
+
+    memset( &Stats, 0, sizeof( Stats ) );
+    memset( Faults, 0, sizeof( Faults ) );
+
+    for ( r = 0; r < BENCH_VERIFY_RUNS; r++ )
+    {
+        // a new pair restarts the faults from the seed
+        if ( !pVirtual->Create( pConfig->nTxPort[0], pConfig->nRxPort[0], &pConfig->Line ) )
+        {
+            fprintf( stderr, "cannot create virtual pair COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+            ret = FALSE;
+            goto done;
+        }
+
+        Verify.nReceived = 0;
+        Tx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnDiscard, NULL );
+        Rx.SetRxMode( SERIAL_RX_CHUNK, nBufferSize, 0, OnVerifyChunk, &Verify );
+
+        // parity on, a flipped bit is reported as well as counted
+        if ( !Tx.Open( NULL, pConfig->nTxPort[0], pConfig->baud, EVENPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) ||
+             !Rx.Open( NULL, pConfig->nRxPort[0], pConfig->baud, EVENPARITY, 8, ONESTOPBIT, EV_RXCHAR, nBufferSize ) )
+        {
+            fprintf( stderr, "cannot open COM%u/COM%u\n", pConfig->nTxPort[0], pConfig->nRxPort[0] );
+            ret = FALSE;
+            goto done;
+        }
+
+        for ( nWritten = 0; nWritten < nTotal; nWritten += nWriteSize )
+        {
+            Tx.Write( pStream + nWritten % BENCH_VERIFY_CODES, ( int )nWriteSize );
+        }
+
+        // every byte the line did not lose arrives, or the drain time is up
+        for ( dwStart = GetTickCount(); ( GetTickCount() - dwStart ) < BENCH_DRAIN_TIME; ::Sleep( 10 ) )
+        {
+            pVirtual->GetFaults( pConfig->nTxPort[0], &Faults[r] );
+
+            if ( ( Faults[r].nSent == nTotal ) && ( ( DWORD )Verify.nReceived >= nTotal - Faults[r].nDropped - Faults[r].nOverrun ) )
+            {
+                break;
+            }
+        }
+
+        ::Sleep( BENCH_POLL_TIMEOUT );
+        Rx.GetStats( &Stats );
+        Tx.Close();
+        Rx.Close();
+        pVirtual->GetFaults( pConfig->nTxPort[0], &Faults[r] );
+    }
+
+    // the last run is checked, the first only has to have had the same faults
+    CompareVerify( Verify.pReceived, min( ( DWORD )Verify.nReceived, nTotal ), nTotal, &nLost, &nFlipped, &nUnmatched );
+    bRepeatable = ( Faults[0].nSent == Faults[1].nSent ) && ( Faults[0].nDropped == Faults[1].nDropped ) &&
+                  ( Faults[0].nCorrupted == Faults[1].nCorrupted ) && ( Faults[0].nFramed == Faults[1].nFramed );
+    bExact = ( ( DWORD )Verify.nReceived == nTotal ) && ( nLost == 0 ) && ( nFlipped == 0 ) && ( nUnmatched == 0 );
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,write_size,baud,sent,received,dropped,corrupted,framed,overrun,lost_seen,flipped_seen,unmatched,"
+                                    "framing_errors,parity_errors,exact,repeatable\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,verify,%lu,%u,%lu,%ld,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lld,%lld,%d,%d\n",
+                 pConfig->pszLabel, nWriteSize, pConfig->baud, Faults[1].nSent, Verify.nReceived,
+                 Faults[1].nDropped, Faults[1].nCorrupted, Faults[1].nFramed, Faults[1].nOverrun, nLost, nFlipped, nUnmatched,
+                 Stats.llFramingErrors, Stats.llParityErrors, bExact, bRepeatable );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"verify\",\"write_size\":%lu,\"baud\":%u,\"sent\":%lu,\"received\":%ld,"
+                                "\"dropped\":%lu,\"corrupted\":%lu,\"framed\":%lu,\"overrun\":%lu,\"lost_seen\":%lu,\"flipped_seen\":%lu,\"unmatched\":%lu,"
+                                "\"framing_errors\":%lld,\"parity_errors\":%lld,\"exact\":%d,\"repeatable\":%d}\n",
+                 pConfig->pszLabel, nWriteSize, pConfig->baud, Faults[1].nSent, Verify.nReceived,
+                 Faults[1].nDropped, Faults[1].nCorrupted, Faults[1].nFramed, Faults[1].nOverrun, nLost, nFlipped, nUnmatched,
+                 Stats.llFramingErrors, Stats.llParityErrors, bExact, bRepeatable );
+    }
+
+    fflush( pConfig->pOut );
+
+    // a clean line delivers every byte as sent, a faulty one exactly what its counters say it did
+    if ( IsCleanLine( pConfig ) && !bExact )
+    {
+        fprintf( stderr, "COM%u did not receive what COM%u sent on a clean line\n", pConfig->nRxPort[0], pConfig->nTxPort[0] );
+        ret = FALSE;
+    }
+
+    if ( ( Faults[1].nSent != nTotal ) || ( ( DWORD )Verify.nReceived != nTotal - Faults[1].nDropped - Faults[1].nOverrun ) ||
+         ( nLost != Faults[1].nDropped + Faults[1].nOverrun ) || ( nFlipped != Faults[1].nCorrupted ) || ( nUnmatched != 0 ) )
+    {
+        fprintf( stderr, "COM%u received other damage than the line injected, write size %lu\n", pConfig->nRxPort[0], nWriteSize );
+        ret = FALSE;
+    }
+
+    // several errors between two reads are one, never more than were injected and never none
+    if ( ( ( Faults[1].nFramed == 0 ) ? ( Stats.llFramingErrors != 0 ) : ( ( Stats.llFramingErrors == 0 ) || ( Stats.llFramingErrors > Faults[1].nFramed ) ) ) ||
+         ( ( Faults[1].nCorrupted == 0 ) ? ( Stats.llParityErrors != 0 ) : ( ( Stats.llParityErrors == 0 ) || ( Stats.llParityErrors > Faults[1].nCorrupted ) ) ) )
+    {
+        fprintf( stderr, "COM%u reported errors the line did not inject, write size %lu\n", pConfig->nRxPort[0], nWriteSize );
+        ret = FALSE;
+    }
+
+    if ( !bRepeatable )
+    {
+        fprintf( stderr, "seed %lu gave other faults on the second run\n", pConfig->Line.dwSeed );
+        ret = FALSE;
+    }
+
+done:
+    Tx.Close();
+    Rx.Close();
+    delete [] Verify.pReceived;
+    delete [] pStream;
+    return ret;
+}
+
+static double TimeChecksum( SERIAL_CHECKSUM_TYPE Type, const BYTE *pData, DWORD nSize, SERIAL_CHECKSUM_METHOD Method, DWORD *pdwValue )
+{
+    LONGLONG llStart = CSerialPort::GetTimestamp();
+    LONGLONG llElapsed;
+    LONGLONG llBytes = 0;
+
+    do
+    {
+        *pdwValue = CSerialChecksum::Compute( Type, pData, nSize, Method );
+        llBytes += nSize;
+        llElapsed = CSerialPort::GetTimestamp() - llStart;
+    }
+    while ( llElapsed < ( LONGLONG )BENCH_CHECKSUM_TIME * 1000 );
+
+    return ( double )llBytes / ( double )llElapsed;
+}
+
+static BOOL RunChecksumCase( BENCH_CONFIG *pConfig, SERIAL_CHECKSUM_TYPE Type, DWORD nSize )
+{
+    static const char *pszTypes[SERIAL_CHECKSUM_TYPES] = { "none", "crc16_modbus", "crc16_ccitt", "crc32", "crc32c", "xor", "lrc" };
+    BYTE *pData = new BYTE[nSize];
+    DWORD dwBitwise;
+    DWORD dwTables;
+    DWORD dwFastest;
+    double dBitwise;
+    double dTables;
+    double dFastest;
+    DWORD i;
+    static BOOL bHeader = FALSE;
+
+    for ( i = 0; i < nSize; i++ )
+    {
+        pData[i] = ( BYTE )( i * 2654435761UL >> 13 );
+    }
+
+    dBitwise = TimeChecksum( Type, pData, nSize, SERIAL_CHECKSUM_BITWISE, &dwBitwise );
+    dTables = TimeChecksum( Type, pData, nSize, SERIAL_CHECKSUM_TABLES, &dwTables );
+    dFastest = TimeChecksum( Type, pData, nSize, SERIAL_CHECKSUM_FASTEST, &dwFastest );
+    delete [] pData;
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,checksum,size,hardware,bitwise_mb_per_s,tables_mb_per_s,fastest_mb_per_s,speedup,value\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,checksum,%s,%lu,%lu,%.1f,%.1f,%.1f,%.1f,%08lx\n",
+                 pConfig->pszLabel, pszTypes[Type], nSize, CSerialChecksum::GetHardware(), dBitwise, dTables, dFastest,
+                 dFastest / dBitwise, dwFastest );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"checksum\",\"checksum\":\"%s\",\"size\":%lu,\"hardware\":%lu,"
+                                "\"bitwise_mb_per_s\":%.1f,\"tables_mb_per_s\":%.1f,\"fastest_mb_per_s\":%.1f,\"speedup\":%.1f,\"value\":\"%08lx\"}\n",
+                 pConfig->pszLabel, pszTypes[Type], nSize, CSerialChecksum::GetHardware(), dBitwise, dTables, dFastest,
+                 dFastest / dBitwise, dwFastest );
+    }
+
+    fflush( pConfig->pOut );
+    // every method has to give the value of the bitwise loop
+    return ( dwTables == dwBitwise ) && ( dwFastest == dwBitwise );
+}
+
+static void CALLBACK OnBenchFrame( LPVOID pContext, const BYTE *pFrame, DWORD nSize, LONGLONG llTimestamp, DWORD dwFlags )
+{
+    BENCH_FRAMES *pFrames = ( BENCH_FRAMES * )pContext;
+
+    pFrames->llFrames++;
+    pFrames->llBytes += nSize;
+
+    if ( dwFlags != 0 )
+    {
+        pFrames->llErrors++;
+    }
+}
+
+static DWORD EncodeCobs( const BYTE *pData, DWORD nSize, BYTE *pOut )
+{
+    DWORD nCode = 0;
+    DWORD nOut = 1;
+    DWORD i;
+
+    // every code byte holds the distance to the next zero, a full block of 254 needs no zero
+    for ( i = 0; i < nSize; i++ )
+    {
+        if ( pData[i] == 0 )
+        {
+            pOut[nCode] = ( BYTE )( nOut - nCode );
+            nCode = nOut++;
+            continue;
+        }
+
+        pOut[nOut++] = pData[i];
+
+        if ( nOut - nCode == 0xFF )
+        {
+            pOut[nCode] = 0xFF;
+            nCode = nOut++;
+        }
+    }
+
+    pOut[nCode] = ( BYTE )( nOut - nCode );
+    pOut[nOut++] = 0;
+    return nOut;
+}
+
+static DWORD MakeFramerStream( UINT nFramer, DWORD nFrame, BYTE *pStream, DWORD *pnFrames )
+{
+    BYTE *pPayload = new BYTE[nFrame];
+    DWORD nStream = 0;
+    DWORD k;
+    DWORD j;
+
+    // whole frames up to the size of the stream, at worst every byte escaped
+    for ( k = 0; nStream + 2 * nFrame + 4 <= BENCH_FRAMER_STREAM; k++ )
+    {
+        for ( j = 0; j < nFrame; j++ )
+        {
+            // printable text for the delimiter, else every byte value including the special ones
+            pPayload[j] = ( nFramer == BENCH_FRAMER_DELIMITER ) ? ( BYTE )( 0x20 + ( j * 7 + k ) % 0x5F ) : ( BYTE )( j * 131 + k );
+        }
+
+        switch ( nFramer )
+        {
+            case BENCH_FRAMER_DELIMITER:
+                memcpy( pStream + nStream, pPayload, nFrame );
+                nStream += nFrame;
+                pStream[nStream++] = '\n';
+                break;
+
+            case BENCH_FRAMER_LENGTH:
+                pStream[nStream++] = ( BYTE )( nFrame >> 8 );
+                pStream[nStream++] = ( BYTE )nFrame;
+                memcpy( pStream + nStream, pPayload, nFrame );
+                nStream += nFrame;
+                break;
+
+            case BENCH_FRAMER_SLIP:
+                for ( j = 0; j < nFrame; j++ )
+                {
+                    if ( pPayload[j] == SLIP_END )
+                    {
+                        pStream[nStream++] = SLIP_ESC;
+                        pStream[nStream++] = SLIP_ESC_END;
+                    }
+                    else if ( pPayload[j] == SLIP_ESC )
+                    {
+                        pStream[nStream++] = SLIP_ESC;
+                        pStream[nStream++] = SLIP_ESC_ESC;
+                    }
+                    else
+                    {
+                        pStream[nStream++] = pPayload[j];
+                    }
+                }
+
+                pStream[nStream++] = SLIP_END;
+                break;
+
+            default:
+                nStream += EncodeCobs( pPayload, nFrame, pStream + nStream );
+                break;
+        }
+    }
+
+    delete [] pPayload;
+    *pnFrames = k;
+    return nStream;
+}
+
+static BOOL RunFramerCase( BENCH_CONFIG *pConfig, UINT nFramer, SERIAL_SCAN_METHOD Method, DWORD nFrame, DWORD nChunk )
+{
+    static const char *pszFramers[BENCH_FRAMERS] = { "delimiter", "length", "slip", "cobs" };
+    static const char *pszScans[] = { "fastest", "sse2", "scalar" };
+    BYTE *pStream = new BYTE[BENCH_FRAMER_STREAM];
+    BYTE *pWork = new BYTE[BENCH_FRAMER_STREAM];
+    CSerialFramer *pFramer;
+    BENCH_FRAMES Frames;
+    DWORD nStream;
+    DWORD nFrames;
+    DWORD nPos;
+    DWORD nPasses = 0;
+    DWORD nErrors;
+    LONGLONG llStart;
+    LONGLONG llElapsed = 0;
+    LONGLONG llExpected;
+    const char *pszScan = ( nFramer == BENCH_FRAMER_LENGTH ) ? "none" : pszScans[Method];
+    BOOL bAvx2 = FALSE;
+    BOOL ret;
+    static BOOL bHeader = FALSE;
+
+#if defined( __AVX2__ )
+    bAvx2 = TRUE;
+#endif
+
+    switch ( nFramer )
+    {
+        case BENCH_FRAMER_DELIMITER:
+            pFramer = new CSerialDelimiterFramer( '\n', FALSE, nFrame + 1 );
+            break;
+
+        case BENCH_FRAMER_LENGTH:
+            pFramer = new CSerialLengthFramer( 0, 2, TRUE, 0, nFrame + 2 );
+            break;
+
+        case BENCH_FRAMER_SLIP:
+            pFramer = new CSerialSlipFramer( nFrame + 1 );
+            break;
+
+        default:
+            pFramer = new CSerialCobsFramer( nFrame + nFrame / 254 + 2 );
+            break;
+    }
+
+    memset( &Frames, 0, sizeof( Frames ) );
+    pFramer->SetCallback( OnBenchFrame, &Frames );
+    pFramer->SetScanMethod( Method );
+    nStream = MakeFramerStream( nFramer, nFrame, pStream, &nFrames );
+
+    do
+    {
+        // the framers decode in place, every pass starts again from the encoded bytes
+        memcpy( pWork, pStream, nStream );
+        llStart = CSerialPort::GetTimestamp();
+
+        for ( nPos = 0; nPos < nStream; nPos += nChunk )
+        {
+            pFramer->Feed( pWork + nPos, min( nChunk, nStream - nPos ), llStart );
+        }
+
+        llElapsed += CSerialPort::GetTimestamp() - llStart;
+        nPasses++;
+    }
+    while ( llElapsed < ( LONGLONG )BENCH_FRAMER_TIME * 1000 );
+
+    nErrors = pFramer->GetErrorCount();
+    delete pFramer;
+    delete [] pWork;
+    delete [] pStream;
+    llElapsed = max( llElapsed, 1 );
+
+    if ( pConfig->bCsv )
+    {
+        if ( !bHeader )
+        {
+            fprintf( pConfig->pOut, "label,mode,framer,scan,avx2,frame_size,chunk_size,mb_per_s,frames_per_s,frames,errors\n" );
+            bHeader = TRUE;
+        }
+
+        fprintf( pConfig->pOut, "%s,framers,%s,%s,%d,%lu,%lu,%.1f,%.0f,%lld,%lld\n",
+                 pConfig->pszLabel, pszFramers[nFramer], pszScan, bAvx2, nFrame, nChunk,
+                 ( double )nStream * nPasses / ( double )llElapsed, ( double )Frames.llFrames * 1000000.0 / ( double )llElapsed,
+                 Frames.llFrames, Frames.llErrors + nErrors );
+    }
+    else
+    {
+        fprintf( pConfig->pOut, "{\"label\":\"%s\",\"mode\":\"framers\",\"framer\":\"%s\",\"scan\":\"%s\",\"avx2\":%d,\"frame_size\":%lu,"
+                                "\"chunk_size\":%lu,\"mb_per_s\":%.1f,\"frames_per_s\":%.0f,\"frames\":%lld,\"errors\":%lld}\n",
+                 pConfig->pszLabel, pszFramers[nFramer], pszScan, bAvx2, nFrame, nChunk,
+                 ( double )nStream * nPasses / ( double )llElapsed, ( double )Frames.llFrames * 1000000.0 / ( double )llElapsed,
+                 Frames.llFrames, Frames.llErrors + nErrors );
+    }
+
+    fflush( pConfig->pOut );
+    // every frame of every pass comes out whole and clean, whatever the scan
+    llExpected = ( LONGLONG )nFrames * nPasses;
+    ret = ( Frames.llFrames == llExpected ) && ( Frames.llErrors == 0 ) && ( nErrors == 0 ) &&
+          ( Frames.llBytes == llExpected * ( nFrame + ( ( nFramer == BENCH_FRAMER_LENGTH ) ? 2 : 0 ) ) );
+
+    if ( !ret )
+    {
+        fprintf( stderr, "%s framer, %s scan, frame %lu: %lld frames of %lld, %lld bytes\n", pszFramers[nFramer], pszScan, nFrame,
+                 Frames.llFrames, llExpected, Frames.llBytes );
+    }
+
+    return ret;
+}
+
+static void Usage()
+{
+    fprintf( stderr, "SerialBench --pairs TX:RX[,TX:RX...] [--baud N] [--time MS]\n"
+                     "            [--sizes N,...] [--buffers N,...] [--timeouts INTERVAL:MULT:CONST,...] [--counts N,...]\n"
+                     "            [--reactor THREADS] [--interval MS]\n"
+                     "            [--command] [--priority [--slices N,...] [--frame N]] [--poll [--slaves N] [--windows N,...]]\n"
+                     "            [--capture FILE] [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --replay FILE [--speeds N,...] [--buffers N,...] [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --pairs TX:RX[,TX:RX...] --startup [--parallel N,...] [--missing PORT,...] [--reactor THREADS]\n"
+                     "            [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --checksum [--sizes N,...] [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --framers [--sizes N,...] [--buffers N] [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench [--pairs TX:RX] --pool [--sizes N,...] [--buffers N] [--time MS] [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --pairs TX:RX --pingpong [--spins US,...] [--core N] [--realtime] [--sizes N,...] [--baud N] [--time MS]\n"
+                     "            [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --pairs TX:RX --await [--sizes N,...] [--buffers N] [--baud N] [--time MS] [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --pairs TX:RX --flow [--delays MS,...] [--sizes N,...] [--buffers N] [--baud N] [--time MS]\n"
+                     "            [--label TEXT] [--csv] [--out FILE]\n"
+                     "SerialBench --pairs TX:RX --image [--sizes N,...] [--pieces N,...] [--buffers N] [--baud N]\n"
+                     "            [--label TEXT] [--csv] [--out FILE]\n"
+                     "--pairs FIRST-LAST takes every two neighbouring ports of the range as a pair\n"
+                     "any of them with --pairs, on virtual pairs instead of ports:\n"
+                     "            --virtual [--latency US] [--jitter US] [--faults DROP:CORRUPT:FRAMING] [--seed N]\n"
+                     "SerialBench --pairs TX:RX --virtual --verify [--faults DROP:CORRUPT:FRAMING] [--seed N] [--sizes N,...] [--buffers N]\n"
+                     "            [--baud N] [--time MS] [--label TEXT] [--csv] [--out FILE]\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+    BENCH_CONFIG Config;
+    CSerialCapture Capture;
+    CSerialReplay Replay;
+    CSerialReactor Reactor;
+    CSerialVirtual *pVirtual = NULL;
+    UINT s, b, t, c;
+    int i;
+    int nFailed = 0;
+
+    memset( &Config, 0, sizeof( Config ) );
+    Config.baud = 115200;
+    Config.dwDuration = 2000;
+    Config.nSizeCount = ParseList( "16,64,256,1024", Config.nSizes, BENCH_MAX_VALUES );
+    Config.nBufferCount = ParseList( "4096", Config.nBuffers, BENCH_MAX_VALUES );
+    Config.nTimeoutCount = ParseTimeouts( "max:0:0", Config.Timeouts, BENCH_MAX_VALUES );
+    Config.nSliceCount = ParseList( "0,256", Config.nSlices, BENCH_MAX_VALUES );
+    Config.nFrameSize = 256;
+    Config.nSlaves = 4;
+    Config.nWindowCount = ParseList( "1,4", Config.nWindows, BENCH_MAX_VALUES );
+    Config.nSpeedCount = ParseList( "1,0", Config.nSpeeds, BENCH_MAX_VALUES );
+    Config.nParallelCount = ParseList( "1,8", Config.nParallels, BENCH_MAX_VALUES );
+    Config.nSpinCount = ParseList( "0,100", Config.nSpins, BENCH_MAX_VALUES );
+    Config.nCore = -1;
+    Config.nDelayCount = ParseList( "0,2,20", Config.nDelays, BENCH_MAX_VALUES );
+    Config.nPieceCount = ParseList( "0,1024", Config.nPieces, BENCH_MAX_VALUES );
+    Config.pszLabel = "";
+    Config.pOut = stdout;
+
+    for ( i = 1; i < argc; i++ )
+    {
+        const char *pszValue = ( i + 1 < argc ) ? argv[i + 1] : "";
+
+        if ( strcmp( argv[i], "--csv" ) == 0 )
+        {
+            Config.bCsv = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--command" ) == 0 )
+        {
+            Config.bCommand = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--priority" ) == 0 )
+        {
+            Config.bPriority = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--poll" ) == 0 )
+        {
+            Config.bPoll = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--startup" ) == 0 )
+        {
+            Config.bStartup = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--checksum" ) == 0 )
+        {
+            Config.bChecksum = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--framers" ) == 0 )
+        {
+            Config.bFramers = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--pool" ) == 0 )
+        {
+            Config.bPool = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--await" ) == 0 )
+        {
+            Config.bAwait = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--pingpong" ) == 0 )
+        {
+            Config.bPing = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--flow" ) == 0 )
+        {
+            Config.bFlow = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--image" ) == 0 )
+        {
+            Config.bImage = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--realtime" ) == 0 )
+        {
+            Config.bRealtime = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--virtual" ) == 0 )
+        {
+            Config.bVirtual = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--verify" ) == 0 )
+        {
+            Config.bVerify = TRUE;
+            continue;
+        }
+
+        if ( strcmp( argv[i], "--pairs" ) == 0 )
+        {
+            Config.nPairs = ParsePairs( pszValue, &Config );
+        }
+        else if ( strcmp( argv[i], "--baud" ) == 0 )
+        {
+            Config.baud = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--time" ) == 0 )
+        {
+            Config.dwDuration = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--interval" ) == 0 )
+        {
+            Config.dwInterval = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--sizes" ) == 0 )
+        {
+            Config.nSizeCount = ParseList( pszValue, Config.nSizes, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--buffers" ) == 0 )
+        {
+            Config.nBufferCount = ParseList( pszValue, Config.nBuffers, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--timeouts" ) == 0 )
+        {
+            Config.nTimeoutCount = ParseTimeouts( pszValue, Config.Timeouts, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--slices" ) == 0 )
+        {
+            Config.nSliceCount = ParseList( pszValue, Config.nSlices, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--frame" ) == 0 )
+        {
+            Config.nFrameSize = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--slaves" ) == 0 )
+        {
+            Config.nSlaves = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--windows" ) == 0 )
+        {
+            Config.nWindowCount = ParseList( pszValue, Config.nWindows, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--counts" ) == 0 )
+        {
+            Config.nCountCount = ParseList( pszValue, Config.nCounts, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--capture" ) == 0 )
+        {
+            if ( !Capture.Create( pszValue ) )
+            {
+                fprintf( stderr, "cannot create %s\n", pszValue );
+                return 2;
+            }
+
+            Config.pCapture = &Capture;
+        }
+        else if ( strcmp( argv[i], "--replay" ) == 0 )
+        {
+            Config.pszReplay = pszValue;
+        }
+        else if ( strcmp( argv[i], "--speeds" ) == 0 )
+        {
+            Config.nSpeedCount = ParseList( pszValue, Config.nSpeeds, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--parallel" ) == 0 )
+        {
+            Config.nParallelCount = ParseList( pszValue, Config.nParallels, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--missing" ) == 0 )
+        {
+            Config.nMissingCount = ParseList( pszValue, Config.nMissing, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--reactor" ) == 0 )
+        {
+            Config.nReactorThreads = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--spins" ) == 0 )
+        {
+            Config.nSpinCount = ParseList( pszValue, Config.nSpins, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--core" ) == 0 )
+        {
+            Config.nCore = ( int )strtol( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--delays" ) == 0 )
+        {
+            Config.nDelayCount = ParseList( pszValue, Config.nDelays, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--pieces" ) == 0 )
+        {
+            Config.nPieceCount = ParseList( pszValue, Config.nPieces, BENCH_MAX_VALUES );
+        }
+        else if ( strcmp( argv[i], "--latency" ) == 0 )
+        {
+            Config.Line.dwLatency = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--jitter" ) == 0 )
+        {
+            Config.Line.dwJitter = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--faults" ) == 0 )
+        {
+            ParseFaults( pszValue, &Config.Line );
+        }
+        else if ( strcmp( argv[i], "--seed" ) == 0 )
+        {
+            Config.Line.dwSeed = strtoul( pszValue, NULL, 10 );
+        }
+        else if ( strcmp( argv[i], "--label" ) == 0 )
+        {
+            Config.pszLabel = pszValue;
+        }
+        else if ( strcmp( argv[i], "--out" ) == 0 )
+        {
+            Config.pOut = fopen( pszValue, "w" );
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+
+        i++;
+    }
+
+    if ( ( ( Config.nPairs == 0 ) && ( Config.pszReplay == NULL ) && !Config.bChecksum && !Config.bFramers && !Config.bPool ) || ( Config.pOut == NULL ) )
+    {
+        Usage();
+        return 2;
+    }
+
+    if ( Config.nCountCount == 0 )
+    {
+        Config.nCounts[0] = Config.nPairs;
+        Config.nCountCount = 1;
+    }
+
+    if ( Config.bVirtual )
+    {
+        // the ports of every pair open as usual, connected by a line thread instead of a cable
+        pVirtual = new CSerialVirtual[Config.nPairs];
+
+        for ( t = 0; t < Config.nPairs; t++ )
+        {
+            if ( !pVirtual[t].Create( Config.nTxPort[t], Config.nRxPort[t], &Config.Line ) )
+            {
+                fprintf( stderr, "cannot create virtual pair COM%u/COM%u\n", Config.nTxPort[t], Config.nRxPort[t] );
+                delete [] pVirtual;
+                return 2;
+            }
+        }
+    }
+
+    // --startup opens on it, the sweep runs every case on a comm thread per port and then on it
+    if ( ( Config.nReactorThreads > 0 ) && !Reactor.Create( Config.nReactorThreads ) )
+    {
+        fprintf( stderr, "cannot create %u reactor threads\n", Config.nReactorThreads );
+        Config.nReactorThreads = 0;
+        nFailed++;
+    }
+
+    if ( Config.bChecksum )
+    {
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            if ( Config.nSizes[s] == 0 )
+            {
+                fprintf( stderr, "skipping size 0\n" );
+                continue;
+            }
+
+            for ( t = SERIAL_CHECKSUM_CRC16_MODBUS; t < SERIAL_CHECKSUM_TYPES; t++ )
+            {
+                if ( !RunChecksumCase( &Config, ( SERIAL_CHECKSUM_TYPE )t, Config.nSizes[s] ) )
+                {
+                    nFailed++;
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bFramers )
+    {
+        // the frame size is the payload, the buffer size the chunks the stream is fed in
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            if ( ( Config.nSizes[s] == 0 ) || ( Config.nSizes[s] > 0xFFFF ) || ( Config.nBuffers[0] == 0 ) )
+            {
+                fprintf( stderr, "skipping size %lu\n", Config.nSizes[s] );
+                continue;
+            }
+
+            for ( t = 0; t < BENCH_FRAMERS; t++ )
+            {
+                for ( c = SERIAL_SCAN_FASTEST; c <= SERIAL_SCAN_SCALAR; c++ )
+                {
+                    // the length framer never scans, one line for it
+                    if ( ( t == BENCH_FRAMER_LENGTH ) && ( c != SERIAL_SCAN_FASTEST ) )
+                    {
+                        break;
+                    }
+
+                    if ( !RunFramerCase( &Config, t, ( SERIAL_SCAN_METHOD )c, Config.nSizes[s], Config.nBuffers[0] ) )
+                    {
+                        nFailed++;
+                    }
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bPool )
+    {
+        // the cycles need no port, the receive part runs on the first pair if there is one
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            if ( ( Config.nSizes[s] == 0 ) || !RunPoolCase( &Config, Config.nSizes[s], Config.nBuffers[0] ) )
+            {
+                nFailed++;
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bPing )
+    {
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            for ( t = 0; t < Config.nSpinCount; t++ )
+            {
+                if ( ( Config.nSizes[s] == 0 ) || ( Config.nSizes[s] > Config.nBuffers[0] ) )
+                {
+                    fprintf( stderr, "skipping size %lu\n", Config.nSizes[s] );
+                    break;
+                }
+
+                if ( !RunPingCase( &Config, Config.nSizes[s], Config.nSpins[t], Config.nBuffers[0] ) )
+                {
+                    nFailed++;
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bAwait )
+    {
+#ifdef SERIAL_AWAIT_ENABLED
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            if ( ( Config.nSizes[s] == 0 ) || ( Config.nSizes[s] > Config.nBuffers[0] ) )
+            {
+                fprintf( stderr, "skipping size %lu\n", Config.nSizes[s] );
+                continue;
+            }
+
+            if ( !RunAwaitCase( &Config, Config.nSizes[s], Config.nBuffers[0] ) )
+            {
+                nFailed++;
+            }
+        }
+#else
+        fprintf( stderr, "--await needs a C++20 build\n" );
+        nFailed++;
+#endif SERIAL_AWAIT_ENABLED
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bFlow )
+    {
+        // the baseline without flow control first, then each kind the pair carries
+        static const DWORD s_dwFlows[] = { 0, SERIAL_FLOW_RTSCTS, SERIAL_FLOW_XONXOFF };
+
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            for ( t = 0; t < Config.nDelayCount; t++ )
+            {
+                for ( c = 0; c < sizeof( s_dwFlows ) / sizeof( s_dwFlows[0] ); c++ )
+                {
+                    if ( ( Config.nSizes[s] == 0 ) || !RunFlowCase( &Config, s_dwFlows[c], Config.nDelays[t], Config.nSizes[s], Config.nBuffers[0] ) )
+                    {
+                        nFailed++;
+                    }
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bImage )
+    {
+        // the same image and pieces three ways, only the copies differ
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            for ( t = 0; t < Config.nPieceCount; t++ )
+            {
+                for ( c = 0; c < BENCH_IMAGE_METHODS; c++ )
+                {
+                    if ( ( Config.nSizes[s] == 0 ) || !RunImageCase( &Config, c, Config.nSizes[s], Config.nPieces[t], Config.nBuffers[0] ) )
+                    {
+                        nFailed++;
+                    }
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bVerify )
+    {
+        // the counters of the line are the reference, a cable has none
+        if ( !Config.bVirtual )
+        {
+            fprintf( stderr, "--verify needs --virtual\n" );
+            nFailed++;
+        }
+
+        for ( s = 0; Config.bVirtual && ( s < Config.nSizeCount ); s++ )
+        {
+            if ( ( Config.nSizes[s] == 0 ) || ( Config.nSizes[s] > Config.nBuffers[0] ) )
+            {
+                fprintf( stderr, "skipping size %lu\n", Config.nSizes[s] );
+                continue;
+            }
+
+            if ( !RunVerifyCase( &Config, &pVirtual[0], Config.nSizes[s], Config.nBuffers[0] ) )
+            {
+                nFailed++;
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bCommand )
+    {
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            if ( ( Config.nSizes[s] == 0 ) || !RunCommandCase( &Config, Config.nSizes[s], Config.nBuffers[0], &Config.Timeouts[0] ) )
+            {
+                nFailed++;
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bPriority )
+    {
+        for ( s = 0; s < Config.nSizeCount; s++ )
+        {
+            for ( t = 0; t < Config.nSliceCount; t++ )
+            {
+                // slices have to end on frame boundaries or the urgent message lands inside a frame
+                if ( ( Config.nFrameSize <= BENCH_HEADER_SIZE ) || ( Config.nFrameSize > BENCH_MAX_MESSAGE ) ||
+                     ( Config.nSizes[s] % Config.nFrameSize != 0 ) || ( Config.nSlices[t] % Config.nFrameSize != 0 ) )
+                {
+                    fprintf( stderr, "skipping write size %lu, slice %lu, frame %lu\n", Config.nSizes[s], Config.nSlices[t], Config.nFrameSize );
+                    continue;
+                }
+
+                if ( !RunPriorityCase( &Config, Config.nSizes[s], Config.nSlices[t], Config.nBuffers[0], &Config.Timeouts[0] ) )
+                {
+                    nFailed++;
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bPoll )
+    {
+        // the hand-written loop first, as the baseline for every window
+        if ( ( Config.nSlaves == 0 ) || ( Config.nSlaves > 247 ) || !RunPollCase( &Config, 0, Config.nBuffers[0], &Config.Timeouts[0] ) )
+        {
+            nFailed++;
+        }
+
+        for ( t = 0; ( Config.nSlaves > 0 ) && ( Config.nSlaves <= 247 ) && ( t < Config.nWindowCount ); t++ )
+        {
+            if ( ( Config.nWindows[t] == 0 ) || ( Config.nWindows[t] > SERIAL_TRANSACTION_MAX ) )
+            {
+                fprintf( stderr, "skipping window %lu\n", Config.nWindows[t] );
+                continue;
+            }
+
+            if ( !RunPollCase( &Config, Config.nWindows[t], Config.nBuffers[0], &Config.Timeouts[0] ) )
+            {
+                nFailed++;
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.bStartup )
+    {
+        for ( t = 0; t < Config.nParallelCount; t++ )
+        {
+            if ( Config.nParallels[t] == 0 )
+            {
+                fprintf( stderr, "skipping parallel 0\n" );
+                continue;
+            }
+
+            if ( !RunStartupCase( &Config, Config.nParallels[t], ( Config.nReactorThreads > 0 ) ? &Reactor : NULL ) )
+            {
+                nFailed++;
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    if ( Config.pszReplay != NULL )
+    {
+        // every speed replays the whole capture from the start
+        if ( !Replay.Open( Config.pszReplay ) )
+        {
+            fprintf( stderr, "cannot open %s\n", Config.pszReplay );
+            nFailed++;
+        }
+
+        for ( b = 0; Replay.IsOpen() && ( b < Config.nBufferCount ); b++ )
+        {
+            for ( s = 0; s < Config.nSpeedCount; s++ )
+            {
+                if ( !RunReplayCase( &Config, &Replay, Config.nSpeeds[s], Config.nBuffers[b] ) )
+                {
+                    nFailed++;
+                }
+            }
+        }
+
+        Config.nCountCount = 0;
+    }
+
+    for ( c = 0; c < Config.nCountCount; c++ )
+    {
+        for ( b = 0; b < Config.nBufferCount; b++ )
+        {
+            for ( t = 0; t < Config.nTimeoutCount; t++ )
+            {
+                for ( s = 0; s < Config.nSizeCount; s++ )
+                {
+                    if ( ( Config.nCounts[c] == 0 ) || ( Config.nCounts[c] > Config.nPairs ) ||
+                         ( Config.nSizes[s] < BENCH_HEADER_SIZE ) || ( Config.nSizes[s] > BENCH_MAX_MESSAGE ) )
+                    {
+                        fprintf( stderr, "skipping %lu pairs, write size %lu\n", Config.nCounts[c], Config.nSizes[s] );
+                        continue;
+                    }
+
+                    if ( !RunCase( &Config, Config.nSizes[s], Config.nBuffers[b], &Config.Timeouts[t], Config.nCounts[c], NULL ) )
+                    {
+                        nFailed++;
+                    }
+
+                    if ( ( Config.nReactorThreads > 0 ) &&
+                         !RunCase( &Config, Config.nSizes[s], Config.nBuffers[b], &Config.Timeouts[t], Config.nCounts[c], &Reactor ) )
+                    {
+                        nFailed++;
+                    }
+                }
+            }
+        }
+    }
+
+    if ( Config.pCapture != NULL )
+    {
+        if ( Capture.GetDroppedCount() > 0 )
+        {
+            fprintf( stderr, "capture dropped %lu records\n", Capture.GetDroppedCount() );
+        }
+
+        Capture.Close();
+    }
+
+    // every port of the cases is closed by now
+    Reactor.Destroy();
+    delete [] pVirtual;
+
+    if ( Config.pOut != stdout )
+    {
+        fclose( Config.pOut );
+    }
+
+    return ( nFailed > 0 ) ? 1 : 0;
+}
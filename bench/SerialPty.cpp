@@ -0,0 +1,456 @@
+/*
+**  FILENAME            SerialPty.cpp
+**
+**  PURPOSE             Self-checking run of the Linux termios backend of CSerialPort on pseudo
+**                      terminals. The port opens the slave, the check holds the master as the
+**                      far end: it reads the termios2 the port set back through the master and
+**                      times the read timeouts, the raw path and the write timeout. Prints one
+**                      JSON line per case, what went wrong to stderr, and exits 1 when a case
+**                      failed.
+**
+**                      g++ -O2 -o SerialPty bench/SerialPty.cpp SerialTermios.cpp -lpthread
+**                      SerialPty > pty.json
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#include "../SerialPort.h"
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PTY_LARGE_WRITE         ( 1UL << 20 )           /* more than a pty holds, the write timeout has to end it */
+#define PTY_SLACK               150000LL                /* us a timed read may take beyond its timeout on a busy machine */
+#define PTY_WATCHDOG            60U                     /* s, a read or write that blocks where it should time out ends the run */
+
+typedef struct
+{
+    int                 nMaster;
+    DWORD               dwDelay;                        /* ms before the second half */
+    const char          *pData;
+    DWORD               nSize;
+} PTY_WRITER;
+
+static int OpenMaster( char *szSlave, size_t nSize )
+{
+    int nMaster = posix_openpt( O_RDWR | O_NOCTTY );
+
+    if ( ( nMaster < 0 ) || ( grantpt( nMaster ) < 0 ) || ( unlockpt( nMaster ) < 0 ) || ( ptsname_r( nMaster, szSlave, nSize ) != 0 ) )
+    {
+        perror( "posix_openpt" );
+        exit( 2 );
+    }
+
+    return nMaster;
+}
+
+static void GetTermios( int nMaster, struct termios2 *pTermios )
+{
+    // the master reads and sets the termios of the slave
+    if ( ioctl( nMaster, TCGETS2, pTermios ) < 0 )
+    {
+        perror( "TCGETS2" );
+        exit( 2 );
+    }
+}
+
+static tcflag_t GetFormatMask( int nMaster )            // the format bits a pty keeps, since 6.0 it forces CS8 without parity
+{
+    struct termios2 Termios;
+    struct termios2 Probe;
+    GetTermios( nMaster, &Termios );
+    Probe = Termios;
+    Probe.c_cflag = ( Probe.c_cflag & ~CSIZE ) | CS7 | PARENB;
+
+    if ( ioctl( nMaster, TCSETS2, &Probe ) < 0 )
+    {
+        perror( "TCSETS2" );
+        exit( 2 );
+    }
+
+    GetTermios( nMaster, &Probe );
+    ioctl( nMaster, TCSETS2, &Termios );
+    return ( ( ( Probe.c_cflag & ( CSIZE | PARENB ) ) == ( CS7 | PARENB ) ) ? ( CSIZE | PARENB ) : 0 ) | PARODD | CMSPAR | CSTOPB;
+}
+
+static DWORD ReadMaster( int nMaster, char *pBuffer, DWORD nSize, int nTimeout )
+{
+    DWORD nRead = 0;
+    ssize_t nResult;
+    struct pollfd Poll;
+
+    while ( nRead < nSize )
+    {
+        Poll.fd = nMaster;
+        Poll.events = POLLIN;
+
+        if ( poll( &Poll, 1, nTimeout ) <= 0 )
+        {
+            break;
+        }
+
+        if ( ( nResult = read( nMaster, pBuffer + nRead, nSize - nRead ) ) <= 0 )
+        {
+            break;
+        }
+
+        nRead += ( DWORD )nResult;
+    }
+
+    return nRead;
+}
+
+static void *WriterThread( void *pParam )
+{
+    PTY_WRITER *pWriter = ( PTY_WRITER * )pParam;
+    DWORD nHalf = pWriter->nSize / 2;
+
+    // two bursts with a quiet line between them
+    if ( write( pWriter->nMaster, pWriter->pData, nHalf ) != ( ssize_t )nHalf )
+    {
+        perror( "write" );
+    }
+
+    usleep( pWriter->dwDelay * 1000 );
+
+    if ( write( pWriter->nMaster, pWriter->pData + nHalf, pWriter->nSize - nHalf ) != ( ssize_t )( pWriter->nSize - nHalf ) )
+    {
+        perror( "write" );
+    }
+
+    return NULL;
+}
+
+static BOOL Report( const char *szCase, const char *szDetail, BOOL bOk )
+{
+    printf( "{\"mode\":\"pty\",\"case\":\"%s\",%s,\"ok\":%s}\n", szCase, szDetail, bOk ? "true" : "false" );
+    fflush( stdout );
+    return bOk;
+}
+
+static BOOL CheckBaud( CSerialPort *pPort, int nMaster )
+{
+    static const DWORD s_Rates[] = { 300, 9600, 115200, 250000, 500000, 1000000, 123456, 3000000 };
+    struct termios2 Termios;
+    DCB  dcb;
+    char szDetail[128];
+    BOOL ret = TRUE;
+    BOOL bSet;
+    UINT i;
+
+    // standard and odd rates alike go to the driver as BOTHER
+    for ( i = 0; i < sizeof( s_Rates ) / sizeof( s_Rates[0] ); i++ )
+    {
+        dcb = *pPort->GetDCB();
+        dcb.BaudRate = s_Rates[i];
+        bSet = pPort->SetDCB( &dcb );
+        GetTermios( nMaster, &Termios );
+        snprintf( szDetail, sizeof( szDetail ), "\"baud\":%u,\"ospeed\":%u,\"ispeed\":%u,\"bother\":%s", ( unsigned int )s_Rates[i],
+                  Termios.c_ospeed, Termios.c_ispeed, ( ( Termios.c_cflag & CBAUD ) == BOTHER ) ? "true" : "false" );
+        ret &= Report( "baud", szDetail, bSet && ( ( Termios.c_cflag & CBAUD ) == BOTHER ) && ( ( ( Termios.c_cflag >> IBSHIFT ) & CBAUD ) == BOTHER ) &&
+                       ( Termios.c_ospeed == s_Rates[i] ) && ( Termios.c_ispeed == s_Rates[i] ) );
+    }
+
+    return ret;
+}
+
+static BOOL CheckFormat( CSerialPort *pPort, int nMaster )
+{
+    static const struct
+    {
+        BYTE            ByteSize;
+        BYTE            Parity;
+        BYTE            StopBits;
+        tcflag_t        cflag;                          /* CSIZE, PARENB, PARODD, CMSPAR and CSTOPB expected */
+    } s_Formats[] =
+    {
+        { 8, NOPARITY,    ONESTOPBIT,   CS8 },
+        { 7, EVENPARITY,  TWOSTOPBITS,  CS7 | PARENB | CSTOPB },
+        { 8, ODDPARITY,   ONESTOPBIT,   CS8 | PARENB | PARODD },
+        { 5, NOPARITY,    ONE5STOPBITS, CS5 | CSTOPB },
+        { 6, MARKPARITY,  ONESTOPBIT,   CS6 | PARENB | PARODD | CMSPAR },
+        { 8, SPACEPARITY, TWOSTOPBITS,  CS8 | PARENB | CMSPAR | CSTOPB }
+    };
+    struct termios2 Termios;
+    tcflag_t Mask = GetFormatMask( nMaster );
+    DCB  dcb;
+    char szDetail[160];
+    BOOL ret = TRUE;
+    BOOL bSet;
+    BOOL bRaw;
+    UINT i;
+
+    for ( i = 0; i < sizeof( s_Formats ) / sizeof( s_Formats[0] ); i++ )
+    {
+        dcb = *pPort->GetDCB();
+        dcb.ByteSize = s_Formats[i].ByteSize;
+        dcb.Parity = s_Formats[i].Parity;
+        dcb.StopBits = s_Formats[i].StopBits;
+        bSet = pPort->SetDCB( &dcb );
+        GetTermios( nMaster, &Termios );
+        bRaw = ( ( Termios.c_lflag & ( ICANON | ECHO | ISIG | IEXTEN ) ) == 0 ) && ( ( Termios.c_oflag & OPOST ) == 0 ) &&
+               ( ( Termios.c_iflag & ( ICRNL | INLCR | IGNCR | ISTRIP | IXON | IXOFF ) ) == 0 ) && ( ( Termios.c_cflag & CREAD ) != 0 );
+        snprintf( szDetail, sizeof( szDetail ), "\"format\":\"%u%c%s\",\"cflag\":\"0x%x\",\"checked\":\"0x%x\",\"raw\":%s", s_Formats[i].ByteSize,
+                  "NOEMS"[s_Formats[i].Parity], ( s_Formats[i].StopBits == ONESTOPBIT ) ? "1" : ( s_Formats[i].StopBits == ONE5STOPBITS ) ? "1.5" : "2",
+                  ( unsigned int )Termios.c_cflag, ( unsigned int )Mask, bRaw ? "true" : "false" );
+        ret &= Report( "format", szDetail, bSet && bRaw && ( ( Termios.c_cflag & Mask ) == ( s_Formats[i].cflag & Mask ) ) );
+    }
+
+    dcb = *pPort->GetDCB();
+    dcb.ByteSize = 8;
+    dcb.Parity = NOPARITY;
+    dcb.StopBits = ONESTOPBIT;
+    pPort->SetDCB( &dcb );
+    return ret;
+}
+
+static BOOL CheckFlow( CSerialPort *pPort, int nMaster )
+{
+    struct termios2 Termios;
+    DCB  dcb = *pPort->GetDCB();
+    DCB  Rejected;
+    char szDetail[128];
+    BOOL ret;
+    BOOL bSet;
+
+    dcb.fOutxCtsFlow = TRUE;
+    dcb.fRtsControl = RTS_CONTROL_HANDSHAKE;
+    dcb.fOutX = TRUE;
+    dcb.fInX = TRUE;
+    dcb.XonChar = 0x11;
+    dcb.XoffChar = 0x13;
+    bSet = pPort->SetDCB( &dcb );
+    GetTermios( nMaster, &Termios );
+    snprintf( szDetail, sizeof( szDetail ), "\"flow\":\"rtscts+xonxoff\",\"crtscts\":%s,\"ixon\":%s,\"ixoff\":%s",
+              ( Termios.c_cflag & CRTSCTS ) ? "true" : "false", ( Termios.c_iflag & IXON ) ? "true" : "false", ( Termios.c_iflag & IXOFF ) ? "true" : "false" );
+    ret = Report( "flow", szDetail, bSet && ( Termios.c_cflag & CRTSCTS ) && ( Termios.c_iflag & IXON ) && ( Termios.c_iflag & IXOFF ) &&
+                  ( Termios.c_cc[VSTART] == 0x11 ) && ( Termios.c_cc[VSTOP] == 0x13 ) );
+
+    // no DTR/DSR handshake in termios: refused, and the settings before stay
+    Rejected = dcb;
+    Rejected.fDtrControl = DTR_CONTROL_HANDSHAKE;
+    Rejected.fOutxDsrFlow = TRUE;
+    bSet = pPort->SetDCB( &Rejected );
+    snprintf( szDetail, sizeof( szDetail ), "\"flow\":\"dtrdsr\",\"refused\":%s,\"errno\":%d", bSet ? "false" : "true", errno );
+    ret &= Report( "flow", szDetail, !bSet && ( errno == EINVAL ) && ( pPort->GetDCB()->fDtrControl != DTR_CONTROL_HANDSHAKE ) );
+
+    dcb.fOutxCtsFlow = FALSE;
+    dcb.fRtsControl = RTS_CONTROL_DISABLE;
+    dcb.fOutX = FALSE;
+    dcb.fInX = FALSE;
+    pPort->SetDCB( &dcb );
+    return ret;
+}
+
+static BOOL CheckRaw( CSerialPort *pPort, int nMaster )
+{
+    static const char s_Bytes[] = "\r\n\x03\x11\x13\x7f\x00\xff";
+    const DWORD nBytes = sizeof( s_Bytes ) - 1;
+    char szReceived[16];
+    char szDetail[128];
+    COMMTIMEOUTS Timeouts = { MAXDWORD, MAXDWORD, 500, 0, 0 };
+    DWORD nSlave;
+    DWORD nMasterRead;
+    BOOL ret;
+
+    // CR, LF, ^C and the flow characters both ways as they are, and no echo
+    pPort->SetCommTimeouts( &Timeouts );
+    pPort->Write( ( void * )s_Bytes, ( int )nBytes );
+    nMasterRead = ReadMaster( nMaster, szReceived, nBytes, 500 );
+    ret = ( nMasterRead == nBytes ) && ( memcmp( szReceived, s_Bytes, nBytes ) == 0 );
+
+    if ( write( nMaster, s_Bytes, nBytes ) != ( ssize_t )nBytes )
+    {
+        perror( "write" );
+    }
+
+    nSlave = 0;
+
+    while ( nSlave < nBytes )
+    {
+        DWORD nRead = pPort->Read( szReceived + nSlave, nBytes - nSlave );
+
+        if ( nRead == 0 )
+        {
+            break;
+        }
+
+        nSlave += nRead;
+    }
+
+    ret = ret && ( nSlave == nBytes ) && ( memcmp( szReceived, s_Bytes, nBytes ) == 0 );
+    ret = ret && ( ReadMaster( nMaster, szReceived, sizeof( szReceived ), 100 ) == 0 );
+    snprintf( szDetail, sizeof( szDetail ), "\"to_master\":%u,\"to_port\":%u,\"sent\":%u", ( unsigned int )nMasterRead, ( unsigned int )nSlave, ( unsigned int )nBytes );
+    return Report( "raw", szDetail, ret );
+}
+
+static BOOL CheckTimeouts( CSerialPort *pPort, int nMaster )
+{
+    static const struct
+    {
+        const char      *szName;
+        COMMTIMEOUTS    Timeouts;
+        DWORD           nSize;
+        DWORD           dwDelay;                        /* ms between the two bursts of the far end, 0 sends nothing */
+        DWORD           nSend;
+        cc_t            Vmin;                           /* expected, 0/0 on the poll() path */
+        cc_t            Vtime;
+        DWORD           nExpected;                      /* bytes Read() returns */
+        LONGLONG        llMin;                          /* us Read() takes at least */
+        LONGLONG        llMax;
+    } s_Cases[] =
+    {
+        { "immediate",      { MAXDWORD, 0, 0, 0, 0 },          64, 0,   0,  0,   0, 0,  0,      PTY_SLACK },
+        { "first_byte",     { MAXDWORD, MAXDWORD, 200, 0, 0 }, 64, 0,   0,  0,   2, 0,  180000, 200000 + PTY_SLACK },
+        { "first_burst",    { MAXDWORD, MAXDWORD, 2000, 0, 0 },64, 400, 16, 0,   20, 8, 0,      PTY_SLACK },
+        { "interval",       { 100, 0, 0, 0, 0 },               64, 400, 16, 255, 1, 8, 80000,  400000 },
+        { "fill",           { 0, 0, 0, 0, 0 },                 16, 300, 16, 255, 0, 16, 280000, 300000 + PTY_SLACK },
+        { "total",          { 0, 10, 100, 0, 0 },              20, 0,   0,  0,   0, 0,  280000, 300000 + PTY_SLACK },
+        { "total_interval", { 50, 10, 1000, 0, 0 },            64, 400, 16, 0,   0, 8, 40000,  400000 }
+    };
+    static const char s_Data[] = "0123456789abcdef";
+    static const COMMTIMEOUTS s_Drain = { MAXDWORD, 0, 0, 0, 0 };
+    struct termios2 Termios;
+    PTY_WRITER Writer;
+    pthread_t  Thread;
+    char       Buffer[64];
+    char       szDetail[192];
+    DWORD      nRead;
+    LONGLONG   llStart;
+    LONGLONG   llElapsed;
+    BOOL       ret = TRUE;
+    BOOL       bSet;
+    UINT       i;
+
+    for ( i = 0; i < sizeof( s_Cases ) / sizeof( s_Cases[0] ); i++ )
+    {
+        bSet = pPort->SetCommTimeouts( &s_Cases[i].Timeouts );
+        GetTermios( nMaster, &Termios );
+        Writer.nMaster = nMaster;
+        Writer.dwDelay = s_Cases[i].dwDelay;
+        Writer.pData = s_Data;
+        Writer.nSize = s_Cases[i].nSend;
+        llStart = CSerialPort::GetTimestamp();
+
+        if ( s_Cases[i].nSend > 0 )
+        {
+            pthread_create( &Thread, NULL, WriterThread, &Writer );
+        }
+
+        nRead = pPort->Read( Buffer, s_Cases[i].nSize );
+        llElapsed = CSerialPort::GetTimestamp() - llStart;
+
+        if ( s_Cases[i].nSend > 0 )
+        {
+            pthread_join( Thread, NULL );
+        }
+
+        snprintf( szDetail, sizeof( szDetail ), "\"timeouts\":\"%s\",\"vmin\":%u,\"vtime\":%u,\"read\":%u,\"elapsed_us\":%lld",
+                  s_Cases[i].szName, Termios.c_cc[VMIN], Termios.c_cc[VTIME], ( unsigned int )nRead, llElapsed );
+        ret &= Report( "timeouts", szDetail, bSet && ( Termios.c_cc[VMIN] == s_Cases[i].Vmin ) && ( Termios.c_cc[VTIME] == s_Cases[i].Vtime ) &&
+                       ( nRead == s_Cases[i].nExpected ) && ( memcmp( Buffer, s_Data, nRead ) == 0 ) &&
+                       ( llElapsed >= s_Cases[i].llMin ) && ( llElapsed <= s_Cases[i].llMax ) );
+
+        // what the case left over does not leak into the next
+        usleep( ( s_Cases[i].dwDelay + 50 ) * 1000 );
+        pPort->SetCommTimeouts( &s_Drain );
+
+        while ( pPort->GetRxCount() > 0 )
+        {
+            pPort->Read( Buffer, sizeof( Buffer ) );
+        }
+    }
+
+    return ret;
+}
+
+static BOOL CheckWriteTimeout( CSerialPort *pPort, int nMaster )
+{
+    COMMTIMEOUTS Timeouts = { MAXDWORD, 0, 0, 0, 200 };
+    char *pData = new char[PTY_LARGE_WRITE];
+    char szDetail[128];
+    LONGLONG llStart;
+    LONGLONG llElapsed;
+    DWORD nQueued = 0;
+    char Buffer[4096];
+    ssize_t nResult;
+
+    // the master does not read: the pty fills, and the write has to give up after 200 ms instead of blocking
+    memset( pData, 'w', PTY_LARGE_WRITE );
+    pPort->SetCommTimeouts( &Timeouts );
+    llStart = CSerialPort::GetTimestamp();
+    pPort->Write( pData, ( int )PTY_LARGE_WRITE );
+    llElapsed = CSerialPort::GetTimestamp() - llStart;
+    delete [] pData;
+
+    while ( ( nResult = ReadMaster( nMaster, Buffer, sizeof( Buffer ), 50 ) ) > 0 )
+    {
+        nQueued += ( DWORD )nResult;
+    }
+
+    snprintf( szDetail, sizeof( szDetail ), "\"size\":%lu,\"delivered\":%u,\"elapsed_us\":%lld", PTY_LARGE_WRITE, ( unsigned int )nQueued, llElapsed );
+    return Report( "write_timeout", szDetail, ( llElapsed >= 190000 ) && ( llElapsed <= 200000 + PTY_SLACK ) && ( nQueued > 0 ) && ( nQueued < PTY_LARGE_WRITE ) );
+}
+
+static BOOL CheckLatency( CSerialPort *pPort, const char *szSlave )
+{
+    char szDetail[128];
+    BOOL bLowLatency;
+    DWORD dwTimer;
+    BOOL bTimer;
+
+    // a pty is no serial driver and has no adapter behind it: both refuse, nothing breaks
+    bLowLatency = pPort->SetLowLatency( TRUE );
+    dwTimer = CSerialPort::GetLatencyTimer( szSlave );
+    bTimer = CSerialPort::SetLatencyTimer( szSlave, 1 );
+    snprintf( szDetail, sizeof( szDetail ), "\"low_latency\":%s,\"latency_timer\":%u,\"set_timer\":%s",
+              bLowLatency ? "true" : "false", ( unsigned int )dwTimer, bTimer ? "true" : "false" );
+    return Report( "latency", szDetail, !bLowLatency && ( dwTimer == 0 ) && !bTimer && !CSerialPort::SetLatencyTimer( szSlave, 0 ) &&
+                   pPort->IsOpen() );
+}
+
+int main( int argc, char *argv[] )
+{
+    CSerialPort Port;
+    char szSlave[128];
+    char szDetail[192];
+    int  nMaster = OpenMaster( szSlave, sizeof( szSlave ) );
+    BOOL ret;
+
+    alarm( PTY_WATCHDOG );
+    ret = Port.Open( NULL, szSlave, 9600 );
+    snprintf( szDetail, sizeof( szDetail ), "\"device\":\"%s\"", szSlave );
+
+    if ( !Report( "open", szDetail, ret ) )
+    {
+        return 1;
+    }
+
+    ret &= CheckBaud( &Port, nMaster );
+    ret &= CheckFormat( &Port, nMaster );
+    ret &= CheckFlow( &Port, nMaster );
+    ret &= CheckRaw( &Port, nMaster );
+    ret &= CheckTimeouts( &Port, nMaster );
+    ret &= CheckWriteTimeout( &Port, nMaster );
+    ret &= CheckLatency( &Port, szSlave );
+
+    Port.Close();
+    close( nMaster );
+
+    if ( !ret )
+    {
+        fprintf( stderr, "the termios backend failed on %s\n", szSlave );
+    }
+
+    return ret ? 0 : 1;
+}
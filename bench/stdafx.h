@@ -0,0 +1,25 @@
+/*
+**  FILENAME            stdafx.h
+**
+**  PURPOSE             Precompiled header of the benchmark console program.
+**                      The port class is built from the parent directory against this header.
+**
+**  CREATION DATE       16-10-2026
+**  LAST MODIFICATION   16-10-2026
+**
+**  AUTHOR              Remon Spekreijse
+*/
+
+#ifndef BENCH_STDAFX_H
+#define BENCH_STDAFX_H
+
+#define VC_EXTRALEAN
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <afxwin.h>
+#include <afxcmn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#endif BENCH_STDAFX_H